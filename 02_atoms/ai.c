@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "atoms.h"
+#include "ai.h"
+
+#define AI_INF (AI_WIN * 2)
+
+/*
+ * Transposition table entries are packed into 64 bits: the score (32 bits),
+ * the depth it was searched to (8 bits), what kind of bound the score is (2
+ * bits) and the best move's cell index plus one (22 bits, zero if there was no
+ * move or it didn't fit).
+ */
+#define AI_BOUND_NONE  0
+#define AI_BOUND_EXACT 1
+#define AI_BOUND_LOWER 2
+#define AI_BOUND_UPPER 3
+
+#define AI_MOVE_BITS 22
+
+#define AI_ENTRY_SCORE(data) ((int32_t) (uint32_t) (data))
+#define AI_ENTRY_DEPTH(data) ((int) ((data) >> 32 & 0xff))
+#define AI_ENTRY_BOUND(data) ((int) ((data) >> 40 & 0x3))
+#define AI_ENTRY_MOVE(data)  ((size_t) ((data) >> 42))
+
+struct ai_table_t *ai_table_alloc(int bits)
+{
+	struct ai_table_t *table = malloc(sizeof(*table));
+	if (!table)
+		return NULL;
+
+	table->mask = ((size_t) 1 << bits) - 1;
+	table->entries = calloc(table->mask + 1, sizeof(struct ai_entry_t));
+	if (!table->entries) {
+		free(table);
+		return NULL;
+	}
+	return table;
+}
+
+void ai_table_free(struct ai_table_t *table)
+{
+	if (table)
+		free(table->entries);
+	free(table);
+}
+
+/* ai_table_probe looks up @key, returning whether it was found. */
+static bool ai_table_probe(struct ai_table_t *table, uint64_t key, uint64_t *data)
+{
+	struct ai_entry_t *entry = &table->entries[key & table->mask];
+	uint64_t value = entry->data;
+	if ((entry->check ^ value) != key || AI_ENTRY_BOUND(value) == AI_BOUND_NONE)
+		return false;
+	*data = value;
+	return true;
+}
+
+/* ai_table_store stores an entry for @key, replacing whatever was there. */
+static void ai_table_store(struct ai_table_t *table, uint64_t key, int score, int depth, int bound, size_t idx)
+{
+	if (idx + 1 >= (size_t) 1 << AI_MOVE_BITS)
+		idx = SIZE_MAX;
+
+	uint64_t data = (uint64_t) (uint32_t) score |
+	                (uint64_t) depth << 32 |
+	                (uint64_t) bound << 40 |
+	                (uint64_t) (idx + 1) << 42;
+
+	struct ai_entry_t *entry = &table->entries[key & table->mask];
+	entry->check = key ^ data;
+	entry->data = data;
+}
+
+/*
+ * ai_root_t is the state shared by all of the threads searching a position.
+ * Root moves are handed out in order, and the best score is shared so that
+ * later moves can be searched with a narrower window.
+ */
+struct ai_root_t {
+	pthread_mutex_t lock;
+	struct ai_table_t *table;
+
+	/* The player we're searching for, and what it does to the hash. */
+	int player;
+	uint64_t salt;
+
+	int depth;
+	size_t *moves;
+	size_t moves_length;
+
+	size_t next;
+	bool found;
+	int best_score;
+	size_t best;
+};
+
+/* ai_worker_t is a single search thread, with its own copy of the game. */
+struct ai_worker_t {
+	pthread_t thread;
+	struct ai_root_t *root;
+	struct game_t *game;
+
+	/* Move lists for each ply, each with room for the whole grid. */
+	size_t *moves;
+	size_t nodes;
+	int err;
+};
+
+/*
+ * ai_evaluate scores a position for @player. Every cell counts for more than
+ * any number of atoms, since owning cells is how the game is won.
+ */
+static int ai_evaluate(struct game_t *game, int player)
+{
+	size_t cells = game->width * game->height;
+	int score = 0;
+
+	for (size_t idx = 0; idx < cells; idx++) {
+		struct cell_t cell = game->grid[idx];
+		if (cell.owner == CELL_NO_OWNER)
+			continue;
+
+		int value = 4 + cell.atoms;
+		score += cell.owner == player + 1 ? value : -value;
+	}
+	return score;
+}
+
+/*
+ * ai_moves fills @moves with the cells the current player can place in. The
+ * move from the transposition table (@hint) goes first, followed by cells that
+ * are about to explode, since those are the moves most likely to matter.
+ */
+static size_t ai_moves(struct game_t *game, size_t hint, size_t *moves)
+{
+	size_t cells = game->width * game->height;
+	uint8_t owner = game->current_player + 1;
+	size_t length = 0;
+
+	if (hint < cells) {
+		uint8_t cur = game->grid[hint].owner;
+		if (cur == CELL_NO_OWNER || cur == owner)
+			moves[length++] = hint;
+		else
+			hint = SIZE_MAX;
+	}
+
+	for (size_t idx = 0; idx < cells; idx++) {
+		struct cell_t cell = game->grid[idx];
+		if (cell.owner == owner && cell.atoms + 1 == game->limits[idx] && idx != hint)
+			moves[length++] = idx;
+	}
+	for (size_t idx = 0; idx < cells; idx++) {
+		struct cell_t cell = game->grid[idx];
+		if (idx == hint)
+			continue;
+		if (cell.owner == CELL_NO_OWNER || (cell.owner == owner && cell.atoms + 1 != game->limits[idx]))
+			moves[length++] = idx;
+	}
+	return length;
+}
+
+/* ai_idx_move converts a cell index into a move. */
+static struct move_t ai_idx_move(struct game_t *game, size_t idx)
+{
+	return (struct move_t) { .x = idx % game->width, .y = idx / game->width };
+}
+
+static int ai_minimax(struct ai_worker_t *worker, int depth, int ply, int alpha, int beta);
+
+/*
+ * ai_try plays the move at @idx, scores it for the root player and unmakes
+ * it. Winning sooner (with more depth left) is better than winning later.
+ */
+static int ai_try(struct ai_worker_t *worker, size_t idx, int depth, int ply, int alpha, int beta)
+{
+	struct game_t *game = worker->game;
+	int mover = game->current_player;
+	int score = 0;
+
+	int err = game_make_move(game, ai_idx_move(game, idx));
+	if (err == -ERROR_QUIT)
+		score = mover == worker->root->player ? AI_WIN + depth : -AI_WIN - depth;
+	else if (err < 0)
+		worker->err = err;
+	else
+		score = ai_minimax(worker, depth - 1, ply + 1, alpha, beta);
+
+	if (!err || err == -ERROR_QUIT)
+		game_unmake_move(game);
+	return score;
+}
+
+/*
+ * ai_minimax is a fail-soft alpha-beta search of the current position to
+ * @depth moves, scored for the root player. Transposition table entries are
+ * only used for their score if they were searched to the same depth, which
+ * keeps the result the same no matter what order the threads search in.
+ */
+static int ai_minimax(struct ai_worker_t *worker, int depth, int ply, int alpha, int beta)
+{
+	struct ai_root_t *root = worker->root;
+	struct game_t *game = worker->game;
+
+	worker->nodes++;
+	if (game_player_lost(game, root->player))
+		return -AI_WIN - depth;
+	if (!depth)
+		return ai_evaluate(game, root->player);
+
+	uint64_t key = game_hash(game) ^ root->salt;
+	uint64_t data = 0;
+	size_t hint = SIZE_MAX;
+	if (ai_table_probe(root->table, key, &data)) {
+		int score = AI_ENTRY_SCORE(data);
+		int bound = AI_ENTRY_BOUND(data);
+
+		if (AI_ENTRY_DEPTH(data) == depth) {
+			if (bound == AI_BOUND_EXACT)
+				return score;
+			if (bound == AI_BOUND_LOWER && score >= beta)
+				return score;
+			if (bound == AI_BOUND_UPPER && score <= alpha)
+				return score;
+		}
+		hint = AI_ENTRY_MOVE(data) - 1;
+	}
+
+	size_t *moves = worker->moves + ply * game->width * game->height;
+	size_t length = ai_moves(game, hint, moves);
+	if (!length)
+		return ai_evaluate(game, root->player);
+
+	bool maximising = game->current_player == root->player;
+	int best = maximising ? -AI_INF : AI_INF;
+	size_t best_idx = SIZE_MAX;
+	int lower = alpha, upper = beta;
+
+	for (size_t i = 0; i < length && alpha < beta; i++) {
+		int score = ai_try(worker, moves[i], depth, ply, alpha, beta);
+		if (worker->err < 0)
+			return 0;
+
+		if (maximising ? score > best : score < best) {
+			best = score;
+			best_idx = moves[i];
+		}
+		if (maximising && best > alpha)
+			alpha = best;
+		if (!maximising && best < beta)
+			beta = best;
+	}
+
+	int bound = AI_BOUND_EXACT;
+	if (best <= lower)
+		bound = AI_BOUND_UPPER;
+	else if (best >= upper)
+		bound = AI_BOUND_LOWER;
+	ai_table_store(root->table, key, best, depth, bound, best_idx);
+	return best;
+}
+
+/*
+ * ai_root_worker searches root moves until there are none left. Moves are
+ * searched with a window just below the best score so far, so that we get an
+ * exact score for any move that is at least as good. Ties go to the move that
+ * comes first, which makes the result independent of the number of threads.
+ */
+static void *ai_root_worker(void *arg)
+{
+	struct ai_worker_t *worker = arg;
+	struct ai_root_t *root = worker->root;
+
+	while (true) {
+		pthread_mutex_lock(&root->lock);
+		size_t i = root->next++;
+		int alpha = root->found ? root->best_score - 1 : -AI_INF;
+		pthread_mutex_unlock(&root->lock);
+
+		if (i >= root->moves_length)
+			break;
+
+		int score = ai_try(worker, root->moves[i], root->depth, 0, alpha, AI_INF);
+		if (worker->err < 0)
+			break;
+
+		pthread_mutex_lock(&root->lock);
+		if (!root->found || score > root->best_score ||
+		    (score == root->best_score && i < root->best)) {
+			root->found = true;
+			root->best_score = score;
+			root->best = i;
+		}
+		pthread_mutex_unlock(&root->lock);
+	}
+	return NULL;
+}
+
+/*
+ * ai_search finds the best move for the current player of @game, searching
+ * one move deeper at a time up to the configured depth (stopping early if it
+ * finds a forced win or loss). @game itself isn't changed.
+ */
+int ai_search(struct game_t *game, const struct ai_config_t *config, struct ai_result_t *result)
+{
+	if (!game || game->state != RUNNING)
+		return -ERROR_INTERNAL;
+
+	size_t cells = game->width * game->height;
+	int depth = config->depth > 0 ? config->depth : AI_DEFAULT_DEPTH;
+	if (depth > AI_MAX_DEPTH)
+		depth = AI_MAX_DEPTH;
+
+	int err = -ERROR_INTERNAL;
+	struct ai_worker_t *workers = NULL;
+	struct ai_table_t *table = config->table;
+	struct ai_root_t root = {
+		.player = game->current_player,
+	};
+	if (!table) {
+		table = ai_table_alloc(AI_TABLE_BITS);
+		if (!table)
+			return -ERROR_INTERNAL;
+	}
+	root.table = table;
+
+	/*
+	 * The hash only covers the grid and whose turn it is, so mix in the board
+	 * size and the player we're searching for to share the table safely.
+	 */
+	root.salt = (uint64_t) root.player | (uint64_t) game->width << 8 | (uint64_t) game->height << 36;
+	for (int i = 0; i < 2; i++) {
+		root.salt *= 0xff51afd7ed558ccdULL;
+		root.salt ^= root.salt >> 33;
+	}
+
+	root.moves = malloc(cells * sizeof(size_t));
+	if (!root.moves)
+		goto out;
+	root.moves_length = 0;
+	for (size_t idx = 0; idx < cells; idx++)
+		if (game_can_place(game, ai_idx_move(game, idx)))
+			root.moves[root.moves_length++] = idx;
+	if (!root.moves_length) {
+		err = -ERROR_CANNOT_PLACE;
+		goto out;
+	}
+
+	*result = (struct ai_result_t) {
+		.move = ai_idx_move(game, root.moves[0]),
+	};
+
+	size_t threads = config->threads ? config->threads : 1;
+	if (threads > root.moves_length)
+		threads = root.moves_length;
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers)
+		goto out;
+	for (size_t i = 0; i < threads; i++) {
+		workers[i].root = &root;
+		workers[i].game = game_clone(game);
+		workers[i].moves = malloc(depth * cells * sizeof(size_t));
+		if (!workers[i].game || !workers[i].moves)
+			goto out;
+	}
+	pthread_mutex_init(&root.lock, NULL);
+
+	/* With only one move there's nothing to search. */
+	err = 0;
+	for (int d = 1; d <= depth && root.moves_length > 1; d++) {
+		root.depth = d;
+		root.next = 0;
+		root.found = false;
+
+		size_t started = 1;
+		for (; started < threads; started++)
+			if (pthread_create(&workers[started].thread, NULL, ai_root_worker, &workers[started]))
+				break;
+		ai_root_worker(&workers[0]);
+		for (size_t i = 1; i < started; i++)
+			pthread_join(workers[i].thread, NULL);
+
+		for (size_t i = 0; i < threads; i++)
+			if (workers[i].err < 0)
+				err = workers[i].err;
+		if (err < 0 || !root.found)
+			break;
+
+		/* Search the best move first next time around. */
+		size_t best = root.moves[root.best];
+		memmove(root.moves + 1, root.moves, root.best * sizeof(size_t));
+		root.moves[0] = best;
+
+		result->move = ai_idx_move(game, best);
+		result->score = root.best_score;
+		result->depth = d;
+		if (root.best_score >= AI_WIN || root.best_score <= -AI_WIN)
+			break;
+	}
+	pthread_mutex_destroy(&root.lock);
+
+	for (size_t i = 0; i < threads; i++)
+		result->nodes += workers[i].nodes;
+
+out:
+	for (size_t i = 0; workers && i < threads; i++) {
+		game_free(workers[i].game);
+		free(workers[i].moves);
+	}
+	free(workers);
+	free(root.moves);
+	if (table != config->table)
+		ai_table_free(table);
+	return err;
+}
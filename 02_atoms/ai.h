@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#pragma once
+
+#if !defined(AI_H)
+#define AI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "atoms.h"
+
+/*
+ * The computer player. It runs an iterative-deepening alpha-beta search over
+ * game_make_move and game_unmake_move. Games with more than two players are
+ * searched "paranoidly": every other player is assumed to be playing against
+ * the player we're searching for. The root moves are split between threads,
+ * which all share a transposition table.
+ */
+
+#define AI_DEFAULT_DEPTH 3
+#define AI_MAX_DEPTH 16
+
+/* Scores at least this large mean that someone has won. */
+#define AI_WIN (1 << 28)
+
+/*
+ * ai_entry_t is an entry in the transposition table. To make the table safe to
+ * share between threads without locking, @check is the key XORed with @data.
+ * An entry that was torn by two threads writing it at the same time then just
+ * doesn't match any key.
+ */
+struct ai_entry_t {
+	volatile uint64_t check;
+	volatile uint64_t data;
+};
+
+/* ai_table_t is a transposition table with 2^bits entries. */
+#define AI_TABLE_BITS 20
+struct ai_table_t {
+	size_t mask;
+	struct ai_entry_t *entries;
+};
+
+struct ai_table_t *ai_table_alloc(int bits);
+void ai_table_free(struct ai_table_t *table);
+
+struct ai_config_t {
+	/* How deep to search (in moves), and how many threads to search with. */
+	int depth;
+	size_t threads;
+
+	/* Can be shared by any number of searches. NULL means use a private one. */
+	struct ai_table_t *table;
+};
+
+struct ai_result_t {
+	struct move_t move;
+	int score;
+	int depth;
+	size_t nodes;
+};
+
+int ai_search(struct game_t *game, const struct ai_config_t *config, struct ai_result_t *result);
+
+#endif /* !defined(AI_H) */
@@ -38,6 +38,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 #include "errno.h"
@@ -58,13 +59,28 @@
 /* move_t represents a move by a particular player. */
 struct move_t {
 	int x, y;
-	/*
-	 * TODO: In order to make UNDO more efficient we could create snapshots of
-	 *       the game state. But then we're wasting a bunch of space on
-	 *       caching. On the plus side there's no cache invalidation concerns.
-	 */
 };
 
+/*
+ * UNDO normally reverts the cells changed by the last move using an undo log.
+ * Once the log holds more than UNDO_LOG_GRIDS grids worth of cells, it is
+ * replaced with a snapshot of the game. UNDO past the start of the log
+ * restores the latest snapshot before that point and replays the moves since
+ * then. At most UNDO_MAX_SNAPSHOTS snapshots are kept (every other one is
+ * dropped when we run out), so memory stays bounded even for long games.
+ */
+#define UNDO_LOG_GRIDS 4
+#define UNDO_MAX_SNAPSHOTS 16
+
+/*
+ * Every game_t.checkpoint_interval moves we keep a compressed checkpoint of the
+ * grid, so that seeking to any turn (PLAYFROM and SEEK) only has to replay at
+ * most that many moves. By default the interval grows with the board so that
+ * checkpoints cost at most about CHECKPOINT_CELLS_PER_MOVE bytes per move.
+ */
+#define CHECKPOINT_MIN_INTERVAL 32
+#define CHECKPOINT_CELLS_PER_MOVE 16
+
 /* The list of player colours, in the order given by the spec. */
 extern const char *PLAYER_COLOURS[PLAYERS_MAX];
 
@@ -81,10 +97,58 @@ struct player_t {
 /*
  * cell_t stores the in-memory state of a particular cell. It is not directly
  * associated with a move, as they are generated from the list of move_ts.
+ * Cells are kept as small as possible so that large grids stay in cache:
+ * @owner is the owning player's index plus one (or CELL_NO_OWNER), and @atoms
+ * is always less than the cell's limit (at most 4).
  */
+#define CELL_NO_OWNER 0
 struct cell_t {
-	struct player_t *owner;
-	int atoms;
+	uint8_t owner;
+	uint8_t atoms;
+};
+
+/* undo_cell_t is the state of a cell before a move changed it. */
+struct undo_cell_t {
+	size_t idx;
+	struct cell_t old;
+};
+
+/*
+ * undo_move_t is the undo log entry for a single move. The cells it changed
+ * are in game_t.undo_cells from @start up to the start of the next entry.
+ */
+struct undo_move_t {
+	size_t start;
+	int player;
+};
+
+/* snapshot_t is a full copy of the game state after @moves_length moves. */
+struct snapshot_t {
+	size_t moves_length;
+	int current_player;
+	struct cell_t *grid;
+};
+
+/*
+ * checkpoint_t is a run-length encoded copy of the grid (see game.c), taken
+ * after some multiple of game_t.checkpoint_interval moves. Checkpoints which
+ * haven't been taken yet have a NULL @data.
+ */
+struct checkpoint_t {
+	int current_player;
+	size_t length;
+	uint8_t *data;
+};
+
+/*
+ * cascade_frame_t is an entry in the worklist used to resolve explosions (see
+ * game_place_cascade). @dir is the next neighbour to place an atom in, or
+ * CASCADE_PENDING if the atom for this cell hasn't been placed yet.
+ */
+#define CASCADE_PENDING -1
+struct cascade_frame_t {
+	int x, y;
+	int dir;
 };
 
 /*
@@ -105,15 +169,58 @@ struct game_t {
 	/* Current board state. */
 	size_t width, height;
 	struct cell_t *grid; /* Stored in [<width>*y + x] */
+	uint8_t *limits; /* Atom limit of each cell, laid out like @grid. */
+	uint64_t grid_hash; /* Zobrist hash of @grid (see game_hash). */
+
+	/*
+	 * Number of cells owned by each player (indexed by player_t.idx), and the
+	 * number of players that own any cells. These are kept up to date as
+	 * cells change owner, so we never need to scan the grid to find out who
+	 * is still playing.
+	 */
+	int *cell_counts;
+	size_t owning_players;
+
+	/* Worklist for game_place_cascade, sized to the grid (grown if needed). */
+	struct cascade_frame_t *cascade;
+	size_t cascade_size;
 
 	/* Player information. */
 	size_t num_players;
 	struct player_t *players;
 	int current_player;
 
-	/* The list of moves taken through the game. */
+	/*
+	 * The list of moves taken through the game. Moves after @moves_length (up
+	 * to @history_length) have been undone or skipped with SEEK, and are kept
+	 * around until a different move is made.
+	 */
 	size_t moves_length;
+	size_t history_length;
 	struct move_t *moves;
+
+	/* Checkpoint i is the game after (i + 1) * @checkpoint_interval moves. */
+	size_t checkpoint_interval;
+	size_t checkpoints_length;
+	struct checkpoint_t *checkpoints;
+
+	/*
+	 * Undo log for the last @undo_moves_length moves. @cell_epoch stores the
+	 * last move (numbered by @epoch) that logged each cell, so that a cell is
+	 * only logged once per move no matter how often a cascade touches it. The
+	 * epochs are kept small so they don't outweigh the grid during a cascade,
+	 * and @cell_epoch is cleared whenever @epoch wraps.
+	 */
+	size_t undo_moves_length, undo_moves_size;
+	struct undo_move_t *undo_moves;
+	size_t undo_cells_length, undo_cells_size;
+	struct undo_cell_t *undo_cells;
+	uint16_t *cell_epoch;
+	uint16_t epoch;
+
+	/* Snapshots taken when the undo log got too big, oldest first. */
+	size_t snapshots_length;
+	struct snapshot_t snapshots[UNDO_MAX_SNAPSHOTS];
 };
 
 /* Needs to be after the definition of game_t. */
@@ -129,14 +236,32 @@ void game_free(struct game_t *game);
 /* Called when creating a new game. */
 int game_init(struct game_t *game, int players, int width, int height);
 
-/* Load and save routines. */
+/*
+ * Load and save routines. By default, saves use the original format from the
+ * spec (unless the board is too big for it). SAVE_FLAG_V2 uses the newer,
+ * smaller format instead, and SAVE_FLAG_CHECKPOINTS also stores the
+ * checkpoints for fast seeking. Loading works out the format by itself.
+ */
+#define SAVE_FLAG_CHECKPOINTS (1 << 0)
+#define SAVE_FLAG_V2          (1 << 1)
+
 int game_savefile_load(struct game_t *game, int fd);
-int game_savefile_save(struct game_t *game, int fd);
+int game_savefile_save(struct game_t *game, int fd, int flags);
 
 /* Commands. */
 void game_cell_count(struct game_t *game, int *counts);
 int game_apply_moves(struct game_t *game, struct move_t *new_moves, size_t length);
 int game_do_move(struct game_t *game, struct move_t move);
+int game_undo(struct game_t *game);
+int game_seek(struct game_t *game, size_t turn);
+bool game_can_place(struct game_t *game, struct move_t move);
+bool game_player_lost(struct game_t *game, size_t idx);
+
+/* Fast paths for searching the game tree. */
+uint64_t game_hash(struct game_t *game);
+int game_make_move(struct game_t *game, struct move_t move);
+void game_unmake_move(struct game_t *game);
+struct game_t *game_clone(struct game_t *game);
 void game_display(struct game_t *game, FILE *out);
 const char *game_current_colour(struct game_t *game);
 
@@ -48,3 +48,5 @@ CMD(STAT)
 CMD(SAVE)
 CMD(LOAD)
 CMD(PLAYFROM)
+CMD(SEEK)
+CMD(HINT)
@@ -41,6 +41,7 @@
 #include <errno.h>
 
 #include "atoms.h"
+#include "ai.h"
 #include "dispatch.h"
 
 int __cmd_HELP(struct cmd_t *cmd, struct game_t *game)
@@ -52,19 +53,21 @@ int __cmd_HELP(struct cmd_t *cmd, struct game_t *game)
 	if (cmd->argc != 1)
 		return -ERROR_INVALID_COMMAND;
 
-	puts("");
-	puts("HELP displays this help message");
-	puts("QUIT quits the current game");
-	puts("");
-	puts("DISPLAY draws the game board in terminal");
-	puts("START <number of players> <width> <height> starts the game");
-	puts("PLACE <x> <y> places an atom in a grid space");
-	puts("UNDO undoes the last move made");
-	puts("STAT displays game statistics");
-	puts("");
-	puts("SAVE <filename> saves the state of the game");
-	puts("LOAD <filename> loads a save file");
-	puts("PLAYFROM <turn> plays from n steps into the game");
+	fputs("\n", cmd->out);
+	fputs("HELP displays this help message\n", cmd->out);
+	fputs("QUIT quits the current game\n", cmd->out);
+	fputs("\n", cmd->out);
+	fputs("DISPLAY draws the game board in terminal\n", cmd->out);
+	fputs("START <number of players> <width> <height> starts the game\n", cmd->out);
+	fputs("PLACE <x> <y> places an atom in a grid space\n", cmd->out);
+	fputs("UNDO undoes the last move made\n", cmd->out);
+	fputs("STAT displays game statistics\n", cmd->out);
+	fputs("HINT [<depth>] suggests a move for the current player\n", cmd->out);
+	fputs("\n", cmd->out);
+	fputs("SAVE <filename> [V2] [CHECKPOINTS] saves the state of the game\n", cmd->out);
+	fputs("LOAD <filename> loads a save file\n", cmd->out);
+	fputs("PLAYFROM <turn> plays from n steps into the game\n", cmd->out);
+	fputs("SEEK <turn|END> moves to any turn of the running game\n", cmd->out);
 	return 0;
 }
 
@@ -75,7 +78,7 @@ int __cmd_QUIT(struct cmd_t *cmd, struct game_t *game)
 	if (cmd->argc != 1)
 		return -ERROR_INVALID_COMMAND;
 
-	puts("Bye!");
+	fputs("Bye!\n", cmd->out);
 	return -ERROR_QUIT;
 }
 
@@ -92,8 +95,8 @@ int __cmd_DISPLAY(struct cmd_t *cmd, struct game_t *game)
 	if (cmd->argc != 1)
 		return -ERROR_INVALID_COMMAND;
 
-	puts("");
-	game_display(game, stdout);
+	fputs("\n", cmd->out);
+	game_display(game, cmd->out);
 	return 0;
 }
 
@@ -135,8 +138,8 @@ int __cmd_START(struct cmd_t *cmd, struct game_t *game)
 	if (err < 0)
 		return err;
 
-	puts("Game Ready");
-	printf("%s's Turn\n", game_current_colour(game));
+	fputs("Game Ready\n", cmd->out);
+	fprintf(cmd->out, "%s's Turn\n", game_current_colour(game));
 	return 0;
 }
 
@@ -174,11 +177,11 @@ int __cmd_PLACE(struct cmd_t *cmd, struct game_t *game)
 	if (err < 0) {
 		/* ERROR_QUIT means we've won. */
 		if (err == -ERROR_QUIT)
-			printf("%s Wins!\n", game_current_colour(game));
+			fprintf(cmd->out, "%s Wins!\n", game_current_colour(game));
 		return err;
 	}
 
-	printf("%s's Turn\n", game_current_colour(game));
+	fprintf(cmd->out, "%s's Turn\n", game_current_colour(game));
 	return 0;
 }
 
@@ -197,11 +200,11 @@ int __cmd_UNDO(struct cmd_t *cmd, struct game_t *game)
 	if (game->moves_length == 0)
 		return -ERROR_CANNOT_UNDO;
 
-	int err = game_apply_moves(game, game->moves, game->moves_length - 1);
+	int err = game_undo(game);
 	if (err < 0)
 		return err;
 
-	printf("%s's Turn\n", game_current_colour(game));
+	fprintf(cmd->out, "%s's Turn\n", game_current_colour(game));
 	return 0;
 }
 
@@ -224,13 +227,13 @@ int __cmd_STAT(struct cmd_t *cmd, struct game_t *game)
 
 	game_cell_count(game, counts);
 	for (size_t i = 0; i < game->num_players; i++) {
-		printf("Player %s:\n", game->players[i].colour);
+		fprintf(cmd->out, "Player %s:\n", game->players[i].colour);
 		if (counts[i] < 0)
-			printf("Lost\n");
+			fprintf(cmd->out, "Lost\n");
 		else
-			printf("Grid Count: %d\n", counts[i]);
+			fprintf(cmd->out, "Grid Count: %d\n", counts[i]);
 		if (i != game->num_players - 1)
-			printf("\n");
+			fprintf(cmd->out, "\n");
 	}
 
 	free(counts);
@@ -246,8 +249,21 @@ int __cmd_SAVE(struct cmd_t *cmd, struct game_t *game)
 		return -ERROR_INVALID_COMMAND;
 	if (cmd->argc < 2)
 		return -ERROR_MISSING_ARGUMENTS;
-	if (cmd->argc > 2)
-		return -ERROR_EXCESS_ARGUMENTS;
+	/*
+	 * SAVE <path> [V2] [CHECKPOINTS]. V2 uses the newer save format, and
+	 * CHECKPOINTS also stores the checkpoints for fast seeking.
+	 */
+	int flags = 0;
+	for (int i = 2; i < cmd->argc; i++) {
+		int flag = 0;
+		if (!strcmp(cmd->argv[i], "V2"))
+			flag = SAVE_FLAG_V2;
+		else if (!strcmp(cmd->argv[i], "CHECKPOINTS"))
+			flag = SAVE_FLAG_CHECKPOINTS;
+		if (!flag || flags & flag)
+			return -ERROR_EXCESS_ARGUMENTS;
+		flags |= flag;
+	}
 
 	char *path = cmd->argv[1];
 	int fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0644);
@@ -257,10 +273,10 @@ int __cmd_SAVE(struct cmd_t *cmd, struct game_t *game)
 		return -ERROR_INTERNAL;
 	}
 
-	int err = game_savefile_save(game, fd);
+	int err = game_savefile_save(game, fd, flags);
 	close(fd);
 	if (!err)
-		puts("Game Saved");
+		fputs("Game Saved\n", cmd->out);
 	return err;
 }
 
@@ -287,7 +303,7 @@ int __cmd_LOAD(struct cmd_t *cmd, struct game_t *game)
 	int err = game_savefile_load(game, fd);
 	close(fd);
 	if (!err)
-		puts("Game Loaded");
+		fputs("Game Loaded\n", cmd->out);
 	return err;
 }
 
@@ -306,25 +322,110 @@ int __cmd_PLAYFROM(struct cmd_t *cmd, struct game_t *game)
 	char *endptr;
 	int n = strtol(cmd->argv[1], &endptr, 10);
 	if (!strcmp(cmd->argv[1], "END"))
-		n = game->moves_length;
+		n = game->history_length;
 	else if (endptr == cmd->argv[1] || *endptr || n < 0)
 		return -ERROR_INVALID_TURN;
 
-	if (n > (int) game->moves_length)
-		n = game->moves_length;
+	if (n > (int) game->history_length)
+		n = game->history_length;
 
-	int err = game_apply_moves(game, game->moves, n);
+	int err = game_seek(game, n);
 	if (err < 0) {
 		/* ERROR_QUIT means we've won. */
 		if (err == -ERROR_QUIT)
-			printf("%s Wins!\n", game_current_colour(game));
+			fprintf(cmd->out, "%s Wins!\n", game_current_colour(game));
 		return err;
 	}
 
 	/* Move game to RUNNING. */
 	game->state = RUNNING;
 
-	puts("Game Ready");
-	printf("%s's Turn\n", game_current_colour(game));
+	fputs("Game Ready\n", cmd->out);
+	fprintf(cmd->out, "%s's Turn\n", game_current_colour(game));
+	return 0;
+}
+
+int __cmd_SEEK(struct cmd_t *cmd, struct game_t *game)
+{
+	if (!cmd || !game)
+		return -ERROR_INTERNAL;
+
+	if (game->state != RUNNING) {
+		if (game->state == LOADED)
+			return -ERROR_INVALID_COMMAND;
+		return -ERROR_GAME_NOT_RUNNING;
+	}
+	if (cmd->argc < 2)
+		return -ERROR_MISSING_ARGUMENTS;
+	if (cmd->argc > 2)
+		return -ERROR_EXCESS_ARGUMENTS;
+
+	/* Same as PLAYFROM, but we can seek back and forth in a running game. */
+	char *endptr;
+	int n = strtol(cmd->argv[1], &endptr, 10);
+	if (!strcmp(cmd->argv[1], "END"))
+		n = game->history_length;
+	else if (endptr == cmd->argv[1] || *endptr || n < 0)
+		return -ERROR_INVALID_TURN;
+
+	if (n > (int) game->history_length)
+		n = game->history_length;
+
+	int err = game_seek(game, n);
+	if (err < 0) {
+		/* ERROR_QUIT means we've won. */
+		if (err == -ERROR_QUIT)
+			fprintf(cmd->out, "%s Wins!\n", game_current_colour(game));
+		return err;
+	}
+
+	fprintf(cmd->out, "%s's Turn\n", game_current_colour(game));
+	return 0;
+}
+
+int __cmd_HINT(struct cmd_t *cmd, struct game_t *game)
+{
+	if (!cmd || !game)
+		return -ERROR_INTERNAL;
+
+	if (game->state != RUNNING) {
+		if (game->state == LOADED)
+			return -ERROR_INVALID_COMMAND;
+		return -ERROR_GAME_NOT_RUNNING;
+	}
+	if (cmd->argc > 2)
+		return -ERROR_EXCESS_ARGUMENTS;
+
+	/* HINT [<depth>] */
+	struct ai_config_t config = {
+		.depth = AI_DEFAULT_DEPTH,
+		.threads = 1,
+	};
+	if (cmd->argc == 2) {
+		char *endptr;
+		config.depth = strtol(cmd->argv[1], &endptr, 10);
+		if (endptr == cmd->argv[1] || *endptr)
+			return -ERROR_INVALID_ARGS;
+		if (config.depth < 1 || config.depth > AI_MAX_DEPTH)
+			return -ERROR_INVALID_ARGS;
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0)
+		config.threads = cpus;
+
+	if (!cmd->hint_table) {
+		cmd->hint_table = ai_table_alloc(AI_TABLE_BITS);
+		if (!cmd->hint_table)
+			return -ERROR_INTERNAL;
+	}
+	config.table = cmd->hint_table;
+
+	struct ai_result_t result;
+	int err = ai_search(game, &config, &result);
+	if (err < 0)
+		return err;
+
+	fprintf(cmd->out, "Hint: PLACE %d %d\n", result.move.x, result.move.y);
 	return 0;
 }
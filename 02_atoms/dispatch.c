@@ -55,6 +55,8 @@ struct cmd_t *cmd_alloc(void)
 		.ident = END_CMDS,
 		.argc = 0,
 		.argv = NULL,
+		.out = stdout,
+		.hint_table = NULL,
 	};
 	return cmd;
 }
@@ -62,8 +64,10 @@ struct cmd_t *cmd_alloc(void)
 /* Frees a cmd_t allocated by cmd_alloc. Noop if cmd is NULL. */
 void cmd_free(struct cmd_t *cmd)
 {
-	if (cmd)
+	if (cmd) {
 		free(cmd->argv);
+		ai_table_free(cmd->hint_table);
+	}
 	free(cmd);
 }
 
@@ -96,6 +100,8 @@ int cmd_parse(struct cmd_t *cmd, char *line)
 		.ident = END_CMDS,
 		.argc = 0,
 		.argv = NULL,
+		.out = cmd->out,
+		.hint_table = cmd->hint_table,
 	};
 
 	for (char *p = line; *p != '\0'; p++) {
@@ -153,3 +159,36 @@ int cmd_dispatch(struct cmd_t *cmd, struct game_t *game)
 
 	return ret;
 }
+
+/*
+ * Parses and dispatches @line the same way the REPL does, printing any error
+ * and the trailing newline to @cmd->out. Returns -ERROR_QUIT if the command
+ * asked us to quit, and 0 otherwise. @line will be modified.
+ */
+int cmd_run(struct cmd_t *cmd, struct game_t *game, char *line)
+{
+	int err = cmd_parse(cmd, line);
+	if (!err)
+		err = cmd_dispatch(cmd, game);
+	return cmd_finish(cmd, err);
+}
+
+/*
+ * Prints the result of a command the same way cmd_run does, for callers that
+ * parse and dispatch commands themselves. @err is what cmd_parse or
+ * cmd_dispatch returned. Returns -ERROR_QUIT if the command asked us to quit,
+ * and 0 otherwise.
+ */
+int cmd_finish(struct cmd_t *cmd, int err)
+{
+	if (err == -ERROR_QUIT)
+		return err;
+
+	atom_perror(cmd->out, err);
+	/*
+	 * Not mentioned in the spec, but apparently we have to output a newline
+	 * after each command for some reason...
+	 */
+	fputs("\n", cmd->out);
+	return 0;
+}
@@ -37,6 +37,7 @@
 #define COMMANDS_H
 
 #include "atoms.h"
+#include "ai.h"
 
 enum {
 #define CMD(ident) CMD_##ident,
@@ -45,11 +46,19 @@ enum {
 	END_CMDS,
 };
 
-/* cmd_t stores the parsed state of a command string. */
+/*
+ * cmd_t stores the parsed state of a command string, and where the output of
+ * the command should go (stdout unless the caller changes it). @hint_table is
+ * the transposition table used by HINT, which is allocated by the first HINT
+ * and kept until cmd_free, since the positions searched by one hint tend to
+ * come up again in the next one.
+ */
 struct cmd_t {
 	int ident;
 	int argc;
 	char **argv;
+	FILE *out;
+	struct ai_table_t *hint_table;
 };
 
 /* malloc and free equivalents for cmd_t. */
@@ -70,6 +79,19 @@ int cmd_parse(struct cmd_t *cmd, char *line);
  */
 int cmd_dispatch(struct cmd_t *cmd, struct game_t *game);
 
+/*
+ * Parses and dispatches @line the same way the REPL does, printing any error
+ * and the trailing newline to @cmd->out. Returns -ERROR_QUIT if the command
+ * asked us to quit, and 0 otherwise. @line will be modified.
+ */
+int cmd_run(struct cmd_t *cmd, struct game_t *game, char *line);
+
+/*
+ * Prints the error (if any) and the trailing newline for a command that was
+ * parsed and dispatched by hand, and returns what cmd_run would have.
+ */
+int cmd_finish(struct cmd_t *cmd, int err);
+
 /* List of commands. */
 #define CMD(ident) int __cmd_##ident(struct cmd_t *cmd, struct game_t *game);
 #include "command_list.h"
@@ -35,8 +35,8 @@
 
 #include "errno.h"
 
-/* Like perror but for atom commands. */
-void atom_perror(int err)
+/* Like perror but for atom commands, and printing to @out. */
+void atom_perror(FILE *out, int err)
 {
 	char *str = "[INTERNAL] Unknown Error";
 
@@ -91,5 +91,5 @@ void atom_perror(int err)
 			break;
 	}
 
-	puts(str);
+	fprintf(out, "%s\n", str);
 }
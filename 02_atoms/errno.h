@@ -36,6 +36,8 @@
 #if !defined(ERRNO_H)
 #define ERRNO_H
 
+#include <stdio.h>
+
 #define ERROR_QUIT               1 /* Signifies that the game should exit. */
 #define ERROR_INTERNAL           2 /* An error that is not defined by the spec. */
 #define ERROR_INVALID_COMMAND    3 /* Invalid Command */
@@ -52,7 +54,7 @@
 #define ERROR_INVALID_COORDS    14 /* Invalid Coordinates */
 #define ERROR_CANNOT_UNDO       15 /* Cannot Undo */
 
-/* Like perror but for atom commands. */
-void atom_perror(int err);
+/* Like perror but for atom commands, and printing to @out. */
+void atom_perror(FILE *out, int err);
 
 #endif /* !defined(ERRNO_H) */
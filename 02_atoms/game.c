@@ -41,6 +41,9 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "atoms.h"
 
@@ -67,17 +70,134 @@ struct game_t *game_alloc(void)
 	return game;
 }
 
+/* game_undo_reset throws away the undo log and all snapshots. */
+static void game_undo_reset(struct game_t *game)
+{
+	for (size_t i = 0; i < game->snapshots_length; i++)
+		free(game->snapshots[i].grid);
+	game->snapshots_length = 0;
+	game->undo_moves_length = 0;
+	game->undo_cells_length = 0;
+}
+
+/*
+ * game_fini frees everything a game instance owns, leaving it as game_alloc
+ * returned it.
+ */
+static void game_fini(struct game_t *game)
+{
+	game_undo_reset(game);
+	for (size_t i = 0; i < game->checkpoints_length; i++)
+		free(game->checkpoints[i].data);
+	free(game->checkpoints);
+	free(game->grid);
+	free(game->limits);
+	free(game->cell_counts);
+	free(game->cell_epoch);
+	free(game->cascade);
+	free(game->undo_moves);
+	free(game->undo_cells);
+	free(game->players);
+	free(game->moves);
+
+	memset(game, 0, sizeof(struct game_t));
+	game->state = BLANK;
+}
+
 /* Free all of the memory used by a game instance. */
 void game_free(struct game_t *game)
 {
-	if (game) {
-		free(game->grid);
-		free(game->players);
-		free(game->moves);
-	}
+	if (game)
+		game_fini(game);
 	free(game);
 }
 
+/* game_clear_grid empties every cell in the grid. */
+static void game_clear_grid(struct game_t *game)
+{
+	memset(game->grid, 0, game->width * game->height * sizeof(struct cell_t));
+	memset(game->cell_counts, 0, game->num_players * sizeof(int));
+	game->owning_players = 0;
+	game->grid_hash = 0;
+}
+
+/* game_mix is the splitmix64 finaliser, used to generate Zobrist keys. */
+static uint64_t game_mix(uint64_t z)
+{
+	z += 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*
+ * game_cell_key is the Zobrist key for the cell at @idx being in state @cell.
+ * Rather than storing a table of random keys (which would be far bigger than
+ * the grid) the keys are generated by hashing the index and state. Empty
+ * cells have a key of zero, so an empty grid hashes to zero.
+ */
+static uint64_t game_cell_key(size_t idx, struct cell_t cell)
+{
+	if (cell.owner == CELL_NO_OWNER)
+		return 0;
+	return game_mix((uint64_t) idx << 5 | cell.owner << 2 | cell.atoms);
+}
+
+/*
+ * game_set_cell changes the cell at @idx, keeping the per-player cell counts
+ * and the grid hash up to date.
+ */
+static void game_set_cell(struct game_t *game, size_t idx, struct cell_t cell)
+{
+	struct cell_t old = game->grid[idx];
+
+	if (old.owner != cell.owner) {
+		if (old.owner != CELL_NO_OWNER && !--game->cell_counts[old.owner - 1])
+			game->owning_players--;
+		if (cell.owner != CELL_NO_OWNER && !game->cell_counts[cell.owner - 1]++)
+			game->owning_players++;
+	}
+
+	game->grid_hash ^= game_cell_key(idx, old) ^ game_cell_key(idx, cell);
+	game->grid[idx] = cell;
+}
+
+/*
+ * game_hash returns the Zobrist hash of the current position (the grid, whose
+ * turn it is and whether players can lose yet).
+ */
+uint64_t game_hash(struct game_t *game)
+{
+	uint64_t turn = game->current_player;
+	if (game->moves_length > game->num_players)
+		turn |= 1 << 8;
+	return game->grid_hash ^ game_mix(~turn);
+}
+
+/* game_get_limit gets the atom limit for a particular cell. */
+static int game_get_limit(struct game_t *game, struct move_t move)
+{
+	/* Default limit is 4, every edge you are touching reduces it by one. */
+	int limit = 4;
+
+	if (move.x == 0 || move.x == (int) game->width - 1)
+		limit--;
+	if (move.y == 0 || move.y == (int) game->height - 1)
+		limit--;
+
+	return limit;
+}
+
+/*
+ * game_player_lost returns whether the player with the given index has lost.
+ * Once we're past move k (every player has had a chance to make a move),
+ * players can lose (any player that doesn't own any cells has lost).
+ */
+bool game_player_lost(struct game_t *game, size_t idx)
+{
+	return game->moves_length > game->num_players && !game->cell_counts[idx];
+}
+
 /* Initialises a game instance to be a "new game" state. */
 int game_init(struct game_t *game, int players, int width, int height)
 {
@@ -92,7 +212,10 @@ int game_init(struct game_t *game, int players, int width, int height)
 
 	if (players < PLAYERS_MIN || players > PLAYERS_MAX)
 		return -ERROR_CANNOT_START;
-	if (width * height < players)
+	/* Big boards would overflow int, and game_t can't represent them anyway. */
+	if (width < 0 || height < 0 || (uint64_t) width * height > INT_MAX)
+		return -ERROR_CANNOT_START;
+	if ((uint64_t) width * height < (uint64_t) players)
 		return -ERROR_CANNOT_START;
 
 	/* Allocate players. */
@@ -114,18 +237,69 @@ int game_init(struct game_t *game, int players, int width, int height)
 	game->grid = malloc(game->width * game->height * sizeof(struct cell_t));
 	if (!game->grid)
 		goto err_free_players;
-	memset(game->grid, 0, game->width * game->height * sizeof(struct cell_t));
+	game->cell_counts = malloc(game->num_players * sizeof(int));
+	if (!game->cell_counts)
+		goto err_free_grid;
+	game_clear_grid(game);
+
+	/* Limits never change, so work them out once rather than every placement. */
+	game->limits = malloc(game->width * game->height * sizeof(uint8_t));
+	if (!game->limits)
+		goto err_free_counts;
+	for (size_t y = 0; y < game->height; y++) {
+		for (size_t x = 0; x < game->width; x++) {
+			struct move_t where = { .x = x, .y = y };
+			game->limits[y*game->width + x] = game_get_limit(game, where);
+		}
+	}
+
+	/*
+	 * Every cell in the worklist has exploded (apart from the top one), so
+	 * unless cells explode again before their neighbours are done, it's never
+	 * deeper than the grid.
+	 */
+	game->cascade_size = game->width * game->height;
+	game->cascade = malloc(game->cascade_size * sizeof(struct cascade_frame_t));
+	if (!game->cascade)
+		goto err_free_limits;
+
+	/* Start with an empty undo log. */
+	game->cell_epoch = calloc(game->width * game->height, sizeof(*game->cell_epoch));
+	if (!game->cell_epoch)
+		goto err_free_cascade;
+	game->epoch = 0;
 
 	/* Start with no moves. */
 	game->moves_length = 0;
+	game->history_length = 0;
 	game->moves = NULL;
 
+	/* Checkpoint often enough for small boards, but not so often for large ones. */
+	game->checkpoint_interval = game->width * game->height / CHECKPOINT_CELLS_PER_MOVE;
+	if (game->checkpoint_interval < CHECKPOINT_MIN_INTERVAL)
+		game->checkpoint_interval = CHECKPOINT_MIN_INTERVAL;
+	game->checkpoints_length = 0;
+	game->checkpoints = NULL;
+
 	/* New games don't need PLAYFROM. */
 	game->state = RUNNING;
 	return 0;
 
+err_free_cascade:
+	free(game->cascade);
+	game->cascade = NULL;
+err_free_limits:
+	free(game->limits);
+	game->limits = NULL;
+err_free_counts:
+	free(game->cell_counts);
+	game->cell_counts = NULL;
+err_free_grid:
+	free(game->grid);
+	game->grid = NULL;
 err_free_players:
 	free(game->players);
+	game->players = NULL;
 err:
 	return -ERROR_INTERNAL;
 }
@@ -142,44 +316,20 @@ const char *game_current_colour(struct game_t *game)
  */
 void game_cell_count(struct game_t *game, int *counts)
 {
-	memset(counts, 0, game->num_players * sizeof(int));
-
-	for (size_t i = 0; i < game->width * game->height; i++) {
-		struct cell_t cell = game->grid[i];
-		if (cell.owner)
-			counts[cell.owner->idx]++;
-	}
-
-	/*
-	 * If we're past move k (every player has had a chance to make a move) then
-	 * players can lose (any player with a count of 0 has lost).
-	 */
-	if (game->moves_length > game->num_players) {
-		for (size_t i = 0; i < game->num_players; i++) {
-			if (!counts[game->players[i].idx])
-				counts[game->players[i].idx] = -1;
-		}
-	}
+	for (size_t i = 0; i < game->num_players; i++)
+		counts[i] = game_player_lost(game, i) ? -1 : game->cell_counts[i];
 }
 
 /*
  * game_active_players returns the number of player that are still playing the
- * game. Returns < 0 if an error occurred.
+ * game.
  */
-static int game_active_players(struct game_t *game)
+static size_t game_active_players(struct game_t *game)
 {
-	int *counts = malloc(game->num_players * sizeof(int));
-	if (!counts)
-		return -ERROR_INTERNAL;
-	game_cell_count(game, counts);
-
-	int active = 0;
-	for (size_t i = 0; i < game->num_players; i++)
-		if (counts[i] != -1)
-			active++;
-
-	free(counts);
-	return active;
+	/* Nobody can have lost until every player has had a chance to move. */
+	if (game->moves_length <= game->num_players)
+		return game->num_players;
+	return game->owning_players;
 }
 
 /* game_display graphically displays the current state of the game grid. */
@@ -194,8 +344,8 @@ void game_display(struct game_t *game, FILE *out)
 	for (size_t y = 0; y < game->height; y++) {
 		for (size_t x = 0; x < game->width; x++) {
 			struct cell_t cell = game->grid[y*game->width + x];
-			if (cell.owner)
-				fprintf(out, "|%c%d", cell.owner->colour[0], cell.atoms);
+			if (cell.owner != CELL_NO_OWNER)
+				fprintf(out, "|%c%d", game->players[cell.owner - 1].colour[0], cell.atoms);
 			else
 				fputs("|  ", out);
 		}
@@ -216,30 +366,120 @@ static bool game_is_move_inside(struct game_t *game, struct move_t move)
 	       (move.y >= 0 && move.y < (int) game->height);
 }
 
-/* game_get_limit gets the atom limit for a particular cell. */
-static int game_get_limit(struct game_t *game, struct move_t move)
+/*
+ * game_can_place returns whether the current player is allowed to place an
+ * atom at @move (it must be inside the grid and not owned by anyone else).
+ */
+bool game_can_place(struct game_t *game, struct move_t move)
 {
-	/* Default limit is 4, every edge you are touching reduces it by one. */
-	int limit = 4;
+	if (!game_is_move_inside(game, move))
+		return false;
 
-	if (move.x == 0 || move.x == (int) game->width - 1)
-		limit--;
-	if (move.y == 0 || move.y == (int) game->height - 1)
-		limit--;
+	uint8_t owner = game->grid[game->width * move.y + move.x].owner;
+	return owner == CELL_NO_OWNER || owner == game->current_player + 1;
+}
 
-	return limit;
+/*
+ * game_undo_cell adds the current state of the cell at @idx to the undo log of
+ * the current move, unless the move has already changed it.
+ */
+static int game_undo_cell(struct game_t *game, size_t idx)
+{
+	if (game->cell_epoch[idx] == game->epoch)
+		return 0;
+	game->cell_epoch[idx] = game->epoch;
+
+	if (game->undo_cells_length == game->undo_cells_size) {
+		size_t size = game->undo_cells_size ? 2 * game->undo_cells_size : 64;
+		struct undo_cell_t *cells = realloc(game->undo_cells, size * sizeof(*cells));
+		if (!cells)
+			return -ERROR_INTERNAL;
+		game->undo_cells = cells;
+		game->undo_cells_size = size;
+	}
+	game->undo_cells[game->undo_cells_length++] = (struct undo_cell_t) {
+		.idx = idx,
+		.old = game->grid[idx],
+	};
+	return 0;
+}
+
+/* game_undo_begin starts the undo log entry for a new move. */
+static int game_undo_begin(struct game_t *game)
+{
+	if (game->undo_moves_length == game->undo_moves_size) {
+		size_t size = game->undo_moves_size ? 2 * game->undo_moves_size : 64;
+		struct undo_move_t *moves = realloc(game->undo_moves, size * sizeof(*moves));
+		if (!moves)
+			return -ERROR_INTERNAL;
+		game->undo_moves = moves;
+		game->undo_moves_size = size;
+	}
+	game->undo_moves[game->undo_moves_length++] = (struct undo_move_t) {
+		.start = game->undo_cells_length,
+		.player = game->current_player,
+	};
+
+	/* Cells start out in epoch 0, so it can't be reused once we wrap. */
+	if (!++game->epoch) {
+		memset(game->cell_epoch, 0, game->width * game->height * sizeof(*game->cell_epoch));
+		game->epoch = 1;
+	}
+	return 0;
 }
 
 /*
- * game_place_cascade (forcefully) places an atom in the given location and
- * then handles the recursive resolution of "explosion" cases where atoms in
- * cells need to bleed into other cells. This is implemented separately to
- * game_do_move to not count explosions as moves. The cascade is handled
- * depth-first, clockwise (from the top) and starts from the atom placement.
+ * game_snapshot replaces the undo log with a snapshot of the current state. If
+ * we're out of snapshots, every other one (starting with the oldest) is
+ * dropped, which keeps the replay needed to get between any two snapshots
+ * roughly proportional to how far back they go.
+ */
+static int game_snapshot(struct game_t *game)
+{
+	struct cell_t *grid = malloc(game->width * game->height * sizeof(struct cell_t));
+	if (!grid)
+		return -ERROR_INTERNAL;
+	memcpy(grid, game->grid, game->width * game->height * sizeof(struct cell_t));
+
+	if (game->snapshots_length == UNDO_MAX_SNAPSHOTS) {
+		size_t kept = 0;
+		for (size_t i = 0; i < game->snapshots_length; i++) {
+			if (i % 2 == 0)
+				free(game->snapshots[i].grid);
+			else
+				game->snapshots[kept++] = game->snapshots[i];
+		}
+		game->snapshots_length = kept;
+	}
+
+	game->snapshots[game->snapshots_length++] = (struct snapshot_t) {
+		.moves_length = game->moves_length,
+		.current_player = game->current_player,
+		.grid = grid,
+	};
+	game->undo_moves_length = 0;
+	game->undo_cells_length = 0;
+	return 0;
+}
+
+/* Explosions expand in the order provided by the spec (up, right, down, left). */
+static const struct move_t CASCADE_DIRECTIONS[] = {
+	{.x =  0, .y = -1},
+	{.x = +1, .y =  0},
+	{.x =  0, .y = +1},
+	{.x = -1, .y =  0},
+};
+
+#if defined(CASCADE_RECURSIVE)
+/*
+ * The original recursive game_place_cascade, kept as a reference for the
+ * worklist version below. It's only built into atoms-sim-ref, which "make
+ * test-cascade" plays the same random games with as atoms-sim. Long chain
+ * reactions will overflow the stack, so it's only any good on small boards.
  */
 static int game_place_cascade(struct game_t *game, struct player_t *player, struct move_t move)
 {
-	int err = -ERROR_INTERNAL;
+	uint8_t owner = player->idx + 1;
 	size_t idx = game->width * move.y + move.x;
 	if (idx > game->width * game->height)
 		return -ERROR_INTERNAL;
@@ -248,55 +488,164 @@ static int game_place_cascade(struct game_t *game, struct player_t *player, stru
 	if (move.y < 0 || move.y >= (int) game->height)
 		return -ERROR_INTERNAL;
 
+	int err = game_undo_cell(game, idx);
+	if (err < 0)
+		return err;
+
 	/* Update owner and count. */
-	game->grid[idx].owner = player;
-	game->grid[idx].atoms++;
+	game_set_cell(game, idx, (struct cell_t) {
+		.owner = owner,
+		.atoms = game->grid[idx].atoms + 1,
+	});
 
-	/*
-	 * Before we do anything recursive, check whether the player has won. This is to avoid */
-	int active = game_active_players(game);
-	if (active < 0)
-		return active;
-	else if (active == 1)
-		/* We've won. */
+	/* Before we do anything recursive, check whether the player has won. */
+	if (game_active_players(game) == 1)
 		return -ERROR_QUIT;
 
 	/*
 	 * If we're not over the limit for the number of atoms, there's nothing
 	 * left to do.
 	 */
-	if (game->grid[idx].atoms < game_get_limit(game, move))
+	if (game->grid[idx].atoms < game->limits[idx])
 		return 0;
 
+	/* Tiny boards can cascade forever, see the worklist version. */
+	if (game->owning_players == 1)
+		return -ERROR_QUIT;
+
 	/*
 	 * Set atom count to zero first. If we decrement it each time we'll run
 	 * into fun issues with cases where a cell will cause us to recompute our
 	 * own expansion.
 	 */
-	game->grid[idx].owner = NULL;
-	game->grid[idx].atoms = 0;
-
-	/* Expand in the order provided by the spec (up, right, down, left). */
-	struct move_t moves[] = {
-		{.x = move.x,     .y = move.y - 1},
-		{.x = move.x + 1, .y = move.y},
-		{.x = move.x,     .y = move.y + 1},
-		{.x = move.x - 1, .y = move.y},
-	};
+	game_set_cell(game, idx, (struct cell_t) { .owner = CELL_NO_OWNER });
 
-	for (size_t i = 0; i < ARRAY_LENGTH(moves); i++) {
-		struct move_t new_move = moves[i];
+	for (size_t i = 0; i < ARRAY_LENGTH(CASCADE_DIRECTIONS); i++) {
+		struct move_t next = {
+			.x = move.x + CASCADE_DIRECTIONS[i].x,
+			.y = move.y + CASCADE_DIRECTIONS[i].y,
+		};
 
-		if (!game_is_move_inside(game, new_move))
+		if (!game_is_move_inside(game, next))
 			continue;
 
-		err = game_place_cascade(game, player, new_move);
+		err = game_place_cascade(game, player, next);
 		if (err < 0)
 			return err;
 	}
 
 	return 0;
 }
+#else
+/*
+ * game_place_cascade (forcefully) places an atom in the given location and
+ * then handles the resolution of "explosion" cases where atoms in cells need
+ * to bleed into other cells. This is implemented separately to game_do_move to
+ * not count explosions as moves. The cascade is handled depth-first, clockwise
+ * (from the top) and starts from the atom placement. Rather than recursing
+ * (which overflows the stack on long chain reactions) we keep our own stack of
+ * cells in @game->cascade.
+ */
+static int game_place_cascade(struct game_t *game, struct player_t *player, struct move_t move)
+{
+	uint8_t owner = player->idx + 1;
+	size_t idx = game->width * move.y + move.x;
+	if (idx > game->width * game->height)
+		return -ERROR_INTERNAL;
+	if (move.x < 0 || move.x >= (int) game->width)
+		return -ERROR_INTERNAL;
+	if (move.y < 0 || move.y >= (int) game->height)
+		return -ERROR_INTERNAL;
+
+	size_t depth = 0;
+	game->cascade[depth++] = (struct cascade_frame_t) {
+		.x = move.x,
+		.y = move.y,
+		.dir = CASCADE_PENDING,
+	};
+
+	while (depth) {
+		struct cascade_frame_t *frame = &game->cascade[depth - 1];
+		struct move_t cur = { .x = frame->x, .y = frame->y };
+		idx = game->width * cur.y + cur.x;
+
+		if (frame->dir == CASCADE_PENDING) {
+			int err = game_undo_cell(game, idx);
+			if (err < 0)
+				return err;
+
+			/* Update owner and count. */
+			game_set_cell(game, idx, (struct cell_t) {
+				.owner = owner,
+				.atoms = game->grid[idx].atoms + 1,
+			});
+
+			/* Before we explode anything, check whether the player has won. */
+			if (game_active_players(game) == 1)
+				/* We've won. */
+				return -ERROR_QUIT;
+
+			/*
+			 * If we're not over the limit for the number of atoms, there's
+			 * nothing left to do.
+			 */
+			if (game->grid[idx].atoms < game->limits[idx]) {
+				depth--;
+				continue;
+			}
+
+			/*
+			 * Explosions can only happen once everyone has had a turn, so if
+			 * we're the only one left with any cells, nobody else can get one
+			 * back and we'll win as soon as this move is over. Stop here,
+			 * since on tiny boards the cascade may never end.
+			 */
+			if (game->owning_players == 1)
+				return -ERROR_QUIT;
+
+			/*
+			 * Set atom count to zero first. If we decrement it each time we'll
+			 * run into fun issues with cases where a cell will cause us to
+			 * recompute our own expansion.
+			 */
+			game_set_cell(game, idx, (struct cell_t) { .owner = CELL_NO_OWNER });
+			frame->dir = 0;
+		}
+
+		/* Find the next neighbour to place an atom in, if there are any left. */
+		struct move_t next = {0};
+		bool found = false;
+		while (!found && frame->dir < (int) ARRAY_LENGTH(CASCADE_DIRECTIONS)) {
+			next = (struct move_t) {
+				.x = cur.x + CASCADE_DIRECTIONS[frame->dir].x,
+				.y = cur.y + CASCADE_DIRECTIONS[frame->dir].y,
+			};
+			frame->dir++;
+			found = game_is_move_inside(game, next);
+		}
+		if (!found) {
+			depth--;
+			continue;
+		}
+
+		if (depth == game->cascade_size) {
+			size_t size = 2 * game->cascade_size;
+			struct cascade_frame_t *cascade = realloc(game->cascade, size * sizeof(*cascade));
+			if (!cascade)
+				return -ERROR_INTERNAL;
+			game->cascade = cascade;
+			game->cascade_size = size;
+		}
+		game->cascade[depth++] = (struct cascade_frame_t) {
+			.x = next.x,
+			.y = next.y,
+			.dir = CASCADE_PENDING,
+		};
+	}
+
+	return 0;
+}
+#endif
 
 /* game_next_player advances to the next player still playing the game. */
 static int game_next_player(struct game_t *game)
@@ -304,183 +653,1027 @@ static int game_next_player(struct game_t *game)
 	if (game_active_players(game) <= 1)
 		return -ERROR_QUIT;
 
-	int *counts = malloc(game->num_players * sizeof(int));
-	if (!counts)
-		return -ERROR_INTERNAL;
-	game_cell_count(game, counts);
-
 	/* Keep advancing until we hit a player that's still playing. */
 	do {
 		game->current_player = (game->current_player + 1) % game->num_players;
-	} while (counts[game->current_player] < 0);
+	} while (game_player_lost(game, game->current_player));
 
-	free(counts);
 	return 0;
 }
 
 /*
- * game_do_move is the front-end to adding moves to the move set (that follow
- * the rules of the game). The grid is mutated as well as the @current_player.
+ * Checkpoints are run-length encoded, since most boards are either mostly
+ * empty or mostly owned by a few players. Each run is a cell byte (see
+ * game_cell_byte) followed by the length of the run as a varint (7 bits per
+ * byte, least significant first, with the top bit set on all but the last).
  */
-int game_do_move(struct game_t *game, struct move_t move)
+static uint8_t game_cell_byte(struct cell_t cell)
 {
-	size_t idx = game->width * move.y + move.x;
-	if (idx > game->width * game->height)
-		return -ERROR_INTERNAL;
+	return (uint8_t) (cell.owner << 2 | cell.atoms);
+}
 
-	/* Check ownership. */
-	struct player_t *current = &game->players[game->current_player];
-	struct player_t *owner = game->grid[idx].owner;
-	if (owner && owner->idx != current->idx)
-		return -ERROR_CANNOT_PLACE;
+/* game_checkpoint stores a checkpoint of the current state, if it's due one. */
+static int game_checkpoint(struct game_t *game)
+{
+	size_t cells = game->width * game->height;
 
-	/* Place and cascade. */
-	int err = game_place_cascade(game, current, move);
-	if (err < 0)
-		return err;
+	if (game->moves_length % game->checkpoint_interval)
+		return 0;
+	size_t i = game->moves_length / game->checkpoint_interval - 1;
+	if (i < game->checkpoints_length && game->checkpoints[i].data)
+		return 0;
 
-	/* Add it to the list of moves. */
-	game->moves = realloc(game->moves, ++game->moves_length * sizeof(struct move_t));
-	if (!game->moves)
+	if (i >= game->checkpoints_length) {
+		struct checkpoint_t *checkpoints = realloc(game->checkpoints, (i + 1) * sizeof(*checkpoints));
+		if (!checkpoints)
+			return -ERROR_INTERNAL;
+		memset(checkpoints + game->checkpoints_length, 0,
+		       (i + 1 - game->checkpoints_length) * sizeof(*checkpoints));
+		game->checkpoints = checkpoints;
+		game->checkpoints_length = i + 1;
+	}
+
+	/* Every run takes at most a byte plus a varint. */
+	uint8_t *data = malloc(cells * (1 + sizeof(size_t) * 8 / 7 + 1));
+	if (!data)
 		return -ERROR_INTERNAL;
-	game->moves[game->moves_length - 1] = move;
 
-	/* Update the current player. */
-	return game_next_player(game);
+	size_t length = 0;
+	for (size_t start = 0; start < cells; ) {
+		uint8_t byte = game_cell_byte(game->grid[start]);
+		size_t run = 1;
+		while (start + run < cells && game_cell_byte(game->grid[start + run]) == byte)
+			run++;
+		start += run;
+
+		data[length++] = byte;
+		for (; run >= 0x80; run >>= 7)
+			data[length++] = (run & 0x7f) | 0x80;
+		data[length++] = run;
+	}
+
+	/* Give back what we didn't need. */
+	uint8_t *shrunk = realloc(data, length);
+	game->checkpoints[i] = (struct checkpoint_t) {
+		.current_player = game->current_player,
+		.length = length,
+		.data = shrunk ? shrunk : data,
+	};
+	return 0;
 }
 
 /*
- * game_apply_moves swaps out a game's move history with an alternative
- * history, recomputing the board and game state. This is used both by UNDO and
- * PLAYFROM. new_moves can be a pointer to game->moves or entirely separate.
+ * game_checkpoint_decode decodes @data into @grid, checking that it's a valid
+ * grid for @game (so it is safe to use on checkpoints from save files).
  */
-int game_apply_moves(struct game_t *game, struct move_t *new_moves, size_t length)
+static int game_checkpoint_decode(struct game_t *game, const uint8_t *data, size_t length, struct cell_t *grid)
 {
-	int err = -ERROR_INTERNAL;
+	size_t cells = game->width * game->height;
+	size_t pos = 0, cell = 0;
+
+	while (pos < length) {
+		uint8_t byte = data[pos++];
+		size_t run = 0;
+		for (int shift = 0; ; shift += 7) {
+			if (pos >= length || shift >= (int) (sizeof(run) * 8))
+				return -ERROR_INTERNAL;
+			run |= (size_t) (data[pos] & 0x7f) << shift;
+			if (!(data[pos++] & 0x80))
+				break;
+		}
+		if (!run || run > cells - cell)
+			return -ERROR_INTERNAL;
 
-	/* Reset everything. */
-	game->current_player = 0;
-	game->moves_length = 0;
-	memset(game->grid, 0, game->width * game->height * sizeof(struct cell_t));
+		size_t owner = byte >> 2;
+		int atoms = byte & 3;
+		if (owner > game->num_players || !owner != !atoms)
+			return -ERROR_INTERNAL;
 
-	/*
-	 * Create a copy of new_moves, since it might actually be pointing inside
-	 * the old game->moves.
-	 */
-	struct move_t *moves_cpy = malloc(length * sizeof(struct move_t));
-	memcpy(moves_cpy, new_moves, length * sizeof(struct move_t));
+		for (; run; run--, cell++) {
+			if (atoms >= game->limits[cell])
+				return -ERROR_INTERNAL;
+			grid[cell] = (struct cell_t) {
+				.owner = owner,
+				.atoms = atoms,
+			};
+		}
+	}
 
-	/* Free game->moves now that we have a copy, to be safe. */
-	free(game->moves);
-	game->moves = NULL;
+	return cell == cells ? 0 : -ERROR_INTERNAL;
+}
 
-	/* If we're applying a moveset that's empty we don't have to do anything else. */
-	if (length <= 0)
-		goto out;
+/* game_checkpoints_drop throws away the checkpoints after @moves_length moves. */
+static void game_checkpoints_drop(struct game_t *game, size_t moves_length)
+{
+	size_t keep = moves_length / game->checkpoint_interval;
+	while (game->checkpoints_length > keep)
+		free(game->checkpoints[--game->checkpoints_length].data);
+}
 
-	/* Apply all of the moves. */
-	for (size_t i = 0; i < length; i++) {
-		err = game_do_move(game, moves_cpy[i]);
-		if (err < 0)
-			goto err;
+/*
+ * game_restore resets the game to the state after @moves_length moves, using
+ * @grid (an empty grid if NULL, and it may be @game->grid itself). The undo log
+ * is thrown away, along with any snapshots that are now in the future.
+ */
+static void game_restore(struct game_t *game, size_t moves_length, int current_player, struct cell_t *grid)
+{
+	size_t cells = game->width * game->height;
+
+	if (!grid)
+		memset(game->grid, 0, cells * sizeof(struct cell_t));
+	else if (grid != game->grid)
+		memcpy(game->grid, grid, cells * sizeof(struct cell_t));
+
+	/* Recount who owns what. */
+	memset(game->cell_counts, 0, game->num_players * sizeof(int));
+	game->owning_players = 0;
+	game->grid_hash = 0;
+	for (size_t i = 0; i < cells; i++) {
+		uint8_t owner = game->grid[i].owner;
+		if (owner != CELL_NO_OWNER && !game->cell_counts[owner - 1]++)
+			game->owning_players++;
+		game->grid_hash ^= game_cell_key(i, game->grid[i]);
 	}
+	game->current_player = current_player;
+	game->moves_length = moves_length;
 
-out:
-	err = 0;
-err:
-	/* TODO: This leaves the game in an inconsistent state. */
-	free(moves_cpy);
-	return err;
+	game->undo_moves_length = 0;
+	game->undo_cells_length = 0;
+	while (game->snapshots_length && game->snapshots[game->snapshots_length - 1].moves_length > moves_length)
+		free(game->snapshots[--game->snapshots_length].grid);
 }
 
-/* save_header represents the header of savefiles. */
-struct save_header_t {
-	uint8_t width;
-	uint8_t height;
-	uint8_t no_players;
-};
-
-/* save_move_t represents each one of the entries in the savefile. */
-union save_move_t {
-	uint32_t raw;
-	struct {
-		uint8_t x, y;
-		uint16_t unused;
-	} parsed;
-};
-
 /*
- * game_savefile_load loads game data and recomputes the game state from the
- * given file descriptor. Note that the on-disk format for save files is
- * endianness dependent (so don't try to play SystemZ save files).
+ * game_play_move plays @move for the current player, without touching the
+ * list of moves (which must already contain it, for everything but
+ * game_do_move this is used to replay the history).
  */
-int game_savefile_load(struct game_t *game, int fd)
+static int game_play_move(struct game_t *game, struct move_t move)
 {
-	if (!game || fd < 0)
-		return -ERROR_INTERNAL;
-	if (game->moves != NULL)
-		/* We could handle this, but it's not required by the spec. */
+	if (!game_is_move_inside(game, move))
 		return -ERROR_INTERNAL;
 
-	/* Read the header. */
-	/* TODO: This is probably not safe wrt struct packing. */
-	struct save_header_t header = {0};
-	size_t n = read(fd, &header, sizeof(header));
-	if (n < sizeof(header))
-		return -ERROR_INTERNAL;
+	/* Check ownership. */
+	struct player_t *current = &game->players[game->current_player];
+	if (!game_can_place(game, move))
+		return -ERROR_CANNOT_PLACE;
 
-	/* Create a new game with the parameters provided in the save file. */
-	int err = game_init(game, header.no_players, header.width, header.height);
+	/* Place and cascade. */
+	int err = game_undo_begin(game);
 	if (err < 0)
 		return err;
-	/* Undo the state change to be safe. */
-	game->state = BLANK;
+	err = game_place_cascade(game, current, move);
+	if (err < 0)
+		return err;
+	game->moves_length++;
 
-	/* Rest of the data is move data. */
-	size_t moves_length = 0;
-	struct move_t *moves = NULL;
+	/* Update the current player. */
+	err = game_next_player(game);
+	if (err < 0)
+		return err;
+
+	err = game_checkpoint(game);
+	if (err < 0)
+		return err;
+
+	/* Don't let the undo log grow without bound. */
+	if (game->undo_cells_length > UNDO_LOG_GRIDS * game->width * game->height)
+		return game_snapshot(game);
+	return 0;
+}
+
+/*
+ * game_do_move is the front-end to adding moves to the move set (that follow
+ * the rules of the game). The grid is mutated as well as the @current_player.
+ */
+int game_do_move(struct game_t *game, struct move_t move)
+{
+	if (!game_is_move_inside(game, move))
+		return -ERROR_INTERNAL;
+
+	/* Check ownership before we throw away any history. */
+	if (!game_can_place(game, move))
+		return -ERROR_CANNOT_PLACE;
+
+	/* Making a move forgets about any moves that were undone. */
+	game->history_length = game->moves_length;
+	game_checkpoints_drop(game, game->moves_length);
+
+	/* Add it to the list of moves. */
+	struct move_t *moves = realloc(game->moves, (game->moves_length + 1) * sizeof(struct move_t));
+	if (!moves)
+		return -ERROR_INTERNAL;
+	game->moves = moves;
+	game->moves[game->moves_length] = move;
+
+	int err = game_play_move(game, move);
+	if (err < 0)
+		return err;
+	game->history_length = game->moves_length;
+	return 0;
+}
+
+/* game_undo_pop reverts the last move in the undo log (which mustn't be empty). */
+static void game_undo_pop(struct game_t *game)
+{
+	struct undo_move_t *last = &game->undo_moves[--game->undo_moves_length];
+	while (game->undo_cells_length > last->start) {
+		struct undo_cell_t *cell = &game->undo_cells[--game->undo_cells_length];
+		game_set_cell(game, cell->idx, cell->old);
+	}
+	game->current_player = last->player;
+	game->moves_length--;
+}
+
+/*
+ * game_undo reverts the last move. If it's still in the undo log, this only
+ * costs as much as the number of cells it changed. Otherwise we seek to the
+ * move before it (which also rebuilds the undo log for the replayed moves).
+ * The undone move is kept in the history, so it can be redone with SEEK.
+ */
+int game_undo(struct game_t *game)
+{
+	if (!game->moves_length)
+		return -ERROR_CANNOT_UNDO;
+
+	if (game->undo_moves_length) {
+		game_undo_pop(game);
+		return 0;
+	}
+
+	return game_seek(game, game->moves_length - 1);
+}
+
+/*
+ * game_make_move and game_unmake_move are a cheap way of trying out moves (for
+ * searching the game tree). The move is only recorded in the undo log (it
+ * isn't added to the history, and never triggers a checkpoint or snapshot),
+ * so it must be unmade before the game is used for anything else. Unlike
+ * game_do_move, winning moves can be unmade too. Returns -ERROR_QUIT if the
+ * current player won, in which case it is still their turn. Any other error
+ * leaves the game unchanged (and the move must not be unmade).
+ */
+int game_make_move(struct game_t *game, struct move_t move)
+{
+	if (!game_can_place(game, move))
+		return -ERROR_CANNOT_PLACE;
+
+	int err = game_undo_begin(game);
+	if (err < 0)
+		return err;
+	err = game_place_cascade(game, &game->players[game->current_player], move);
+	game->moves_length++;
+	if (!err)
+		err = game_next_player(game);
+	if (err < 0 && err != -ERROR_QUIT)
+		game_undo_pop(game);
+	return err;
+}
+
+void game_unmake_move(struct game_t *game)
+{
+	game_undo_pop(game);
+}
+
+/*
+ * game_clone creates a copy of a running game, with the same history up to the
+ * current move (but without any of the undone moves, checkpoints or undo
+ * log). The copy has to be freed with game_free. It can't be used on a game
+ * that has moves which haven't been unmade with game_unmake_move.
+ */
+struct game_t *game_clone(struct game_t *game)
+{
+	if (!game || game->state != RUNNING)
+		return NULL;
+
+	struct game_t *clone = game_alloc();
+	if (!clone)
+		return NULL;
+	if (game_init(clone, game->num_players, game->width, game->height) < 0)
+		goto err;
+
+	if (game->moves_length) {
+		clone->moves = malloc(game->moves_length * sizeof(struct move_t));
+		if (!clone->moves)
+			goto err;
+		memcpy(clone->moves, game->moves, game->moves_length * sizeof(struct move_t));
+	}
+	clone->history_length = game->moves_length;
+	game_restore(clone, game->moves_length, game->current_player, game->grid);
+	return clone;
+
+err:
+	game_free(clone);
+	return NULL;
+}
+
+/*
+ * game_seek moves the game to the state after the first @turn moves of the
+ * history. Short trips backwards use the undo log, and otherwise we start from
+ * whichever is closest before @turn out of the current state, the checkpoints
+ * and the undo snapshots, so at most game_t.checkpoint_interval moves are
+ * replayed.
+ */
+int game_seek(struct game_t *game, size_t turn)
+{
+	if (turn > game->history_length)
+		return -ERROR_INVALID_TURN;
+
+	if (turn <= game->moves_length && game->moves_length - turn <= game->undo_moves_length) {
+		while (game->moves_length > turn) {
+			int err = game_undo(game);
+			if (err < 0)
+				return err;
+		}
+		return 0;
+	}
+
+	/* If we're going backwards (or it's closer) start from a checkpoint or snapshot. */
+	struct checkpoint_t *checkpoint = NULL;
+	struct snapshot_t *snapshot = NULL;
+	size_t start = 0;
+
+	size_t i = turn / game->checkpoint_interval;
+	if (i > game->checkpoints_length)
+		i = game->checkpoints_length;
+	for (; i > 0 && !checkpoint; i--) {
+		if (game->checkpoints[i - 1].data) {
+			checkpoint = &game->checkpoints[i - 1];
+			start = i * game->checkpoint_interval;
+		}
+	}
+
+	for (size_t j = game->snapshots_length; j > 0; j--) {
+		if (game->snapshots[j - 1].moves_length <= turn) {
+			if (game->snapshots[j - 1].moves_length > start) {
+				snapshot = &game->snapshots[j - 1];
+				start = snapshot->moves_length;
+			}
+			break;
+		}
+	}
+
+	if (turn < game->moves_length || start > game->moves_length) {
+		if (snapshot) {
+			game_restore(game, start, snapshot->current_player, snapshot->grid);
+		} else if (checkpoint) {
+			int err = game_checkpoint_decode(game, checkpoint->data, checkpoint->length, game->grid);
+			if (err < 0)
+				return err;
+			game_restore(game, start, checkpoint->current_player, game->grid);
+		} else {
+			game_restore(game, 0, 0, NULL);
+		}
+	}
+
+	while (game->moves_length < turn) {
+		int err = game_play_move(game, game->moves[game->moves_length]);
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * game_apply_moves swaps out a game's move history with an alternative
+ * history, recomputing the board and game state. new_moves can be a pointer to
+ * game->moves or entirely separate.
+ */
+int game_apply_moves(struct game_t *game, struct move_t *new_moves, size_t length)
+{
+	/*
+	 * Create a copy of new_moves, since it might actually be pointing inside
+	 * the old game->moves.
+	 */
+	struct move_t *moves_cpy = malloc((length + 1) * sizeof(struct move_t));
+	if (!moves_cpy)
+		return -ERROR_INTERNAL;
+	memcpy(moves_cpy, new_moves, length * sizeof(struct move_t));
+
+	free(game->moves);
+	game->moves = moves_cpy;
+	game->history_length = length;
+
+	/* Reset everything. */
+	game_checkpoints_drop(game, 0);
+	game_undo_reset(game);
+	game_restore(game, 0, 0, NULL);
+
+	return game_seek(game, length);
+}
+
+/* save_header represents the header of savefiles. */
+struct save_header_t {
+	uint8_t width;
+	uint8_t height;
+	uint8_t no_players;
+};
+
+/* save_move_t represents each one of the entries in the savefile. */
+union save_move_t {
+	uint32_t raw;
+	struct {
+		uint8_t x, y;
+		uint16_t unused;
+	} parsed;
+};
+
+/*
+ * Save files can optionally end with the game's checkpoints, so that loaded
+ * games can seek without replaying from the start. The checkpoints come after
+ * a marker entry (which older versions reject as garbage), and are stored as
+ * a save_checkpoints_t followed by a save_checkpoint_t and the encoded grid
+ * for each checkpoint.
+ */
+static const union save_move_t SAVE_CHECKPOINTS_MARKER = {
+	.parsed = { .x = 'C', .y = 'K', .unused = 0xffff },
+};
+
+struct save_checkpoints_t {
+	uint32_t interval;
+	uint32_t count;
+};
+
+struct save_checkpoint_t {
+	uint32_t index;
+	uint32_t current_player;
+	uint32_t length;
+};
+
+/*
+ * Version 2 save files lift the limits of the format above (which can't
+ * describe boards bigger than 255x255, and spends four bytes on every move).
+ * Integers are either little-endian or varints (see game_cell_byte), so unlike
+ * version 1 files they don't depend on the machine that wrote them:
+ *
+ *   magic        SAVE_V2_MAGIC, then the version and flags (a byte each)
+ *   board        width and height (u32 each), then the player count (a byte)
+ *   moves        the number of moves, then each move (varints)
+ *   checkpoints  only if SAVE_V2_HAS_CHECKPOINTS is set: the interval and
+ *                count (varints), then for each checkpoint the gap since the
+ *                last one (varint), the current player (a byte), the length
+ *                of the encoded grid (varint) and the encoded grid itself
+ *   checksum     the CRC-32 of everything before it (u32)
+ *
+ * Each move is the zigzag-encoded difference between its cell index (y*width
+ * + x) and the previous move's, so nearby moves only take a byte. The third
+ * byte of the magic is bigger than PLAYERS_MAX, so no valid version 1 file
+ * can be mistaken for a version 2 one.
+ */
+static const uint8_t SAVE_V2_MAGIC[4] = { 0x89, 'A', 'T', 'M' };
+#define SAVE_V2_VERSION 2
+#define SAVE_V2_HAS_CHECKPOINTS (1 << 0)
+
+/* save_cursor_t walks over a save file that has been read into memory. */
+struct save_cursor_t {
+	const uint8_t *data;
+	size_t length;
+	size_t offset;
+};
+
+/* save_take copies the next @size bytes out of @cursor, if there are enough. */
+static bool save_take(struct save_cursor_t *cursor, void *dst, size_t size)
+{
+	if (cursor->length - cursor->offset < size)
+		return false;
+	memcpy(dst, cursor->data + cursor->offset, size);
+	cursor->offset += size;
+	return true;
+}
+
+/* save_take_u32 reads a little-endian u32 from @cursor. */
+static bool save_take_u32(struct save_cursor_t *cursor, uint32_t *value)
+{
+	uint8_t bytes[4];
+	if (!save_take(cursor, bytes, sizeof(bytes)))
+		return false;
+	*value = bytes[0] | bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+	return true;
+}
+
+/* save_take_varint reads a varint from @cursor, rejecting overlong ones. */
+static bool save_take_varint(struct save_cursor_t *cursor, uint64_t *value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		uint8_t byte;
+		if (!save_take(cursor, &byte, sizeof(byte)))
+			return false;
+		*value |= (uint64_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * save_put copies @size bytes into @buf at @offset and moves @offset along. If
+ * @buf is NULL, it only moves @offset (which is how we size the buffer).
+ */
+static void save_put(uint8_t *buf, size_t *offset, const void *src, size_t size)
+{
+	if (buf)
+		memcpy(buf + *offset, src, size);
+	*offset += size;
+}
+
+/* save_put_u32 writes @value as a little-endian u32. */
+static void save_put_u32(uint8_t *buf, size_t *offset, uint32_t value)
+{
+	uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+	save_put(buf, offset, bytes, sizeof(bytes));
+}
+
+/* save_put_varint writes @value as a varint. */
+static void save_put_varint(uint8_t *buf, size_t *offset, uint64_t value)
+{
+	uint8_t bytes[10];
+	size_t length = 0;
+	for (; value >= 0x80; value >>= 7)
+		bytes[length++] = (value & 0x7f) | 0x80;
+	bytes[length++] = value;
+	save_put(buf, offset, bytes, length);
+}
+
+/* save_crc32 is the CRC-32 used by zlib (and just about everything else). */
+static uint32_t save_crc32(const uint8_t *data, size_t length)
+{
+	/* Going a nibble at a time keeps the table small. */
+	static const uint32_t table[16] = {
+		0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+		0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+		0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+		0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+	};
+
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < length; i++) {
+		crc = (crc >> 4) ^ table[(crc ^ data[i]) & 0xf];
+		crc = (crc >> 4) ^ table[(crc ^ (data[i] >> 4)) & 0xf];
+	}
+	return ~crc;
+}
+
+/* game_checkpoints_saved is how many checkpoints are worth putting in a save. */
+static size_t game_checkpoints_saved(struct game_t *game)
+{
+	/* We only save the moves up to the current one. */
+	size_t length = game->moves_length / game->checkpoint_interval;
+	if (length > game->checkpoints_length)
+		length = game->checkpoints_length;
+	return length;
+}
+
+/*
+ * game_checkpoints_load parses the checkpoints section of a save file of the
+ * given @version, which has to be the rest of @cursor.
+ */
+static int game_checkpoints_load(struct game_t *game, struct save_cursor_t *cursor, size_t moves_length, int version)
+{
+	size_t cells = game->width * game->height;
+	struct checkpoint_t *checkpoints = NULL;
+	struct cell_t *grid = NULL;
+	uint8_t *data = NULL;
+	size_t length = 0;
+
+	uint64_t interval, count;
+	if (version == 1) {
+		struct save_checkpoints_t hdr = {0};
+		if (!save_take(cursor, &hdr, sizeof(hdr)))
+			goto err;
+		interval = hdr.interval;
+		count = hdr.count;
+	} else if (!save_take_varint(cursor, &interval) || !save_take_varint(cursor, &count)) {
+		goto err;
+	}
+	if (!interval || interval > SIZE_MAX)
+		goto err;
+
+	length = moves_length / interval;
+	checkpoints = calloc(length + 1, sizeof(*checkpoints));
+	grid = malloc(cells * sizeof(*grid));
+	if (!checkpoints || !grid)
+		goto err;
+
+	for (uint64_t i = 0, next = 0; i < count; i++) {
+		uint64_t index, current_player, data_length;
+		if (version == 1) {
+			struct save_checkpoint_t entry = {0};
+			if (!save_take(cursor, &entry, sizeof(entry)))
+				goto err;
+			index = entry.index;
+			current_player = entry.current_player;
+			data_length = entry.length;
+		} else {
+			uint64_t gap;
+			uint8_t player;
+			if (!save_take_varint(cursor, &gap) || gap >= length - next)
+				goto err;
+			if (!save_take(cursor, &player, sizeof(player)))
+				goto err;
+			if (!save_take_varint(cursor, &data_length))
+				goto err;
+			index = next + gap;
+			current_player = player;
+			next = index + 1;
+		}
+
+		if (index >= length || checkpoints[index].data)
+			goto err;
+		if (current_player >= game->num_players)
+			goto err;
+		/* A run can't take more than a byte plus a varint. */
+		if (!data_length || data_length > cells * (1 + sizeof(size_t) * 8 / 7 + 1))
+			goto err;
+
+		data = malloc(data_length);
+		if (!data)
+			goto err;
+		if (!save_take(cursor, data, data_length))
+			goto err;
+		if (game_checkpoint_decode(game, data, data_length, grid) < 0)
+			goto err;
+
+		checkpoints[index] = (struct checkpoint_t) {
+			.current_player = current_player,
+			.length = data_length,
+			.data = data,
+		};
+		data = NULL;
+	}
+
+	/* The checkpoints have to be the end of the file. */
+	if (cursor->offset != cursor->length)
+		goto err;
+
+	game->checkpoint_interval = interval;
+	game->checkpoints_length = length;
+	game->checkpoints = checkpoints;
+	free(grid);
+	return 0;
+
+err:
+	for (size_t i = 0; checkpoints && i < length; i++)
+		free(checkpoints[i].data);
+	free(checkpoints);
+	free(grid);
+	free(data);
+	return -ERROR_CANNOT_LOAD;
+}
+
+/*
+ * game_checkpoints_verify checks the checkpoints of a freshly loaded game
+ * against its history, since game_seek trusts them to be the state after their
+ * move. We replay the history up to the last checkpoint (which takes fresh
+ * checkpoints as it goes) and compare each loaded checkpoint to the fresh one,
+ * and the game keeps the fresh ones. The game is left at the first move.
+ */
+static int game_checkpoints_verify(struct game_t *game)
+{
+	size_t cells = game->width * game->height;
+	struct checkpoint_t *loaded = game->checkpoints;
+	size_t loaded_length = game->checkpoints_length;
+	int err = -ERROR_CANNOT_LOAD;
+
+	/* Only replay as far as the last checkpoint we were given. */
+	size_t last = loaded_length;
+	while (last > 0 && !loaded[last - 1].data)
+		last--;
+
+	struct cell_t *grid = malloc(cells * sizeof(*grid));
+	if (!grid)
+		return -ERROR_INTERNAL;
+
+	game->checkpoints = NULL;
+	game->checkpoints_length = 0;
+	game_restore(game, 0, 0, NULL);
+	while (game->moves_length < last * game->checkpoint_interval) {
+		if (game_play_move(game, game->moves[game->moves_length]) < 0)
+			goto out;
+
+		if (game->moves_length % game->checkpoint_interval)
+			continue;
+		struct checkpoint_t *checkpoint = &loaded[game->moves_length / game->checkpoint_interval - 1];
+		if (!checkpoint->data)
+			continue;
+		if (checkpoint->current_player != game->current_player)
+			goto out;
+		if (game_checkpoint_decode(game, checkpoint->data, checkpoint->length, grid) < 0)
+			goto out;
+		if (memcmp(grid, game->grid, cells * sizeof(*grid)))
+			goto out;
+	}
+	err = 0;
+
+out:
+	game_undo_reset(game);
+	game_restore(game, 0, 0, NULL);
+	for (size_t i = 0; i < loaded_length; i++)
+		free(loaded[i].data);
+	free(loaded);
+	free(grid);
+	return err;
+}
+
+/*
+ * game_checkpoints_save serialises the marker and checkpoints into @buf, and
+ * returns how many bytes that took. If @buf is NULL, nothing is written.
+ */
+static size_t game_checkpoints_save(struct game_t *game, uint8_t *buf)
+{
+	struct save_checkpoints_t hdr = {
+		.interval = game->checkpoint_interval,
+	};
+
+	size_t length = game_checkpoints_saved(game);
+	for (size_t i = 0; i < length; i++)
+		if (game->checkpoints[i].data)
+			hdr.count++;
+
+	size_t offset = 0;
+	save_put(buf, &offset, &SAVE_CHECKPOINTS_MARKER.raw, sizeof(SAVE_CHECKPOINTS_MARKER.raw));
+	save_put(buf, &offset, &hdr, sizeof(hdr));
+
+	for (size_t i = 0; i < length; i++) {
+		struct checkpoint_t *checkpoint = &game->checkpoints[i];
+		if (!checkpoint->data)
+			continue;
+
+		struct save_checkpoint_t entry = {
+			.index = i,
+			.current_player = checkpoint->current_player,
+			.length = checkpoint->length,
+		};
+		save_put(buf, &offset, &entry, sizeof(entry));
+		save_put(buf, &offset, checkpoint->data, checkpoint->length);
+	}
+	return offset;
+}
+
+/*
+ * game_read_file reads everything left in @fd into a single buffer. For
+ * regular files we know the size upfront, so this is usually just one read()
+ * rather than one per move.
+ */
+static int game_read_file(int fd, uint8_t **bufp, size_t *lengthp)
+{
+	struct stat st;
+	bool sized = !fstat(fd, &st) && S_ISREG(st.st_mode);
+	size_t size = sized ? (size_t) st.st_size : 4096;
+
+	uint8_t *buf = malloc(size ? size : 1);
+	if (!buf)
+		return -ERROR_INTERNAL;
+
+	size_t length = 0;
 	while (true) {
+		if (length == size) {
+			if (sized)
+				break;
+			uint8_t *newbuf = realloc(buf, size * 2);
+			if (!newbuf)
+				goto err;
+			buf = newbuf;
+			size *= 2;
+		}
+
+		ssize_t n = read(fd, buf + length, size - length);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			goto err;
+		}
+		if (!n)
+			break;
+		length += n;
+	}
+
+	*bufp = buf;
+	*lengthp = length;
+	return 0;
+
+err:
+	free(buf);
+	return -ERROR_INTERNAL;
+}
+
+/* game_write_file writes all of @buf to @fd, even if write() comes up short. */
+static int game_write_file(int fd, const uint8_t *buf, size_t length)
+{
+	while (length) {
+		ssize_t n = write(fd, buf, length);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -ERROR_INTERNAL;
+		}
+		buf += n;
+		length -= n;
+	}
+	return 0;
+}
+
+/* game_savefile_load_v1 loads a version 1 save file from @cursor. */
+static int game_savefile_load_v1(struct game_t *game, struct save_cursor_t *cursor)
+{
+	/* Read the header. */
+	/* TODO: This is probably not safe wrt struct packing. */
+	struct save_header_t header = {0};
+	if (!save_take(cursor, &header, sizeof(header)))
+		return -ERROR_INTERNAL;
+
+	/* Create a new game with the parameters provided in the save file. */
+	int err = game_init(game, header.no_players, header.width, header.height);
+	if (err < 0)
+		return err;
+	/* Undo the state change to be safe. */
+	game->state = BLANK;
+
+	/*
+	 * Rest of the data is move data, up to the checkpoints marker (if there is
+	 * one). Count the moves first so we only have to allocate once.
+	 */
+	size_t moves_start = cursor->offset, moves_length = 0;
+	bool has_checkpoints = false;
+	while (cursor->offset < cursor->length) {
 		/* TODO: This is probably not safe wrt struct packing. */
 		union save_move_t move = {0};
-		size_t n = read(fd, &move.raw, sizeof(move.raw));
-		if (n == 0)
+		if (!save_take(cursor, &move.raw, sizeof(move.raw)))
+			return -ERROR_CANNOT_LOAD;
+
+		/* Everything after the marker is checkpoints. */
+		if (move.raw == SAVE_CHECKPOINTS_MARKER.raw) {
+			has_checkpoints = true;
 			break;
-		if (n < sizeof(move))
-			goto err_free_moves;
+		}
 
 		/* Purely a sanity check to avoid reading garbage data. */
 		if (move.parsed.unused != 0)
-			goto err_free_moves;
+			return -ERROR_CANNOT_LOAD;
+		moves_length++;
+	}
 
-		/* Add to move list. */
-		moves = realloc(moves, ++moves_length * sizeof(*moves));
-		moves[moves_length - 1] = (struct move_t) {
+	struct move_t *moves = NULL;
+	if (moves_length) {
+		moves = malloc(moves_length * sizeof(*moves));
+		if (!moves)
+			return -ERROR_INTERNAL;
+	}
+	for (size_t i = 0; i < moves_length; i++) {
+		union save_move_t move = {0};
+		memcpy(&move.raw, cursor->data + moves_start + i * sizeof(move.raw), sizeof(move.raw));
+		moves[i] = (struct move_t) {
 			.x = move.parsed.x,
 			.y = move.parsed.y,
 		};
 	}
 
-	/* Commit move changes and change state. */
+	if (has_checkpoints) {
+		err = game_checkpoints_load(game, cursor, moves_length, 1);
+		if (err < 0) {
+			free(moves);
+			return err;
+		}
+	}
+
 	game->moves = moves;
-	game->moves_length = moves_length;
-	game->state = LOADED;
+	game->history_length = moves_length;
+	return 0;
+}
+
+/* game_savefile_load_v2 loads a version 2 save file from @cursor. */
+static int game_savefile_load_v2(struct game_t *game, struct save_cursor_t *cursor)
+{
+	/* Check the whole file before we believe anything it says. */
+	uint32_t checksum;
+	if (cursor->length < sizeof(SAVE_V2_MAGIC) + sizeof(checksum))
+		return -ERROR_CANNOT_LOAD;
+	cursor->offset = cursor->length - sizeof(checksum);
+	if (!save_take_u32(cursor, &checksum))
+		return -ERROR_CANNOT_LOAD;
+	if (checksum != save_crc32(cursor->data, cursor->length - sizeof(checksum)))
+		return -ERROR_CANNOT_LOAD;
+	cursor->length -= sizeof(checksum);
+	cursor->offset = sizeof(SAVE_V2_MAGIC);
+
+	uint8_t version, flags, players;
+	uint32_t width, height;
+	if (!save_take(cursor, &version, sizeof(version)) || version != SAVE_V2_VERSION)
+		return -ERROR_CANNOT_LOAD;
+	if (!save_take(cursor, &flags, sizeof(flags)) || flags & ~SAVE_V2_HAS_CHECKPOINTS)
+		return -ERROR_CANNOT_LOAD;
+	if (!save_take_u32(cursor, &width) || !save_take_u32(cursor, &height))
+		return -ERROR_CANNOT_LOAD;
+	if (!save_take(cursor, &players, sizeof(players)))
+		return -ERROR_CANNOT_LOAD;
+	/* game_t can't represent anything bigger than this. */
+	if (width > INT_MAX || height > INT_MAX || (uint64_t) width * height > INT_MAX)
+		return -ERROR_CANNOT_LOAD;
+
+	/* Create a new game with the parameters provided in the save file. */
+	int err = game_init(game, players, width, height);
+	if (err < 0)
+		return err;
+	/* Undo the state change to be safe. */
+	game->state = BLANK;
+
+	/* Every move takes at least a byte, which bounds the allocation. */
+	uint64_t moves_length;
+	if (!save_take_varint(cursor, &moves_length))
+		return -ERROR_CANNOT_LOAD;
+	if (moves_length > cursor->length - cursor->offset)
+		return -ERROR_CANNOT_LOAD;
+
+	struct move_t *moves = NULL;
+	if (moves_length) {
+		moves = malloc(moves_length * sizeof(*moves));
+		if (!moves)
+			return -ERROR_INTERNAL;
+	}
+
+	size_t cells = game->width * game->height, last = 0;
+	for (size_t i = 0; i < moves_length; i++) {
+		uint64_t zigzag;
+		if (!save_take_varint(cursor, &zigzag) || zigzag >> 1 >= cells)
+			goto err_free_moves;
+		int64_t delta = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+		if ((int64_t) last + delta < 0 || (int64_t) last + delta >= (int64_t) cells)
+			goto err_free_moves;
+
+		last += delta;
+		moves[i] = (struct move_t) {
+			.x = last % game->width,
+			.y = last / game->width,
+		};
+	}
+
+	if (flags & SAVE_V2_HAS_CHECKPOINTS) {
+		err = game_checkpoints_load(game, cursor, moves_length, SAVE_V2_VERSION);
+		if (err < 0)
+			goto err_free_moves;
+	} else if (cursor->offset != cursor->length) {
+		goto err_free_moves;
+	}
+
+	game->moves = moves;
+	game->history_length = moves_length;
 	return 0;
 
 err_free_moves:
 	free(moves);
-	return err;
+	return -ERROR_CANNOT_LOAD;
 }
 
 /*
- * game_savefile_save writes the current game state to the given file
- * descriptor. Note that the on-disk format for save files is endianness
- * dependent (so don't try to play SystemZ save files).
+ * game_savefile_load loads game data and recomputes the game state from the
+ * given file descriptor. Both versions of the save format are supported (see
+ * above), and which one it is gets worked out from the file.
  */
-int game_savefile_save(struct game_t *game, int fd)
+int game_savefile_load(struct game_t *game, int fd)
 {
 	if (!game || fd < 0)
 		return -ERROR_INTERNAL;
+	if (game->moves != NULL)
+		/* We could handle this, but it's not required by the spec. */
+		return -ERROR_INTERNAL;
+
+	/* Pull in the whole file, rather than going back to the kernel per move. */
+	struct save_cursor_t cursor = {0};
+	uint8_t *buf = NULL;
+	int err = game_read_file(fd, &buf, &cursor.length);
+	if (err < 0)
+		return err;
+	cursor.data = buf;
+
+	if (cursor.length >= sizeof(SAVE_V2_MAGIC) && !memcmp(buf, SAVE_V2_MAGIC, sizeof(SAVE_V2_MAGIC)))
+		err = game_savefile_load_v2(game, &cursor);
+	else
+		err = game_savefile_load_v1(game, &cursor);
+	free(buf);
 
+	/* Don't let a save file send SEEK to a state that isn't in its history. */
+	if (!err && game->checkpoints_length)
+		err = game_checkpoints_verify(game);
+
+	if (err < 0) {
+		/* Don't leave a half-loaded game around for the next LOAD to trip over. */
+		game_fini(game);
+		return err;
+	}
+
+	/* PLAYFROM picks where we start. */
+	game->state = LOADED;
+	return 0;
+}
+
+/*
+ * game_savefile_encode_v1 serialises @game as a version 1 save file into @buf,
+ * and returns how many bytes that took. If @buf is NULL, nothing is written.
+ * Note that the format is endianness dependent (so don't try to play SystemZ
+ * save files).
+ */
+static size_t game_savefile_encode_v1(struct game_t *game, uint8_t *buf, bool checkpoints)
+{
 	/* Create header. */
 	struct save_header_t hdr = {
 		.width      = game->width & 0xff,
@@ -488,9 +1681,8 @@ int game_savefile_save(struct game_t *game, int fd)
 		.no_players = game->num_players & 0xff,
 	};
 
-	size_t n = write(fd, &hdr, sizeof(hdr));
-	if (n != sizeof(hdr))
-		return -ERROR_INTERNAL;
+	size_t offset = 0;
+	save_put(buf, &offset, &hdr, sizeof(hdr));
 
 	/*
 	 * Create moves entries. In a nice world, we could just write game->moves
@@ -506,12 +1698,97 @@ int game_savefile_save(struct game_t *game, int fd)
 				.unused = 0,
 			},
 		};
+		save_put(buf, &offset, &move.raw, sizeof(move.raw));
+	}
 
-		size_t n = write(fd, &move.raw, sizeof(move.raw));
-		if (n != sizeof(move.raw))
-			return -ERROR_INTERNAL;
+	if (checkpoints)
+		offset += game_checkpoints_save(game, buf ? buf + offset : NULL);
+	return offset;
+}
+
+/*
+ * game_savefile_encode_v2 serialises @game as a version 2 save file into @buf,
+ * and returns how many bytes that took. If @buf is NULL, nothing is written.
+ */
+static size_t game_savefile_encode_v2(struct game_t *game, uint8_t *buf, bool checkpoints)
+{
+	uint8_t version = SAVE_V2_VERSION;
+	uint8_t flags = checkpoints ? SAVE_V2_HAS_CHECKPOINTS : 0;
+	uint8_t players = game->num_players;
+
+	size_t offset = 0;
+	save_put(buf, &offset, SAVE_V2_MAGIC, sizeof(SAVE_V2_MAGIC));
+	save_put(buf, &offset, &version, sizeof(version));
+	save_put(buf, &offset, &flags, sizeof(flags));
+	save_put_u32(buf, &offset, game->width);
+	save_put_u32(buf, &offset, game->height);
+	save_put(buf, &offset, &players, sizeof(players));
+
+	save_put_varint(buf, &offset, game->moves_length);
+	int64_t last = 0;
+	for (size_t i = 0; i < game->moves_length; i++) {
+		int64_t cell = (int64_t) game->moves[i].y * game->width + game->moves[i].x;
+		int64_t delta = cell - last;
+		save_put_varint(buf, &offset, (uint64_t) delta << 1 ^ (uint64_t) (delta >> 63));
+		last = cell;
+	}
+
+	if (checkpoints) {
+		size_t length = game_checkpoints_saved(game), count = 0;
+		for (size_t i = 0; i < length; i++)
+			if (game->checkpoints[i].data)
+				count++;
+
+		save_put_varint(buf, &offset, game->checkpoint_interval);
+		save_put_varint(buf, &offset, count);
+		for (size_t i = 0, next = 0; i < length; i++) {
+			struct checkpoint_t *checkpoint = &game->checkpoints[i];
+			if (!checkpoint->data)
+				continue;
+
+			uint8_t player = checkpoint->current_player;
+			save_put_varint(buf, &offset, i - next);
+			save_put(buf, &offset, &player, sizeof(player));
+			save_put_varint(buf, &offset, checkpoint->length);
+			save_put(buf, &offset, checkpoint->data, checkpoint->length);
+			next = i + 1;
+		}
 	}
 
+	save_put_u32(buf, &offset, buf ? save_crc32(buf, offset) : 0);
+	return offset;
+}
+
+/*
+ * game_savefile_save writes the current game state to the given file
+ * descriptor, in the format picked by @flags (SAVE_FLAG_*).
+ */
+int game_savefile_save(struct game_t *game, int fd, int flags)
+{
+	if (!game || fd < 0)
+		return -ERROR_INTERNAL;
+
+	/* Version 1 files can't describe boards this big. */
+	if (game->width > UINT8_MAX || game->height > UINT8_MAX)
+		flags |= SAVE_FLAG_V2;
+
+	bool checkpoints = flags & SAVE_FLAG_CHECKPOINTS;
+	size_t (*encode)(struct game_t *, uint8_t *, bool) = game_savefile_encode_v1;
+	if (flags & SAVE_FLAG_V2)
+		encode = game_savefile_encode_v2;
+
+	/* Serialise everything into one buffer, so it only takes one write(). */
+	size_t size = encode(game, NULL, checkpoints);
+	uint8_t *buf = malloc(size);
+	if (!buf)
+		return -ERROR_INTERNAL;
+	size = encode(game, buf, checkpoints);
+
+	int err = game_write_file(fd, buf, size);
+	free(buf);
+	if (err < 0)
+		return err;
+
 	/* Ensure things were written to disk. */
 	fsync(fd);
 	return 0;
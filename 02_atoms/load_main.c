@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+/*
+ * atoms-load is a load generator for atoms-server. It keeps -c sessions
+ * connected at once until -n sessions have been run. Each session plays a
+ * random script of -m commands (mostly PLACE, with the odd UNDO, STAT, DISPLAY
+ * and bogus command) followed by QUIT, and the whole script is written at once
+ * so the server has to pipeline it. With -v, each session's output is checked
+ * against running the same script through cmd_run in this process.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "atoms.h"
+#include "sim.h"
+
+#define DEFAULT_SOCKET "atoms.sock"
+
+/* load_config_t describes the load to generate. */
+struct load_config_t {
+	const char *path;
+	size_t sessions, clients, commands;
+	int players, width, height;
+	uint64_t seed;
+	bool verify;
+};
+
+/* client_t is a connected session that hasn't finished yet. */
+struct client_t {
+	int fd;
+	struct timespec start;
+
+	char *script;
+	size_t script_length, script_sent;
+
+	char *reply;
+	size_t reply_length, reply_size;
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: atoms-load [-s <socket>] [-n <sessions>] [-c <clients>] [-m <commands>] [-S <seed>] [-p <players>] [-W <width>] [-H <height>] [-v]\n");
+}
+
+/* parse_size parses a non-negative integer argument, returning -1 on error. */
+static long long parse_size(const char *arg)
+{
+	char *endptr;
+	long long n = strtoll(arg, &endptr, 10);
+	if (endptr == arg || *endptr || n < 0)
+		return -1;
+	return n;
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/* make_script writes the (newline separated) commands for session @n. */
+static char *make_script(const struct load_config_t *config, size_t n, size_t *length)
+{
+	uint64_t rng = config->seed ^ (n * 0xd1b54a32d192ed03ULL);
+	char *buf = NULL;
+	FILE *script = open_memstream(&buf, length);
+	if (!script)
+		return NULL;
+
+	fprintf(script, "START %d %d %d\n", config->players, config->width, config->height);
+	for (size_t i = 0; i < config->commands; i++) {
+		int what = sim_rand(&rng) % 100;
+		if (what < 85)
+			fprintf(script, "PLACE %d %d\n", (int) (sim_rand(&rng) % config->width),
+			        (int) (sim_rand(&rng) % config->height));
+		else if (what < 90)
+			fputs("UNDO\n", script);
+		else if (what < 95)
+			fputs("STAT\n", script);
+		else if (what < 98)
+			fputs("DISPLAY\n", script);
+		else
+			fputs("PLACE 1\n", script);
+	}
+	fputs("QUIT\n", script);
+
+	if (fclose(script)) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/* run_script works out what the server should reply to @script. */
+static char *run_script(const char *script, size_t length, size_t *reply_length)
+{
+	char *reply = NULL;
+	char *lines = malloc(length + 1);
+	struct cmd_t *cmd = cmd_alloc();
+	struct game_t *game = game_alloc();
+	FILE *out = open_memstream(&reply, reply_length);
+	if (!lines || !cmd || !game || !out)
+		goto out;
+
+	memcpy(lines, script, length);
+	lines[length] = '\0';
+	cmd->out = out;
+	for (char *line = lines, *end; (end = strchr(line, '\n')); line = end + 1) {
+		*end = '\0';
+		if (cmd_run(cmd, game, line) == -ERROR_QUIT)
+			break;
+	}
+
+out:
+	if (out && fclose(out)) {
+		free(reply);
+		reply = NULL;
+	}
+	game_free(game);
+	cmd_free(cmd);
+	free(lines);
+	return reply;
+}
+
+/* client_connect starts session @n, returning NULL if we can't connect. */
+static struct client_t *client_connect(const struct load_config_t *config, int epfd, size_t n)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	strncpy(addr.sun_path, config->path, sizeof(addr.sun_path) - 1);
+
+	struct client_t *client = calloc(1, sizeof(*client));
+	if (!client)
+		return NULL;
+	client->script = make_script(config, n, &client->script_length);
+	if (!client->script)
+		goto err;
+
+	clock_gettime(CLOCK_MONOTONIC, &client->start);
+	client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (client->fd < 0)
+		goto err;
+	/* Connect before going non-blocking, so we don't have to wait for it. */
+	if (connect(client->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		goto err_close;
+	int flags = fcntl(client->fd, F_GETFL);
+	if (flags < 0 || fcntl(client->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		goto err_close;
+
+	struct epoll_event event = {
+		.events = EPOLLIN | EPOLLOUT,
+		.data.ptr = client,
+	};
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, client->fd, &event) < 0)
+		goto err_close;
+	return client;
+
+err_close:
+	close(client->fd);
+err:
+	free(client->script);
+	free(client);
+	return NULL;
+}
+
+static void client_free(struct client_t *client)
+{
+	close(client->fd);
+	free(client->script);
+	free(client->reply);
+	free(client);
+}
+
+/*
+ * client_io sends what's left of @client's script and reads its reply. Returns
+ * 1 once the server has hung up, and < 0 on errors.
+ */
+static int client_io(struct client_t *client, int epfd)
+{
+	while (client->script_sent < client->script_length) {
+		ssize_t n = send(client->fd, client->script + client->script_sent,
+		                 client->script_length - client->script_sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		client->script_sent += n;
+		if (client->script_sent == client->script_length) {
+			struct epoll_event event = {
+				.events = EPOLLIN,
+				.data.ptr = client,
+			};
+			if (epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &event) < 0)
+				return -1;
+		}
+	}
+
+	while (true) {
+		if (client->reply_size - client->reply_length < 4096) {
+			size_t size = client->reply_size ? client->reply_size * 2 : 8192;
+			char *reply = realloc(client->reply, size);
+			if (!reply)
+				return -1;
+			client->reply = reply;
+			client->reply_size = size;
+		}
+
+		ssize_t n = read(client->fd, client->reply + client->reply_length,
+		                 client->reply_size - client->reply_length);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		if (!n)
+			return 1;
+		client->reply_length += n;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	long long n;
+	struct load_config_t config = {
+		.path = DEFAULT_SOCKET,
+		.sessions = 1000,
+		.clients = 100,
+		.commands = 100,
+		.players = 2,
+		.width = 8,
+		.height = 8,
+	};
+
+	while ((opt = getopt(argc, argv, "s:n:c:m:S:p:W:H:v")) != -1) {
+		/* Everything but the socket and -v is a number. */
+		n = 0;
+		if (opt != 's' && opt != 'v' && opt != '?') {
+			n = parse_size(optarg);
+			if (n < 0 || (strchr("pWH", opt) && (n < 1 || n > INT_MAX))) {
+				usage();
+				return 1;
+			}
+		}
+
+		switch (opt) {
+		case 's':
+			config.path = optarg;
+			break;
+		case 'n':
+			config.sessions = n;
+			break;
+		case 'c':
+			config.clients = n;
+			break;
+		case 'm':
+			config.commands = n;
+			break;
+		case 'S':
+			config.seed = n;
+			break;
+		case 'p':
+			config.players = n;
+			break;
+		case 'W':
+			config.width = n;
+			break;
+		case 'H':
+			config.height = n;
+			break;
+		case 'v':
+			config.verify = true;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind != argc || !config.clients) {
+		usage();
+		return 1;
+	}
+	if (strlen(config.path) >= sizeof(((struct sockaddr_un *) NULL)->sun_path))
+		bail(1, "atoms-load: socket path too long: %s\n", config.path);
+
+	int epfd = epoll_create1(0);
+	double *latencies = malloc((config.sessions + 1) * sizeof(double));
+	if (epfd < 0 || !latencies)
+		bail(1, "error allocating memory\n");
+
+	size_t started = 0, finished = 0, failed = 0, mismatched = 0, active = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	struct epoll_event events[256];
+	while (finished < config.sessions) {
+		while (active < config.clients && started < config.sessions) {
+			if (!client_connect(&config, epfd, started))
+				bail(1, "atoms-load: cannot connect to %s: %s\n", config.path, strerror(errno));
+			started++;
+			active++;
+		}
+
+		int nevents = epoll_wait(epfd, events, ARRAY_LENGTH(events), -1);
+		if (nevents < 0) {
+			if (errno == EINTR)
+				continue;
+			bail(1, "atoms-load: epoll_wait: %s\n", strerror(errno));
+		}
+
+		for (int i = 0; i < nevents; i++) {
+			struct client_t *client = events[i].data.ptr;
+			int err = client_io(client, epfd);
+			if (!err)
+				continue;
+
+			/* The server hung up (after QUIT, hopefully). */
+			if (err < 0 || client->script_sent != client->script_length) {
+				failed++;
+			} else if (config.verify) {
+				size_t length = 0;
+				char *expected = run_script(client->script, client->script_length, &length);
+				if (!expected)
+					bail(1, "error allocating memory\n");
+				if (length != client->reply_length || memcmp(expected, client->reply, length))
+					mismatched++;
+				free(expected);
+			}
+
+			latencies[finished++] = elapsed(&client->start);
+			active--;
+			client_free(client);
+		}
+	}
+
+	double seconds = elapsed(&start);
+	size_t commands = config.sessions * (config.commands + 2);
+	qsort(latencies, finished, sizeof(double), compare_doubles);
+
+	printf("sessions:    %zu (%zu at once, %zu failed)\n", finished, config.clients, failed);
+	printf("commands:    %zu (%zu per session)\n", commands, config.commands + 2);
+	printf("time:        %.3fs (%.0f sessions/s, %.0f commands/s)\n", seconds,
+	       seconds > 0 ? finished / seconds : 0.0, seconds > 0 ? commands / seconds : 0.0);
+	if (finished)
+		printf("latency:     %.2fms median, %.2fms p99, %.2fms max\n",
+		       latencies[finished / 2] * 1e3, latencies[finished * 99 / 100] * 1e3,
+		       latencies[finished - 1] * 1e3);
+	if (config.verify)
+		printf("verified:    %zu mismatched\n", mismatched);
+
+	free(latencies);
+	close(epfd);
+	return failed || mismatched;
+}
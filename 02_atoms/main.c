@@ -85,34 +85,14 @@ int main(void)
 		goto err_free;
 
 	while (true) {
-		int err = -ERROR_INTERNAL;
 		char *line = readline();
 		if (!line)
 			break;
 
-		err = cmd_parse(cmd, line);
-		if (err < 0)
-			goto next;
-
-		err = cmd_dispatch(cmd, game);
-		if (err < 0)
-			goto next;
-
-		/* TODO: Do we need to have a state update step here. */
-
-		/* Clear error value, everything went well. */
-		err = 0;
-next:
+		int err = cmd_run(cmd, game, line);
 		free(line);
 		if (err == -ERROR_QUIT)
 			break;
-		if (err < 0)
-			atom_perror(err);
-		/*
-		 * Not mentioned in the spec, but apparently we have to output a
-		 * newline after each command for some reason...
-		 */
-		printf("\n");
 		fflush(stdout);
 	}
 
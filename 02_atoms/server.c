@@ -0,0 +1,728 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "atoms.h"
+#include "server.h"
+
+/* How many events we take from epoll at once. */
+#define SERVER_EVENTS 256
+
+/*
+ * hint_job_t is a HINT waiting for (or being run by) the hint thread. It has
+ * its own copy of the command and its own output, so that the event loop can
+ * keep sending the session's earlier output while the search runs. If the
+ * session goes away first, @session is NULL and the job owns @game.
+ */
+struct hint_job_t {
+	struct session_t *session;
+	struct game_t *game;
+	struct cmd_t *cmd;
+	char *line;
+
+	/* Output of the command (cmd->out), and what it returned. */
+	FILE *file;
+	char *out;
+	size_t out_length;
+	int err;
+
+	struct hint_job_t *next;
+};
+
+/* session_t is a single client connection, and the game it's playing. */
+struct session_t {
+	int fd;
+	struct game_t *game;
+	struct cmd_t *cmd;
+
+	/* Input that hasn't been run yet. There is always room for a '\0'. */
+	char *in;
+	size_t in_length, in_size;
+
+	/* Output from the commands (cmd->out is a memstream), and how much was sent. */
+	FILE *file;
+	char *out;
+	size_t out_length, out_sent;
+
+	/* The client hung up (@eof) or sent QUIT (@quit), so we stop reading. */
+	bool eof, quit;
+
+	/* HINT being run for us. Nothing else is run (or read) until it's done. */
+	struct hint_job_t *hint;
+	/* We took the session out of the epoll set while waiting for @hint. */
+	bool parked;
+
+	/* What we're waiting on epoll for. */
+	uint32_t events;
+
+	/* Sessions which have more commands to run, even without new input. */
+	bool ready;
+	struct session_t *next_ready;
+
+	/* Position in server_t.sessions. */
+	size_t index;
+};
+
+/* server_t is the state of a running server. */
+struct server_t {
+	const struct server_config_t *config;
+	struct server_stats_t *stats;
+
+	int epfd, listenfd;
+	bool accepting;
+
+	struct session_t **sessions;
+	size_t sessions_length, sessions_size;
+
+	struct session_t *ready;
+
+	/*
+	 * Hint thread. The event loop queues jobs on @hint_todo, and the thread
+	 * moves them to @hint_done and writes a byte to @hint_pipe once each one
+	 * is finished. Everything here is protected by @hint_lock.
+	 */
+	pthread_t hint_thread;
+	pthread_mutex_t hint_lock;
+	pthread_cond_t hint_cond;
+	struct hint_job_t *hint_todo, **hint_todo_tail, *hint_done;
+	bool hint_stop;
+	int hint_pipe[2];
+
+	/* Transposition table lent to each job's cmd_t, only used by the hint thread. */
+	struct ai_table_t *hint_table;
+};
+
+/* set_nonblock makes @fd non-blocking. */
+static int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* session_free closes @session's connection and frees everything it owns. */
+static void session_free(struct server_t *server, struct session_t *session)
+{
+	/* Swap the last session into our slot. */
+	struct session_t *last = server->sessions[--server->sessions_length];
+	server->sessions[session->index] = last;
+	last->index = session->index;
+
+	/* A running search still needs the game, so the job takes it over. */
+	if (session->hint) {
+		session->hint->session = NULL;
+		session->game = NULL;
+	}
+
+	/* Closing the fd also takes it out of the epoll set. */
+	close(session->fd);
+	if (session->file)
+		fclose(session->file);
+	free(session->out);
+	free(session->in);
+	cmd_free(session->cmd);
+	game_free(session->game);
+	free(session);
+
+	/* We might have stopped accepting because we ran out of fds. */
+	if (!server->accepting) {
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data.ptr = NULL,
+		};
+		if (!epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->listenfd, &event))
+			server->accepting = true;
+	}
+}
+
+/* session_alloc sets up a session for a freshly accepted connection. */
+static struct session_t *session_alloc(struct server_t *server, int fd)
+{
+	if (server->sessions_length == server->sessions_size) {
+		size_t size = server->sessions_size ? server->sessions_size * 2 : 64;
+		struct session_t **sessions = realloc(server->sessions, size * sizeof(*sessions));
+		if (!sessions)
+			return NULL;
+		server->sessions = sessions;
+		server->sessions_size = size;
+	}
+
+	struct session_t *session = calloc(1, sizeof(*session));
+	if (!session)
+		return NULL;
+	session->fd = fd;
+	session->game = game_alloc();
+	session->cmd = cmd_alloc();
+	session->file = open_memstream(&session->out, &session->out_length);
+	if (!session->game || !session->cmd || !session->file)
+		goto err;
+
+	session->cmd->out = session->file;
+	session->events = EPOLLIN;
+	struct epoll_event event = {
+		.events = session->events,
+		.data.ptr = session,
+	};
+	if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+		goto err;
+
+	session->index = server->sessions_length;
+	server->sessions[server->sessions_length++] = session;
+	return session;
+
+err:
+	if (session->file)
+		fclose(session->file);
+	free(session->out);
+	cmd_free(session->cmd);
+	game_free(session->game);
+	free(session);
+	return NULL;
+}
+
+/*
+ * session_check_path rejects SAVE and LOAD of anything but a plain file name,
+ * so that sessions can only touch files in the server's working directory
+ * (and not hidden ones, or "." and ".."). Everything else is left to the
+ * command itself, so the errors are the same as the REPL's.
+ */
+static int session_check_path(struct cmd_t *cmd)
+{
+	if (cmd->ident != CMD_SAVE && cmd->ident != CMD_LOAD)
+		return 0;
+	if (cmd->argc < 2)
+		return 0;
+	if (strchr(cmd->argv[1], '/') || cmd->argv[1][0] == '.')
+		return -ERROR_INVALID_ARGS;
+	return 0;
+}
+
+/* hint_job_free frees @job, and its game if the session has gone away. */
+static void hint_job_free(struct hint_job_t *job)
+{
+	if (!job->session)
+		game_free(job->game);
+	if (job->file)
+		fclose(job->file);
+	free(job->out);
+	free(job->line);
+	cmd_free(job->cmd);
+	free(job);
+}
+
+/* hint_thread runs every queued HINT, until the server stops. */
+static void *hint_thread(void *data)
+{
+	struct server_t *server = data;
+
+	pthread_mutex_lock(&server->hint_lock);
+	while (true) {
+		while (!server->hint_todo && !server->hint_stop)
+			pthread_cond_wait(&server->hint_cond, &server->hint_lock);
+		if (server->hint_stop)
+			break;
+
+		struct hint_job_t *job = server->hint_todo;
+		server->hint_todo = job->next;
+		if (!server->hint_todo)
+			server->hint_todo_tail = &server->hint_todo;
+		pthread_mutex_unlock(&server->hint_lock);
+
+		job->cmd->hint_table = server->hint_table;
+		job->err = cmd_parse(job->cmd, job->line);
+		if (!job->err)
+			job->err = cmd_dispatch(job->cmd, job->game);
+		/* Keep the table (which HINT may have just allocated) for the next job. */
+		server->hint_table = job->cmd->hint_table;
+		job->cmd->hint_table = NULL;
+		fclose(job->file);
+		job->file = NULL;
+
+		pthread_mutex_lock(&server->hint_lock);
+		job->next = server->hint_done;
+		server->hint_done = job;
+		/* If the pipe is full, the loop already has a wakeup coming. */
+		ssize_t n = write(server->hint_pipe[1], "", 1);
+		(void) n;
+	}
+	pthread_mutex_unlock(&server->hint_lock);
+	return NULL;
+}
+
+/*
+ * session_hint hands the HINT in @session->cmd to the hint thread. Its output
+ * is added to the session's once the search is done (see server_hints_done).
+ */
+static int session_hint(struct server_t *server, struct session_t *session)
+{
+	struct cmd_t *cmd = session->cmd;
+	struct hint_job_t *job = calloc(1, sizeof(*job));
+	if (!job)
+		return -ERROR_INTERNAL;
+
+	/* @cmd points into the session's input, so rebuild the line for the job. */
+	size_t length = 0;
+	for (int i = 0; i < cmd->argc; i++)
+		length += strlen(cmd->argv[i]) + 1;
+	job->line = malloc(length);
+	if (!job->line)
+		goto err;
+	char *p = job->line;
+	for (int i = 0; i < cmd->argc; i++)
+		p += sprintf(p, "%s%s", i ? " " : "", cmd->argv[i]);
+
+	job->session = session;
+	job->game = session->game;
+	job->cmd = cmd_alloc();
+	job->file = open_memstream(&job->out, &job->out_length);
+	if (!job->cmd || !job->file)
+		goto err;
+	job->cmd->out = job->file;
+
+	session->hint = job;
+	pthread_mutex_lock(&server->hint_lock);
+	*server->hint_todo_tail = job;
+	server->hint_todo_tail = &job->next;
+	pthread_cond_signal(&server->hint_cond);
+	pthread_mutex_unlock(&server->hint_lock);
+	return 0;
+
+err:
+	hint_job_free(job);
+	return -ERROR_INTERNAL;
+}
+
+/* session_next_line finds the end of the next complete line in @session's input. */
+static char *session_next_line(struct session_t *session, size_t start)
+{
+	if (!session->in)
+		return NULL;
+
+	char *end = memchr(session->in + start, '\n', session->in_length - start);
+	/* Like the REPL, a last line without a newline still counts. */
+	if (!end && session->eof && start < session->in_length)
+		end = session->in + session->in_length;
+	return end;
+}
+
+/*
+ * session_pump runs the commands waiting in @session's input, sends as much of
+ * the output as the socket will take, and then works out what to wait for.
+ * Returns < 0 if the session is finished and should be freed.
+ */
+static int session_pump(struct server_t *server, struct session_t *session)
+{
+	size_t start = 0;
+	for (size_t i = 0; i < SERVER_BATCH && !session->quit && !session->hint; i++) {
+		/* The buffer only shrinks once all of it is sent, so count all of it. */
+		if (session->out_length >= SERVER_MAX_OUTPUT)
+			break;
+		char *end = session_next_line(session, start);
+		if (!end)
+			break;
+
+		char *line = session->in + start;
+		*end = '\0';
+		start = end - session->in + 1;
+		if (start > session->in_length)
+			start = session->in_length;
+
+		server->stats->commands++;
+		int err = cmd_parse(session->cmd, line);
+		if (!err)
+			err = session_check_path(session->cmd);
+		if (!err && session->cmd->ident == CMD_HINT) {
+			err = session_hint(server, session);
+			if (!err)
+				continue;
+		}
+		if (!err)
+			err = cmd_dispatch(session->cmd, session->game);
+		if (cmd_finish(session->cmd, err) == -ERROR_QUIT)
+			session->quit = true;
+
+		/* Keep @out_length up to date, for the check above. */
+		if (fflush(session->file))
+			return -1;
+	}
+
+	/* Nothing after QUIT gets run. */
+	if (session->quit)
+		start = session->in_length;
+	if (start) {
+		memmove(session->in, session->in + start, session->in_length - start);
+		session->in_length -= start;
+	}
+
+	while (session->out_sent < session->out_length) {
+		ssize_t n = send(session->fd, session->out + session->out_sent,
+		                 session->out_length - session->out_sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		session->out_sent += n;
+	}
+	if (session->out_sent && session->out_sent == session->out_length) {
+		/* Everything was sent, so start again from the top of the buffer. */
+		rewind(session->file);
+		session->out_sent = session->out_length = 0;
+	}
+
+	bool pending = session->out_length > 0;
+	bool complete = session_next_line(session, 0);
+	bool runnable = !session->quit && !session->hint && complete;
+	if (!pending && !runnable && !session->hint && (session->quit || session->eof))
+		return -1;
+	if (!complete && session->in_length >= SERVER_MAX_LINE)
+		return -1;
+
+	/* Throttled sessions get going again once their output drains. */
+	bool throttled = session->out_length >= SERVER_MAX_OUTPUT;
+	if (runnable && !throttled && !session->ready) {
+		session->ready = true;
+		session->next_ready = server->ready;
+		server->ready = session;
+	}
+
+	/*
+	 * While a HINT runs with nothing left to send, there is nothing to wait
+	 * for. epoll always reports hangups, so take the session out of the set
+	 * altogether rather than spin on a client that has gone away.
+	 */
+	if (session->hint && !pending) {
+		if (!session->parked) {
+			if (epoll_ctl(server->epfd, EPOLL_CTL_DEL, session->fd, NULL) < 0)
+				return -1;
+			session->parked = true;
+		}
+		return 0;
+	}
+
+	uint32_t events = 0;
+	if (!session->quit && !session->eof && !throttled && !session->hint)
+		events |= EPOLLIN;
+	if (pending)
+		events |= EPOLLOUT;
+	if (events != session->events || session->parked) {
+		struct epoll_event event = {
+			.events = events,
+			.data.ptr = session,
+		};
+		int op = session->parked ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+		if (epoll_ctl(server->epfd, op, session->fd, &event) < 0)
+			return -1;
+		session->events = events;
+		session->parked = false;
+	}
+	return 0;
+}
+
+/* session_read reads whatever @session's client has sent us. */
+static int session_read(struct session_t *session)
+{
+	if (session->in_size - session->in_length < SERVER_READ_SIZE + 1) {
+		size_t size = session->in_length + SERVER_READ_SIZE + 1;
+		char *in = realloc(session->in, size);
+		if (!in)
+			return -1;
+		session->in = in;
+		session->in_size = size;
+	}
+
+	ssize_t n = read(session->fd, session->in + session->in_length, SERVER_READ_SIZE);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		return -1;
+	}
+	if (!n)
+		session->eof = true;
+	session->in_length += n;
+	return 0;
+}
+
+/*
+ * server_hints_done adds the output of every finished HINT to its session, and
+ * puts the session back on the ready list.
+ */
+static void server_hints_done(struct server_t *server)
+{
+	char buf[256];
+	while (read(server->hint_pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&server->hint_lock);
+	struct hint_job_t *done = server->hint_done;
+	server->hint_done = NULL;
+	pthread_mutex_unlock(&server->hint_lock);
+
+	while (done) {
+		struct hint_job_t *job = done;
+		struct session_t *session = job->session;
+		done = job->next;
+
+		/*
+		 * The session might have more events waiting in this batch, so leave
+		 * it to the ready list to get it going again.
+		 */
+		if (session) {
+			session->hint = NULL;
+			fwrite(job->out, 1, job->out_length, session->file);
+			cmd_finish(session->cmd, job->err);
+			if (!session->ready) {
+				session->ready = true;
+				session->next_ready = server->ready;
+				server->ready = session;
+			}
+		}
+		hint_job_free(job);
+	}
+}
+
+/* server_accept accepts every connection waiting on the listening socket. */
+static void server_accept(struct server_t *server)
+{
+	while (true) {
+		int fd = accept(server->listenfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			/*
+			 * If we're out of fds, the listening socket would stay readable
+			 * and we'd spin, so stop listening until a session goes away.
+			 */
+			if ((errno == EMFILE || errno == ENFILE) && server->sessions_length) {
+				epoll_ctl(server->epfd, EPOLL_CTL_DEL, server->listenfd, NULL);
+				server->accepting = false;
+			}
+			return;
+		}
+
+		if (server->sessions_length >= server->config->max_sessions ||
+		    set_nonblock(fd) < 0 || !session_alloc(server, fd)) {
+			server->stats->rejected++;
+			close(fd);
+			continue;
+		}
+
+		server->stats->sessions++;
+		if (server->sessions_length > server->stats->peak_sessions)
+			server->stats->peak_sessions = server->sessions_length;
+	}
+}
+
+/* server_listen creates the listening socket at @path. */
+static int server_listen(const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	/* Clean up after a server that didn't get to (but leave anything else). */
+	struct stat st;
+	if (!stat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		goto err;
+	if (listen(fd, SOMAXCONN) < 0)
+		goto err;
+	if (set_nonblock(fd) < 0)
+		goto err;
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+/*
+ * server_run listens on @config->path and serves sessions until
+ * @config->stop is set. If setting up the server fails, errno says why.
+ */
+int server_run(const struct server_config_t *config, struct server_stats_t *stats)
+{
+	struct server_t server = {
+		.config = config,
+		.stats = stats,
+		.accepting = true,
+		.epfd = -1,
+		.hint_lock = PTHREAD_MUTEX_INITIALIZER,
+		.hint_cond = PTHREAD_COND_INITIALIZER,
+		.hint_pipe = { -1, -1 },
+	};
+	server.hint_todo_tail = &server.hint_todo;
+	memset(stats, 0, sizeof(*stats));
+
+	server.listenfd = server_listen(config->path);
+	if (server.listenfd < 0)
+		return -ERROR_INTERNAL;
+
+	server.epfd = epoll_create1(0);
+	if (server.epfd < 0)
+		goto err_close;
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = NULL,
+	};
+	if (epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.listenfd, &event) < 0)
+		goto err_close;
+
+	/* The hint thread wakes us up through the pipe. */
+	if (pipe(server.hint_pipe) < 0)
+		goto err_close;
+	if (set_nonblock(server.hint_pipe[0]) < 0 || set_nonblock(server.hint_pipe[1]) < 0)
+		goto err_close;
+	event.data.ptr = server.hint_pipe;
+	if (epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.hint_pipe[0], &event) < 0)
+		goto err_close;
+	if (pthread_create(&server.hint_thread, NULL, hint_thread, &server))
+		goto err_close;
+
+	struct epoll_event events[SERVER_EVENTS];
+	while (!*config->stop) {
+		/* Don't sleep if there are still commands to run. */
+		int n = epoll_wait(server.epfd, events, SERVER_EVENTS, server.ready ? 0 : -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			struct session_t *session = events[i].data.ptr;
+			if (!session) {
+				server_accept(&server);
+				continue;
+			}
+			if (events[i].data.ptr == server.hint_pipe) {
+				server_hints_done(&server);
+				continue;
+			}
+
+			int err = 0;
+			if (events[i].events & EPOLLERR)
+				err = -1;
+			else if (events[i].events & (EPOLLIN | EPOLLHUP) && !session->eof && !session->quit)
+				err = session_read(session);
+			/* Sessions on the ready list get pumped below. */
+			if (!err && !session->ready)
+				err = session_pump(&server, session);
+			if (err < 0) {
+				if (session->ready)
+					/* Don't free it out from under the ready list. */
+					session->quit = session->eof = true;
+				else
+					session_free(&server, session);
+			}
+		}
+
+		/* Give everyone with commands left over their next batch. */
+		struct session_t *ready = server.ready;
+		server.ready = NULL;
+		while (ready) {
+			struct session_t *session = ready;
+			ready = session->next_ready;
+			session->ready = false;
+			if (session_pump(&server, session) < 0)
+				session_free(&server, session);
+		}
+	}
+
+	while (server.sessions_length)
+		session_free(&server, server.sessions[0]);
+	free(server.sessions);
+
+	/* Wait for the search in progress (if any), and drop everything else. */
+	pthread_mutex_lock(&server.hint_lock);
+	server.hint_stop = true;
+	pthread_cond_signal(&server.hint_cond);
+	pthread_mutex_unlock(&server.hint_lock);
+	pthread_join(server.hint_thread, NULL);
+	ai_table_free(server.hint_table);
+	while (server.hint_todo) {
+		struct hint_job_t *job = server.hint_todo;
+		server.hint_todo = job->next;
+		hint_job_free(job);
+	}
+	while (server.hint_done) {
+		struct hint_job_t *job = server.hint_done;
+		server.hint_done = job->next;
+		hint_job_free(job);
+	}
+
+	close(server.hint_pipe[0]);
+	close(server.hint_pipe[1]);
+	close(server.epfd);
+	close(server.listenfd);
+	unlink(config->path);
+	return 0;
+
+err_close:
+	if (server.hint_pipe[0] >= 0) {
+		close(server.hint_pipe[0]);
+		close(server.hint_pipe[1]);
+	}
+	if (server.epfd >= 0)
+		close(server.epfd);
+	close(server.listenfd);
+	unlink(config->path);
+	return -ERROR_INTERNAL;
+}
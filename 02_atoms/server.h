@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#pragma once
+
+#if !defined(SERVER_H)
+#define SERVER_H
+
+#include <stddef.h>
+#include <signal.h>
+
+#include "atoms.h"
+
+/*
+ * A server hosting many atoms games in one process. Clients connect to a Unix
+ * socket, and each connection is a session with its own game_t that speaks
+ * exactly the same protocol as the REPL (one command per line, and the same
+ * output as cmd_run). Clients can pipeline as many commands as they like,
+ * which are run in order. The only difference is that SAVE and LOAD only take
+ * plain file names (see session_check_path), which are relative to the
+ * server's working directory.
+ *
+ * Connections are multiplexed with epoll on a single thread. So that one
+ * session can't hog the loop, each session runs at most SERVER_BATCH commands
+ * before the others get a turn, and we stop reading from it while more than
+ * SERVER_MAX_OUTPUT bytes of its output are waiting to be received. Sessions
+ * that send a line longer than SERVER_MAX_LINE are disconnected. HINT can
+ * search for a long time, so it is run on a separate thread (one search at a
+ * time) and the session's later commands wait until it is done.
+ */
+#define SERVER_BATCH 64
+#define SERVER_MAX_OUTPUT (1 << 20)
+#define SERVER_MAX_LINE (1 << 16)
+
+/* How much we try to read from a session at once. */
+#define SERVER_READ_SIZE 4096
+
+/* server_config_t describes how the server should run. */
+struct server_config_t {
+	/* Path of the Unix socket to listen on. */
+	const char *path;
+
+	/* Connections beyond this many sessions are closed straight away. */
+	size_t max_sessions;
+
+	/* The server shuts down once this is set (by a signal handler). */
+	volatile sig_atomic_t *stop;
+};
+
+/* server_stats_t counts what a server did over its lifetime. */
+struct server_stats_t {
+	size_t sessions;
+	size_t rejected;
+	size_t peak_sessions;
+	size_t commands;
+};
+
+int server_run(const struct server_config_t *config, struct server_stats_t *stats);
+
+#endif /* !defined(SERVER_H) */
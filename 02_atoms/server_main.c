@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "atoms.h"
+#include "server.h"
+
+#define DEFAULT_SOCKET "atoms.sock"
+#define DEFAULT_MAX_SESSIONS 10000
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_stop(int sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: atoms-server [-s <socket>] [-n <max-sessions>]\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	struct server_config_t config = {
+		.path = DEFAULT_SOCKET,
+		.max_sessions = DEFAULT_MAX_SESSIONS,
+		.stop = &stop,
+	};
+
+	while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+		char *endptr;
+		long long n;
+
+		switch (opt) {
+		case 's':
+			config.path = optarg;
+			break;
+		case 'n':
+			n = strtoll(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr || n < 1) {
+				usage();
+				return 1;
+			}
+			config.max_sessions = n;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		usage();
+		return 1;
+	}
+
+	/* No SA_RESTART, so that epoll_wait notices. */
+	struct sigaction sa = {
+		.sa_handler = handle_stop,
+	};
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	struct server_stats_t stats;
+	if (server_run(&config, &stats) < 0)
+		bail(1, "atoms-server: cannot serve on %s: %s\n", config.path, strerror(errno));
+
+	printf("sessions:    %zu (%zu rejected, at most %zu at once)\n",
+	       stats.sessions, stats.rejected, stats.peak_sessions);
+	printf("commands:    %zu\n", stats.commands);
+	return 0;
+}
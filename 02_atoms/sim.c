@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "atoms.h"
+#include "ai.h"
+#include "sim.h"
+
+/*
+ * sim_rand returns the next number from a splitmix64 generator. It's fast,
+ * has a single word of state and any seed works, which is all we need for
+ * picking moves.
+ */
+uint64_t sim_rand(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*
+ * sim_policy_random picks a cell uniformly at random out of the cells the
+ * current player can place an atom in. A few random guesses usually find one,
+ * and otherwise we count them and pick one.
+ */
+int sim_policy_random(struct game_t *game, uint64_t *rng, struct move_t *move, void *data)
+{
+	size_t cells = game->width * game->height;
+	(void) data; /* Random play doesn't need any state. */
+
+	for (int i = 0; i < SIM_RANDOM_TRIES; i++) {
+		size_t idx = sim_rand(rng) % cells;
+		*move = (struct move_t) { .x = idx % game->width, .y = idx / game->width };
+		if (game_can_place(game, *move))
+			return 0;
+	}
+
+	size_t count = 0;
+	for (size_t idx = 0; idx < cells; idx++) {
+		struct move_t cur = { .x = idx % game->width, .y = idx / game->width };
+		if (game_can_place(game, cur))
+			count++;
+	}
+	if (!count)
+		return -ERROR_CANNOT_PLACE;
+
+	size_t pick = sim_rand(rng) % count;
+	for (size_t idx = 0; idx < cells; idx++) {
+		struct move_t cur = { .x = idx % game->width, .y = idx / game->width };
+		if (game_can_place(game, cur) && !pick--) {
+			*move = cur;
+			return 0;
+		}
+	}
+	return -ERROR_INTERNAL;
+}
+
+/*
+ * sim_policy_ai asks the computer player for a move (or plays randomly for
+ * players it isn't playing for).
+ */
+int sim_policy_ai(struct game_t *game, uint64_t *rng, struct move_t *move, void *data)
+{
+	struct sim_ai_t *ai = data;
+	if (game->current_player >= ai->players || game->moves_length < ai->random_moves)
+		return sim_policy_random(game, rng, move, NULL);
+
+	struct ai_result_t result;
+	int err = ai_search(game, &ai->config, &result);
+	if (err < 0)
+		return err;
+	*move = result.move;
+
+	pthread_mutex_lock(&ai->lock);
+	ai->nodes += result.nodes;
+	pthread_mutex_unlock(&ai->lock);
+	return 0;
+}
+
+/* sim_grid_hash hashes every cell of @game's grid. */
+static uint64_t sim_grid_hash(struct game_t *game)
+{
+	size_t cells = game->width * game->height;
+	uint64_t hash = cells;
+
+	for (size_t idx = 0; idx < cells; idx++) {
+		uint64_t state = hash ^ (game->grid[idx].owner << 8 | game->grid[idx].atoms);
+		hash = sim_rand(&state);
+	}
+	return hash;
+}
+
+/*
+ * sim_play_game plays a single game from @config to the end (or until it runs
+ * out of moves), using @seed for the policy. Errors are only returned if the
+ * game couldn't be played at all, such as an invalid opening.
+ */
+int sim_play_game(const struct sim_config_t *config, uint64_t seed, struct sim_result_t *result)
+{
+	sim_policy_t policy = config->policy ? config->policy : sim_policy_random;
+	uint64_t rng = seed;
+
+	struct game_t *game = game_alloc();
+	if (!game)
+		return -ERROR_INTERNAL;
+	int err = game_init(game, config->players, config->width, config->height);
+	if (err < 0)
+		goto out;
+
+	*result = (struct sim_result_t) {
+		.winner = SIM_NO_WINNER,
+	};
+	while (!config->max_moves || game->moves_length < config->max_moves) {
+		struct move_t move;
+		if (game->moves_length < config->opening_length) {
+			move = config->opening[game->moves_length];
+		} else {
+			/* If the player is stuck, the game can't be finished. */
+			err = policy(game, &rng, &move, config->policy_data);
+			if (err == -ERROR_CANNOT_PLACE) {
+				err = 0;
+				break;
+			}
+			if (err < 0)
+				goto out;
+		}
+
+		err = game_do_move(game, move);
+		if (err == -ERROR_QUIT) {
+			/* The winning move doesn't get counted by the game. */
+			result->winner = game->current_player;
+			result->moves = game->moves_length + 1;
+			err = 0;
+			goto out;
+		}
+		if (err < 0)
+			goto out;
+	}
+	result->moves = game->moves_length;
+
+out:
+	if (!err)
+		result->grid = sim_grid_hash(game);
+	game_free(game);
+	return err;
+}
+
+/* sim_stats_add merges the outcome of a single game into @stats. */
+static void sim_stats_add(struct sim_stats_t *stats, struct sim_result_t *result)
+{
+	if (!stats->games || result->moves < stats->min_moves)
+		stats->min_moves = result->moves;
+	if (!stats->games || result->moves > stats->max_moves)
+		stats->max_moves = result->moves;
+
+	uint64_t state = result->grid ^ ((uint64_t) result->moves << 8 | (uint8_t) result->winner);
+	stats->checksum += sim_rand(&state);
+
+	stats->games++;
+	stats->moves += result->moves;
+	if (result->winner == SIM_NO_WINNER)
+		stats->unfinished++;
+	else
+		stats->wins[result->winner]++;
+}
+
+/* sim_stats_merge merges the stats of another batch of games into @stats. */
+static void sim_stats_merge(struct sim_stats_t *stats, struct sim_stats_t *other)
+{
+	if (!other->games)
+		return;
+
+	if (!stats->games || other->min_moves < stats->min_moves)
+		stats->min_moves = other->min_moves;
+	if (!stats->games || other->max_moves > stats->max_moves)
+		stats->max_moves = other->max_moves;
+
+	stats->games += other->games;
+	stats->moves += other->moves;
+	stats->checksum += other->checksum;
+	stats->unfinished += other->unfinished;
+	for (size_t i = 0; i < PLAYERS_MAX; i++)
+		stats->wins[i] += other->wins[i];
+}
+
+/*
+ * sim_worker_t is the state of a single thread of sim_run, which plays every
+ * @step-th game starting from game @first.
+ */
+struct sim_worker_t {
+	pthread_t thread;
+	const struct sim_config_t *config;
+	size_t first, step;
+	struct sim_stats_t stats;
+	int err;
+};
+
+/* sim_game_seed derives the seed of the @n-th game in a batch. */
+static uint64_t sim_game_seed(uint64_t seed, size_t n)
+{
+	uint64_t state = seed ^ (n * 0xd1b54a32d192ed03ULL);
+	return sim_rand(&state);
+}
+
+static void *sim_worker(void *arg)
+{
+	struct sim_worker_t *worker = arg;
+	const struct sim_config_t *config = worker->config;
+
+	for (size_t n = worker->first; n < config->games; n += worker->step) {
+		struct sim_result_t result;
+		worker->err = sim_play_game(config, sim_game_seed(config->seed, n), &result);
+		if (worker->err < 0)
+			break;
+		sim_stats_add(&worker->stats, &result);
+	}
+	return NULL;
+}
+
+/*
+ * sim_run plays all of the games described by @config across
+ * sim_config_t.threads threads, and fills @stats with the combined outcome.
+ */
+int sim_run(const struct sim_config_t *config, struct sim_stats_t *stats)
+{
+	size_t threads = config->threads ? config->threads : 1;
+	if (threads > config->games)
+		threads = config->games ? config->games : 1;
+
+	struct sim_worker_t *workers = calloc(threads, sizeof(*workers));
+	if (!workers)
+		return -ERROR_INTERNAL;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Thread 0 is us, so a single-threaded run doesn't need to spawn anything. */
+	size_t started = 1;
+	for (size_t i = 0; i < threads; i++) {
+		workers[i] = (struct sim_worker_t) {
+			.config = config,
+			.first = i,
+			.step = threads,
+		};
+	}
+	for (; started < threads; started++)
+		if (pthread_create(&workers[started].thread, NULL, sim_worker, &workers[started]))
+			break;
+
+	/* If we couldn't start all of the threads, do their games ourselves. */
+	for (size_t i = started; i < threads; i++)
+		sim_worker(&workers[i]);
+	sim_worker(&workers[0]);
+	for (size_t i = 1; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	int err = 0;
+	memset(stats, 0, sizeof(*stats));
+	for (size_t i = 0; i < threads; i++) {
+		sim_stats_merge(stats, &workers[i].stats);
+		if (workers[i].err < 0)
+			err = workers[i].err;
+	}
+	stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	free(workers);
+	return err;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#pragma once
+
+#if !defined(SIM_H)
+#define SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "atoms.h"
+#include "ai.h"
+
+/*
+ * Headless batch simulation of atoms games. Games are played straight through
+ * the game_t API without any command parsing or output, so that strategies
+ * can be evaluated over a large number of games. Each game gets its own seed
+ * (derived from sim_config_t.seed and the game's index), so the results don't
+ * depend on how many threads were used.
+ */
+
+/*
+ * sim_policy_t picks the next move for the current player of @game, using
+ * @rng as its source of randomness (see sim_rand). It should return
+ * -ERROR_CANNOT_PLACE if there is no move to make.
+ */
+typedef int (*sim_policy_t)(struct game_t *game, uint64_t *rng, struct move_t *move, void *data);
+
+/* Random guesses made by sim_policy_random before it searches the grid. */
+#define SIM_RANDOM_TRIES 8
+
+/* sim_config_t describes a batch of games. */
+struct sim_config_t {
+	int players, width, height;
+
+	/* Number of games, and how many threads to play them on. */
+	size_t games;
+	size_t threads;
+	uint64_t seed;
+
+	/* Games are stopped (and counted as unfinished) after this many moves. */
+	size_t max_moves;
+
+	/* Moves played at the start of every game, before @policy takes over. */
+	struct move_t *opening;
+	size_t opening_length;
+
+	/* Defaults to sim_policy_random if NULL. */
+	sim_policy_t policy;
+	void *policy_data;
+};
+
+/* sim_result_t is the outcome of a single game. */
+#define SIM_NO_WINNER -1
+struct sim_result_t {
+	int winner;
+	size_t moves;
+
+	/* Hash of the final grid, so that games can be compared. */
+	uint64_t grid;
+};
+
+/* sim_stats_t is the aggregate outcome of a batch of games. */
+struct sim_stats_t {
+	size_t games;
+	size_t unfinished;
+	size_t wins[PLAYERS_MAX];
+
+	size_t moves;
+	size_t min_moves, max_moves;
+
+	/*
+	 * Sum of a hash of every game's grid, winner and length. It doesn't
+	 * depend on the order the games finished in, so two batches with the
+	 * same seed only have the same checksum if they played the same games.
+	 */
+	uint64_t checksum;
+
+	/* Wall clock time taken by sim_run. */
+	double seconds;
+};
+
+/*
+ * sim_ai_t is the data for sim_policy_ai, which lets the computer player play
+ * the first @players players (the rest play randomly). Since the computer
+ * player always picks the same move, the first @random_moves moves of each
+ * game are random so that games differ. @nodes counts the positions searched
+ * by every game using it.
+ */
+struct sim_ai_t {
+	struct ai_config_t config;
+	int players;
+	size_t random_moves;
+
+	pthread_mutex_t lock;
+	size_t nodes;
+};
+
+uint64_t sim_rand(uint64_t *state);
+int sim_policy_random(struct game_t *game, uint64_t *rng, struct move_t *move, void *data);
+int sim_policy_ai(struct game_t *game, uint64_t *rng, struct move_t *move, void *data);
+
+int sim_play_game(const struct sim_config_t *config, uint64_t seed, struct sim_result_t *result);
+int sim_run(const struct sim_config_t *config, struct sim_stats_t *stats);
+
+#endif /* !defined(SIM_H) */
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "atoms.h"
+#include "sim.h"
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: atoms-sim [-n <games>] [-j <threads>] [-s <seed>] [-m <max-moves>] [-a <depth> [-A <players>] [-R <moves>]] [-p <players>] [-W <width>] [-H <height>]\n");
+	fprintf(stderr, "       atoms-sim [-n <games>] [-j <threads>] [-s <seed>] [-m <max-moves>] [-a <depth> [-A <players>] [-R <moves>]] -l <save-file>\n");
+}
+
+/* parse_size parses a non-negative integer argument, returning -1 on error. */
+static long long parse_size(const char *arg)
+{
+	char *endptr;
+	long long n = strtoll(arg, &endptr, 10);
+	if (endptr == arg || *endptr || n < 0)
+		return -1;
+	return n;
+}
+
+/*
+ * load_opening uses the moves from a save file as the opening of every game
+ * (the game's size and players also come from the save file).
+ */
+static int load_opening(struct sim_config_t *config, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -ERROR_CANNOT_LOAD;
+
+	struct game_t *game = game_alloc();
+	if (!game) {
+		close(fd);
+		return -ERROR_INTERNAL;
+	}
+
+	int err = game_savefile_load(game, fd);
+	close(fd);
+	if (err < 0)
+		goto out;
+
+	config->players = game->num_players;
+	config->width = game->width;
+	config->height = game->height;
+	config->opening_length = game->history_length;
+	if (config->opening_length) {
+		config->opening = malloc(config->opening_length * sizeof(struct move_t));
+		if (!config->opening) {
+			err = -ERROR_INTERNAL;
+			goto out;
+		}
+		memcpy(config->opening, game->moves, config->opening_length * sizeof(struct move_t));
+	}
+
+out:
+	game_free(game);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	long long n;
+	char *opening = NULL;
+	struct sim_ai_t ai = {
+		.config = {
+			.threads = 1,
+		},
+		.players = PLAYERS_MAX,
+	};
+	struct sim_config_t config = {
+		.players = 2,
+		.width = 8,
+		.height = 8,
+		.games = 100000,
+		.threads = 1,
+		.seed = 0,
+		.max_moves = 0,
+	};
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0)
+		config.threads = cpus;
+
+	while ((opt = getopt(argc, argv, "n:j:s:m:a:A:R:p:W:H:l:")) != -1) {
+		/* Everything but the save file is a number. */
+		n = 0;
+		if (opt != 'l' && opt != '?') {
+			n = parse_size(optarg);
+			if (n < 0 || (strchr("aApWH", opt) && n > INT_MAX)) {
+				usage();
+				return 1;
+			}
+		}
+
+		switch (opt) {
+		case 'n':
+			config.games = n;
+			break;
+		case 'j':
+			config.threads = n;
+			break;
+		case 's':
+			config.seed = n;
+			break;
+		case 'm':
+			config.max_moves = n;
+			break;
+		case 'a':
+			/* The computer player plays itself, games are already threaded. */
+			if (n < 1 || n > AI_MAX_DEPTH) {
+				usage();
+				return 1;
+			}
+			ai.config.depth = n;
+			break;
+		case 'A':
+			ai.players = n;
+			break;
+		case 'R':
+			ai.random_moves = n;
+			break;
+		case 'p':
+			config.players = n;
+			break;
+		case 'W':
+			config.width = n;
+			break;
+		case 'H':
+			config.height = n;
+			break;
+		case 'l':
+			opening = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		usage();
+		return 1;
+	}
+
+	if (opening) {
+		int err = load_opening(&config, opening);
+		if (err < 0)
+			bail(1, "atoms-sim: cannot load opening from %s\n", opening);
+	}
+
+	/* Check the game settings once, rather than failing every game. */
+	struct game_t *game = game_alloc();
+	if (!game)
+		bail(1, "error allocating memory\n");
+	int err = game_init(game, config.players, config.width, config.height);
+	game_free(game);
+	if (err < 0)
+		bail(1, "atoms-sim: invalid game settings (%d players on %dx%d)\n",
+		     config.players, config.width, config.height);
+
+	if (ai.config.depth) {
+		ai.config.table = ai_table_alloc(AI_TABLE_BITS);
+		if (!ai.config.table)
+			bail(1, "error allocating memory\n");
+		pthread_mutex_init(&ai.lock, NULL);
+		config.policy = sim_policy_ai;
+		config.policy_data = &ai;
+	}
+
+	struct sim_stats_t stats;
+	err = sim_run(&config, &stats);
+	free(config.opening);
+	ai_table_free(ai.config.table);
+	if (err < 0)
+		bail(1, "atoms-sim: simulation failed (bad opening?)\n");
+
+	printf("games:       %zu (%d players on %dx%d, %zu threads)\n",
+	       stats.games, config.players, config.width, config.height, config.threads);
+	for (int i = 0; i < config.players; i++)
+		printf("%-6s wins: %zu (%.2f%%)\n", PLAYER_COLOURS[i], stats.wins[i],
+		       stats.games ? 100.0 * stats.wins[i] / stats.games : 0.0);
+	printf("unfinished:  %zu\n", stats.unfinished);
+	printf("moves:       %zu (%.1f per game, min %zu, max %zu)\n", stats.moves,
+	       stats.games ? (double) stats.moves / stats.games : 0.0,
+	       stats.min_moves, stats.max_moves);
+	printf("checksum:    %016llx\n", (unsigned long long) stats.checksum);
+	printf("time:        %.3fs (%.0f games/s, %.0f moves/s)\n", stats.seconds,
+	       stats.seconds > 0 ? stats.games / stats.seconds : 0.0,
+	       stats.seconds > 0 ? stats.moves / stats.seconds : 0.0);
+	if (ai.config.depth)
+		printf("search:      %zu nodes at depth %d (%.0f nodes/s)\n", ai.nodes,
+		       ai.config.depth, stats.seconds > 0 ? ai.nodes / stats.seconds : 0.0);
+	return 0;
+}
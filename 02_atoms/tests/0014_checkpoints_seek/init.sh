@@ -0,0 +1,11 @@
+#!/bin/sh
+
+self="$(readlink -f "$(dirname "$BASH_SOURCE")")"
+rm -f $self/*.as
+
+# Version 1 saves (3x3, 2 players, moves (0,0) and (2,2)) with a checkpoint
+# after every move. Only the first has a checkpoint that matches the history.
+moves='\003\003\002\000\000\000\000\002\002\000\000CK\377\377\001\000\000\000\001\000\000\000'
+printf "$moves"'\000\000\000\000\001\000\000\000\004\000\000\000\005\001\000\010' > $self/matching.as
+printf "$moves"'\000\000\000\000\001\000\000\000\006\000\000\000\000\004\005\001\000\004' > $self/wrong_grid.as
+printf "$moves"'\000\000\000\000\000\000\000\000\004\000\000\000\005\001\000\010' > $self/wrong_player.as
@@ -0,0 +1,7 @@
+#!/bin/sh
+
+self="$(readlink -f "$(dirname "$BASH_SOURCE")")"
+rm -f $self/*.as
+
+# A version 2 save (6x6, 3 players, no moves) with the wrong checksum.
+printf '\211ATM\002\000\006\000\000\000\006\000\000\000\003\000\000\000\000\000' > $self/corrupt.as
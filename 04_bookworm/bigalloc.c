@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "bigalloc.h"
+
+/*
+ * Every allocation is preceded by a header (padded to keep the user pointer
+ * aligned), so big_free knows how it was allocated. For mmap-ed allocations,
+ * ->len is the size of the whole mapping (rounded up to a huge page), so
+ * big_realloc can grow in place until that runs out.
+ */
+struct big_header_t {
+	size_t len;
+	size_t size;
+	int backing;
+} __attribute__((aligned(64)));
+
+static atomic_int policy = BIGALLOC_AUTO;
+
+static atomic_size_t allocations[NUM_BIGALLOC_BACKINGS];
+static atomic_size_t bytes[NUM_BIGALLOC_BACKINGS];
+static atomic_size_t fallbacks;
+
+int bigalloc_set_policy(int new)
+{
+	if (new < BIGALLOC_AUTO || new > BIGALLOC_MALLOC) {
+		errno = EINVAL;
+		return -1;
+	}
+	atomic_store(&policy, new);
+	return 0;
+}
+
+/* Parses the policy names used on the command-line ("auto", "thp" or "off"). */
+int bigalloc_parse_policy(const char *name)
+{
+	if (!strcmp(name, "auto"))
+		return BIGALLOC_AUTO;
+	if (!strcmp(name, "thp"))
+		return BIGALLOC_THP;
+	if (!strcmp(name, "off"))
+		return BIGALLOC_MALLOC;
+	errno = EINVAL;
+	return -1;
+}
+
+/* Reads how much of this process is backed by transparent huge pages, in bytes. */
+static size_t thp_resident(void)
+{
+	char line[256];
+	size_t kb = 0;
+
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+			break;
+	fclose(f);
+	return kb << 10;
+}
+
+void bigalloc_stats(struct bigalloc_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	for (int i = 0; i < NUM_BIGALLOC_BACKINGS; i++) {
+		stats->allocations[i] = atomic_load(&allocations[i]);
+		stats->bytes[i] = atomic_load(&bytes[i]);
+	}
+	stats->fallbacks = atomic_load(&fallbacks);
+	stats->thp_resident = thp_resident();
+}
+
+static void account(int backing, size_t size, int sign)
+{
+	if (sign > 0) {
+		atomic_fetch_add(&allocations[backing], 1);
+		atomic_fetch_add(&bytes[backing], size);
+	} else {
+		atomic_fetch_sub(&allocations[backing], 1);
+		atomic_fetch_sub(&bytes[backing], size);
+	}
+}
+
+/* Maps @len bytes (a multiple of the huge page size) with the best backing we can. */
+static void *big_map(size_t len, int *backing)
+{
+	int current = atomic_load(&policy);
+	void *map;
+
+	if (current == BIGALLOC_AUTO) {
+		map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (map != MAP_FAILED) {
+			*backing = BIGALLOC_BACKING_HUGETLB;
+			return map;
+		}
+		atomic_fetch_add(&fallbacks, 1);
+	}
+
+	if (current == BIGALLOC_AUTO || current == BIGALLOC_THP) {
+		map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map != MAP_FAILED) {
+			/* THP may be disabled entirely, in which case this is still fine. */
+			if (madvise(map, len, MADV_HUGEPAGE) < 0)
+				atomic_fetch_add(&fallbacks, 1);
+			*backing = BIGALLOC_BACKING_THP;
+			return map;
+		}
+		atomic_fetch_add(&fallbacks, 1);
+	}
+
+	return NULL;
+}
+
+/* Allocates, and returns whether the memory is already zeroed in @zeroed. */
+static void *__big_alloc(size_t size, int *zeroed)
+{
+	struct big_header_t *hdr = NULL;
+	int backing = BIGALLOC_BACKING_MALLOC;
+	size_t len = sizeof(*hdr) + size;
+
+	/* Guard against overflow. */
+	if (len < size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	*zeroed = 0;
+	if (size >= BIGALLOC_THRESHOLD) {
+		len = (len + BIGALLOC_HUGE_PAGE - 1) & ~(BIGALLOC_HUGE_PAGE - 1);
+		hdr = big_map(len, &backing);
+		/* Anonymous mappings are always zeroed. */
+		*zeroed = !!hdr;
+	}
+	if (!hdr) {
+		backing = BIGALLOC_BACKING_MALLOC;
+		len = sizeof(*hdr) + size;
+		hdr = malloc(len);
+		if (!hdr)
+			return NULL;
+	}
+
+	hdr->len = len;
+	hdr->size = size;
+	hdr->backing = backing;
+	account(backing, len, 1);
+	return hdr + 1;
+}
+
+void *big_alloc(size_t size)
+{
+	int zeroed;
+	return __big_alloc(size, &zeroed);
+}
+
+void *big_calloc(size_t nmemb, size_t size)
+{
+	int zeroed;
+
+	if (size && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	void *ptr = __big_alloc(nmemb * size, &zeroed);
+	if (ptr && !zeroed)
+		memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+void *big_realloc(void *ptr, size_t size)
+{
+	if (!ptr)
+		return big_alloc(size);
+
+	/* Grow in place if the mapping is big enough. */
+	struct big_header_t *hdr = (struct big_header_t *) ptr - 1;
+	if (hdr->backing != BIGALLOC_BACKING_MALLOC && sizeof(*hdr) + size <= hdr->len) {
+		hdr->size = size;
+		return ptr;
+	}
+
+	void *new = big_alloc(size);
+	if (!new)
+		return NULL;
+	memcpy(new, ptr, hdr->size < size ? hdr->size : size);
+	big_free(ptr);
+	return new;
+}
+
+void big_free(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	struct big_header_t *hdr = (struct big_header_t *) ptr - 1;
+	account(hdr->backing, hdr->len, -1);
+	if (hdr->backing == BIGALLOC_BACKING_MALLOC)
+		free(hdr);
+	else
+		munmap(hdr, hdr->len);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(BIGALLOC_H)
+#define BIGALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocator for large, randomly accessed arrays (the node array and the
+ * per-search arrays like best_k, seen and previous). Allocations of at least
+ * BIGALLOC_THRESHOLD bytes are backed by huge pages where possible, which cuts
+ * down on TLB misses when searching large graphs. Smaller allocations just use
+ * malloc. Memory from big_* must only be freed with big_free.
+ */
+#define BIGALLOC_HUGE_PAGE (2UL << 20)
+#define BIGALLOC_THRESHOLD BIGALLOC_HUGE_PAGE
+
+/*
+ * Policies, which decide what is tried (in order) for large allocations.
+ * BIGALLOC_AUTO tries explicit huge pages (MAP_HUGETLB, which need to be
+ * reserved by the admin) and then transparent huge pages, BIGALLOC_THP only
+ * tries transparent huge pages. Everything falls back to malloc.
+ */
+enum {
+	BIGALLOC_AUTO,
+	BIGALLOC_THP,
+	BIGALLOC_MALLOC,
+};
+
+/* Backings, used to index bigalloc_stats_t. */
+enum {
+	BIGALLOC_BACKING_HUGETLB,
+	BIGALLOC_BACKING_THP,
+	BIGALLOC_BACKING_MALLOC,
+	NUM_BIGALLOC_BACKINGS,
+};
+
+struct bigalloc_stats_t {
+	/* Number of live allocations, and the bytes they cover, per backing. */
+	size_t allocations[NUM_BIGALLOC_BACKINGS];
+	size_t bytes[NUM_BIGALLOC_BACKINGS];
+	/* Number of times a huge page backing failed and we fell back. */
+	size_t fallbacks;
+	/* Bytes of anonymous memory actually backed by THP (from the kernel). */
+	size_t thp_resident;
+};
+
+int bigalloc_set_policy(int policy);
+int bigalloc_parse_policy(const char *name);
+void bigalloc_stats(struct bigalloc_stats_t *stats);
+
+void *big_alloc(size_t size);
+void *big_calloc(size_t nmemb, size_t size);
+void *big_realloc(void *ptr, size_t size);
+void big_free(void *ptr);
+
+#endif
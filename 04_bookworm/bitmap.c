@@ -0,0 +1,564 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "worm.h"
+#include "bitmap.h"
+
+#define BITMAP_KEY(idx)    ((uint16_t) ((idx) >> 16))
+#define BITMAP_OFFSET(idx) ((uint16_t) ((idx) & 0xffff))
+
+struct bitmap_t *bitmap_alloc(void)
+{
+	return calloc(1, sizeof(struct bitmap_t));
+}
+
+static void container_free(struct bitmap_container_t *c)
+{
+	free(c->array);
+	free(c->bits);
+}
+
+void bitmap_free(struct bitmap_t *bitmap)
+{
+	if (!bitmap)
+		return;
+	for (size_t i = 0; i < bitmap->n_containers; i++)
+		container_free(&bitmap->containers[i]);
+	free(bitmap->containers);
+	free(bitmap);
+}
+
+/* Converts an array container which has grown too large to a bitset. */
+static int container_to_bits(struct bitmap_container_t *c)
+{
+	uint64_t *bits = calloc(BITMAP_WORDS, sizeof(*bits));
+	if (!bits)
+		return -1;
+	for (uint32_t i = 0; i < c->n; i++)
+		bits[c->array[i] / 64] |= 1ULL << (c->array[i] % 64);
+
+	free(c->array);
+	c->array = NULL;
+	c->cap = 0;
+	c->bits = bits;
+	return 0;
+}
+
+/* Converts a bitset container which has become sparse back to an array. */
+static int container_to_array(struct bitmap_container_t *c)
+{
+	uint16_t *array = malloc((c->n ? c->n : 1) * sizeof(*array));
+	if (!array)
+		return -1;
+
+	uint32_t n = 0;
+	for (size_t w = 0; w < BITMAP_WORDS; w++)
+		for (uint64_t word = c->bits[w]; word; word &= word - 1)
+			array[n++] = w * 64 + __builtin_ctzll(word);
+
+	free(c->bits);
+	c->bits = NULL;
+	c->array = array;
+	c->cap = c->n;
+	return 0;
+}
+
+/* Picks the smaller representation for a container that was just computed. */
+static int container_normalise(struct bitmap_container_t *c)
+{
+	if (c->bits && c->n <= BITMAP_ARRAY_MAX)
+		return container_to_array(c);
+	if (!c->bits && c->n > BITMAP_ARRAY_MAX)
+		return container_to_bits(c);
+	return 0;
+}
+
+static int container_copy(struct bitmap_container_t *dst, const struct bitmap_container_t *src)
+{
+	*dst = (struct bitmap_container_t) {
+		.key = src->key,
+		.n = src->n,
+		.cap = src->bits ? 0 : src->n,
+	};
+	if (src->bits) {
+		dst->bits = malloc(BITMAP_WORDS * sizeof(*dst->bits));
+		if (!dst->bits)
+			return -1;
+		memcpy(dst->bits, src->bits, BITMAP_WORDS * sizeof(*dst->bits));
+	} else {
+		dst->array = malloc((src->n ? src->n : 1) * sizeof(*dst->array));
+		if (!dst->array)
+			return -1;
+		memcpy(dst->array, src->array, src->n * sizeof(*dst->array));
+	}
+	return 0;
+}
+
+static inline bool container_contains(const struct bitmap_container_t *c, uint16_t offset)
+{
+	if (c->bits)
+		return c->bits[offset / 64] & (1ULL << (offset % 64));
+
+	/* Binary search, since the array is sorted. */
+	size_t lo = 0, hi = c->n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (c->array[mid] < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < c->n && c->array[lo] == offset;
+}
+
+/* Finds the container for @key, or where it would have to be inserted. */
+static size_t bitmap_find(const struct bitmap_t *bitmap, uint16_t key)
+{
+	size_t lo = 0, hi = bitmap->n_containers;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (bitmap->containers[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Appends a (non-empty) container, which must have the largest key so far. */
+static int bitmap_push(struct bitmap_t *bitmap, struct bitmap_container_t *c)
+{
+	if (bitmap->n_containers >= bitmap->cap) {
+		size_t cap = bitmap->cap ? 2 * bitmap->cap : 4;
+		struct bitmap_container_t *containers = realloc(bitmap->containers, cap * sizeof(*containers));
+		if (!containers)
+			return -1;
+		bitmap->containers = containers;
+		bitmap->cap = cap;
+	}
+	bitmap->containers[bitmap->n_containers++] = *c;
+	return 0;
+}
+
+int bitmap_add(struct bitmap_t *bitmap, size_t idx)
+{
+	if (idx > UINT32_MAX)
+		return -1;
+
+	uint16_t key = BITMAP_KEY(idx), offset = BITMAP_OFFSET(idx);
+	size_t pos = bitmap->n_containers;
+
+	/* Ascending inserts always land in the last container. */
+	if (!pos || bitmap->containers[pos - 1].key != key)
+		pos = bitmap_find(bitmap, key);
+	else
+		pos--;
+
+	if (pos == bitmap->n_containers || bitmap->containers[pos].key != key) {
+		struct bitmap_container_t c = { .key = key };
+		if (bitmap_push(bitmap, &c) < 0)
+			return -1;
+		/* Move it into place. */
+		memmove(&bitmap->containers[pos + 1], &bitmap->containers[pos],
+			(bitmap->n_containers - pos - 1) * sizeof(*bitmap->containers));
+		bitmap->containers[pos] = c;
+	}
+
+	struct bitmap_container_t *c = &bitmap->containers[pos];
+	if (c->bits) {
+		uint64_t bit = 1ULL << (offset % 64);
+		if (!(c->bits[offset / 64] & bit)) {
+			c->bits[offset / 64] |= bit;
+			c->n++;
+		}
+		return 0;
+	}
+
+	/* Find the insertion point, checking the end first for ascending inserts. */
+	size_t at = c->n;
+	if (c->n && c->array[c->n - 1] >= offset) {
+		if (container_contains(c, offset))
+			return 0;
+		at = 0;
+		while (c->array[at] < offset)
+			at++;
+	}
+
+	if (c->n >= c->cap) {
+		uint32_t cap = c->cap ? 2 * c->cap : 4;
+		uint16_t *array = realloc(c->array, cap * sizeof(*array));
+		if (!array)
+			return -1;
+		c->array = array;
+		c->cap = cap;
+	}
+	memmove(&c->array[at + 1], &c->array[at], (c->n - at) * sizeof(*c->array));
+	c->array[at] = offset;
+	c->n++;
+
+	if (c->n > BITMAP_ARRAY_MAX)
+		return container_to_bits(c);
+	return 0;
+}
+
+bool bitmap_contains(const struct bitmap_t *bitmap, size_t idx)
+{
+	if (idx > UINT32_MAX)
+		return false;
+
+	size_t pos = bitmap_find(bitmap, BITMAP_KEY(idx));
+	if (pos == bitmap->n_containers || bitmap->containers[pos].key != BITMAP_KEY(idx))
+		return false;
+	return container_contains(&bitmap->containers[pos], BITMAP_OFFSET(idx));
+}
+
+size_t bitmap_cardinality(const struct bitmap_t *bitmap)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < bitmap->n_containers; i++)
+		n += bitmap->containers[i].n;
+	return n;
+}
+
+enum {
+	BITMAP_AND,
+	BITMAP_OR,
+	BITMAP_ANDNOT,
+};
+
+/* Combines two array containers, by merging them. */
+static int container_op_arrays(int op, const struct bitmap_container_t *a, const struct bitmap_container_t *b,
+			       struct bitmap_container_t *out)
+{
+	uint32_t cap = op == BITMAP_OR ? a->n + b->n : a->n;
+	uint32_t i = 0, j = 0, n = 0;
+
+	out->array = malloc((cap ? cap : 1) * sizeof(*out->array));
+	if (!out->array)
+		return -1;
+	out->cap = cap;
+
+	while (i < a->n && j < b->n) {
+		if (a->array[i] < b->array[j]) {
+			if (op != BITMAP_AND)
+				out->array[n++] = a->array[i];
+			i++;
+		} else if (a->array[i] > b->array[j]) {
+			if (op == BITMAP_OR)
+				out->array[n++] = b->array[j];
+			j++;
+		} else {
+			if (op != BITMAP_ANDNOT)
+				out->array[n++] = a->array[i];
+			i++;
+			j++;
+		}
+	}
+	if (op != BITMAP_AND)
+		while (i < a->n)
+			out->array[n++] = a->array[i++];
+	if (op == BITMAP_OR)
+		while (j < b->n)
+			out->array[n++] = b->array[j++];
+
+	out->n = n;
+	return container_normalise(out);
+}
+
+/*
+ * Combines two containers where at least one is a bitset. The result is
+ * built as a bitset, except for intersections and differences with an array
+ * on the left, which just filter the array.
+ */
+static int container_op(int op, const struct bitmap_container_t *a, const struct bitmap_container_t *b,
+			struct bitmap_container_t *out)
+{
+	*out = (struct bitmap_container_t) { .key = a->key };
+
+	if (!a->bits && !b->bits)
+		return container_op_arrays(op, a, b, out);
+
+	if (!a->bits && op != BITMAP_OR) {
+		out->array = malloc((a->n ? a->n : 1) * sizeof(*out->array));
+		if (!out->array)
+			return -1;
+		out->cap = a->n;
+		for (uint32_t i = 0; i < a->n; i++)
+			if (container_contains(b, a->array[i]) == (op == BITMAP_AND))
+				out->array[out->n++] = a->array[i];
+		return 0;
+	}
+
+	/* Union is symmetric, so keep the bitset on the left. */
+	if (!a->bits) {
+		const struct bitmap_container_t *tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	out->bits = malloc(BITMAP_WORDS * sizeof(*out->bits));
+	if (!out->bits)
+		return -1;
+	memcpy(out->bits, a->bits, BITMAP_WORDS * sizeof(*out->bits));
+
+	if (b->bits) {
+		for (size_t w = 0; w < BITMAP_WORDS; w++) {
+			switch (op) {
+			case BITMAP_AND:
+				out->bits[w] &= b->bits[w];
+				break;
+			case BITMAP_OR:
+				out->bits[w] |= b->bits[w];
+				break;
+			case BITMAP_ANDNOT:
+				out->bits[w] &= ~b->bits[w];
+				break;
+			}
+		}
+	} else if (op == BITMAP_AND) {
+		/* Only the members of the array can survive. */
+		memset(out->bits, 0, BITMAP_WORDS * sizeof(*out->bits));
+		for (uint32_t i = 0; i < b->n; i++)
+			if (container_contains(a, b->array[i]))
+				out->bits[b->array[i] / 64] |= 1ULL << (b->array[i] % 64);
+	} else {
+		for (uint32_t i = 0; i < b->n; i++) {
+			uint64_t bit = 1ULL << (b->array[i] % 64);
+			if (op == BITMAP_OR)
+				out->bits[b->array[i] / 64] |= bit;
+			else
+				out->bits[b->array[i] / 64] &= ~bit;
+		}
+	}
+
+	for (size_t w = 0; w < BITMAP_WORDS; w++)
+		out->n += __builtin_popcountll(out->bits[w]);
+	return container_normalise(out);
+}
+
+/* Walks the containers of both bitmaps in key order, combining matching keys. */
+static struct bitmap_t *bitmap_op(int op, const struct bitmap_t *a, const struct bitmap_t *b)
+{
+	struct bitmap_t *out = bitmap_alloc();
+	struct bitmap_container_t c;
+	size_t i = 0, j = 0;
+
+	if (!out)
+		return NULL;
+
+	while (i < a->n_containers || j < b->n_containers) {
+		const struct bitmap_container_t *ca = i < a->n_containers ? &a->containers[i] : NULL;
+		const struct bitmap_container_t *cb = j < b->n_containers ? &b->containers[j] : NULL;
+
+		if (ca && (!cb || ca->key < cb->key)) {
+			i++;
+			if (op == BITMAP_AND)
+				continue;
+			if (container_copy(&c, ca) < 0)
+				goto err_free_container;
+		} else if (cb && (!ca || cb->key < ca->key)) {
+			j++;
+			if (op != BITMAP_OR)
+				continue;
+			if (container_copy(&c, cb) < 0)
+				goto err_free_container;
+		} else {
+			i++;
+			j++;
+			if (container_op(op, ca, cb, &c) < 0)
+				goto err_free_container;
+			if (!c.n) {
+				container_free(&c);
+				continue;
+			}
+		}
+
+		if (bitmap_push(out, &c) < 0)
+			goto err_free_container;
+	}
+	return out;
+
+err_free_container:
+	container_free(&c);
+	bitmap_free(out);
+	return NULL;
+}
+
+struct bitmap_t *bitmap_and(const struct bitmap_t *a, const struct bitmap_t *b)
+{
+	return bitmap_op(BITMAP_AND, a, b);
+}
+
+struct bitmap_t *bitmap_or(const struct bitmap_t *a, const struct bitmap_t *b)
+{
+	return bitmap_op(BITMAP_OR, a, b);
+}
+
+struct bitmap_t *bitmap_andnot(const struct bitmap_t *a, const struct bitmap_t *b)
+{
+	return bitmap_op(BITMAP_ANDNOT, a, b);
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a, y = *(const size_t *) b;
+	return (x > y) - (x < y);
+}
+
+struct bitmap_t *bitmap_from_result(struct book_t *nodes, struct result_t *result)
+{
+	struct bitmap_t *bitmap = NULL;
+	size_t *idxs = NULL;
+
+	if (!result)
+		return NULL;
+
+	/* Sorting first means every add takes the fast path. */
+	idxs = malloc((result->n_elements ? result->n_elements : 1) * sizeof(*idxs));
+	if (!idxs)
+		goto out;
+	for (size_t i = 0; i < result->n_elements; i++)
+		idxs[i] = result->elements[i] - nodes;
+	qsort(idxs, result->n_elements, sizeof(*idxs), cmp_size);
+
+	bitmap = bitmap_alloc();
+	if (!bitmap)
+		goto out;
+	for (size_t i = 0; i < result->n_elements; i++) {
+		if (bitmap_add(bitmap, idxs[i]) < 0) {
+			bitmap_free(bitmap);
+			bitmap = NULL;
+			goto out;
+		}
+	}
+
+out:
+	free(idxs);
+	free(result->elements);
+	free(result);
+	return bitmap;
+}
+
+struct result_t *bitmap_to_result(struct book_t *nodes, const struct bitmap_t *bitmap)
+{
+	struct result_t *result = calloc(1, sizeof(*result));
+	if (!result)
+		return NULL;
+
+	size_t n = bitmap_cardinality(bitmap);
+	result->elements = malloc((n ? n : 1) * sizeof(*result->elements));
+	if (!result->elements) {
+		free(result);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < bitmap->n_containers; i++) {
+		const struct bitmap_container_t *c = &bitmap->containers[i];
+		size_t base = (size_t) c->key << 16;
+
+		if (!c->bits) {
+			for (uint32_t j = 0; j < c->n; j++)
+				result->elements[result->n_elements++] = &nodes[base + c->array[j]];
+			continue;
+		}
+		for (size_t w = 0; w < BITMAP_WORDS; w++)
+			for (uint64_t word = c->bits[w]; word; word &= word - 1)
+				result->elements[result->n_elements++] = &nodes[base + w * 64 + __builtin_ctzll(word)];
+	}
+	return result;
+}
+
+struct bitmap_t *bitmap_books_by_author(struct book_t *nodes, size_t count, size_t author_id)
+{
+	return bitmap_from_result(nodes, find_books_by_author(nodes, count, author_id));
+}
+
+struct bitmap_t *bitmap_books_reprinted(struct book_t *nodes, size_t count, size_t publisher_id)
+{
+	return bitmap_from_result(nodes, find_books_reprinted(nodes, count, publisher_id));
+}
+
+struct bitmap_t *bitmap_books_k_distance(struct book_t *nodes, size_t count, size_t book_id, uint16_t k)
+{
+	return bitmap_from_result(nodes, find_books_k_distance(nodes, count, book_id, k));
+}
+
+/* Intersects two bitmaps and converts the result, consuming both bitmaps. */
+static struct result_t *bitmap_intersect_result(struct book_t *nodes, struct bitmap_t *a, struct bitmap_t *b)
+{
+	struct result_t *result = NULL;
+
+	if (a && b) {
+		struct bitmap_t *both = bitmap_and(a, b);
+		if (both)
+			result = bitmap_to_result(nodes, both);
+		bitmap_free(both);
+	}
+	bitmap_free(a);
+	bitmap_free(b);
+	return result;
+}
+
+/**
+ * find_books_k_distance_by_author - Finds books by an author near a book
+ * @nodes: node list from graph
+ * @count: size of node list
+ * @book_id: source book
+ * @k: distance
+ * @author_id: author of the books
+ */
+struct result_t *find_books_k_distance_by_author(struct book_t *nodes, size_t count, size_t book_id, uint16_t k, size_t author_id)
+{
+	return bitmap_intersect_result(nodes, bitmap_books_k_distance(nodes, count, book_id, k),
+				       bitmap_books_by_author(nodes, count, author_id));
+}
+
+/**
+ * find_books_reprinted_within - Finds reprints near a book
+ * @nodes: node list from graph
+ * @count: size of node list
+ * @book_id: source book
+ * @k: distance
+ * @publisher_id: initial publisher
+ */
+struct result_t *find_books_reprinted_within(struct book_t *nodes, size_t count, size_t book_id, uint16_t k, size_t publisher_id)
+{
+	return bitmap_intersect_result(nodes, bitmap_books_k_distance(nodes, count, book_id, k),
+				       bitmap_books_reprinted(nodes, count, publisher_id));
+}
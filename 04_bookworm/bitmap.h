@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(BITMAP_H)
+#define BITMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "worm.h"
+
+/*
+ * Compressed bitmaps of node indices (roaring-style), used to combine query
+ * results. Indices are split into a 16-bit key and a 16-bit offset, and each
+ * key that has members gets a container, which is either a sorted array of
+ * offsets (while it has at most BITMAP_ARRAY_MAX members) or a plain bitset.
+ * Sparse results stay small, and dense ones are combined a word at a time.
+ * Only indices below 2^32 can be stored.
+ */
+#define BITMAP_ARRAY_MAX 4096
+#define BITMAP_WORDS     (65536 / 64)
+
+struct bitmap_container_t {
+	uint16_t key;
+	/* Number of members, the container is an array iff ->bits is NULL. */
+	uint32_t n;
+	uint32_t cap;
+	uint16_t *array;
+	uint64_t *bits;
+};
+
+struct bitmap_t {
+	/* Sorted by key, and never empty. */
+	struct bitmap_container_t *containers;
+	size_t n_containers, cap;
+};
+
+struct bitmap_t *bitmap_alloc(void);
+void bitmap_free(struct bitmap_t *bitmap);
+
+/* Adding indices in ascending order is the fast path. */
+int bitmap_add(struct bitmap_t *bitmap, size_t idx);
+bool bitmap_contains(const struct bitmap_t *bitmap, size_t idx);
+size_t bitmap_cardinality(const struct bitmap_t *bitmap);
+
+/*
+ * Set algebra, which returns a new bitmap (or NULL on error). bitmap_andnot is
+ * the difference @a - @b.
+ */
+struct bitmap_t *bitmap_and(const struct bitmap_t *a, const struct bitmap_t *b);
+struct bitmap_t *bitmap_or(const struct bitmap_t *a, const struct bitmap_t *b);
+struct bitmap_t *bitmap_andnot(const struct bitmap_t *a, const struct bitmap_t *b);
+
+/*
+ * Conversions from and to result_t. bitmap_from_result consumes @result, and
+ * bitmap_to_result returns the books in ascending order of node index.
+ */
+struct bitmap_t *bitmap_from_result(struct book_t *nodes, struct result_t *result);
+struct result_t *bitmap_to_result(struct book_t *nodes, const struct bitmap_t *bitmap);
+
+/* Bitmap versions of the find_* queries. */
+struct bitmap_t *bitmap_books_by_author(struct book_t *nodes, size_t count, size_t author_id);
+struct bitmap_t *bitmap_books_reprinted(struct book_t *nodes, size_t count, size_t publisher_id);
+struct bitmap_t *bitmap_books_k_distance(struct book_t *nodes, size_t count, size_t book_id, uint16_t k);
+
+/*
+ * Composite queries, which intersect the results of the find_* queries.
+ * find_books_k_distance_by_author gives the books within distance @k of
+ * @book_id which were written by @author_id, and find_books_reprinted_within
+ * gives the reprints of @publisher_id's books within distance @k of @book_id.
+ */
+struct result_t *find_books_k_distance_by_author(struct book_t *nodes, size_t count, size_t book_id, uint16_t k, size_t author_id);
+struct result_t *find_books_reprinted_within(struct book_t *nodes, size_t count, size_t book_id, uint16_t k, size_t publisher_id);
+
+#endif
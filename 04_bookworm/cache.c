@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "worm.h"
+#include "cache.h"
+
+/* Initial size of the hash table, must be a power of two. */
+#define QCACHE_BUCKETS 64
+
+/* Rough per-entry cost, used when accounting for the budget. */
+#define QCACHE_ENTRY_COST(n) (sizeof(struct qcache_entry_t) + (n) * sizeof(uint32_t))
+
+struct query_cache_t *qcache_alloc(size_t max_bytes)
+{
+	struct query_cache_t *cache = malloc(sizeof(*cache));
+	if (!cache)
+		goto err;
+	memset(cache, 0, sizeof(*cache));
+
+	cache->n_buckets = QCACHE_BUCKETS;
+	cache->buckets = calloc(cache->n_buckets, sizeof(*cache->buckets));
+	if (!cache->buckets)
+		goto err_buckets;
+
+	cache->max_bytes = max_bytes;
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+
+err_buckets:
+	free(cache);
+err:
+	return NULL;
+}
+
+static void qcache_entry_free(struct qcache_entry_t *entry)
+{
+	if (entry)
+		free(entry->indices);
+	free(entry);
+}
+
+/* Drops all entries. Must be called with ->lock held. */
+static void __qcache_flush(struct query_cache_t *cache)
+{
+	struct qcache_entry_t *entry = cache->head;
+	while (entry) {
+		struct qcache_entry_t *next = entry->next;
+		qcache_entry_free(entry);
+		entry = next;
+	}
+
+	memset(cache->buckets, 0, cache->n_buckets * sizeof(*cache->buckets));
+	cache->head = cache->tail = NULL;
+	cache->n_entries = 0;
+	cache->bytes = 0;
+	cache->generation++;
+	cache->stats.invalidations++;
+}
+
+void qcache_free(struct query_cache_t *cache)
+{
+	if (cache) {
+		__qcache_flush(cache);
+		pthread_mutex_destroy(&cache->lock);
+		free(cache->buckets);
+	}
+	free(cache);
+}
+
+void qcache_invalidate(struct query_cache_t *cache)
+{
+	if (!cache)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	__qcache_flush(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void qcache_stats(struct query_cache_t *cache, struct qcache_stats_t *stats)
+{
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* 64-bit mixer from splitmix64, good enough to spread sequential ids. */
+static inline uint64_t qcache_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static inline size_t qcache_hash(int type, size_t arg0, size_t arg1)
+{
+	return qcache_mix(qcache_mix(arg0 ^ ((uint64_t) type << 56)) ^ arg1);
+}
+
+/* LRU list helpers. Must be called with ->lock held. */
+static void qcache_lru_unlink(struct query_cache_t *cache, struct qcache_entry_t *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+static void qcache_lru_push(struct query_cache_t *cache, struct qcache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head)
+		cache->head->prev = entry;
+	cache->head = entry;
+	if (!cache->tail)
+		cache->tail = entry;
+}
+
+/* Removes @entry from the hash table and LRU list, and frees it. */
+static void qcache_evict(struct query_cache_t *cache, struct qcache_entry_t *entry)
+{
+	size_t bucket = qcache_hash(entry->type, entry->args[0], entry->args[1]) & (cache->n_buckets - 1);
+
+	struct qcache_entry_t **pp = &cache->buckets[bucket];
+	while (*pp && *pp != entry)
+		pp = &(*pp)->hnext;
+	if (*pp)
+		*pp = entry->hnext;
+
+	qcache_lru_unlink(cache, entry);
+	cache->bytes -= QCACHE_ENTRY_COST(entry->n_indices);
+	cache->n_entries--;
+	cache->stats.evictions++;
+	qcache_entry_free(entry);
+}
+
+/* Doubles the size of the hash table. Failure to grow isn't fatal. */
+static void qcache_grow(struct query_cache_t *cache)
+{
+	size_t n_buckets = cache->n_buckets * 2;
+	struct qcache_entry_t **buckets = calloc(n_buckets, sizeof(*buckets));
+	if (!buckets)
+		return;
+
+	for (struct qcache_entry_t *entry = cache->head; entry; entry = entry->next) {
+		size_t bucket = qcache_hash(entry->type, entry->args[0], entry->args[1]) & (n_buckets - 1);
+		entry->hnext = buckets[bucket];
+		buckets[bucket] = entry;
+	}
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->n_buckets = n_buckets;
+}
+
+/*
+ * Makes sure that the cache is bound to the given graph, flushing it if it
+ * isn't. Must be called with ->lock held.
+ */
+static void qcache_bind(struct query_cache_t *cache, struct book_t *nodes, size_t count)
+{
+	if (cache->nodes == nodes && cache->count == count)
+		return;
+
+	if (cache->n_entries)
+		__qcache_flush(cache);
+	cache->nodes = nodes;
+	cache->count = count;
+}
+
+/*
+ * Looks up a cached result, returning a freshly allocated result_t (owned by
+ * the caller) on a hit and NULL on a miss.
+ */
+static struct result_t *qcache_lookup(struct query_cache_t *cache, struct book_t *nodes, int type, size_t arg0, size_t arg1)
+{
+	size_t bucket = qcache_hash(type, arg0, arg1) & (cache->n_buckets - 1);
+
+	struct qcache_entry_t *entry = cache->buckets[bucket];
+	for (; entry; entry = entry->hnext)
+		if (entry->type == type && entry->args[0] == arg0 && entry->args[1] == arg1)
+			break;
+	if (!entry) {
+		cache->stats.misses++;
+		return NULL;
+	}
+
+	struct result_t *result = malloc(sizeof(*result));
+	if (!result)
+		return NULL;
+	memset(result, 0, sizeof(*result));
+
+	if (entry->n_indices) {
+		result->elements = malloc(entry->n_indices * sizeof(*result->elements));
+		if (!result->elements) {
+			free(result);
+			return NULL;
+		}
+		for (size_t i = 0; i < entry->n_indices; i++)
+			result->elements[i] = &nodes[entry->indices[i]];
+		result->n_elements = entry->n_indices;
+	}
+
+	/* Bump to the front of the LRU. */
+	qcache_lru_unlink(cache, entry);
+	qcache_lru_push(cache, entry);
+
+	cache->stats.hits++;
+	return result;
+}
+
+/*
+ * Inserts a copy of @result into the cache, evicting the least recently used
+ * entries until it fits in the budget. Must be called with ->lock held.
+ */
+static void qcache_insert(struct query_cache_t *cache, struct book_t *nodes, int type, size_t arg0, size_t arg1, struct result_t *result)
+{
+	size_t cost = QCACHE_ENTRY_COST(result->n_elements);
+
+	/* Results that won't fit (or can't be stored compactly) aren't cached. */
+	if (cost > cache->max_bytes || cache->count > UINT32_MAX)
+		return;
+
+	/* A concurrent miss might have beaten us to it. */
+	size_t bucket = qcache_hash(type, arg0, arg1) & (cache->n_buckets - 1);
+	for (struct qcache_entry_t *entry = cache->buckets[bucket]; entry; entry = entry->hnext)
+		if (entry->type == type && entry->args[0] == arg0 && entry->args[1] == arg1)
+			return;
+
+	struct qcache_entry_t *entry = malloc(sizeof(*entry));
+	if (!entry)
+		return;
+	*entry = (struct qcache_entry_t) {
+		.type = type,
+		.args = { arg0, arg1 },
+		.n_indices = result->n_elements,
+	};
+
+	if (entry->n_indices) {
+		entry->indices = malloc(entry->n_indices * sizeof(*entry->indices));
+		if (!entry->indices) {
+			free(entry);
+			return;
+		}
+		for (size_t i = 0; i < entry->n_indices; i++)
+			entry->indices[i] = result->elements[i] - nodes;
+	}
+
+	while (cache->tail && cache->bytes + cost > cache->max_bytes)
+		qcache_evict(cache, cache->tail);
+
+	if (cache->n_entries >= cache->n_buckets)
+		qcache_grow(cache);
+
+	bucket = qcache_hash(type, arg0, arg1) & (cache->n_buckets - 1);
+	entry->hnext = cache->buckets[bucket];
+	cache->buckets[bucket] = entry;
+	qcache_lru_push(cache, entry);
+
+	cache->bytes += cost;
+	cache->n_entries++;
+	cache->stats.insertions++;
+}
+
+/*
+ * Generates the cached variant of a query. The lock is dropped while running
+ * the actual query, so concurrent misses for the same key will both compute
+ * the result (only the first one is inserted). If
+ * the cache was invalidated while we weren't holding the lock the result is
+ * not inserted, since it might have been computed from the old graph.
+ */
+#define DEFUN_CACHED(fn, type, query, arg0_t, arg1_t)				\
+	struct result_t *fn(struct query_cache_t *cache, struct book_t *nodes,	\
+			    size_t count, arg0_t arg0, arg1_t arg1)		\
+	{									\
+		if (!cache)							\
+			return query(nodes, count, arg0, arg1);			\
+										\
+		pthread_mutex_lock(&cache->lock);				\
+		qcache_bind(cache, nodes, count);				\
+		struct result_t *result = qcache_lookup(cache, nodes, type, arg0, arg1); \
+		uint64_t generation = cache->generation;			\
+		pthread_mutex_unlock(&cache->lock);				\
+		if (result)							\
+			return result;						\
+										\
+		result = query(nodes, count, arg0, arg1);			\
+		if (!result)							\
+			return NULL;						\
+										\
+		pthread_mutex_lock(&cache->lock);				\
+		if (cache->generation == generation)				\
+			qcache_insert(cache, nodes, type, arg0, arg1, result);	\
+		pthread_mutex_unlock(&cache->lock);				\
+		return result;							\
+	}
+
+DEFUN_CACHED(cached_find_books_k_distance, QUERY_K_DISTANCE, find_books_k_distance, size_t, uint16_t);
+DEFUN_CACHED(cached_find_shortest_distance, QUERY_SHORTEST_DISTANCE, find_shortest_distance, size_t, size_t);
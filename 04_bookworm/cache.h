@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(CACHE_H)
+#define CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "worm.h"
+
+/* Query types that can be cached. */
+enum {
+	QUERY_K_DISTANCE,
+	QUERY_SHORTEST_DISTANCE,
+};
+
+/* Hit/miss statistics for a query cache. */
+struct qcache_stats_t {
+	size_t hits;
+	size_t misses;
+	size_t insertions;
+	size_t evictions;
+	size_t invalidations;
+};
+
+/*
+ * A single cached result. We don't store the result_t itself, but rather the
+ * indices of the elements inside the graph (which are half the size of a
+ * pointer and stay valid as long as the graph does).
+ */
+struct qcache_entry_t {
+	int type;
+	size_t args[2];
+
+	uint32_t *indices;
+	size_t n_indices;
+
+	/* Hash chain. */
+	struct qcache_entry_t *hnext;
+	/* LRU list, ->head is the most recently used entry. */
+	struct qcache_entry_t *prev, *next;
+};
+
+/*
+ * Bounded LRU cache of query results for a single graph. The cache is bound to
+ * the (nodes, count) pair it was first used with, and any use with a different
+ * graph will flush it. If the graph is mutated in-place, the caller must call
+ * qcache_invalidate.
+ */
+struct query_cache_t {
+	pthread_mutex_t lock;
+
+	/* Which graph we are caching results for. */
+	struct book_t *nodes;
+	size_t count;
+	/* Bumped on every invalidation, so in-flight misses don't insert stale data. */
+	uint64_t generation;
+
+	/* Budget (in bytes) and current usage. */
+	size_t max_bytes;
+	size_t bytes;
+
+	/* Hash table. */
+	struct qcache_entry_t **buckets;
+	size_t n_buckets;
+	size_t n_entries;
+
+	/* LRU list. */
+	struct qcache_entry_t *head, *tail;
+
+	struct qcache_stats_t stats;
+};
+
+/* Allocation and free routines for query_cache_t. */
+struct query_cache_t *qcache_alloc(size_t max_bytes);
+void qcache_free(struct query_cache_t *cache);
+
+/* Drops every entry in the cache. Must be called after mutating the graph. */
+void qcache_invalidate(struct query_cache_t *cache);
+
+/* Copies the current statistics into @stats. */
+void qcache_stats(struct query_cache_t *cache, struct qcache_stats_t *stats);
+
+/* Cached versions of the traversal queries. @cache may be NULL. */
+struct result_t *cached_find_books_k_distance(struct query_cache_t *cache, struct book_t *nodes, size_t count, size_t book_id, uint16_t k);
+struct result_t *cached_find_shortest_distance(struct query_cache_t *cache, struct book_t *nodes, size_t count, size_t b1_id, size_t b2_id);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+/*
+ * Bundled client for the query server. It doesn't wait for a response before
+ * sending the next request, so it doubles as a way of testing pipelining.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+#define CLIENT_BUFFER 65536
+
+/* Writes all of @buf, retrying on short writes. */
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int client_run(const char *path)
+{
+	char buf[CLIENT_BUFFER], out[CLIENT_BUFFER];
+	size_t out_len = 0;
+	bool eof = false, shut = false;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "client_run: socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		goto err;
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		goto err_close;
+
+	/*
+	 * The socket is non-blocking, because the server stops reading from us
+	 * when we have too many requests in flight. If we blocked writing to it we
+	 * would never read the responses that would let it make progress again.
+	 */
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		goto err_close;
+
+	/*
+	 * Shovel stdin to the server and the server to stdout. Anything from stdin
+	 * the server isn't ready for yet is kept in @out, and we stop reading stdin
+	 * while @out is full. Once stdin is done and @out has been sent we shut
+	 * down our half of the socket, and the server will close its half once it
+	 * has answered everything.
+	 */
+	struct pollfd fds[2];
+	while (true) {
+		fds[0] = (struct pollfd) {
+			.fd = !eof && out_len < sizeof(out) ? STDIN_FILENO : -1,
+			.events = POLLIN,
+		};
+		fds[1] = (struct pollfd) {
+			.fd = fd,
+			.events = POLLIN | (out_len ? POLLOUT : 0),
+		};
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			goto err_close;
+		}
+
+		if (fds[0].revents) {
+			ssize_t n = read(STDIN_FILENO, out + out_len, sizeof(out) - out_len);
+			if (n < 0 && errno != EINTR)
+				goto err_close;
+			if (n == 0)
+				eof = true;
+			else if (n > 0)
+				out_len += n;
+		}
+
+		if (fds[1].revents & POLLOUT) {
+			ssize_t n = write(fd, out, out_len);
+			if (n < 0 && errno != EINTR && errno != EAGAIN)
+				goto err_close;
+			if (n > 0) {
+				memmove(out, out + n, out_len - n);
+				out_len -= n;
+			}
+		}
+
+		/* Everything has been sent. */
+		if (eof && !out_len && !shut) {
+			shutdown(fd, SHUT_WR);
+			shut = true;
+		}
+
+		if (fds[1].revents & ~POLLOUT) {
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n < 0 && errno != EINTR && errno != EAGAIN)
+				goto err_close;
+			if (n == 0)
+				break;
+			if (n > 0 && write_all(STDOUT_FILENO, buf, n) < 0)
+				goto err_close;
+		}
+	}
+
+	close(fd);
+	return 0;
+
+err_close:
+	close(fd);
+err:
+	perror("client_run");
+	return -1;
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "worm.h"
+#include "cursor.h"
+#include "bigalloc.h"
+
+#define BITS_PER_WORD 64
+
+static inline bool bitmap_test_and_set(uint64_t *bitmap, size_t idx)
+{
+	uint64_t bit = 1ULL << (idx % BITS_PER_WORD);
+	bool set = bitmap[idx / BITS_PER_WORD] & bit;
+	bitmap[idx / BITS_PER_WORD] |= bit;
+	return set;
+}
+
+/* Same as the linear search in worm.c, which isn't exported. */
+static struct book_t *cursor_search(struct book_t *nodes, size_t count, size_t book_id)
+{
+	for (size_t i = 0; i < count; i++)
+		if (nodes[i].id == book_id)
+			return &nodes[i];
+	return NULL;
+}
+
+static struct result_cursor_t *cursor_alloc(int type, struct book_t *nodes, size_t count)
+{
+	struct result_cursor_t *cursor = malloc(sizeof(*cursor));
+	if (!cursor)
+		return NULL;
+
+	*cursor = (struct result_cursor_t) {
+		.type = type,
+		.nodes = nodes,
+		.count = count,
+	};
+	return cursor;
+}
+
+struct result_cursor_t *cursor_books_k_distance(struct book_t *nodes, size_t count, size_t book_id, uint16_t k)
+{
+	struct result_cursor_t *cursor = cursor_alloc(CURSOR_K_DISTANCE, nodes, count);
+	if (!cursor)
+		return NULL;
+	cursor->k = k;
+
+	struct book_t *book = cursor_search(nodes, count, book_id);
+	if (!book) {
+		cursor->done = true;
+		return cursor;
+	}
+
+	/*
+	 * A bitmap is 32x smaller than the best_k array in find_books_k_distance,
+	 * which matters since we have to clear it before the first result. The
+	 * queue is never read before it is written, so we don't touch it.
+	 */
+	cursor->seen = big_calloc((count + BITS_PER_WORD - 1) / BITS_PER_WORD, sizeof(*cursor->seen));
+	cursor->queue = big_alloc(count * sizeof(*cursor->queue));
+	if (!cursor->seen || !cursor->queue) {
+		cursor_free(cursor);
+		return NULL;
+	}
+
+	/* The source is the first result, and is at depth 0. */
+	size_t idx = book - nodes;
+	bitmap_test_and_set(cursor->seen, idx);
+	cursor->queue[cursor->tail++] = idx;
+	return cursor;
+}
+
+struct result_cursor_t *cursor_books_reprinted(struct book_t *nodes, size_t count, size_t publisher_id)
+{
+	struct result_cursor_t *cursor = cursor_alloc(CURSOR_REPRINTED, nodes, count);
+	if (!cursor)
+		return NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		if (nodes[i].publisher_id == publisher_id) {
+			cursor->source = &nodes[i];
+			break;
+		}
+	}
+	if (!cursor->source)
+		cursor->done = true;
+	return cursor;
+}
+
+static size_t cursor_next_k_distance(struct result_cursor_t *cursor, struct book_t **elements, size_t max)
+{
+	size_t n = 0;
+
+	/*
+	 * Nodes are returned as they are discovered, so the only one that hasn't
+	 * been returned when it was queued is the source. ->level_end is only
+	 * set once it has been.
+	 */
+	if (cursor->head == 0 && !cursor->current && cursor->level_end == 0) {
+		elements[n++] = &cursor->nodes[cursor->queue[0]];
+		cursor->level_end = cursor->tail;
+	}
+
+	while (n < max) {
+		if (cursor->current) {
+			struct book_t *book = cursor->current;
+
+			for (; cursor->edge < book->n_citation_edges && n < max; cursor->edge++) {
+				size_t nxt = book->b_citation_edges[cursor->edge];
+				if (bitmap_test_and_set(cursor->seen, nxt))
+					continue;
+				cursor->queue[cursor->tail++] = nxt;
+				elements[n++] = &cursor->nodes[nxt];
+			}
+			if (cursor->edge < book->n_citation_edges)
+				break;
+			cursor->current = NULL;
+		}
+
+		/* Move on to the next node, and the next level if we've finished this one. */
+		if (cursor->head == cursor->tail) {
+			cursor->done = true;
+			break;
+		}
+		if (cursor->head == cursor->level_end) {
+			cursor->depth++;
+			cursor->level_end = cursor->tail;
+		}
+		/* Nodes at depth k can't lead anywhere interesting, prune. */
+		if (cursor->depth >= cursor->k) {
+			cursor->done = true;
+			break;
+		}
+
+		cursor->current = &cursor->nodes[cursor->queue[cursor->head++]];
+		cursor->edge = 0;
+	}
+
+	return n;
+}
+
+static size_t cursor_next_reprinted(struct result_cursor_t *cursor, struct book_t **elements, size_t max)
+{
+	size_t n = 0;
+	struct book_t *source = cursor->source;
+
+	/* Same order as find_books_reprinted, the source's publisher edges then itself. */
+	for (; cursor->pub <= source->n_publisher_edges && n < max; cursor->pub++) {
+		struct book_t *book = source;
+		if (cursor->pub < source->n_publisher_edges)
+			book = &cursor->nodes[source->b_publisher_edges[cursor->pub]];
+
+		for (; cursor->author < book->n_author_edges && n < max; cursor->author++) {
+			struct book_t *other = &cursor->nodes[book->b_author_edges[cursor->author]];
+			if (other->id == book->id)
+				elements[n++] = other;
+		}
+		if (cursor->author < book->n_author_edges)
+			break;
+		cursor->author = 0;
+	}
+
+	if (cursor->pub > source->n_publisher_edges)
+		cursor->done = true;
+	return n;
+}
+
+size_t cursor_next(struct result_cursor_t *cursor, struct book_t **elements, size_t max)
+{
+	if (!cursor || cursor->done || !max)
+		return 0;
+
+	switch (cursor->type) {
+	case CURSOR_K_DISTANCE:
+		return cursor_next_k_distance(cursor, elements, max);
+	case CURSOR_REPRINTED:
+		return cursor_next_reprinted(cursor, elements, max);
+	}
+	return 0;
+}
+
+void cursor_free(struct result_cursor_t *cursor)
+{
+	if (cursor) {
+		big_free(cursor->seen);
+		big_free(cursor->queue);
+	}
+	free(cursor);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(CURSOR_H)
+#define CURSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "worm.h"
+
+/* Queries that can be streamed through a cursor. */
+enum {
+	CURSOR_K_DISTANCE,
+	CURSOR_REPRINTED,
+};
+
+/*
+ * result_cursor_t is the state of a partially evaluated query. Rather than
+ * materialising the whole result before returning it, the traversal is only
+ * run far enough to fill each chunk the caller asks for. Freeing the cursor
+ * stops the traversal.
+ */
+struct result_cursor_t {
+	int type;
+	struct book_t *nodes;
+	size_t count;
+	bool done;
+
+	/* CURSOR_K_DISTANCE: a level-synchronous BFS over citations. */
+	uint16_t k;
+	uint16_t depth;
+	uint64_t *seen;
+	size_t *queue;
+	size_t head, tail, level_end;
+	/* The node currently being expanded, and how far through its edges we are. */
+	struct book_t *current;
+	size_t edge;
+
+	/* CURSOR_REPRINTED: position in the publisher's books and their author edges. */
+	struct book_t *source;
+	size_t pub, author;
+};
+
+/*
+ * Cursor equivalents of find_books_k_distance and find_books_reprinted. The
+ * set of books returned is the same, but k-distance results are returned in
+ * BFS order (nearest first) rather than in graph order. Returns NULL if an
+ * error occurred.
+ */
+struct result_cursor_t *cursor_books_k_distance(struct book_t *nodes, size_t count, size_t book_id, uint16_t k);
+struct result_cursor_t *cursor_books_reprinted(struct book_t *nodes, size_t count, size_t publisher_id);
+
+/*
+ * Fills @elements with up to @max more results, returning how many were
+ * filled in. A return value of 0 means the query is finished.
+ */
+size_t cursor_next(struct result_cursor_t *cursor, struct book_t **elements, size_t max);
+
+/* Frees a cursor, abandoning the rest of the query. */
+void cursor_free(struct result_cursor_t *cursor);
+
+#endif
@@ -0,0 +1,896 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "worm.h"
+#include "cache.h"
+#include "graph.h"
+#include "bigalloc.h"
+#include "index.h"
+#include "rank.h"
+
+/* Initial number of slots in a group_table_t, must be a power of two. */
+#define GROUP_SLOTS 64
+
+static int adj_push(struct adj_t *adj, size_t val)
+{
+	if (adj->n_edges >= adj->cap) {
+		size_t cap = adj->cap ? adj->cap * 2 : 4;
+		size_t *edges = realloc(adj->edges, cap * sizeof(*edges));
+		if (!edges)
+			return -1;
+		adj->edges = edges;
+		adj->cap = cap;
+	}
+	adj->edges[adj->n_edges++] = val;
+	return 0;
+}
+
+/* Removes the first occurrence of @val, preserving the order of the rest. */
+static bool adj_remove(size_t *edges, size_t *n_edges, size_t val)
+{
+	for (size_t i = 0; i < *n_edges; i++) {
+		if (edges[i] == val) {
+			memmove(edges + i, edges + i + 1, (*n_edges - i - 1) * sizeof(*edges));
+			(*n_edges)--;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool adj_contains(size_t *edges, size_t n_edges, size_t val)
+{
+	for (size_t i = 0; i < n_edges; i++)
+		if (edges[i] == val)
+			return true;
+	return false;
+}
+
+static void adj_free(struct adj_t *adj)
+{
+	free(adj->edges);
+	*adj = (struct adj_t) {0};
+}
+
+static int group_table_init(struct group_table_t *table)
+{
+	memset(table, 0, sizeof(*table));
+	table->n_slots = GROUP_SLOTS;
+	table->slots = malloc(table->n_slots * sizeof(*table->slots));
+	if (!table->slots)
+		return -1;
+	memset(table->slots, 0xff, table->n_slots * sizeof(*table->slots));
+	return 0;
+}
+
+static void group_table_free(struct group_table_t *table)
+{
+	for (size_t i = 0; i < table->n_groups; i++)
+		adj_free(&table->groups[i].members);
+	free(table->groups);
+	free(table->slots);
+	memset(table, 0, sizeof(*table));
+}
+
+/* Returns the slot where @key is (or would be) stored. */
+static size_t group_table_probe(struct group_table_t *table, size_t key)
+{
+	size_t mask = table->n_slots - 1;
+	size_t slot = graph_mix(key) & mask;
+
+	while (table->slots[slot] != SIZE_MAX) {
+		if (table->groups[table->slots[slot]].key == key)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+static struct group_t *group_table_find(struct group_table_t *table, size_t key)
+{
+	size_t slot = group_table_probe(table, key);
+	if (table->slots[slot] == SIZE_MAX)
+		return NULL;
+	return &table->groups[table->slots[slot]];
+}
+
+/* Doubles the number of slots, keeping the load factor under 1/2. */
+static int group_table_grow(struct group_table_t *table)
+{
+	size_t n_slots = table->n_slots * 2;
+	size_t *slots = malloc(n_slots * sizeof(*slots));
+	if (!slots)
+		return -1;
+	memset(slots, 0xff, n_slots * sizeof(*slots));
+
+	for (size_t i = 0; i < table->n_groups; i++) {
+		size_t slot = graph_mix(table->groups[i].key) & (n_slots - 1);
+		while (slots[slot] != SIZE_MAX)
+			slot = (slot + 1) & (n_slots - 1);
+		slots[slot] = i;
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->n_slots = n_slots;
+	return 0;
+}
+
+/* Adds @idx to the group for @key, creating the group if necessary. */
+static int group_table_add(struct group_table_t *table, size_t key, size_t idx)
+{
+	struct group_t *group = group_table_find(table, key);
+	if (group)
+		return adj_push(&group->members, idx);
+
+	if (2 * (table->n_groups + 1) > table->n_slots)
+		if (group_table_grow(table) < 0)
+			return -1;
+
+	if (table->n_groups >= table->cap) {
+		size_t cap = table->cap ? table->cap * 2 : 16;
+		struct group_t *groups = realloc(table->groups, cap * sizeof(*groups));
+		if (!groups)
+			return -1;
+		table->groups = groups;
+		table->cap = cap;
+	}
+
+	/*
+	 * Groups are never removed from the table (even when they become empty)
+	 * which means we don't need tombstones in ->slots.
+	 */
+	size_t slot = group_table_probe(table, key);
+	table->slots[slot] = table->n_groups;
+	group = &table->groups[table->n_groups++];
+	*group = (struct group_t) { .key = key };
+	return adj_push(&group->members, idx);
+}
+
+static void group_table_remove(struct group_table_t *table, size_t key, size_t idx)
+{
+	struct group_t *group = group_table_find(table, key);
+	if (group)
+		adj_remove(group->members.edges, &group->members.n_edges, idx);
+}
+
+static inline bool book_is_dead(struct book_t *book)
+{
+	return book->id == BOOK_ID_NONE;
+}
+
+static inline size_t book_key(struct book_t *book, int group)
+{
+	switch (group) {
+	case GROUP_BOOK:
+		return book->id;
+	case GROUP_AUTHOR:
+		return book->author_id;
+	case GROUP_PUBLISHER:
+		return book->publisher_id;
+	}
+	return BOOK_ID_NONE;
+}
+
+/* Gets pointers to the edge list of the given type. */
+static void book_edges(struct book_t *book, int type, size_t ***b_edges, size_t **n_edges)
+{
+	switch (type) {
+	case EDGE_AUTHOR:
+		*b_edges = &book->b_author_edges;
+		*n_edges = &book->n_author_edges;
+		break;
+	case EDGE_CITATION:
+		*b_edges = &book->b_citation_edges;
+		*n_edges = &book->n_citation_edges;
+		break;
+	case EDGE_PUBLISHER:
+		*b_edges = &book->b_publisher_edges;
+		*n_edges = &book->n_publisher_edges;
+		break;
+	}
+}
+
+static void book_clear(struct graph_t *graph, struct book_t *book)
+{
+	graph_shm_edges_free(graph->shm, book->b_author_edges);
+	graph_shm_edges_free(graph->shm, book->b_citation_edges);
+	graph_shm_edges_free(graph->shm, book->b_publisher_edges);
+	*book = (struct book_t) {
+		.id = BOOK_ID_NONE,
+		.author_id = BOOK_ID_NONE,
+		.publisher_id = BOOK_ID_NONE,
+	};
+}
+
+/*
+ * Builds ->cited_by and ->groups for the current ->nodes. If the graph has a
+ * sidecar index, the reverse citations are copied from it rather than being
+ * rebuilt edge by edge.
+ */
+static int graph_build(struct graph_t *graph)
+{
+	struct book_t *nodes = graph->nodes;
+	size_t count = graph->count;
+
+	/* Build the reverse citation adjacency. */
+	graph->cited_by = big_calloc(count ? count : 1, sizeof(*graph->cited_by));
+	if (!graph->cited_by)
+		goto err;
+	for (size_t i = 0; i < count; i++) {
+		if (graph->index) {
+			struct adj_t *adj = &graph->cited_by[i];
+			const size_t *citers = graph_index_cited_by(graph->index, i, &adj->n_edges);
+
+			adj->cap = adj->n_edges;
+			if (!adj->n_edges)
+				continue;
+			adj->edges = malloc(adj->n_edges * sizeof(*adj->edges));
+			if (!adj->edges)
+				goto err_free_cited;
+			memcpy(adj->edges, citers, adj->n_edges * sizeof(*adj->edges));
+			continue;
+		}
+
+		for (size_t j = 0; j < nodes[i].n_citation_edges; j++)
+			if (adj_push(&graph->cited_by[nodes[i].b_citation_edges[j]], i) < 0)
+				goto err_free_cited;
+	}
+
+	/* Build the id indexes. */
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		if (group_table_init(&graph->groups[group]) < 0)
+			goto err_free_groups;
+		for (size_t i = 0; i < count; i++)
+			if (group_table_add(&graph->groups[group], book_key(&nodes[i], group), i) < 0)
+				goto err_free_groups;
+	}
+	return 0;
+
+err_free_groups:
+	for (int group = 0; group < NUM_GROUPS; group++)
+		group_table_free(&graph->groups[group]);
+err_free_cited:
+	for (size_t i = 0; i < count; i++)
+		adj_free(&graph->cited_by[i]);
+	big_free(graph->cited_by);
+	graph->cited_by = NULL;
+err:
+	return -1;
+}
+
+struct graph_t *graph_alloc_indexed(struct book_t *nodes, size_t count, struct graph_index_t *index)
+{
+	struct graph_t *graph = malloc(sizeof(*graph));
+	if (!graph)
+		goto err;
+	memset(graph, 0, sizeof(*graph));
+
+	graph->nodes = nodes;
+	graph->count = count;
+	graph->reserved = count;
+
+	/* With an index, everything is built lazily on the first compaction. */
+	graph->index = index;
+	if (!index && graph_build(graph) < 0)
+		goto err_free_graph;
+
+	pthread_rwlock_init(&graph->lock, NULL);
+	pthread_mutex_init(&graph->delta_lock, NULL);
+	pthread_mutex_init(&graph->rank_lock, NULL);
+	pthread_cond_init(&graph->compactor_cond, NULL);
+
+	/* Only take the mapping once nothing can fail, since the caller frees @nodes on error. */
+	graph->shm = graph_shm_take(nodes);
+	return graph;
+
+err_free_graph:
+	free(graph);
+err:
+	return NULL;
+}
+
+struct graph_t *graph_alloc(struct book_t *nodes, size_t count)
+{
+	return graph_alloc_indexed(nodes, count, NULL);
+}
+
+void graph_free(struct graph_t *graph)
+{
+	if (!graph)
+		return;
+
+	graph_compactor_stop(graph);
+
+	for (size_t i = 0; i < graph->count; i++) {
+		book_clear(graph, &graph->nodes[i]);
+		if (graph->cited_by)
+			adj_free(&graph->cited_by[i]);
+	}
+	big_free(graph->nodes);
+	big_free(graph->cited_by);
+
+	for (int group = 0; group < NUM_GROUPS; group++)
+		group_table_free(&graph->groups[group]);
+
+	free(graph->delta);
+	adj_free(&graph->free_slots);
+	graph_shm_release(graph->shm);
+	graph_index_close(graph->index);
+	graph_rank_free(graph->rank);
+
+	pthread_cond_destroy(&graph->compactor_cond);
+	pthread_mutex_destroy(&graph->rank_lock);
+	pthread_mutex_destroy(&graph->delta_lock);
+	pthread_rwlock_destroy(&graph->lock);
+	free(graph);
+}
+
+void graph_read_lock(struct graph_t *graph)
+{
+	pthread_rwlock_rdlock(&graph->lock);
+}
+
+void graph_read_unlock(struct graph_t *graph)
+{
+	pthread_rwlock_unlock(&graph->lock);
+}
+
+ssize_t graph_lookup(struct graph_t *graph, int group, size_t key)
+{
+	if (group < 0 || group >= NUM_GROUPS)
+		return -1;
+	if (graph->index)
+		return graph_index_lookup(graph->index, group, key);
+
+	struct group_t *found = group_table_find(&graph->groups[group], key);
+	if (!found || !found->members.n_edges)
+		return -1;
+
+	/* Return the lowest index, to match what a linear search would find. */
+	size_t idx = found->members.edges[0];
+	for (size_t i = 1; i < found->members.n_edges; i++)
+		if (found->members.edges[i] < idx)
+			idx = found->members.edges[i];
+	return idx;
+}
+
+ssize_t graph_component(struct graph_t *graph, size_t idx)
+{
+	if (!graph->index || idx >= graph->count)
+		return -1;
+	return graph_index_component(graph->index, idx);
+}
+
+const struct rank_t *graph_rank_get(struct graph_t *graph, int scoring)
+{
+	struct rank_t *rank = NULL;
+	struct rank_params_t params;
+
+	rank_params_default(&params);
+	params.hits = scoring == RANK_AUTHORITY || scoring == RANK_HUB;
+
+	/*
+	 * Readers share the read lock, so they have to agree on who computes the
+	 * scores. HITS is only computed once something asks for it, since it
+	 * converges a lot slower than PageRank.
+	 */
+	pthread_mutex_lock(&graph->rank_lock);
+	if (!graph->rank)
+		graph->rank = graph_rank(graph->nodes, graph->count, &params);
+	else if (graph_rank_update(graph->rank, graph->nodes, graph->count, &params) < 0)
+		goto out;
+	rank = graph->rank;
+out:
+	pthread_mutex_unlock(&graph->rank_lock);
+	return rank;
+}
+
+/* Appends to the delta buffer. Must be called with ->delta_lock held. */
+static int __graph_queue(struct graph_t *graph, struct graph_delta_t delta)
+{
+	if (graph->n_delta >= graph->delta_cap) {
+		size_t cap = graph->delta_cap ? graph->delta_cap * 2 : 64;
+		struct graph_delta_t *buf = realloc(graph->delta, cap * sizeof(*buf));
+		if (!buf)
+			return -1;
+		graph->delta = buf;
+		graph->delta_cap = cap;
+	}
+	graph->delta[graph->n_delta++] = delta;
+
+	/* Kick the compactor if the buffer is getting big. */
+	if (graph->compactor_running && graph->n_delta > graph->compactor_threshold)
+		pthread_cond_signal(&graph->compactor_cond);
+	return 0;
+}
+
+ssize_t graph_insert_book(struct graph_t *graph, size_t id, size_t author_id, size_t publisher_id)
+{
+	if (!graph || id == BOOK_ID_NONE)
+		return -1;
+
+	pthread_mutex_lock(&graph->delta_lock);
+
+	/* Prefer recycling slots from deleted books. */
+	size_t idx;
+	if (graph->free_slots.n_edges)
+		idx = graph->free_slots.edges[--graph->free_slots.n_edges];
+	else
+		idx = graph->reserved++;
+
+	int err = __graph_queue(graph, (struct graph_delta_t) {
+		.op = DELTA_BOOK_INSERT,
+		.src = idx,
+		.id = id,
+		.author_id = author_id,
+		.publisher_id = publisher_id,
+	});
+	if (err < 0) {
+		/* Give the slot back. */
+		adj_push(&graph->free_slots, idx);
+	}
+
+	pthread_mutex_unlock(&graph->delta_lock);
+	return err < 0 ? err : (ssize_t) idx;
+}
+
+int graph_remove_book(struct graph_t *graph, size_t idx)
+{
+	if (!graph)
+		return -1;
+
+	pthread_mutex_lock(&graph->delta_lock);
+	int err = -1;
+	if (idx < graph->reserved)
+		err = __graph_queue(graph, (struct graph_delta_t) {
+			.op = DELTA_BOOK_REMOVE,
+			.src = idx,
+		});
+	pthread_mutex_unlock(&graph->delta_lock);
+	return err;
+}
+
+static int graph_queue_edge(struct graph_t *graph, int op, int type, size_t src, size_t dst)
+{
+	if (!graph)
+		return -1;
+	if (type != EDGE_AUTHOR && type != EDGE_CITATION && type != EDGE_PUBLISHER)
+		return -1;
+
+	pthread_mutex_lock(&graph->delta_lock);
+	int err = -1;
+	if (src < graph->reserved && dst < graph->reserved)
+		err = __graph_queue(graph, (struct graph_delta_t) {
+			.op = op,
+			.type = type,
+			.src = src,
+			.dst = dst,
+		});
+	pthread_mutex_unlock(&graph->delta_lock);
+	return err;
+}
+
+int graph_add_edge(struct graph_t *graph, int type, size_t src, size_t dst)
+{
+	return graph_queue_edge(graph, DELTA_EDGE_ADD, type, src, dst);
+}
+
+int graph_remove_edge(struct graph_t *graph, int type, size_t src, size_t dst)
+{
+	return graph_queue_edge(graph, DELTA_EDGE_REMOVE, type, src, dst);
+}
+
+/*
+ * edge_op_t is a single (directed) edge change, generated from the delta
+ * buffer during compaction. ->seq is used to keep the sort stable, so that
+ * changes to the same node are applied in the order they were made.
+ */
+struct edge_op_t {
+	size_t src, dst;
+	size_t seq;
+	uint8_t type;
+	uint8_t op;
+};
+
+struct edge_ops_t {
+	struct edge_op_t *ops;
+	size_t n_ops, cap;
+};
+
+static int edge_ops_push(struct edge_ops_t *ops, uint8_t op, uint8_t type, size_t src, size_t dst)
+{
+	if (ops->n_ops >= ops->cap) {
+		size_t cap = ops->cap ? ops->cap * 2 : 64;
+		struct edge_op_t *buf = realloc(ops->ops, cap * sizeof(*buf));
+		if (!buf)
+			return -1;
+		ops->ops = buf;
+		ops->cap = cap;
+	}
+	ops->ops[ops->n_ops] = (struct edge_op_t) {
+		.src = src,
+		.dst = dst,
+		.seq = ops->n_ops,
+		.type = type,
+		.op = op,
+	};
+	ops->n_ops++;
+	return 0;
+}
+
+/* Pushes both directions of a symmetric edge. */
+static int edge_ops_push_sym(struct edge_ops_t *ops, uint8_t op, uint8_t type, size_t a, size_t b)
+{
+	if (edge_ops_push(ops, op, type, a, b) < 0)
+		return -1;
+	return edge_ops_push(ops, op, type, b, a);
+}
+
+static int edge_op_cmp(const void *a, const void *b)
+{
+	const struct edge_op_t *x = a, *y = b;
+
+	if (x->src != y->src)
+		return x->src < y->src ? -1 : 1;
+	if (x->type != y->type)
+		return x->type < y->type ? -1 : 1;
+	if (x->seq != y->seq)
+		return x->seq < y->seq ? -1 : 1;
+	return 0;
+}
+
+/* Fills a reserved slot, linking it into its author and publisher groups. */
+static int graph_apply_insert(struct graph_t *graph, struct graph_delta_t *delta, struct edge_ops_t *ops)
+{
+	size_t idx = delta->src;
+	struct book_t *book = &graph->nodes[idx];
+	if (!book_is_dead(book))
+		return 0;
+
+	book->id = delta->id;
+	book->author_id = delta->author_id;
+	book->publisher_id = delta->publisher_id;
+
+	struct group_t *authors = group_table_find(&graph->groups[GROUP_AUTHOR], book->author_id);
+	if (authors)
+		for (size_t i = 0; i < authors->members.n_edges; i++)
+			if (edge_ops_push_sym(ops, DELTA_EDGE_ADD, EDGE_AUTHOR, idx, authors->members.edges[i]) < 0)
+				return -1;
+
+	struct group_t *publishers = group_table_find(&graph->groups[GROUP_PUBLISHER], book->publisher_id);
+	if (publishers)
+		for (size_t i = 0; i < publishers->members.n_edges; i++)
+			if (edge_ops_push_sym(ops, DELTA_EDGE_ADD, EDGE_PUBLISHER, idx, publishers->members.edges[i]) < 0)
+				return -1;
+
+	for (int group = 0; group < NUM_GROUPS; group++)
+		if (group_table_add(&graph->groups[group], book_key(book, group), idx) < 0)
+			return -1;
+	return 0;
+}
+
+/* Turns a node into a tombstone, unlinking every edge that touches it. */
+static int graph_apply_remove(struct graph_t *graph, struct graph_delta_t *delta, struct edge_ops_t *ops, struct adj_t *freed)
+{
+	size_t idx = delta->src;
+	struct book_t *book = &graph->nodes[idx];
+	if (book_is_dead(book))
+		return 0;
+
+	/* Author and publisher edges are symmetric. */
+	for (size_t i = 0; i < book->n_author_edges; i++)
+		if (edge_ops_push(ops, DELTA_EDGE_REMOVE, EDGE_AUTHOR, book->b_author_edges[i], idx) < 0)
+			return -1;
+	for (size_t i = 0; i < book->n_publisher_edges; i++)
+		if (edge_ops_push(ops, DELTA_EDGE_REMOVE, EDGE_PUBLISHER, book->b_publisher_edges[i], idx) < 0)
+			return -1;
+
+	/* Citations need the reverse adjacency. */
+	struct adj_t *citers = &graph->cited_by[idx];
+	for (size_t i = 0; i < citers->n_edges; i++)
+		if (edge_ops_push(ops, DELTA_EDGE_REMOVE, EDGE_CITATION, citers->edges[i], idx) < 0)
+			return -1;
+	for (size_t i = 0; i < book->n_citation_edges; i++) {
+		struct adj_t *rev = &graph->cited_by[book->b_citation_edges[i]];
+		adj_remove(rev->edges, &rev->n_edges, idx);
+	}
+
+	for (int group = 0; group < NUM_GROUPS; group++)
+		group_table_remove(&graph->groups[group], book_key(book, group), idx);
+
+	adj_free(citers);
+	book_clear(graph, book);
+	return adj_push(freed, idx);
+}
+
+/*
+ * Applies a run of edge changes to a single (src, type) edge list. The new
+ * list is built separately and swapped in, so each list is only reallocated
+ * once per compaction no matter how many edges were added.
+ */
+static int graph_apply_edges(struct graph_t *graph, struct edge_op_t *ops, size_t n_ops)
+{
+	size_t src = ops[0].src;
+	int type = ops[0].type;
+	struct book_t *book = &graph->nodes[src];
+
+	/* Nothing to remove from, and nothing should be added to, dead nodes. */
+	if (book_is_dead(book))
+		return 0;
+
+	size_t **b_edges = NULL, *n_edges = NULL;
+	book_edges(book, type, &b_edges, &n_edges);
+
+	size_t n_adds = 0;
+	for (size_t i = 0; i < n_ops; i++)
+		if (ops[i].op == DELTA_EDGE_ADD)
+			n_adds++;
+
+	size_t n_new = *n_edges;
+	size_t *edges = malloc((n_new + n_adds + 1) * sizeof(*edges));
+	if (!edges)
+		return -1;
+	if (n_new)
+		memcpy(edges, *b_edges, n_new * sizeof(*edges));
+
+	for (size_t i = 0; i < n_ops; i++) {
+		size_t dst = ops[i].dst;
+
+		switch (ops[i].op) {
+		case DELTA_EDGE_ADD:
+			if (book_is_dead(&graph->nodes[dst]))
+				break;
+			/* Author and publisher edges are sets, citations are not. */
+			if (type != EDGE_CITATION && (dst == src || adj_contains(edges, n_new, dst)))
+				break;
+			edges[n_new++] = dst;
+			if (type == EDGE_CITATION && adj_push(&graph->cited_by[dst], src) < 0)
+				goto err;
+			break;
+		case DELTA_EDGE_REMOVE:
+			if (!adj_remove(edges, &n_new, dst))
+				break;
+			if (type == EDGE_CITATION) {
+				struct adj_t *rev = &graph->cited_by[dst];
+				adj_remove(rev->edges, &rev->n_edges, src);
+			}
+			break;
+		}
+	}
+
+	graph_shm_edges_free(graph->shm, *b_edges);
+	*b_edges = edges;
+	*n_edges = n_new;
+	return 0;
+
+err:
+	free(edges);
+	return -1;
+}
+
+/* Grows the node array to cover every reserved slot. */
+static int graph_grow(struct graph_t *graph, size_t reserved)
+{
+	if (reserved <= graph->count)
+		return 0;
+
+	struct book_t *nodes = big_realloc(graph->nodes, reserved * sizeof(*nodes));
+	if (!nodes)
+		return -1;
+	graph->nodes = nodes;
+
+	struct adj_t *cited_by = big_realloc(graph->cited_by, reserved * sizeof(*cited_by));
+	if (!cited_by)
+		return -1;
+	graph->cited_by = cited_by;
+
+	/* Reserved slots start out dead, until their insert is applied. */
+	for (size_t i = graph->count; i < reserved; i++) {
+		graph->nodes[i] = (struct book_t) {
+			.id = BOOK_ID_NONE,
+			.author_id = BOOK_ID_NONE,
+			.publisher_id = BOOK_ID_NONE,
+		};
+		graph->cited_by[i] = (struct adj_t) {0};
+	}
+	graph->count = reserved;
+	return 0;
+}
+
+int graph_compact(struct graph_t *graph)
+{
+	int err = -1;
+	if (!graph)
+		return -1;
+
+	/* Steal the delta buffer, so mutators don't have to wait for us. */
+	pthread_mutex_lock(&graph->delta_lock);
+	struct graph_delta_t *delta = graph->delta;
+	size_t n_delta = graph->n_delta;
+	size_t reserved = graph->reserved;
+	graph->delta = NULL;
+	graph->n_delta = graph->delta_cap = 0;
+	pthread_mutex_unlock(&graph->delta_lock);
+
+	if (!n_delta) {
+		free(delta);
+		return 0;
+	}
+
+	struct edge_ops_t ops = {0};
+	struct adj_t freed = {0};
+
+	pthread_rwlock_wrlock(&graph->lock);
+
+	/* The sidecar index only describes the graph as it was loaded. */
+	if (graph->index) {
+		if (graph_build(graph) < 0)
+			goto out;
+		graph_index_close(graph->index);
+		graph->index = NULL;
+	}
+
+	if (graph_grow(graph, reserved) < 0)
+		goto out;
+
+	/*
+	 * Node changes are applied first (in order), and generate the edge changes
+	 * needed to keep the author and publisher groups connected. Edge changes
+	 * involving nodes that end up dead are dropped when they are applied.
+	 */
+	for (size_t i = 0; i < n_delta; i++) {
+		struct graph_delta_t *d = &delta[i];
+		int ret = 0;
+
+		switch (d->op) {
+		case DELTA_BOOK_INSERT:
+			ret = graph_apply_insert(graph, d, &ops);
+			break;
+		case DELTA_BOOK_REMOVE:
+			ret = graph_apply_remove(graph, d, &ops, &freed);
+			break;
+		case DELTA_EDGE_ADD:
+		case DELTA_EDGE_REMOVE:
+			if (d->type == EDGE_CITATION)
+				ret = edge_ops_push(&ops, d->op, d->type, d->src, d->dst);
+			else
+				ret = edge_ops_push_sym(&ops, d->op, d->type, d->src, d->dst);
+			break;
+		}
+		if (ret < 0)
+			goto out;
+	}
+
+	/* Group by (src, type) and apply each edge list in one go. */
+	qsort(ops.ops, ops.n_ops, sizeof(*ops.ops), edge_op_cmp);
+	for (size_t i = 0; i < ops.n_ops; ) {
+		size_t j = i + 1;
+		while (j < ops.n_ops && ops.ops[j].src == ops.ops[i].src && ops.ops[j].type == ops.ops[i].type)
+			j++;
+		if (graph_apply_edges(graph, ops.ops + i, j - i) < 0)
+			goto out;
+		i = j;
+	}
+
+	err = 0;
+out:
+	/* Even on failure the graph has changed, so drop any cached results. */
+	graph->generation++;
+	qcache_invalidate(graph->cache);
+	graph_rank_free(graph->rank);
+	graph->rank = NULL;
+	pthread_rwlock_unlock(&graph->lock);
+
+	/* Slots from deleted books can now be recycled. */
+	pthread_mutex_lock(&graph->delta_lock);
+	for (size_t i = 0; i < freed.n_edges; i++)
+		adj_push(&graph->free_slots, freed.edges[i]);
+	pthread_mutex_unlock(&graph->delta_lock);
+
+	adj_free(&freed);
+	free(ops.ops);
+	free(delta);
+	return err;
+}
+
+static void *graph_compactor(void *arg)
+{
+	struct graph_t *graph = arg;
+
+	pthread_mutex_lock(&graph->delta_lock);
+	while (graph->compactor_running) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += graph->compactor_interval_ms / 1000;
+		deadline.tv_nsec += (graph->compactor_interval_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		pthread_cond_timedwait(&graph->compactor_cond, &graph->delta_lock, &deadline);
+		if (!graph->compactor_running || !graph->n_delta)
+			continue;
+
+		pthread_mutex_unlock(&graph->delta_lock);
+		graph_compact(graph);
+		pthread_mutex_lock(&graph->delta_lock);
+	}
+	pthread_mutex_unlock(&graph->delta_lock);
+	return NULL;
+}
+
+int graph_compactor_start(struct graph_t *graph, unsigned interval_ms, size_t threshold)
+{
+	if (!graph)
+		return -1;
+
+	pthread_mutex_lock(&graph->delta_lock);
+	if (graph->compactor_running) {
+		pthread_mutex_unlock(&graph->delta_lock);
+		return -1;
+	}
+	graph->compactor_running = true;
+	graph->compactor_interval_ms = interval_ms;
+	graph->compactor_threshold = threshold;
+	pthread_mutex_unlock(&graph->delta_lock);
+
+	int err = pthread_create(&graph->compactor, NULL, graph_compactor, graph);
+	if (err) {
+		graph->compactor_running = false;
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+void graph_compactor_stop(struct graph_t *graph)
+{
+	pthread_mutex_lock(&graph->delta_lock);
+	bool running = graph->compactor_running;
+	graph->compactor_running = false;
+	pthread_cond_signal(&graph->compactor_cond);
+	pthread_mutex_unlock(&graph->delta_lock);
+
+	if (running)
+		pthread_join(graph->compactor, NULL);
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(GRAPH_H)
+#define GRAPH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "worm.h"
+#include "cache.h"
+#include "index.h"
+#include "rank.h"
+
+/* Sentinel used for the ids of deleted (or not-yet-inserted) books. */
+#define BOOK_ID_NONE SIZE_MAX
+
+/* Edge types, used by the mutation API. */
+enum {
+	EDGE_AUTHOR,
+	EDGE_CITATION,
+	EDGE_PUBLISHER,
+};
+
+/* 64-bit mixer from splitmix64. */
+static inline uint64_t graph_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* Grouping tables maintained by graph_t. */
+enum {
+	GROUP_BOOK,
+	GROUP_AUTHOR,
+	GROUP_PUBLISHER,
+	NUM_GROUPS,
+};
+
+/* adj_t is a growable list of node indices. */
+struct adj_t {
+	size_t *edges;
+	size_t n_edges, cap;
+};
+
+/* group_t is the set of node indices that share a particular key. */
+struct group_t {
+	size_t key;
+	struct adj_t members;
+};
+
+/*
+ * group_table_t maps a key (book, author or publisher id) to the group_t of
+ * nodes with that key. ->slots is an open-addressing table of indices into
+ * ->groups (SIZE_MAX marks an empty slot).
+ */
+struct group_table_t {
+	size_t *slots;
+	size_t n_slots;
+	struct group_t *groups;
+	size_t n_groups, cap;
+};
+
+/* Pending mutations, stored in the delta buffer until the next compaction. */
+enum {
+	DELTA_BOOK_INSERT,
+	DELTA_BOOK_REMOVE,
+	DELTA_EDGE_ADD,
+	DELTA_EDGE_REMOVE,
+};
+
+struct graph_delta_t {
+	uint8_t op;
+	uint8_t type;
+	size_t src, dst;
+	/* Only used by DELTA_BOOK_INSERT. */
+	size_t id, author_id, publisher_id;
+};
+
+/*
+ * graph_t wraps a graph loaded with graph_load so that it can be mutated in
+ * place. Mutations are appended to a delta buffer (which is cheap and doesn't
+ * block readers), and are only applied to the adjacency lists in ->nodes when
+ * the graph is compacted. Readers must hold the read lock while using ->nodes
+ * (and any result_t that points into it), since compaction may move it.
+ */
+struct graph_t {
+	pthread_rwlock_t lock;
+
+	struct book_t *nodes;
+	size_t count;
+
+	/*
+	 * If ->nodes was attached to a shared memory segment, its edge lists are
+	 * read-only until compaction replaces them with private copies.
+	 */
+	struct graph_shm_t *shm;
+
+	/*
+	 * Sidecar index (see index.h). While this is set, ->cited_by and ->groups
+	 * haven't been built yet and lookups go to the index instead. They are
+	 * built (and the index dropped) on the first compaction.
+	 */
+	struct graph_index_t *index;
+
+	/* Reverse citation adjacency (who cites ->nodes[i]). */
+	struct adj_t *cited_by;
+
+	/* Id indexes. */
+	struct group_table_t groups[NUM_GROUPS];
+
+	/* Influence scores, computed on first use and dropped by compaction. */
+	pthread_mutex_t rank_lock;
+	struct rank_t *rank;
+
+	/* Bumped on every compaction that changed something. */
+	uint64_t generation;
+	/* If set, invalidated whenever the graph changes. */
+	struct query_cache_t *cache;
+
+	/* Protects everything below. */
+	pthread_mutex_t delta_lock;
+
+	/* Delta buffer. */
+	struct graph_delta_t *delta;
+	size_t n_delta, delta_cap;
+
+	/* Node slots handed out to inserts. Deleted slots are recycled. */
+	size_t reserved;
+	struct adj_t free_slots;
+
+	/* Background compaction. */
+	pthread_t compactor;
+	pthread_cond_t compactor_cond;
+	bool compactor_running;
+	unsigned compactor_interval_ms;
+	size_t compactor_threshold;
+};
+
+/*
+ * Loading and saving of graphs (see load.c). graph_open will load graphs in
+ * either the text or binary formats, and graphs returned by any of these must
+ * be freed with graph_unload (or handed to graph_alloc).
+ */
+struct book_t *graph_load(char *filename, size_t *count);
+struct book_t *graph_load_binary(char *filename, size_t *count);
+struct book_t *graph_open(char *filename, size_t *count);
+int graph_save_binary(char *filename, struct book_t *nodes, size_t count);
+void graph_unload(struct book_t *nodes, size_t count);
+
+/*
+ * Shared memory graphs (see load.c). graph_shm_publish stores a graph in a
+ * named segment, and graph_shm_attach (or graph_open with GRAPH_SHM_PREFIX)
+ * gives a graph whose edge lists are read-only and shared with every other
+ * process attached to that segment. Attached graphs are freed with
+ * graph_unload as usual.
+ */
+#define GRAPH_SHM_PREFIX "shm:"
+
+struct graph_shm_t;
+
+int graph_shm_publish(char *name, struct book_t *nodes, size_t count);
+struct book_t *graph_shm_attach(char *name, size_t *count);
+struct graph_shm_t *graph_shm_take(struct book_t *nodes);
+void graph_shm_release(struct graph_shm_t *shm);
+void graph_shm_edges_free(struct graph_shm_t *shm, size_t *edges);
+
+/*
+ * Allocation and free routines for graph_t. graph_alloc takes ownership of
+ * @nodes (which must have been allocated by graph_load or attached with
+ * graph_shm_attach). graph_alloc_indexed also takes ownership of @index (if
+ * it succeeds), which must have been opened for the same graph.
+ */
+struct graph_t *graph_alloc(struct book_t *nodes, size_t count);
+struct graph_t *graph_alloc_indexed(struct book_t *nodes, size_t count, struct graph_index_t *index);
+void graph_free(struct graph_t *graph);
+
+/* Must be held while accessing ->nodes or results pointing into it. */
+void graph_read_lock(struct graph_t *graph);
+void graph_read_unlock(struct graph_t *graph);
+
+/*
+ * Looks up a node index by id in one of the GROUP_* tables. Returns < 0 if
+ * there is no such node. Caller must hold the read lock.
+ */
+ssize_t graph_lookup(struct graph_t *graph, int group, size_t key);
+
+/*
+ * Returns the (weakly connected) component label of a node, or < 0 if the
+ * graph has no index. Books in different components can't reach each other.
+ * Caller must hold the read lock.
+ */
+ssize_t graph_component(struct graph_t *graph, size_t idx);
+
+/*
+ * Returns the influence scores for the graph, computing @scoring (RANK_*) if
+ * this is the first time it has been needed since the last compaction. Returns
+ * NULL if it couldn't be computed. Caller must hold the read lock.
+ */
+const struct rank_t *graph_rank_get(struct graph_t *graph, int scoring);
+
+/*
+ * Mutations. These are queued in the delta buffer and become visible after
+ * the next graph_compact. Inserting a book also links it to every other book
+ * with the same author and publisher. Author and publisher edges are
+ * symmetric, so adding or removing one also changes the reverse edge. Return
+ * value is < 0 if an error occurred.
+ */
+ssize_t graph_insert_book(struct graph_t *graph, size_t id, size_t author_id, size_t publisher_id);
+int graph_remove_book(struct graph_t *graph, size_t idx);
+int graph_add_edge(struct graph_t *graph, int type, size_t src, size_t dst);
+int graph_remove_edge(struct graph_t *graph, int type, size_t src, size_t dst);
+
+/* Applies the delta buffer to the graph. */
+int graph_compact(struct graph_t *graph);
+
+/*
+ * Starts (or stops) a background thread that compacts the graph every
+ * @interval_ms, or sooner if the delta buffer has more than @threshold
+ * entries.
+ */
+int graph_compactor_start(struct graph_t *graph, unsigned interval_ms, size_t threshold);
+void graph_compactor_stop(struct graph_t *graph);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "worm.h"
+#include "cache.h"
+#include "graph.h"
+#include "handle.h"
+
+/* How long the loader sleeps between checks for drained readers. */
+#define HANDLE_DRAIN_USEC 1000
+
+struct graph_handle_t *graph_handle_alloc(struct graph_t *graph, struct query_cache_t *cache)
+{
+	struct graph_handle_t *handle = malloc(sizeof(*handle));
+	if (!handle)
+		return NULL;
+	memset(handle, 0, sizeof(*handle));
+
+	/* Epoch 0 is reserved for "not reading". */
+	atomic_init(&handle->epoch, 1);
+	for (size_t i = 0; i < HANDLE_MAX_READERS; i++) {
+		atomic_init(&handle->readers[i].epoch, 0);
+		atomic_init(&handle->readers[i].in_use, false);
+	}
+
+	struct graph_snapshot_t *snap = NULL;
+	if (graph) {
+		snap = malloc(sizeof(*snap));
+		if (!snap) {
+			free(handle);
+			return NULL;
+		}
+		*snap = (struct graph_snapshot_t) { .graph = graph };
+		graph->cache = cache;
+	}
+	atomic_init(&handle->current, snap);
+
+	handle->cache = cache;
+	pthread_mutex_init(&handle->retire_lock, NULL);
+	pthread_mutex_init(&handle->reload_lock, NULL);
+	return handle;
+}
+
+static void snapshot_free(struct graph_snapshot_t *snap)
+{
+	if (snap)
+		graph_free(snap->graph);
+	free(snap);
+}
+
+void graph_handle_free(struct graph_handle_t *handle)
+{
+	if (!handle)
+		return;
+
+	graph_handle_wait(handle);
+
+	struct graph_snapshot_t *snap = handle->retired;
+	while (snap) {
+		struct graph_snapshot_t *next = snap->next;
+		snapshot_free(snap);
+		snap = next;
+	}
+	snapshot_free(atomic_load(&handle->current));
+
+	pthread_mutex_destroy(&handle->reload_lock);
+	pthread_mutex_destroy(&handle->retire_lock);
+	free(handle);
+}
+
+int graph_reader_register(struct graph_handle_t *handle, struct graph_reader_t *reader)
+{
+	for (int i = 0; i < HANDLE_MAX_READERS; i++) {
+		bool expected = false;
+		if (atomic_compare_exchange_strong(&handle->readers[i].in_use, &expected, true)) {
+			*reader = (struct graph_reader_t) {
+				.handle = handle,
+				.slot = i,
+			};
+			return 0;
+		}
+	}
+	errno = EBUSY;
+	return -1;
+}
+
+void graph_reader_unregister(struct graph_reader_t *reader)
+{
+	struct reader_slot_t *slot = &reader->handle->readers[reader->slot];
+
+	atomic_store(&slot->epoch, 0);
+	atomic_store(&slot->in_use, false);
+}
+
+/*
+ * The ordering here is what makes reclamation safe. The reader announces the
+ * epoch it observed *before* loading ->current, and the publisher swaps
+ * ->current *before* bumping the epoch and scanning the announcements. So if
+ * the publisher doesn't see our announcement, we must see the new snapshot.
+ * All of these are sequentially consistent atomics.
+ */
+struct graph_t *graph_reader_enter(struct graph_reader_t *reader)
+{
+	struct graph_handle_t *handle = reader->handle;
+	struct reader_slot_t *slot = &handle->readers[reader->slot];
+
+	atomic_store(&slot->epoch, atomic_load(&handle->epoch));
+	struct graph_snapshot_t *snap = atomic_load(&handle->current);
+	return snap ? snap->graph : NULL;
+}
+
+void graph_reader_exit(struct graph_reader_t *reader)
+{
+	atomic_store(&reader->handle->readers[reader->slot].epoch, 0);
+}
+
+/* Returns the oldest epoch announced by an active reader (or UINT64_MAX). */
+static uint64_t graph_handle_min_epoch(struct graph_handle_t *handle)
+{
+	uint64_t min = UINT64_MAX;
+
+	for (size_t i = 0; i < HANDLE_MAX_READERS; i++) {
+		uint64_t epoch = atomic_load(&handle->readers[i].epoch);
+		if (epoch && epoch < min)
+			min = epoch;
+	}
+	return min;
+}
+
+void graph_handle_reclaim(struct graph_handle_t *handle)
+{
+	struct graph_snapshot_t *dead = NULL;
+
+	pthread_mutex_lock(&handle->retire_lock);
+	uint64_t min = graph_handle_min_epoch(handle);
+
+	/*
+	 * A snapshot retired at epoch E can only be seen by readers that
+	 * announced an epoch < E.
+	 */
+	struct graph_snapshot_t **pp = &handle->retired;
+	while (*pp) {
+		struct graph_snapshot_t *snap = *pp;
+		if (snap->retire_epoch <= min) {
+			*pp = snap->next;
+			snap->next = dead;
+			dead = snap;
+		} else {
+			pp = &snap->next;
+		}
+	}
+	pthread_mutex_unlock(&handle->retire_lock);
+
+	/* Free outside of the lock, this can take a while for big graphs. */
+	while (dead) {
+		struct graph_snapshot_t *next = dead->next;
+		snapshot_free(dead);
+		dead = next;
+	}
+}
+
+int graph_handle_publish(struct graph_handle_t *handle, struct graph_t *graph)
+{
+	struct graph_snapshot_t *snap = malloc(sizeof(*snap));
+	if (!snap)
+		return -1;
+	*snap = (struct graph_snapshot_t) { .graph = graph };
+	graph->cache = handle->cache;
+
+	struct graph_snapshot_t *old = atomic_exchange(&handle->current, snap);
+	uint64_t epoch = atomic_fetch_add(&handle->epoch, 1) + 1;
+
+	/* Results cached from the old graph are now meaningless. */
+	qcache_invalidate(handle->cache);
+
+	if (old) {
+		old->retire_epoch = epoch;
+		pthread_mutex_lock(&handle->retire_lock);
+		old->next = handle->retired;
+		handle->retired = old;
+		pthread_mutex_unlock(&handle->retire_lock);
+	}
+
+	graph_handle_reclaim(handle);
+	return 0;
+}
+
+static int graph_handle_load(struct graph_handle_t *handle)
+{
+	size_t count = 0;
+
+	struct book_t *nodes = graph_open(handle->path, &count);
+	if (!nodes)
+		return -1;
+
+	struct graph_index_t *index = graph_index_open(handle->path, nodes, count);
+	struct graph_t *graph = graph_alloc_indexed(nodes, count, index);
+	if (!graph) {
+		graph_index_close(index);
+		graph_unload(nodes, count);
+		return -1;
+	}
+
+	if (graph_handle_publish(handle, graph) < 0) {
+		graph_free(graph);
+		return -1;
+	}
+
+	/* Wait for the readers of the old graph to drain, so it is freed promptly. */
+	while (true) {
+		graph_handle_reclaim(handle);
+
+		pthread_mutex_lock(&handle->retire_lock);
+		bool drained = !handle->retired;
+		pthread_mutex_unlock(&handle->retire_lock);
+		if (drained)
+			break;
+
+		usleep(HANDLE_DRAIN_USEC);
+	}
+	return 0;
+}
+
+static void *graph_handle_loader(void *arg)
+{
+	struct graph_handle_t *handle = arg;
+
+	handle->status = graph_handle_load(handle);
+	atomic_store(&handle->finished, true);
+	return NULL;
+}
+
+int graph_handle_reload(struct graph_handle_t *handle, const char *path)
+{
+	int err = -1;
+
+	pthread_mutex_lock(&handle->reload_lock);
+	if (handle->loading) {
+		if (!atomic_load(&handle->finished)) {
+			errno = EBUSY;
+			goto out;
+		}
+		/* The last reload is done, so this won't block. */
+		pthread_join(handle->loader, NULL);
+		handle->loading = false;
+	}
+
+	free(handle->path);
+	handle->path = strdup(path);
+	if (!handle->path)
+		goto out;
+
+	atomic_store(&handle->finished, false);
+	int ret = pthread_create(&handle->loader, NULL, graph_handle_loader, handle);
+	if (ret) {
+		errno = ret;
+		goto out;
+	}
+	handle->loading = true;
+	err = 0;
+
+out:
+	pthread_mutex_unlock(&handle->reload_lock);
+	return err;
+}
+
+int graph_handle_wait(struct graph_handle_t *handle)
+{
+	int status = 0;
+
+	pthread_mutex_lock(&handle->reload_lock);
+	if (handle->loading) {
+		pthread_join(handle->loader, NULL);
+		handle->loading = false;
+		status = handle->status;
+	}
+	free(handle->path);
+	handle->path = NULL;
+	pthread_mutex_unlock(&handle->reload_lock);
+
+	return status;
+}
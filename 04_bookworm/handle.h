@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(HANDLE_H)
+#define HANDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "worm.h"
+#include "cache.h"
+#include "graph.h"
+
+/* Maximum number of reader threads that can be registered with a handle. */
+#define HANDLE_MAX_READERS 128
+
+/* A published version of the graph. */
+struct graph_snapshot_t {
+	struct graph_t *graph;
+	/* Epoch at which the snapshot was unpublished. */
+	uint64_t retire_epoch;
+	struct graph_snapshot_t *next;
+};
+
+/*
+ * Per-reader epoch announcement. 0 means the reader isn't inside a critical
+ * section. Padded to a cache line to avoid false sharing between readers.
+ */
+struct reader_slot_t {
+	_Atomic uint64_t epoch;
+	atomic_bool in_use;
+	char pad[64 - sizeof(uint64_t) - sizeof(atomic_bool)];
+};
+
+/*
+ * graph_handle_t is an RCU-style container for the "current" graph. Readers
+ * pin the current snapshot for the length of a query, while a new graph can
+ * be published at any time without waiting for them. Unpublished snapshots
+ * are freed once every reader that might have seen them has left its critical
+ * section (epoch-based reclamation).
+ */
+struct graph_handle_t {
+	_Atomic(struct graph_snapshot_t *) current;
+	_Atomic uint64_t epoch;
+	struct reader_slot_t readers[HANDLE_MAX_READERS];
+
+	/* Snapshots waiting for readers to drain. */
+	pthread_mutex_t retire_lock;
+	struct graph_snapshot_t *retired;
+
+	/* If set, invalidated whenever a new graph is published. */
+	struct query_cache_t *cache;
+
+	/* Background reloading. ->finished is set once the loader is done. */
+	pthread_mutex_t reload_lock;
+	pthread_t loader;
+	bool loading;
+	atomic_bool finished;
+	char *path;
+	int status;
+};
+
+/* A registered reader, used to enter and leave read-side critical sections. */
+struct graph_reader_t {
+	struct graph_handle_t *handle;
+	int slot;
+};
+
+/*
+ * Allocation and free routines for graph_handle_t. graph_handle_alloc takes
+ * ownership of @graph (which may be NULL). There must be no readers left when
+ * graph_handle_free is called.
+ */
+struct graph_handle_t *graph_handle_alloc(struct graph_t *graph, struct query_cache_t *cache);
+void graph_handle_free(struct graph_handle_t *handle);
+
+/* Reader registration, each thread should have its own graph_reader_t. */
+int graph_reader_register(struct graph_handle_t *handle, struct graph_reader_t *reader);
+void graph_reader_unregister(struct graph_reader_t *reader);
+
+/*
+ * Enters a read-side critical section, returning the current graph (which
+ * stays valid until graph_reader_exit). Critical sections don't nest. Note
+ * that if the graph is being mutated, the caller must still hold the graph's
+ * own read lock while running queries.
+ */
+struct graph_t *graph_reader_enter(struct graph_reader_t *reader);
+void graph_reader_exit(struct graph_reader_t *reader);
+
+/*
+ * Atomically replaces the current graph with @graph (taking ownership of it).
+ * The old graph is freed once all readers have moved on.
+ */
+int graph_handle_publish(struct graph_handle_t *handle, struct graph_t *graph);
+
+/* Frees any retired snapshots that no reader can still be using. */
+void graph_handle_reclaim(struct graph_handle_t *handle);
+
+/*
+ * Loads the graph at @path (in either format) in a background thread, and
+ * publishes it once it has been loaded. Only one reload can be in progress at
+ * a time, and graph_handle_reload fails with EBUSY (rather than waiting) if
+ * there is one. graph_handle_wait waits for the reload to finish and returns
+ * its status (< 0 if the load failed).
+ */
+int graph_handle_reload(struct graph_handle_t *handle, const char *path);
+int graph_handle_wait(struct graph_handle_t *handle);
+
+#endif
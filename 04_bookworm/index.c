@@ -0,0 +1,554 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+/*
+ * The sidecar format is the following (all integers are native-endian, and
+ * every section is an array of uint64_t, except for the uint32_t component
+ * labels at the end).
+ *
+ *   +-------------------------------+
+ *   | graph_index_header_t          |
+ *   +-------------------------------+
+ *   | cited_by offsets (count + 1)  |
+ *   | cited_by edges               |
+ *   +-------------------------------+
+ *   | for each group:               |
+ *   |   keys (n_groups)             |
+ *   |   slots (n_slots)             |
+ *   |   member offsets (n_groups+1) |
+ *   |   members (count)             |
+ *   +-------------------------------+
+ *   | components (count)            |
+ *   +-------------------------------+
+ *
+ * Every section is referred to by its offset from the start of the file, so
+ * the file can be mapped anywhere. ->slots is an open-addressing table (using
+ * graph_mix, like group_table_t) of indices into ->keys, with UINT64_MAX
+ * marking empty slots. Members of each group are in ascending order.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "worm.h"
+#include "graph.h"
+#include "index.h"
+
+#define GRAPH_INDEX_MAGIC   "WORMIDX\0"
+#define GRAPH_INDEX_VERSION 2
+
+struct graph_index_group_t {
+	uint64_t n_groups;
+	uint64_t n_slots;
+	uint64_t keys;
+	uint64_t slots;
+	uint64_t offsets;
+	uint64_t members;
+};
+
+struct graph_index_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	/* Identifies the graph this index was built from. */
+	uint64_t checksum;
+	uint64_t n_edges;
+	uint64_t count;
+	uint64_t size;
+	uint64_t n_components;
+	uint64_t cited_offsets;
+	uint64_t cited_edges;
+	uint64_t components;
+	struct graph_index_group_t groups[NUM_GROUPS];
+};
+
+struct graph_index_t {
+	char *map;
+	size_t len;
+	struct graph_index_header_t *hdr;
+};
+
+#define INDEX_SECTION(index, offset) ((void *) ((index)->map + (offset)))
+
+static inline uint64_t checksum_edges(uint64_t checksum, size_t *edges, size_t n)
+{
+	checksum = graph_mix(checksum ^ n);
+	for (size_t i = 0; i < n; i++)
+		checksum = graph_mix(checksum ^ edges[i]) + i;
+	return checksum;
+}
+
+/*
+ * Checksums the loaded graph, which is what decides whether a sidecar is
+ * stale. We hash @nodes rather than the graph file, so that the sidecar always
+ * describes the graph that was actually parsed, even if the file was replaced
+ * after it was loaded.
+ */
+static void graph_checksum(struct book_t *nodes, size_t count, uint64_t *checksum, uint64_t *n_edges)
+{
+	*checksum = 0x9e3779b97f4a7c15ULL;
+	*n_edges = 0;
+	for (size_t i = 0; i < count; i++) {
+		struct book_t *book = &nodes[i];
+
+		*checksum = graph_mix(*checksum ^ book->id);
+		*checksum = graph_mix(*checksum ^ book->author_id);
+		*checksum = graph_mix(*checksum ^ book->publisher_id);
+		*checksum = checksum_edges(*checksum, book->b_author_edges, book->n_author_edges);
+		*checksum = checksum_edges(*checksum, book->b_citation_edges, book->n_citation_edges);
+		*checksum = checksum_edges(*checksum, book->b_publisher_edges, book->n_publisher_edges);
+		*n_edges += book->n_author_edges + book->n_citation_edges + book->n_publisher_edges;
+	}
+}
+
+static inline size_t index_key(struct book_t *book, int group)
+{
+	switch (group) {
+	case GROUP_BOOK:
+		return book->id;
+	case GROUP_AUTHOR:
+		return book->author_id;
+	case GROUP_PUBLISHER:
+		return book->publisher_id;
+	}
+	return BOOK_ID_NONE;
+}
+
+/* Union-find with path halving, used to label the components. */
+static size_t uf_find(size_t *parent, size_t x)
+{
+	while (parent[x] != x) {
+		parent[x] = parent[parent[x]];
+		x = parent[x];
+	}
+	return x;
+}
+
+static void uf_union(size_t *parent, size_t a, size_t b)
+{
+	a = uf_find(parent, a);
+	b = uf_find(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+/* Number of slots for @n keys, keeping the load factor under 1/2. */
+static size_t index_slots(size_t n)
+{
+	size_t n_slots = 64;
+	while (n_slots < 2 * n)
+		n_slots *= 2;
+	return n_slots;
+}
+
+static ssize_t index_probe(uint64_t *keys, uint64_t *slots, size_t n_slots, size_t key, size_t *slot)
+{
+	size_t mask = n_slots - 1;
+
+	*slot = graph_mix(key) & mask;
+	while (slots[*slot] != UINT64_MAX) {
+		if (keys[slots[*slot]] == key)
+			return slots[*slot];
+		*slot = (*slot + 1) & mask;
+	}
+	return -1;
+}
+
+/*
+ * Builds the index for @nodes into the file @filename. The group keys are
+ * collected first (so the layout can be computed), and then everything is
+ * written directly into a mapping of the file.
+ */
+static int graph_index_build(char *filename, struct book_t *nodes, size_t count, uint64_t checksum, uint64_t n_edges)
+{
+	struct graph_index_header_t hdr = {
+		.version = GRAPH_INDEX_VERSION,
+		.checksum = checksum,
+		.n_edges = n_edges,
+		.count = count,
+	};
+	uint64_t *keys[NUM_GROUPS] = {0}, *slots[NUM_GROUPS] = {0};
+	size_t *parent = NULL;
+	char *map = MAP_FAILED;
+	int fd = -1, err = -1;
+
+	/* Collect the distinct keys of each group. */
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		struct graph_index_group_t *g = &hdr.groups[group];
+
+		g->n_slots = index_slots(count);
+		keys[group] = malloc((count ? count : 1) * sizeof(**keys));
+		slots[group] = malloc(g->n_slots * sizeof(**slots));
+		if (!keys[group] || !slots[group])
+			goto out;
+		memset(slots[group], 0xff, g->n_slots * sizeof(**slots));
+
+		for (size_t i = 0; i < count; i++) {
+			size_t key = index_key(&nodes[i], group), slot;
+			if (index_probe(keys[group], slots[group], g->n_slots, key, &slot) >= 0)
+				continue;
+			slots[group][slot] = g->n_groups;
+			keys[group][g->n_groups++] = key;
+		}
+	}
+
+	/* Lay out the sections. */
+	size_t n_cited = 0;
+	for (size_t i = 0; i < count; i++)
+		n_cited += nodes[i].n_citation_edges;
+
+	uint64_t offset = sizeof(hdr);
+	hdr.cited_offsets = offset;
+	offset += (count + 1) * sizeof(uint64_t);
+	hdr.cited_edges = offset;
+	offset += n_cited * sizeof(uint64_t);
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		struct graph_index_group_t *g = &hdr.groups[group];
+
+		g->keys = offset;
+		offset += g->n_groups * sizeof(uint64_t);
+		g->slots = offset;
+		offset += g->n_slots * sizeof(uint64_t);
+		g->offsets = offset;
+		offset += (g->n_groups + 1) * sizeof(uint64_t);
+		g->members = offset;
+		offset += count * sizeof(uint64_t);
+	}
+	hdr.components = offset;
+	offset += count * sizeof(uint32_t);
+	hdr.size = offset;
+
+	fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto out;
+	if (ftruncate(fd, hdr.size) < 0)
+		goto out;
+	map = mmap(NULL, hdr.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto out;
+
+	/* Reverse citations, as CSR (counting pass, then fill). */
+	uint64_t *cited_offsets = (void *) (map + hdr.cited_offsets);
+	uint64_t *cited_edges = (void *) (map + hdr.cited_edges);
+	for (size_t i = 0; i < count; i++)
+		for (size_t j = 0; j < nodes[i].n_citation_edges; j++)
+			cited_offsets[nodes[i].b_citation_edges[j] + 1]++;
+	for (size_t i = 0; i < count; i++)
+		cited_offsets[i + 1] += cited_offsets[i];
+	/* Use the offsets as cursors, and then shift them back afterwards. */
+	for (size_t i = 0; i < count; i++)
+		for (size_t j = 0; j < nodes[i].n_citation_edges; j++)
+			cited_edges[cited_offsets[nodes[i].b_citation_edges[j]]++] = i;
+	for (size_t i = count; i > 0; i--)
+		cited_offsets[i] = cited_offsets[i - 1];
+	cited_offsets[0] = 0;
+
+	/* Groups, also as CSR (the members end up sorted since i is ascending). */
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		struct graph_index_group_t *g = &hdr.groups[group];
+		uint64_t *offsets = (void *) (map + g->offsets);
+		uint64_t *members = (void *) (map + g->members);
+
+		memcpy(map + g->keys, keys[group], g->n_groups * sizeof(uint64_t));
+		memcpy(map + g->slots, slots[group], g->n_slots * sizeof(uint64_t));
+
+		for (size_t i = 0; i < count; i++) {
+			size_t slot;
+			ssize_t id = index_probe(keys[group], slots[group], g->n_slots, index_key(&nodes[i], group), &slot);
+			offsets[id + 1]++;
+		}
+		for (size_t i = 0; i < g->n_groups; i++)
+			offsets[i + 1] += offsets[i];
+		for (size_t i = 0; i < count; i++) {
+			size_t slot;
+			ssize_t id = index_probe(keys[group], slots[group], g->n_slots, index_key(&nodes[i], group), &slot);
+			members[offsets[id]++] = i;
+		}
+		for (size_t i = g->n_groups; i > 0; i--)
+			offsets[i] = offsets[i - 1];
+		offsets[0] = 0;
+	}
+
+	/* Weakly connected components, over every kind of edge. */
+	parent = malloc((count ? count : 1) * sizeof(*parent));
+	if (!parent)
+		goto out;
+	for (size_t i = 0; i < count; i++)
+		parent[i] = i;
+	for (size_t i = 0; i < count; i++) {
+		for (size_t j = 0; j < nodes[i].n_author_edges; j++)
+			uf_union(parent, i, nodes[i].b_author_edges[j]);
+		for (size_t j = 0; j < nodes[i].n_citation_edges; j++)
+			uf_union(parent, i, nodes[i].b_citation_edges[j]);
+		for (size_t j = 0; j < nodes[i].n_publisher_edges; j++)
+			uf_union(parent, i, nodes[i].b_publisher_edges[j]);
+	}
+
+	/* Roots are always the smallest member, so labels are handed out in order. */
+	uint32_t *components = (void *) (map + hdr.components);
+	for (size_t i = 0; i < count; i++) {
+		size_t root = uf_find(parent, i);
+		components[i] = root == i ? hdr.n_components++ : components[root];
+	}
+
+	/* Only stamp the magic once everything else is in place. */
+	memcpy(hdr.magic, GRAPH_INDEX_MAGIC, sizeof(hdr.magic));
+	memcpy(map, &hdr, sizeof(hdr));
+	err = msync(map, hdr.size, MS_SYNC);
+
+out:
+	if (map != MAP_FAILED)
+		munmap(map, hdr.size);
+	if (fd >= 0)
+		close(fd);
+	if (err < 0)
+		unlink(filename);
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		free(keys[group]);
+		free(slots[group]);
+	}
+	free(parent);
+	return err;
+}
+
+/* Checks that @n elements of @width bytes at @offset lie within the sidecar. */
+static bool index_section_ok(struct graph_index_header_t *hdr, uint64_t offset, uint64_t n, size_t width)
+{
+	if (offset < sizeof(*hdr) || offset > hdr->size || offset % sizeof(uint64_t))
+		return false;
+	return n <= (hdr->size - offset) / width;
+}
+
+/*
+ * Checks that the @n lists described by @offsets (which has @n + 1 entries) are
+ * in order, cover all @n_values of @values, and only contain values < @bound.
+ */
+static bool index_lists_ok(uint64_t *offsets, uint64_t n, uint64_t *values, uint64_t n_values, uint64_t bound)
+{
+	if (offsets[0] != 0 || offsets[n] != n_values)
+		return false;
+	for (uint64_t i = 0; i < n; i++)
+		if (offsets[i] > offsets[i + 1])
+			return false;
+	for (uint64_t i = 0; i < n_values; i++)
+		if (values[i] >= bound)
+			return false;
+	return true;
+}
+
+/*
+ * Checks the section table and every index stored in the sections, so a
+ * damaged sidecar can't send lookups astray. This is linear in the size of the
+ * sidecar, but that is still much cheaper than rebuilding it.
+ */
+static bool index_sections_ok(struct graph_index_header_t *hdr, char *map)
+{
+	uint64_t count = hdr->count;
+
+	if (!index_section_ok(hdr, hdr->cited_offsets, count + 1, sizeof(uint64_t)))
+		return false;
+	uint64_t *cited_offsets = (void *) (map + hdr->cited_offsets);
+	uint64_t n_cited = cited_offsets[count];
+	if (!index_section_ok(hdr, hdr->cited_edges, n_cited, sizeof(uint64_t)))
+		return false;
+	if (!index_lists_ok(cited_offsets, count, (void *) (map + hdr->cited_edges), n_cited, count))
+		return false;
+
+	if (!index_section_ok(hdr, hdr->components, count, sizeof(uint32_t)))
+		return false;
+	uint32_t *components = (void *) (map + hdr->components);
+	for (uint64_t i = 0; i < count; i++)
+		if (components[i] >= hdr->n_components)
+			return false;
+
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		struct graph_index_group_t *g = &hdr->groups[group];
+
+		/*
+		 * index_probe masks with n_slots - 1, and only stops on a match or an
+		 * empty slot, so there must always be at least one empty slot.
+		 */
+		if (!g->n_slots || g->n_slots & (g->n_slots - 1) || g->n_groups >= g->n_slots)
+			return false;
+		if (!index_section_ok(hdr, g->keys, g->n_groups, sizeof(uint64_t)) ||
+		    !index_section_ok(hdr, g->slots, g->n_slots, sizeof(uint64_t)) ||
+		    !index_section_ok(hdr, g->offsets, g->n_groups + 1, sizeof(uint64_t)) ||
+		    !index_section_ok(hdr, g->members, count, sizeof(uint64_t)))
+			return false;
+
+		uint64_t *slots = (void *) (map + g->slots);
+		for (uint64_t i = 0; i < g->n_slots; i++)
+			if (slots[i] != UINT64_MAX && slots[i] >= g->n_groups)
+				return false;
+		if (!index_lists_ok((void *) (map + g->offsets), g->n_groups, (void *) (map + g->members), count, count))
+			return false;
+	}
+	return true;
+}
+
+/* Maps the sidecar, returning NULL if it's missing or doesn't match. */
+static struct graph_index_t *graph_index_map(char *filename, size_t count, uint64_t checksum, uint64_t n_edges)
+{
+	struct graph_index_header_t *hdr;
+	struct stat st;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	hdr = (void *) map;
+	if (memcmp(hdr->magic, GRAPH_INDEX_MAGIC, sizeof(hdr->magic)) || hdr->version != GRAPH_INDEX_VERSION)
+		goto err;
+	if (hdr->checksum != checksum || hdr->n_edges != n_edges || hdr->count != count)
+		goto err;
+	if (hdr->size != (uint64_t) st.st_size || !index_sections_ok(hdr, map))
+		goto err;
+
+	struct graph_index_t *index = malloc(sizeof(*index));
+	if (!index)
+		goto err;
+	*index = (struct graph_index_t) {
+		.map = map,
+		.len = st.st_size,
+		.hdr = hdr,
+	};
+	return index;
+
+err:
+	munmap(map, st.st_size);
+	return NULL;
+}
+
+/*
+ * Opens the index for the graph in @filename (which has been loaded into
+ * @nodes), rebuilding the sidecar if it's stale. Returns NULL if the index
+ * couldn't be used, in which case the caller should build everything itself.
+ */
+struct graph_index_t *graph_index_open(char *filename, struct book_t *nodes, size_t count)
+{
+	uint64_t checksum, n_edges;
+	struct graph_index_t *index = NULL;
+
+	/* Shared memory segments don't have anywhere to put a sidecar. */
+	if (!strncmp(filename, GRAPH_SHM_PREFIX, strlen(GRAPH_SHM_PREFIX)))
+		return NULL;
+
+	graph_checksum(nodes, count, &checksum, &n_edges);
+
+	size_t len = strlen(filename) + strlen(GRAPH_INDEX_SUFFIX) + 1;
+	char *path = malloc(len);
+	/* Enough for the pid suffix of the temporary file. */
+	char *tmp = malloc(len + 32);
+	if (!path || !tmp)
+		goto out;
+	snprintf(path, len, "%s%s", filename, GRAPH_INDEX_SUFFIX);
+
+	index = graph_index_map(path, count, checksum, n_edges);
+	if (index)
+		goto out;
+
+	/* Build under a temporary name, so readers never see a partial sidecar. */
+	snprintf(tmp, len + 32, "%s.%d", path, getpid());
+	if (graph_index_build(tmp, nodes, count, checksum, n_edges) < 0) {
+		perror("graph_index_open: build index");
+		goto out;
+	}
+	if (rename(tmp, path) < 0) {
+		perror("graph_index_open: rename index");
+		unlink(tmp);
+		goto out;
+	}
+	index = graph_index_map(path, count, checksum, n_edges);
+
+out:
+	free(path);
+	free(tmp);
+	return index;
+}
+
+void graph_index_close(struct graph_index_t *index)
+{
+	if (index)
+		munmap(index->map, index->len);
+	free(index);
+}
+
+ssize_t graph_index_lookup(struct graph_index_t *index, int group, size_t key)
+{
+	if (group < 0 || group >= NUM_GROUPS)
+		return -1;
+
+	struct graph_index_group_t *g = &index->hdr->groups[group];
+	uint64_t *offsets = INDEX_SECTION(index, g->offsets);
+	uint64_t *members = INDEX_SECTION(index, g->members);
+	size_t slot;
+
+	ssize_t id = index_probe(INDEX_SECTION(index, g->keys), INDEX_SECTION(index, g->slots), g->n_slots, key, &slot);
+	if (id < 0 || offsets[id] == offsets[id + 1])
+		return -1;
+	return members[offsets[id]];
+}
+
+const size_t *graph_index_cited_by(struct graph_index_t *index, size_t idx, size_t *n)
+{
+	uint64_t *offsets = INDEX_SECTION(index, index->hdr->cited_offsets);
+	uint64_t *edges = INDEX_SECTION(index, index->hdr->cited_edges);
+
+	*n = offsets[idx + 1] - offsets[idx];
+	return (const size_t *) edges + offsets[idx];
+}
+
+uint32_t graph_index_component(struct graph_index_t *index, size_t idx)
+{
+	uint32_t *components = INDEX_SECTION(index, index->hdr->components);
+	return components[idx];
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(INDEX_H)
+#define INDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "worm.h"
+
+/*
+ * Sidecar index files. Everything graph_alloc derives from a graph (the id
+ * indexes for each group, the reverse citation adjacency) plus the weakly
+ * connected component of every book is stored in "<graph>.idx", keyed by a
+ * checksum of the loaded graph. Opening an index maps the sidecar if it's still
+ * valid, and otherwise rebuilds it from the loaded graph and writes it out for
+ * next time.
+ */
+#define GRAPH_INDEX_SUFFIX ".idx"
+
+struct graph_index_t;
+
+struct graph_index_t *graph_index_open(char *filename, struct book_t *nodes, size_t count);
+void graph_index_close(struct graph_index_t *index);
+
+/*
+ * Lookups. graph_index_lookup returns the lowest index of the books with @key
+ * in @group (or -1), graph_index_cited_by returns the books citing @idx and
+ * graph_index_component returns the component label of @idx.
+ */
+ssize_t graph_index_lookup(struct graph_index_t *index, int group, size_t key);
+const size_t *graph_index_cited_by(struct graph_index_t *index, size_t idx, size_t *n);
+uint32_t graph_index_component(struct graph_index_t *index, size_t idx);
+
+#endif
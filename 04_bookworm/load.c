@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+/*
+ * Loading and saving of book graphs. There are two on-disk formats: the
+ * original text format (which is what the assignment provides), and a binary
+ * format which is much faster to load since it needs no parsing. The binary
+ * format can also be published into a shared memory segment, which other
+ * processes can attach to without making their own copy of the edges.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "worm.h"
+#include "graph.h"
+#include "bigalloc.h"
+
+static int record_load(char *line, size_t **b_edges, size_t *n_edges)
+{
+	char *current;
+	size_t cap = 20;
+
+	/* Start with nothing. */
+	*b_edges = malloc(cap * sizeof(**b_edges));
+	*n_edges = 0;
+
+	/* We assume all records are well-formed. */
+	current = strtok(line, " ");
+	if (!current)
+		goto out;
+	do {
+		char *endptr;
+		size_t val = strtol(current, &endptr, 10);
+		if (endptr == current || *endptr)
+			goto err;
+
+		if (*n_edges >= cap)
+			*b_edges = realloc(*b_edges, (cap *= 2) * sizeof(**b_edges));
+		(*b_edges)[(*n_edges)++] = val;
+	} while ((current = strtok(NULL, " ")) != NULL);
+
+out:
+	return 0;
+
+err:
+	free(*b_edges);
+	*b_edges = NULL;
+	return -1;
+}
+
+static void trimright(char *str)
+{
+	char *end = str + strlen(str) - 1;
+	while (end >= str && isspace(*end))
+		*end-- = '\0';
+}
+
+#define MAX_BUFFER 65536
+
+/* Loads a given book graph. The format is the following (rows separated by
+ * newlines, records separated with whitespace).
+ *
+ *   +------------+
+ *   | book_count |
+ *   +------------+
+ *   | book_specs |
+ *   |    ...     |
+ *   +------------+
+ *
+ * With 'book_specs' being defined as.
+ *
+ *   +-------------------------+
+ *   | ->id                    |
+ *   +-------------------------+
+ *   | ->publisher_id          |
+ *   +-------------------------+
+ *   | ->author_id             |
+ *   +-------------------------+
+ *   | ->b_publisher_edges ... |
+ *   +-------------------------+
+ *   | ->b_author_edges    ... |
+ *   +-------------------------+
+ *   | ->b_citation_edges  ... |
+ *   +-------------------------+
+ */
+struct book_t *graph_load(char *filename, size_t *count)
+{
+	size_t n_books = 0;
+	char line[MAX_BUFFER], *endptr;
+	struct book_t *graph = NULL;
+
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		perror("graph_load: open graph file");
+		return NULL;
+	}
+
+	/* Read book_count. */
+	if (!fgets(line, MAX_BUFFER, f))
+		goto err_parsing;
+	trimright(line);
+	n_books = strtol(line, &endptr, 10);
+	if (endptr == line || *endptr)
+		goto err_parsing;
+
+	/* Zeroed so that a partially parsed graph can be freed with graph_unload. */
+	graph = big_calloc(n_books ? n_books : 1, sizeof(*graph));
+	if (!graph)
+		goto err_parsing;
+
+	/* Read all of the books. */
+	for (size_t i = 0; i < n_books; i++) {
+		/* Parse book->id. */
+		if (!fgets(line, MAX_BUFFER, f))
+			goto err_parsing;
+		trimright(line);
+		graph[i].id = strtol(line, &endptr, 10);
+		if (endptr == line || *endptr)
+			goto err_parsing;
+
+		/* Parse book->publisher_id. */
+		if (!fgets(line, MAX_BUFFER, f))
+			goto err_parsing;
+		trimright(line);
+		graph[i].publisher_id = strtol(line, &endptr, 10);
+		if (endptr == line || *endptr)
+			goto err_parsing;
+
+		/* Parse book->author_id. */
+		if (!fgets(line, MAX_BUFFER, f))
+			goto err_parsing;
+		trimright(line);
+		graph[i].author_id = strtol(line, &endptr, 10);
+		if (endptr == line || *endptr)
+			goto err_parsing;
+
+		/* Parse book->b_publisher_edges. */
+		if (!fgets(line, MAX_BUFFER, f))
+			goto err_parsing;
+		trimright(line);
+		if (record_load(line, &graph[i].b_publisher_edges, &graph[i].n_publisher_edges) < 0)
+			goto err_parsing;
+
+		/* Parse book->b_author_edges. */
+		if (!fgets(line, MAX_BUFFER, f))
+			goto err_parsing;
+		trimright(line);
+		if (record_load(line, &graph[i].b_author_edges, &graph[i].n_author_edges) < 0)
+			goto err_parsing;
+
+		/* Parse book->b_citation_edges. */
+		if (!fgets(line, MAX_BUFFER, f))
+			goto err_parsing;
+		trimright(line);
+		if (record_load(line, &graph[i].b_citation_edges, &graph[i].n_citation_edges) < 0)
+			goto err_parsing;
+	}
+
+	fclose(f);
+	*count = n_books;
+	return graph;
+
+err_parsing:
+	fprintf(stderr, "graph_load: failed to parse graph file\n");
+	graph_unload(graph, n_books);
+	fclose(f);
+	return NULL;
+}
+
+/* Frees a graph allocated by any of the graph_load* functions. */
+void graph_unload(struct book_t *nodes, size_t count)
+{
+	if (!nodes)
+		return;
+
+	/* Attached graphs only own the node array, the edges are shared. */
+	struct graph_shm_t *shm = graph_shm_take(nodes);
+	for (size_t i = 0; i < count; i++) {
+		graph_shm_edges_free(shm, nodes[i].b_author_edges);
+		graph_shm_edges_free(shm, nodes[i].b_publisher_edges);
+		graph_shm_edges_free(shm, nodes[i].b_citation_edges);
+	}
+	big_free(nodes);
+	graph_shm_release(shm);
+}
+
+/*
+ * The binary format is the following (all integers are native-endian, so
+ * don't try to load graphs generated on SystemZ).
+ *
+ *   +-------------------------+
+ *   | graph_file_header_t     |
+ *   +-------------------------+
+ *   | graph_file_book_t ...   | (->count entries)
+ *   +-------------------------+
+ *   | uint64_t edges ...      | (->n_edges entries)
+ *   +-------------------------+
+ *
+ * The edges of each book are stored in order (author, citation, publisher)
+ * and the books' edges are stored in the same order as the books.
+ */
+#define GRAPH_FILE_MAGIC   "WORMGRPH"
+#define GRAPH_FILE_VERSION 1
+
+struct graph_file_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t count;
+	uint64_t n_edges;
+};
+
+struct graph_file_book_t {
+	uint64_t id;
+	uint64_t author_id;
+	uint64_t publisher_id;
+	uint64_t n_author_edges;
+	uint64_t n_citation_edges;
+	uint64_t n_publisher_edges;
+};
+
+/* Size of the binary format for the given header. */
+static size_t graph_file_size(struct graph_file_header_t *hdr)
+{
+	return sizeof(*hdr) + hdr->count * sizeof(struct graph_file_book_t) + hdr->n_edges * sizeof(uint64_t);
+}
+
+/*
+ * Checks that the counts in @hdr describe a graph of exactly @size bytes. The
+ * counts are bounded by @size first, so a corrupt header can't overflow the
+ * calculation.
+ */
+static bool graph_file_fits(struct graph_file_header_t *hdr, size_t size)
+{
+	size_t left = size;
+
+	if (left < sizeof(*hdr))
+		return false;
+	left -= sizeof(*hdr);
+	if (hdr->count > left / sizeof(struct graph_file_book_t))
+		return false;
+	left -= hdr->count * sizeof(struct graph_file_book_t);
+	if (hdr->n_edges > left / sizeof(uint64_t))
+		return false;
+	return graph_file_size(hdr) == size;
+}
+
+/*
+ * Takes @n edges from the @left edges that the header said are left, failing
+ * if there aren't enough. Each count is checked on its own so that the sum of
+ * a book's counts can't wrap around.
+ */
+static bool edges_take(uint64_t n, uint64_t *left)
+{
+	if (n > *left)
+		return false;
+	*left -= n;
+	return true;
+}
+
+/*
+ * Reads an edge list of length @n from @f into a freshly allocated array. @left
+ * is the number of edges left in the file.
+ */
+static int edges_load(FILE *f, size_t **b_edges, size_t *n_edges, uint64_t n, uint64_t *left)
+{
+	if (!edges_take(n, left))
+		return -1;
+
+	/* Match record_load, which never leaves ->b_*_edges NULL. */
+	*n_edges = n;
+	*b_edges = malloc((n ? n : 1) * sizeof(**b_edges));
+	if (!*b_edges)
+		return -1;
+
+	/* size_t and uint64_t are the same on everything we care about. */
+	_Static_assert(sizeof(size_t) == sizeof(uint64_t), "size_t must be 64-bit");
+	if (n && fread(*b_edges, sizeof(uint64_t), n, f) != n)
+		return -1;
+	return 0;
+}
+
+struct book_t *graph_load_binary(char *filename, size_t *count)
+{
+	struct graph_file_header_t hdr;
+	struct graph_file_book_t *books = NULL;
+	struct book_t *graph = NULL;
+	struct stat st;
+	uint64_t left;
+
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		perror("graph_load_binary: open graph file");
+		return NULL;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+		goto err_parsing;
+	if (memcmp(hdr.magic, GRAPH_FILE_MAGIC, sizeof(hdr.magic)) || hdr.version != GRAPH_FILE_VERSION)
+		goto err_parsing;
+
+	/* Don't trust the counts until we know the file is big enough. */
+	if (fstat(fileno(f), &st) < 0 || !graph_file_fits(&hdr, st.st_size))
+		goto err_parsing;
+	left = hdr.n_edges;
+
+	/* Read the fixed-size records in one go. */
+	books = malloc((hdr.count ? hdr.count : 1) * sizeof(*books));
+	graph = big_calloc(hdr.count ? hdr.count : 1, sizeof(*graph));
+	if (!books || !graph)
+		goto err_parsing;
+	if (hdr.count && fread(books, sizeof(*books), hdr.count, f) != hdr.count)
+		goto err_parsing;
+
+	for (size_t i = 0; i < hdr.count; i++) {
+		graph[i].id = books[i].id;
+		graph[i].author_id = books[i].author_id;
+		graph[i].publisher_id = books[i].publisher_id;
+
+		if (edges_load(f, &graph[i].b_author_edges, &graph[i].n_author_edges, books[i].n_author_edges, &left) < 0)
+			goto err_parsing;
+		if (edges_load(f, &graph[i].b_citation_edges, &graph[i].n_citation_edges, books[i].n_citation_edges, &left) < 0)
+			goto err_parsing;
+		if (edges_load(f, &graph[i].b_publisher_edges, &graph[i].n_publisher_edges, books[i].n_publisher_edges, &left) < 0)
+			goto err_parsing;
+	}
+
+	free(books);
+	fclose(f);
+	*count = hdr.count;
+	return graph;
+
+err_parsing:
+	fprintf(stderr, "graph_load_binary: failed to parse graph file\n");
+	graph_unload(graph, books ? hdr.count : 0);
+	free(books);
+	fclose(f);
+	return NULL;
+}
+
+/* Saves a graph in the binary format. Return value is < 0 if an error occurred. */
+int graph_save_binary(char *filename, struct book_t *nodes, size_t count)
+{
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		perror("graph_save_binary: open graph file");
+		return -1;
+	}
+
+	struct graph_file_header_t hdr = {
+		.magic = GRAPH_FILE_MAGIC,
+		.version = GRAPH_FILE_VERSION,
+		.count = count,
+	};
+	for (size_t i = 0; i < count; i++)
+		hdr.n_edges += nodes[i].n_author_edges + nodes[i].n_citation_edges + nodes[i].n_publisher_edges;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto err;
+
+	for (size_t i = 0; i < count; i++) {
+		struct graph_file_book_t book = {
+			.id = nodes[i].id,
+			.author_id = nodes[i].author_id,
+			.publisher_id = nodes[i].publisher_id,
+			.n_author_edges = nodes[i].n_author_edges,
+			.n_citation_edges = nodes[i].n_citation_edges,
+			.n_publisher_edges = nodes[i].n_publisher_edges,
+		};
+		if (fwrite(&book, sizeof(book), 1, f) != 1)
+			goto err;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (fwrite(nodes[i].b_author_edges, sizeof(size_t), nodes[i].n_author_edges, f) != nodes[i].n_author_edges)
+			goto err;
+		if (fwrite(nodes[i].b_citation_edges, sizeof(size_t), nodes[i].n_citation_edges, f) != nodes[i].n_citation_edges)
+			goto err;
+		if (fwrite(nodes[i].b_publisher_edges, sizeof(size_t), nodes[i].n_publisher_edges, f) != nodes[i].n_publisher_edges)
+			goto err;
+	}
+
+	if (fclose(f))
+		return -1;
+	return 0;
+
+err:
+	perror("graph_save_binary: write graph file");
+	fclose(f);
+	return -1;
+}
+
+/*
+ * Shared memory segments contain a graph in the binary format, which only uses
+ * counts (and thus implicit offsets) rather than pointers, so it can be mapped
+ * anywhere. Attaching builds a private array of struct book_t whose edge lists
+ * point into the (read-only) mapping, so each process only pays for the node
+ * array and the edges are shared by everyone.
+ *
+ * Each attached graph has a graph_shm_t registered against its node array, so
+ * that graph_unload and graph_alloc can tell that the edges aren't theirs to
+ * free.
+ */
+struct graph_shm_t {
+	struct book_t *nodes;
+	char *map;
+	size_t len;
+	struct graph_shm_t *next;
+};
+
+static pthread_mutex_t shm_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct graph_shm_t *shm_list;
+
+/*
+ * Publishes the graph as the shared memory segment @name (which must start with
+ * a '/'), replacing any existing segment with that name. Processes already
+ * attached to the old segment keep using it until they detach.
+ */
+int graph_shm_publish(char *name, struct book_t *nodes, size_t count)
+{
+	struct graph_file_header_t hdr = {
+		.version = GRAPH_FILE_VERSION,
+		.count = count,
+	};
+	for (size_t i = 0; i < count; i++)
+		hdr.n_edges += nodes[i].n_author_edges + nodes[i].n_citation_edges + nodes[i].n_publisher_edges;
+	size_t len = graph_file_size(&hdr);
+
+	if (shm_unlink(name) < 0 && errno != ENOENT)
+		goto err;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		goto err;
+	if (ftruncate(fd, len) < 0)
+		goto err_unlink;
+	char *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err_unlink;
+
+	struct graph_file_book_t *books = (void *) (map + sizeof(hdr));
+	uint64_t *edges = (void *) (books + count);
+	for (size_t i = 0; i < count; i++) {
+		books[i] = (struct graph_file_book_t) {
+			.id = nodes[i].id,
+			.author_id = nodes[i].author_id,
+			.publisher_id = nodes[i].publisher_id,
+			.n_author_edges = nodes[i].n_author_edges,
+			.n_citation_edges = nodes[i].n_citation_edges,
+			.n_publisher_edges = nodes[i].n_publisher_edges,
+		};
+
+		memcpy(edges, nodes[i].b_author_edges, nodes[i].n_author_edges * sizeof(*edges));
+		edges += nodes[i].n_author_edges;
+		memcpy(edges, nodes[i].b_citation_edges, nodes[i].n_citation_edges * sizeof(*edges));
+		edges += nodes[i].n_citation_edges;
+		memcpy(edges, nodes[i].b_publisher_edges, nodes[i].n_publisher_edges * sizeof(*edges));
+		edges += nodes[i].n_publisher_edges;
+	}
+
+	/* Only stamp the magic once everything else is in place. */
+	memcpy(hdr.magic, GRAPH_FILE_MAGIC, sizeof(hdr.magic));
+	memcpy(map, &hdr, sizeof(hdr));
+
+	munmap(map, len);
+	close(fd);
+	return 0;
+
+err_unlink:
+	shm_unlink(name);
+	close(fd);
+err:
+	perror("graph_shm_publish: create segment");
+	return -1;
+}
+
+/* Attaches read-only to a graph published with graph_shm_publish. */
+struct book_t *graph_shm_attach(char *name, size_t *count)
+{
+	struct graph_file_header_t hdr;
+	struct stat st;
+	struct graph_shm_t *shm = NULL;
+	struct book_t *graph = NULL;
+	char *map = MAP_FAILED;
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		perror("graph_shm_attach: open segment");
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(hdr))
+		goto err_parsing;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err_parsing;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if (memcmp(hdr.magic, GRAPH_FILE_MAGIC, sizeof(hdr.magic)) || hdr.version != GRAPH_FILE_VERSION)
+		goto err_parsing;
+	if (!graph_file_fits(&hdr, st.st_size))
+		goto err_parsing;
+
+	shm = malloc(sizeof(*shm));
+	graph = big_calloc(hdr.count ? hdr.count : 1, sizeof(*graph));
+	if (!shm || !graph)
+		goto err_parsing;
+
+	/* Resolve the implicit offsets of every edge list. */
+	struct graph_file_book_t *books = (void *) (map + sizeof(hdr));
+	size_t *edges = (void *) (books + hdr.count);
+	size_t offset = 0;
+	uint64_t left = hdr.n_edges;
+	for (size_t i = 0; i < hdr.count; i++) {
+		struct graph_file_book_t *book = &books[i];
+
+		if (!edges_take(book->n_author_edges, &left) ||
+		    !edges_take(book->n_citation_edges, &left) ||
+		    !edges_take(book->n_publisher_edges, &left))
+			goto err_parsing;
+
+		graph[i] = (struct book_t) {
+			.id = book->id,
+			.author_id = book->author_id,
+			.publisher_id = book->publisher_id,
+			.b_author_edges = edges + offset,
+			.n_author_edges = book->n_author_edges,
+			.b_citation_edges = edges + offset + book->n_author_edges,
+			.n_citation_edges = book->n_citation_edges,
+			.b_publisher_edges = edges + offset + book->n_author_edges + book->n_citation_edges,
+			.n_publisher_edges = book->n_publisher_edges,
+		};
+		offset += book->n_author_edges + book->n_citation_edges + book->n_publisher_edges;
+	}
+	close(fd);
+
+	*shm = (struct graph_shm_t) {
+		.nodes = graph,
+		.map = map,
+		.len = st.st_size,
+	};
+	pthread_mutex_lock(&shm_lock);
+	shm->next = shm_list;
+	shm_list = shm;
+	pthread_mutex_unlock(&shm_lock);
+
+	*count = hdr.count;
+	return graph;
+
+err_parsing:
+	fprintf(stderr, "graph_shm_attach: failed to attach graph segment\n");
+	big_free(graph);
+	free(shm);
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	close(fd);
+	return NULL;
+}
+
+/*
+ * Removes the graph_shm_t for @nodes from the registry, passing ownership of
+ * the mapping to the caller. Returns NULL if @nodes wasn't attached.
+ */
+struct graph_shm_t *graph_shm_take(struct book_t *nodes)
+{
+	struct graph_shm_t *shm = NULL;
+
+	pthread_mutex_lock(&shm_lock);
+	for (struct graph_shm_t **prev = &shm_list; *prev; prev = &(*prev)->next) {
+		if ((*prev)->nodes == nodes) {
+			shm = *prev;
+			*prev = shm->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&shm_lock);
+	return shm;
+}
+
+/* Unmaps a segment returned by graph_shm_take. */
+void graph_shm_release(struct graph_shm_t *shm)
+{
+	if (shm)
+		munmap(shm->map, shm->len);
+	free(shm);
+}
+
+/* Frees an edge list, unless it lives inside the mapping of @shm. */
+void graph_shm_edges_free(struct graph_shm_t *shm, size_t *edges)
+{
+	if (shm && (char *) edges >= shm->map && (char *) edges <= shm->map + shm->len)
+		return;
+	free(edges);
+}
+
+/*
+ * Loads a graph in either format, deciding based on the magic number. Names
+ * of the form "shm:<name>" attach to a shared memory segment instead.
+ */
+struct book_t *graph_open(char *filename, size_t *count)
+{
+	char magic[8] = {0};
+
+	if (!strncmp(filename, GRAPH_SHM_PREFIX, strlen(GRAPH_SHM_PREFIX)))
+		return graph_shm_attach(filename + strlen(GRAPH_SHM_PREFIX), count);
+
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		perror("graph_open: open graph file");
+		return NULL;
+	}
+	size_t n = fread(magic, 1, sizeof(magic), f);
+	fclose(f);
+
+	if (n == sizeof(magic) && !memcmp(magic, GRAPH_FILE_MAGIC, sizeof(magic)))
+		return graph_load_binary(filename, count);
+	return graph_load(filename, count);
+}
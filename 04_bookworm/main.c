@@ -32,6 +32,7 @@
  */
 
 #include <ctype.h>
+#include <time.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,6 +44,13 @@
 #include <fcntl.h>
 
 #include "worm.h"
+#include "graph.h"
+#include "bigalloc.h"
+#include "validate.h"
+#include "rank.h"
+#include "handle.h"
+#include "server.h"
+#include "shard.h"
 
 /*
  * Gets a new line from stdin, caller responsible for calling free on returned
@@ -80,152 +88,6 @@ char *readline(int fd)
 	return line;
 }
 
-int record_load(char *line, size_t **b_edges, size_t *n_edges)
-{
-	char *current;
-	size_t cap = 20;
-
-	/* Start with nothing. */
-	*b_edges = malloc(cap * sizeof(**b_edges));
-	*n_edges = 0;
-
-	/* We assume all records are well-formed. */
-	current = strtok(line, " ");
-	if (!current)
-		goto out;
-	do {
-		char *endptr;
-		size_t val = strtol(current, &endptr, 10);
-		if (endptr == current || *endptr)
-			goto err;
-
-		if (*n_edges >= cap)
-			*b_edges = realloc(*b_edges, (cap *= 2) * sizeof(**b_edges));
-		(*b_edges)[(*n_edges)++] = val;
-	} while ((current = strtok(NULL, " ")) != NULL);
-
-out:
-	return 0;
-
-err:
-	free(*b_edges);
-	return -1;
-}
-
-void trimright(char *str)
-{
-	char *end = str + strlen(str) - 1;
-	while (end >= str && isspace(*end))
-		*end-- = '\0';
-}
-
-#define MAX_BUFFER 65536
-
-/* Loads a given book graph. The format is the following (rows separated by
- * newlines, records separated with whitespace).
- *
- *   +------------+
- *   | book_count |
- *   +------------+
- *   | book_specs |
- *   |    ...     |
- *   +------------+
- *
- * With 'book_specs' being defined as.
- *
- *   +-------------------------+
- *   | ->id                    |
- *   +-------------------------+
- *   | ->publisher_id          |
- *   +-------------------------+
- *   | ->author_id             |
- *   +-------------------------+
- *   | ->b_publisher_edges ... |
- *   +-------------------------+
- *   | ->b_author_edges    ... |
- *   +-------------------------+
- *   | ->b_citation_edges  ... |
- *   +-------------------------+
- */
-struct book_t *graph_load(char *filename, size_t *count)
-{
-	size_t n_books = 0;
-	char line[MAX_BUFFER], *endptr;
-	struct book_t *graph = NULL;
-
-	FILE *f = fopen(filename, "r");
-	if (!f) {
-		perror("graph_load: open graph file");
-		return NULL;
-	}
-
-	/* Read book_count. */
-	if (!fgets(line, MAX_BUFFER, f))
-		goto err_parsing;
-	trimright(line);
-	n_books = strtol(line, &endptr, 10);
-	if (endptr == line || *endptr)
-		goto err_parsing;
-
-	graph = malloc(n_books * sizeof(*graph));
-
-	/* Read all of the books. */
-	for (size_t i = 0; i < n_books; i++) {
-		/* Parse book->id. */
-		if (!fgets(line, MAX_BUFFER, f))
-			goto err_parsing;
-		trimright(line);
-		graph[i].id = strtol(line, &endptr, 10);
-		if (endptr == line || *endptr)
-			goto err_parsing;
-
-		/* Parse book->publisher_id. */
-		if (!fgets(line, MAX_BUFFER, f))
-			goto err_parsing;
-		trimright(line);
-		graph[i].publisher_id = strtol(line, &endptr, 10);
-		if (endptr == line || *endptr)
-			goto err_parsing;
-
-		/* Parse book->author_id. */
-		if (!fgets(line, MAX_BUFFER, f))
-			goto err_parsing;
-		trimright(line);
-		graph[i].author_id = strtol(line, &endptr, 10);
-		if (endptr == line || *endptr)
-			goto err_parsing;
-
-		/* Parse book->b_publisher_edges. */
-		if (!fgets(line, MAX_BUFFER, f))
-			goto err_parsing;
-		trimright(line);
-		if (record_load(line, &graph[i].b_publisher_edges, &graph[i].n_publisher_edges) < 0)
-			goto err_parsing;
-
-		/* Parse book->b_author_edges. */
-		if (!fgets(line, MAX_BUFFER, f))
-			goto err_parsing;
-		trimright(line);
-		if (record_load(line, &graph[i].b_author_edges, &graph[i].n_author_edges) < 0)
-			goto err_parsing;
-
-		/* Parse book->b_citation_edges. */
-		if (!fgets(line, MAX_BUFFER, f))
-			goto err_parsing;
-		trimright(line);
-		if (record_load(line, &graph[i].b_citation_edges, &graph[i].n_citation_edges) < 0)
-			goto err_parsing;
-	}
-
-	*count = n_books;
-	return graph;
-
-err_parsing:
-	fprintf(stderr, "graph_load: failed to parse graph file\n");
-	free(graph);
-	return NULL;
-}
-
 #define HOW_OFTEN 8757 /* To make it much more sane to run on large graphs. */
 
 /* Runs some benchmarks. */
@@ -336,23 +198,286 @@ void bench(struct book_t *graph, size_t count)
 	}
 }
 
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Times the search loops with a range of prefetch distances. The same random
+ * queries are used for every distance, and this only really shows anything on
+ * graphs which are much larger than the last level cache.
+ */
+void bench_prefetch(struct book_t *graph, size_t count, size_t queries)
+{
+	size_t distances[] = { 0, 2, 4, 8, 16, 32 };
+	size_t saved = g_prefetch_distance;
+
+	size_t *sources = malloc(2 * queries * sizeof(*sources));
+	srand(2129);
+	for (size_t i = 0; i < 2 * queries; i++)
+		sources[i] = graph[rand() % count].id;
+
+	printf("%8s %14s %14s\n", "distance", "shortest (ms)", "kdist (ms)");
+	for (size_t d = 0; d < sizeof(distances) / sizeof(*distances); d++) {
+		g_prefetch_distance = distances[d];
+
+		double start = now();
+		for (size_t i = 0; i < queries; i++) {
+			struct result_t *result = find_shortest_distance(graph, count, sources[2*i], sources[2*i + 1]);
+			free(result->elements);
+			free(result);
+		}
+		double shortest = now() - start;
+
+		start = now();
+		for (size_t i = 0; i < queries; i++) {
+			struct result_t *result = find_books_k_distance(graph, count, sources[i], 4);
+			free(result->elements);
+			free(result);
+		}
+		double kdist = now() - start;
+
+		printf("%8lu %14.1f %14.1f\n", distances[d], shortest * 1e3, kdist * 1e3);
+	}
+
+	g_prefetch_distance = saved;
+	free(sources);
+}
+
+/* Prints the @k most influential books, with all of their scores. */
+int print_influential(struct book_t *graph, size_t count, size_t k, size_t nthreads)
+{
+	struct rank_params_t params;
+	rank_params_default(&params);
+	params.nthreads = nthreads;
+	params.hits = true;
+
+	double start = now();
+	struct rank_t *rank = graph_rank(graph, count, &params);
+	if (!rank)
+		return -1;
+	fprintf(stderr, "pagerank: %lu iterations (residual %.3g), hits: %lu iterations (residual %.3g), %.1f ms\n",
+		rank->iterations[0], rank->residual[0], rank->iterations[1], rank->residual[1], (now() - start) * 1e3);
+
+	struct result_t *result = find_top_influential(graph, count, rank, RANK_PAGERANK, k);
+	if (!result) {
+		graph_rank_free(rank);
+		return -1;
+	}
+
+	printf("%12s %14s %14s %14s\n", "id", "pagerank", "authority", "hub");
+	for (size_t i = 0; i < result->n_elements; i++) {
+		size_t idx = result->elements[i] - graph;
+		printf("%12lu %14.6e %14.6e %14.6e\n", graph[idx].id, rank->scores[RANK_PAGERANK][idx],
+		       rank->scores[RANK_AUTHORITY][idx], rank->scores[RANK_HUB][idx]);
+	}
+
+	free(result->elements);
+	free(result);
+	graph_rank_free(rank);
+	return 0;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "usage: worm [-H <auto|thp|off>] [-P <prefetch>] [-o <binary-output>] <graph>\n");
+	fprintf(stderr, "       worm [-H <auto|thp|off>] -b <queries> <graph>\n");
+	fprintf(stderr, "       worm [-H <auto|thp|off>] -m <shm-name> <graph>\n");
+	fprintf(stderr, "       worm [-H <auto|thp|off>] -V [-j <threads>] <graph>\n");
+	fprintf(stderr, "       worm [-H <auto|thp|off>] -r <k> [-j <threads>] <graph>\n");
+	fprintf(stderr, "       worm [-H <auto|thp|off>] -s <socket|-> [-j <workers>] <graph>\n");
+	fprintf(stderr, "       worm [-H <auto|thp|off>] -p <shards> [-M <cut|publisher>] -o <prefix> <graph>\n");
+	fprintf(stderr, "       worm [-H <auto|thp|off>] -W <socket> <shard>\n");
+	fprintf(stderr, "       worm -D <socket>[,<socket>...]\n");
+	fprintf(stderr, "       worm -c <socket>\n");
+}
+
 int main(int argc, char **argv) {
-	if (argc != 2)
+	int opt;
+	char *output = NULL, *serve = NULL, *connect = NULL, *publish = NULL;
+	char *shard_worker = NULL, *shard_coordinator = NULL;
+	size_t workers = g_nthreads;
+	size_t bench_queries = 0, influential = 0, shards = 0;
+	int shard_method = SHARD_BY_CUT;
+	bool validate = false;
+
+	while ((opt = getopt(argc, argv, "H:P:b:o:m:s:c:j:Vr:p:M:W:D:")) != -1) {
+		switch (opt) {
+		case 'H':
+			/* Huge page policy for large arrays (see bigalloc.h). */
+			if (bigalloc_set_policy(bigalloc_parse_policy(optarg)) < 0) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'P': {
+			/* Unlike the other numbers, 0 is fine (it turns prefetching off). */
+			char *endptr;
+			errno = 0;
+			unsigned long distance = strtoul(optarg, &endptr, 10);
+			if (errno || endptr == optarg || *endptr || *optarg == '-' || distance > PREFETCH_MAX_DISTANCE) {
+				usage();
+				return -1;
+			}
+			g_prefetch_distance = distance;
+			break;
+		}
+		case 'b':
+			bench_queries = strtoul(optarg, NULL, 10);
+			if (!bench_queries) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'r':
+			influential = strtoul(optarg, NULL, 10);
+			if (!influential) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'V':
+			validate = true;
+			break;
+		case 'p':
+			shards = strtoul(optarg, NULL, 10);
+			if (!shards) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'M':
+			shard_method = shard_parse_method(optarg);
+			if (shard_method < 0) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'W':
+			shard_worker = optarg;
+			break;
+		case 'D':
+			shard_coordinator = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'm':
+			publish = optarg;
+			break;
+		case 's':
+			serve = optarg;
+			break;
+		case 'c':
+			connect = optarg;
+			break;
+		case 'j':
+			workers = strtoul(optarg, NULL, 10);
+			if (!workers) {
+				usage();
+				return -1;
+			}
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	/* The client doesn't need a graph. */
+	if (connect)
+		return client_run(connect) < 0;
+
+	/* Neither does the coordinator, the workers have it all. */
+	if (shard_coordinator)
+		return shard_coordinator_run(shard_coordinator) < 0;
+
+	if (argc - optind != 1 || (shards && !output)) {
+		usage();
 		return -1;
+	}
+
+	/* Workers only load their own shard of the graph. */
+	if (shard_worker) {
+		struct shard_t *shard = shard_load(argv[optind]);
+		if (!shard)
+			return 1;
+		int err = shard_worker_run(shard, shard_worker);
+		shard_free(shard);
+		return err < 0;
+	}
 
 	size_t count = 0;
-	book_t* graph = graph_load(argv[1], &count);
+	book_t* graph = graph_open(argv[optind], &count);
 	if (graph == NULL) {
 		return 1;
 	}
 
-	bench(graph, count);
+	/* Split the graph into shard files ("<output>.<n>"). */
+	if (shards) {
+		int err = shard_partition(graph, count, shards, shard_method, output);
+		graph_unload(graph, count);
+		return err < 0;
+	}
 
-	for (size_t i = 0; i < count; i++) {
-		free(graph[i].b_author_edges);
-		free(graph[i].b_publisher_edges);
-        free(graph[i].b_citation_edges);
+	/* Just convert the graph to the binary format. */
+	if (output) {
+		int err = graph_save_binary(output, graph, count);
+		graph_unload(graph, count);
+		return err < 0;
 	}
-	free(graph);
+
+	/* Check the graph and dump its statistics, exiting non-zero if it's broken. */
+	if (validate) {
+		struct graph_report_t report;
+		int err = graph_validate(graph, count, workers, &report);
+		if (!err)
+			graph_report_json(stdout, &report);
+		graph_unload(graph, count);
+		return err < 0 || report.errors;
+	}
+
+	/* Score the books by influence, and print the top ones. */
+	if (influential) {
+		int err = print_influential(graph, count, influential, workers);
+		graph_unload(graph, count);
+		return err < 0;
+	}
+
+	/* Publish the graph for other processes to attach to (with "shm:<name>"). */
+	if (publish) {
+		int err = graph_shm_publish(publish, graph, count);
+		graph_unload(graph, count);
+		return err < 0;
+	}
+
+	/* Load once, and answer queries until we're told to stop. */
+	if (serve) {
+		struct graph_index_t *index = graph_index_open(argv[optind], graph, count);
+		struct graph_t *g = graph_alloc_indexed(graph, count, index);
+		if (!g) {
+			graph_index_close(index);
+			graph_unload(graph, count);
+			return 1;
+		}
+		struct graph_handle_t *handle = graph_handle_alloc(g, NULL);
+		if (!handle) {
+			graph_free(g);
+			return 1;
+		}
+		int err = server_run(handle, argv[optind], serve, workers);
+		graph_handle_free(handle);
+		return err < 0;
+	}
+
+	if (bench_queries)
+		bench_prefetch(graph, count, bench_queries);
+	else
+		bench(graph, count);
+
+	graph_unload(graph, count);
 	return 0;
 }
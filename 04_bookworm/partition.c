@@ -0,0 +1,600 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+/*
+ * Graph partitioning, and the shard file format (see shard.h). Shard files
+ * are the following (native-endian, like the binary graph format):
+ *
+ *   +-------------------------+
+ *   | shard_file_header_t     |
+ *   +-------------------------+
+ *   | shard_file_book_t ...   | (->n_owned entries, ascending ->idx)
+ *   +-------------------------+
+ *   | uint64_t edges ...      | (->n_edges entries, global indices)
+ *   +-------------------------+
+ *   | shard_file_ghost_t ...  | (->n_ghosts entries, ascending ->idx)
+ *   +-------------------------+
+ *
+ * As in the binary graph format, each book's edges are stored in order
+ * (author, citation, publisher) and in the same order as the books.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "worm.h"
+#include "graph.h"
+#include "bigalloc.h"
+#include "shard.h"
+
+#define SHARD_FILE_MAGIC   "WORMSHRD"
+#define SHARD_FILE_VERSION 1
+
+/* Owner of books that haven't been assigned yet. */
+#define SHARD_UNASSIGNED UINT32_MAX
+
+struct shard_file_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t shard;
+	uint32_t n_shards;
+	uint64_t count;
+	uint64_t n_owned;
+	uint64_t n_edges;
+	uint64_t n_ghosts;
+};
+
+struct shard_file_book_t {
+	uint64_t idx;
+	uint64_t id;
+	uint64_t author_id;
+	uint64_t publisher_id;
+	uint64_t n_author_edges;
+	uint64_t n_citation_edges;
+	uint64_t n_publisher_edges;
+};
+
+struct shard_file_ghost_t {
+	uint64_t idx;
+	uint64_t owner;
+};
+
+int shard_parse_method(const char *name)
+{
+	if (!strcmp(name, "cut"))
+		return SHARD_BY_CUT;
+	if (!strcmp(name, "publisher"))
+		return SHARD_BY_PUBLISHER;
+	return -1;
+}
+
+/* Counts the edges of @book which go to books owned by each shard. */
+static void partition_score(struct book_t *book, uint32_t *owner, size_t *score)
+{
+	size_t *lists[] = { book->b_author_edges, book->b_citation_edges, book->b_publisher_edges };
+	size_t lens[] = { book->n_author_edges, book->n_citation_edges, book->n_publisher_edges };
+
+	for (size_t l = 0; l < sizeof(lists) / sizeof(*lists); l++)
+		for (size_t i = 0; i < lens[l]; i++)
+			if (owner[lists[l][i]] != SHARD_UNASSIGNED)
+				score[owner[lists[l][i]]]++;
+}
+
+/*
+ * Linear deterministic greedy: books are streamed in order, and each goes to
+ * the shard holding most of its (already assigned) neighbours, weighted by how
+ * much room that shard has left.
+ */
+static int partition_cut(struct book_t *nodes, size_t count, size_t n_shards, uint32_t *owner)
+{
+	size_t *sizes = calloc(n_shards, sizeof(*sizes));
+	size_t *score = calloc(n_shards, sizeof(*score));
+	if (!sizes || !score)
+		goto err;
+
+	double capacity = SHARD_SLACK * count / n_shards + 1;
+	for (size_t i = 0; i < count; i++)
+		owner[i] = SHARD_UNASSIGNED;
+
+	for (size_t i = 0; i < count; i++) {
+		ssize_t best = -1;
+		double best_score = 0;
+
+		memset(score, 0, n_shards * sizeof(*score));
+		partition_score(&nodes[i], owner, score);
+
+		for (size_t s = 0; s < n_shards; s++) {
+			if (sizes[s] >= capacity)
+				continue;
+
+			double weighted = score[s] * (1 - sizes[s] / capacity);
+			if (best < 0 || weighted > best_score ||
+			    (weighted == best_score && sizes[s] < sizes[best])) {
+				best = s;
+				best_score = weighted;
+			}
+		}
+
+		owner[i] = best;
+		sizes[best]++;
+	}
+
+	free(sizes);
+	free(score);
+	return 0;
+
+err:
+	free(sizes);
+	free(score);
+	return -1;
+}
+
+struct partition_group_t {
+	size_t key;
+	size_t idx;
+};
+
+static int group_cmp(const void *a, const void *b)
+{
+	const struct partition_group_t *x = a, *y = b;
+	if (x->key != y->key)
+		return (x->key > y->key) - (x->key < y->key);
+	return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+/* Runs of one publisher in the sorted books, biggest first. */
+struct partition_run_t {
+	size_t start;
+	size_t len;
+};
+
+static int run_cmp(const void *a, const void *b)
+{
+	const struct partition_run_t *x = a, *y = b;
+	if (x->len != y->len)
+		return (x->len < y->len) - (x->len > y->len);
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * Keeps each publisher's books together. Publishers are assigned biggest first
+ * to whichever shard is smallest at the time, which keeps the shards balanced
+ * unless one publisher dwarfs the rest.
+ */
+static int partition_publisher(struct book_t *nodes, size_t count, size_t n_shards, uint32_t *owner)
+{
+	struct partition_run_t *runs = NULL;
+	size_t n_runs = 0;
+	int err = -1;
+
+	struct partition_group_t *books = big_alloc((count ? count : 1) * sizeof(*books));
+	size_t *sizes = calloc(n_shards, sizeof(*sizes));
+	if (!books || !sizes)
+		goto out;
+
+	for (size_t i = 0; i < count; i++)
+		books[i] = (struct partition_group_t) { .key = nodes[i].publisher_id, .idx = i };
+	qsort(books, count, sizeof(*books), group_cmp);
+
+	runs = malloc((count ? count : 1) * sizeof(*runs));
+	if (!runs)
+		goto out;
+	for (size_t i = 0; i < count; i++) {
+		if (!i || books[i].key != books[i - 1].key)
+			runs[n_runs++] = (struct partition_run_t) { .start = i };
+		runs[n_runs - 1].len++;
+	}
+	qsort(runs, n_runs, sizeof(*runs), run_cmp);
+
+	for (size_t r = 0; r < n_runs; r++) {
+		size_t best = 0;
+		for (size_t s = 1; s < n_shards; s++)
+			if (sizes[s] < sizes[best])
+				best = s;
+
+		for (size_t i = runs[r].start; i < runs[r].start + runs[r].len; i++)
+			owner[books[i].idx] = best;
+		sizes[best] += runs[r].len;
+	}
+	err = 0;
+
+out:
+	big_free(books);
+	free(sizes);
+	free(runs);
+	return err;
+}
+
+static int ghost_cmp(const void *a, const void *b)
+{
+	const struct shard_file_ghost_t *x = a, *y = b;
+	return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+/* Writes the shard file for @shard. */
+static int shard_save(const char *filename, struct book_t *nodes, size_t count, uint32_t *owner,
+		      uint32_t shard, uint32_t n_shards)
+{
+	struct shard_file_header_t hdr = {
+		.version = SHARD_FILE_VERSION,
+		.shard = shard,
+		.n_shards = n_shards,
+		.count = count,
+	};
+	struct shard_file_ghost_t *ghosts = NULL;
+	size_t n_ghosts = 0, cap_ghosts = 0;
+
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		perror("shard_save: open shard file");
+		return -1;
+	}
+
+	/* Count everything (and collect the ghosts) so the header is right. */
+	for (size_t i = 0; i < count; i++) {
+		if (owner[i] != shard)
+			continue;
+
+		struct book_t *book = &nodes[i];
+		size_t *lists[] = { book->b_author_edges, book->b_citation_edges, book->b_publisher_edges };
+		size_t lens[] = { book->n_author_edges, book->n_citation_edges, book->n_publisher_edges };
+
+		hdr.n_owned++;
+		for (size_t l = 0; l < sizeof(lists) / sizeof(*lists); l++) {
+			hdr.n_edges += lens[l];
+			for (size_t k = 0; k < lens[l]; k++) {
+				if (owner[lists[l][k]] == shard)
+					continue;
+				if (n_ghosts >= cap_ghosts) {
+					cap_ghosts = cap_ghosts ? 2 * cap_ghosts : 64;
+					struct shard_file_ghost_t *tmp = realloc(ghosts, cap_ghosts * sizeof(*ghosts));
+					if (!tmp)
+						goto err;
+					ghosts = tmp;
+				}
+				ghosts[n_ghosts++] = (struct shard_file_ghost_t) {
+					.idx = lists[l][k],
+					.owner = owner[lists[l][k]],
+				};
+			}
+		}
+	}
+
+	/* Deduplicate the ghosts. */
+	qsort(ghosts, n_ghosts, sizeof(*ghosts), ghost_cmp);
+	for (size_t i = 0; i < n_ghosts; i++)
+		if (!hdr.n_ghosts || ghosts[i].idx != ghosts[hdr.n_ghosts - 1].idx)
+			ghosts[hdr.n_ghosts++] = ghosts[i];
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto err;
+
+	for (size_t i = 0; i < count; i++) {
+		if (owner[i] != shard)
+			continue;
+
+		struct shard_file_book_t book = {
+			.idx = i,
+			.id = nodes[i].id,
+			.author_id = nodes[i].author_id,
+			.publisher_id = nodes[i].publisher_id,
+			.n_author_edges = nodes[i].n_author_edges,
+			.n_citation_edges = nodes[i].n_citation_edges,
+			.n_publisher_edges = nodes[i].n_publisher_edges,
+		};
+		if (fwrite(&book, sizeof(book), 1, f) != 1)
+			goto err;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (owner[i] != shard)
+			continue;
+		if (fwrite(nodes[i].b_author_edges, sizeof(size_t), nodes[i].n_author_edges, f) != nodes[i].n_author_edges)
+			goto err;
+		if (fwrite(nodes[i].b_citation_edges, sizeof(size_t), nodes[i].n_citation_edges, f) != nodes[i].n_citation_edges)
+			goto err;
+		if (fwrite(nodes[i].b_publisher_edges, sizeof(size_t), nodes[i].n_publisher_edges, f) != nodes[i].n_publisher_edges)
+			goto err;
+	}
+
+	if (hdr.n_ghosts && fwrite(ghosts, sizeof(*ghosts), hdr.n_ghosts, f) != hdr.n_ghosts)
+		goto err;
+
+	/* Write the magic last, so partially written files are rejected. */
+	memcpy(hdr.magic, SHARD_FILE_MAGIC, sizeof(hdr.magic));
+	if (fseek(f, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto err;
+
+	free(ghosts);
+	if (fclose(f))
+		return -1;
+	return 0;
+
+err:
+	perror("shard_save: write shard file");
+	free(ghosts);
+	fclose(f);
+	return -1;
+}
+
+int shard_partition(struct book_t *nodes, size_t count, size_t n_shards, int method, const char *prefix)
+{
+	int err = -1;
+
+	if (!n_shards || n_shards >= SHARD_UNASSIGNED)
+		return -1;
+
+	uint32_t *owner = big_alloc((count ? count : 1) * sizeof(*owner));
+	size_t *sizes = calloc(n_shards, sizeof(*sizes));
+	size_t len = strlen(prefix) + 32;
+	char *filename = malloc(len);
+	if (!owner || !sizes || !filename)
+		goto out;
+
+	switch (method) {
+	case SHARD_BY_CUT:
+		err = partition_cut(nodes, count, n_shards, owner);
+		break;
+	case SHARD_BY_PUBLISHER:
+		err = partition_publisher(nodes, count, n_shards, owner);
+		break;
+	}
+	if (err < 0)
+		goto out;
+
+	/* Report how good the partition is. */
+	size_t edges = 0, cut = 0;
+	for (size_t i = 0; i < count; i++) {
+		struct book_t *book = &nodes[i];
+		size_t *lists[] = { book->b_author_edges, book->b_citation_edges, book->b_publisher_edges };
+		size_t lens[] = { book->n_author_edges, book->n_citation_edges, book->n_publisher_edges };
+
+		sizes[owner[i]]++;
+		for (size_t l = 0; l < sizeof(lists) / sizeof(*lists); l++) {
+			edges += lens[l];
+			for (size_t k = 0; k < lens[l]; k++)
+				cut += owner[lists[l][k]] != owner[i];
+		}
+	}
+
+	size_t smallest = SIZE_MAX, largest = 0;
+	for (size_t s = 0; s < n_shards; s++) {
+		if (sizes[s] < smallest)
+			smallest = sizes[s];
+		if (sizes[s] > largest)
+			largest = sizes[s];
+	}
+	fprintf(stderr, "shard_partition: %lu shards of %lu-%lu books, %lu of %lu edges cut (%.1f%%)\n",
+		n_shards, smallest, largest, cut, edges, edges ? 100.0 * cut / edges : 0.0);
+
+	for (size_t s = 0; s < n_shards; s++) {
+		snprintf(filename, len, "%s.%lu", prefix, s);
+		err = shard_save(filename, nodes, count, owner, s, n_shards);
+		if (err < 0)
+			goto out;
+	}
+
+out:
+	big_free(owner);
+	free(sizes);
+	free(filename);
+	return err;
+}
+
+static ssize_t search_u64(uint64_t *array, size_t n, uint64_t val)
+{
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (array[mid] < val)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < n && array[lo] == val ? (ssize_t) lo : -1;
+}
+
+ssize_t shard_local(struct shard_t *shard, uint64_t idx)
+{
+	return search_u64(shard->owned, shard->n_owned, idx);
+}
+
+/* Rewrites an edge list from global indices to local and ghost references. */
+static int shard_resolve(struct shard_t *shard, size_t *edges, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		ssize_t ref = shard_local(shard, edges[i]);
+		if (ref >= 0) {
+			edges[i] = ref;
+			continue;
+		}
+
+		ref = search_u64(shard->ghosts, shard->n_ghosts, edges[i]);
+		if (ref < 0)
+			return -1;
+		edges[i] = ref | SHARD_REF_GHOST;
+	}
+	return 0;
+}
+
+/*
+ * Checks that the counts in @hdr describe a shard file of exactly @size bytes,
+ * bounding each count by what is left of @size before it is multiplied.
+ */
+static bool shard_file_fits(struct shard_file_header_t *hdr, size_t size)
+{
+	size_t left = size;
+
+	if (left < sizeof(*hdr))
+		return false;
+	left -= sizeof(*hdr);
+	if (hdr->n_owned > left / sizeof(struct shard_file_book_t))
+		return false;
+	left -= hdr->n_owned * sizeof(struct shard_file_book_t);
+	if (hdr->n_edges > left / sizeof(uint64_t))
+		return false;
+	left -= hdr->n_edges * sizeof(uint64_t);
+	if (hdr->n_ghosts > left / sizeof(struct shard_file_ghost_t))
+		return false;
+	return left == hdr->n_ghosts * sizeof(struct shard_file_ghost_t);
+}
+
+/* Reads @n edges, which must be no more than the @left edges in the file. */
+static int shard_edges_load(FILE *f, size_t **b_edges, size_t *n_edges, uint64_t n, uint64_t *left)
+{
+	if (n > *left)
+		return -1;
+	*left -= n;
+
+	*n_edges = n;
+	*b_edges = malloc((n ? n : 1) * sizeof(**b_edges));
+	if (!*b_edges)
+		return -1;
+	if (n && fread(*b_edges, sizeof(uint64_t), n, f) != n)
+		return -1;
+	return 0;
+}
+
+struct shard_t *shard_load(const char *filename)
+{
+	struct shard_file_header_t hdr;
+	struct shard_file_book_t *books = NULL;
+	struct shard_file_ghost_t *ghosts = NULL;
+	struct stat st;
+	uint64_t left;
+
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		perror("shard_load: open shard file");
+		return NULL;
+	}
+
+	struct shard_t *shard = calloc(1, sizeof(*shard));
+	if (!shard)
+		goto err_parsing;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+		goto err_parsing;
+	if (memcmp(hdr.magic, SHARD_FILE_MAGIC, sizeof(hdr.magic)) || hdr.version != SHARD_FILE_VERSION)
+		goto err_parsing;
+	if (hdr.shard >= hdr.n_shards)
+		goto err_parsing;
+	if (fstat(fileno(f), &st) < 0 || !shard_file_fits(&hdr, st.st_size))
+		goto err_parsing;
+	left = hdr.n_edges;
+
+	shard->shard = hdr.shard;
+	shard->n_shards = hdr.n_shards;
+	shard->count = hdr.count;
+
+	books = malloc((hdr.n_owned ? hdr.n_owned : 1) * sizeof(*books));
+	shard->owned = big_alloc((hdr.n_owned ? hdr.n_owned : 1) * sizeof(*shard->owned));
+	shard->nodes = big_calloc(hdr.n_owned ? hdr.n_owned : 1, sizeof(*shard->nodes));
+	if (!books || !shard->owned || !shard->nodes)
+		goto err_parsing;
+	if (hdr.n_owned && fread(books, sizeof(*books), hdr.n_owned, f) != hdr.n_owned)
+		goto err_parsing;
+
+	for (size_t i = 0; i < hdr.n_owned; i++) {
+		struct book_t *book = &shard->nodes[i];
+
+		shard->owned[i] = books[i].idx;
+		book->id = books[i].id;
+		book->author_id = books[i].author_id;
+		book->publisher_id = books[i].publisher_id;
+		shard->n_owned++;
+
+		if (shard_edges_load(f, &book->b_author_edges, &book->n_author_edges, books[i].n_author_edges, &left) < 0)
+			goto err_parsing;
+		if (shard_edges_load(f, &book->b_citation_edges, &book->n_citation_edges, books[i].n_citation_edges, &left) < 0)
+			goto err_parsing;
+		if (shard_edges_load(f, &book->b_publisher_edges, &book->n_publisher_edges, books[i].n_publisher_edges, &left) < 0)
+			goto err_parsing;
+	}
+
+	ghosts = malloc((hdr.n_ghosts ? hdr.n_ghosts : 1) * sizeof(*ghosts));
+	shard->ghosts = malloc((hdr.n_ghosts ? hdr.n_ghosts : 1) * sizeof(*shard->ghosts));
+	shard->ghost_owner = malloc((hdr.n_ghosts ? hdr.n_ghosts : 1) * sizeof(*shard->ghost_owner));
+	if (!ghosts || !shard->ghosts || !shard->ghost_owner)
+		goto err_parsing;
+	if (hdr.n_ghosts && fread(ghosts, sizeof(*ghosts), hdr.n_ghosts, f) != hdr.n_ghosts)
+		goto err_parsing;
+	for (size_t i = 0; i < hdr.n_ghosts; i++) {
+		if (ghosts[i].owner >= hdr.n_shards || ghosts[i].owner == hdr.shard)
+			goto err_parsing;
+		shard->ghosts[i] = ghosts[i].idx;
+		shard->ghost_owner[i] = ghosts[i].owner;
+	}
+	shard->n_ghosts = hdr.n_ghosts;
+
+	for (size_t i = 0; i < shard->n_owned; i++) {
+		struct book_t *book = &shard->nodes[i];
+		if (shard_resolve(shard, book->b_author_edges, book->n_author_edges) < 0 ||
+		    shard_resolve(shard, book->b_citation_edges, book->n_citation_edges) < 0 ||
+		    shard_resolve(shard, book->b_publisher_edges, book->n_publisher_edges) < 0)
+			goto err_parsing;
+	}
+
+	free(books);
+	free(ghosts);
+	fclose(f);
+	return shard;
+
+err_parsing:
+	fprintf(stderr, "shard_load: failed to parse shard file\n");
+	free(books);
+	free(ghosts);
+	shard_free(shard);
+	fclose(f);
+	return NULL;
+}
+
+void shard_free(struct shard_t *shard)
+{
+	if (!shard)
+		return;
+
+	/* ->nodes is laid out just like a loaded graph. */
+	if (shard->nodes)
+		graph_unload(shard->nodes, shard->n_owned);
+	big_free(shard->owned);
+	free(shard->ghosts);
+	free(shard->ghost_owner);
+	free(shard);
+}
@@ -31,217 +31,343 @@
  * mention that it's also completely unethical.
  */
 
+
+/*
+ * Benchmark and property tests for the priority queues in pqueue.h. The
+ * workloads are traces of every pqueue_* operation done by real
+ * find_books_k_distance() runs (worm.c is built with -DPQ_TRACE), which are
+ * then replayed against each of the heap variants.
+ */
+
 #include <time.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "worm.h"
+#include "graph.h"
+#include "pqueue.h"
+
+struct pq_op_t {
+	uint8_t op;
+	uint32_t idx;
+	uint32_t value;
+};
 
-/* MIN-Priority Queue using array backing. */
-struct p_queue_t {
-	size_t *vector;
-	ssize_t *inverse;
-	size_t end;
+struct pq_trace_t {
+	struct pq_op_t *ops;
+	size_t n_ops, cap;
+	/* Largest queue allocated, which is the size of values[]. */
+	size_t size;
 };
 
-static struct p_queue_t *pqueue_alloc(size_t size)
+static struct pq_trace_t g_trace;
+
+void pqueue_trace(int op, size_t idx, uint32_t value)
 {
-	struct p_queue_t *queue = malloc(sizeof(*queue));
-	if (!queue)
-		goto err;
-
-	/* ->vector stores the actual queue. */
-	queue->vector = malloc(size * sizeof(*queue->vector));
-	if (!queue->vector)
-		goto err_vec;
-
-	/*
-	 * ->inverse stores a mapping from book_idx -> vector_idx. This is done to
-	 *  avoid linear lookups in pqueue_increase. Since the size of ->vector is
-	 *  always the same as the size of the graph (this is guaranteed by the
-	 *  caller) this is perfectly safe.
-	 */
-	queue->inverse = malloc(size * sizeof(*queue->vector));
-	if (!queue->inverse)
-		goto err_inv;
-
-	queue->end = 0;
-	memset(queue->vector, 0, size * sizeof(*queue->vector));
-	for (size_t i = 0; i < size; i++)
-		queue->inverse[i] = -1;
-	return queue;
-
-err_inv:
-	free(queue->vector);
-err_vec:
-	free(queue);
-err:
-	return NULL;
+	struct pq_trace_t *trace = &g_trace;
+
+	if (trace->n_ops == trace->cap) {
+		size_t cap = trace->cap ? 2 * trace->cap : 4096;
+		struct pq_op_t *ops = realloc(trace->ops, cap * sizeof(*ops));
+		if (!ops) {
+			perror("pqtest: realloc trace");
+			exit(1);
+		}
+		trace->ops = ops;
+		trace->cap = cap;
+	}
+
+	if (op == PQ_OP_ALLOC && idx > trace->size)
+		trace->size = idx;
+	trace->ops[trace->n_ops++] = (struct pq_op_t) {
+		.op = op,
+		.idx = idx,
+		.value = value,
+	};
 }
 
-static void pqueue_free(struct p_queue_t *queue)
+/* Opens a hardware cache-miss counter for this thread, or returns -1. */
+static int perf_open(void)
 {
-	if (queue) {
-		free(queue->vector);
-		free(queue->inverse);
-	}
-	free(queue);
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
 /*
- * Macros for indexing within the array. It's a binary heap, but stored as a
- * flat array to make cache access easier on the CPU.
+ * DEFUN_REPLAY(name) defines replay_name(), which replays @trace against the
+ * given queue variant and returns the number of removals whose value differed
+ * from the recorded one. Ties can be broken differently by each variant, but
+ * since the keys are monotone the sequence of removed values must be the same.
  */
-#define PQ_ROOT        0
-#define PQ_OFFSET      1
-#define PQ_LEFT(idx)   ((2*((idx) + PQ_OFFSET)) - PQ_OFFSET)
-#define PQ_RIGHT(idx)  ((2*((idx) + PQ_OFFSET) + 1) - PQ_OFFSET)
-#define PQ_PARENT(idx) ((((idx) + PQ_OFFSET) / 2) - PQ_OFFSET)
+#define DEFUN_REPLAY(name)							\
+	static size_t replay_##name(struct pq_trace_t *trace, uint32_t *values) \
+	{									\
+		struct name##_t *queue = NULL;					\
+		size_t mismatches = 0;						\
+										\
+		for (size_t i = 0; i < trace->n_ops; i++) {			\
+			struct pq_op_t *op = &trace->ops[i];			\
+										\
+			switch (op->op) {					\
+			case PQ_OP_ALLOC:					\
+				queue = name##_alloc(op->idx);			\
+				break;						\
+			case PQ_OP_INSERT:					\
+			case PQ_OP_INCREASE:					\
+				values[op->idx] = op->value;			\
+				name##_increase(queue, values, op->idx);	\
+				break;						\
+			case PQ_OP_REMOVE:					\
+				if (name##_empty(queue) ||			\
+				    values[name##_remove(queue, values)] != op->value) \
+					mismatches++;				\
+				break;						\
+			case PQ_OP_FREE:					\
+				name##_free(queue);				\
+				queue = NULL;					\
+				break;						\
+			}							\
+		}								\
+		return mismatches;						\
+	}
 
 /*
- * Insert the the given index (with the corresponding value in @values) into
- * the priority queue.
+ * DEFUN_CHECK(name) defines check_name(), which runs @rounds random
+ * operations against the variant and checks each removal against a naive
+ * reference (a linear scan of everything that should be queued). Returns the
+ * number of failures.
  */
-static inline void pqueue_insert(struct p_queue_t *queue, const uint32_t *values, size_t idx)
-{
-	/*
-	 * We make a lot of assumptions to allow us to store the raw idx as well as
-	 * not doing any extra allocations. In particular, we assume the caller
-	 * isn't messing with us and won't change values that are owned by us. This
-	 * isn't Rust so you can't express that restriction in code without locks.
-	 */
+#define DEFUN_CHECK(name)							\
+	static size_t check_##name(size_t size, size_t rounds, unsigned seed)	\
+	{									\
+		struct name##_t *queue = name##_alloc(size);			\
+		uint32_t *values = malloc(size * sizeof(*values));		\
+		uint8_t *queued = calloc(size, sizeof(*queued));		\
+		size_t n_queued = 0, failures = 0;				\
+		uint32_t last = 0;						\
+										\
+		srand(seed);							\
+		for (size_t i = 0; i < rounds; i++) {				\
+			size_t idx = rand() % size;				\
+										\
+			if (rand() % 3 || !n_queued) {				\
+				/* Keys must stay monotone for rheap. */	\
+				uint32_t value = last + rand() % 64;		\
+				if (queued[idx] && value >= values[idx])	\
+					continue;				\
+				if (!queued[idx])				\
+					n_queued++;				\
+				queued[idx] = 1;				\
+				values[idx] = value;				\
+				name##_increase(queue, values, idx);		\
+				continue;					\
+			}							\
+										\
+			uint32_t min = UINT32_MAX;				\
+			for (size_t j = 0; j < size; j++)			\
+				if (queued[j] && values[j] < min)		\
+					min = values[j];			\
+										\
+			idx = name##_remove(queue, values);			\
+			if (!queued[idx] || values[idx] != min)			\
+				failures++;					\
+			queued[idx] = 0;					\
+			n_queued--;						\
+			last = values[idx];					\
+		}								\
+										\
+		/* Drain the queue, which must also be in order. */		\
+		while (!name##_empty(queue)) {					\
+			size_t idx = name##_remove(queue, values);		\
+			if (!queued[idx] || values[idx] < last)			\
+				failures++;					\
+			queued[idx] = 0;					\
+			n_queued--;						\
+			last = values[idx];					\
+		}								\
+		if (n_queued)							\
+			failures++;						\
+										\
+		free(queued);							\
+		free(values);							\
+		name##_free(queue);						\
+		return failures;						\
+	}
 
-	/* Insert at the end. */
-	size_t slot = queue->end++;
+DEFUN_REPLAY(dheap2)
+DEFUN_REPLAY(dheap4)
+DEFUN_REPLAY(pheap)
+DEFUN_REPLAY(rheap)
 
-	/* Propogate up the tree. */
-	while (slot) {
-		size_t parent = PQ_PARENT(slot);
+DEFUN_CHECK(dheap2)
+DEFUN_CHECK(dheap4)
+DEFUN_CHECK(pheap)
+DEFUN_CHECK(rheap)
 
-		if (values[idx] > values[queue->vector[parent]])
-			break;
+struct variant_t {
+	const char *name;
+	size_t (*replay)(struct pq_trace_t *, uint32_t *);
+	size_t (*check)(size_t, size_t, unsigned);
+};
 
-		queue->vector[slot] = queue->vector[parent];
-		queue->inverse[queue->vector[slot]] = slot;
-		slot = parent;
-	}
+#define VARIANT(name) { #name, replay_##name, check_##name }
 
-	queue->vector[slot] = idx;
-	queue->inverse[idx] = slot;
-}
+static struct variant_t variants[] = {
+	VARIANT(dheap2),
+	VARIANT(dheap4),
+	VARIANT(pheap),
+	VARIANT(rheap),
+};
 
-/*
- * Increases the priority (decreases the value) of the given idx in the
- * priority queue. Note that the *only* value owned by queue that is allowed to
- * be changed by the caller is value[idx] -- and the value *must* have been
- * *decreased*.
- */
-static void pqueue_increase(struct p_queue_t *queue, const uint32_t *values, size_t idx)
+#define NUM_VARIANTS (sizeof(variants) / sizeof(*variants))
+
+/* Records the pqueue trace of find_books_k_distance() from @sources books. */
+static void record(struct book_t *nodes, size_t count, size_t sources, uint16_t k)
 {
-	/*
-	 * Get the inverse vector and fall-back to a normal insert if the element
-	 * is not present in the pqueue.
-	 */
-	ssize_t vecidx = queue->inverse[idx];
-	if (vecidx < 0)
-		return pqueue_insert(queue, values, idx);
-
-	/*
-	 * Bubble *up*. We know the direction because the caller told us they
-	 * decreased the value.
-	 */
-	size_t slot = vecidx;
-	while (slot) {
-		size_t parent = PQ_PARENT(slot);
-
-		if (values[idx] > values[queue->vector[parent]])
-			break;
+	size_t stride = count / sources ? count / sources : 1;
 
-		queue->vector[slot] = queue->vector[parent];
-		queue->inverse[queue->vector[slot]] = slot;
-		slot = parent;
+	for (size_t i = 0; i < count; i += stride) {
+		struct result_t *result = find_books_k_distance(nodes, count, nodes[i].id, k);
+		free(result->elements);
+		free(result);
 	}
-
-	queue->vector[slot] = idx;
-	queue->inverse[idx] = slot;
 }
 
-/*
- * Pop the highest value off the priority queue and reorder the queue as
- * necessary usign the provided values vector.
- */
-static inline size_t pqueue_remove(struct p_queue_t *queue, const uint32_t *values)
+static int bench(struct pq_trace_t *trace, size_t rounds)
 {
-	/* Get our return value first. */
-	size_t slot = PQ_ROOT;
-	size_t idx = queue->vector[slot];
-
-	/* Deregister inverse. */
-	queue->inverse[idx] = -1;
-
-	/* We need to swap the end with the head. */
-	queue->vector[slot] = queue->vector[--queue->end];
-	size_t tmp = queue->vector[slot];
-
-	/* Propogate the newest head down if necessary. */
-	while (PQ_LEFT(slot) <= queue->end) {
-		size_t left = PQ_LEFT(slot);
-		size_t right = PQ_RIGHT(slot);
-
-		size_t child = left;
-		if (right < queue->end) {
-			if (values[queue->vector[right]] < values[queue->vector[left]])
-				child = right;
+	uint32_t *values = malloc(trace->size * sizeof(*values));
+	int perf = perf_open(), failed = 0;
+
+	printf("%-8s %14s %14s %10s\n", "variant", "ops/sec", "cache-misses", "mismatches");
+	for (size_t i = 0; i < NUM_VARIANTS; i++) {
+		struct variant_t *variant = &variants[i];
+		size_t mismatches = 0;
+		uint64_t misses = 0;
+
+		if (perf >= 0) {
+			ioctl(perf, PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf, PERF_EVENT_IOC_ENABLE, 0);
 		}
 
-		if (values[tmp] <= values[queue->vector[child]])
-			break;
+		double start = now();
+		for (size_t r = 0; r < rounds; r++)
+			mismatches += variant->replay(trace, values);
+		double elapsed = now() - start;
+
+		if (perf >= 0) {
+			ioctl(perf, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(perf, &misses, sizeof(misses)) != sizeof(misses))
+				misses = 0;
+		}
+
+		printf("%-8s %14.0f ", variant->name, trace->n_ops * rounds / elapsed);
+		if (perf >= 0)
+			printf("%14lu ", misses);
+		else
+			printf("%14s ", "-");
+		printf("%10lu\n", mismatches);
 
-		queue->vector[slot] = queue->vector[child];
-		queue->inverse[queue->vector[slot]] = slot;
-		slot = child;
+		if (mismatches)
+			failed = 1;
 	}
 
-	queue->vector[slot] = tmp;
-	queue->inverse[tmp] = slot;
-	return idx;
+	if (perf >= 0)
+		close(perf);
+	free(values);
+	return failed;
+}
+
+static int check(size_t rounds)
+{
+	size_t sizes[] = { 1, 2, 7, 100, 1000 };
+	int failed = 0;
+
+	for (size_t i = 0; i < NUM_VARIANTS; i++) {
+		struct variant_t *variant = &variants[i];
+		size_t failures = 0;
+
+		for (size_t j = 0; j < sizeof(sizes) / sizeof(*sizes); j++)
+			failures += variant->check(sizes[j], rounds, j + 1);
+
+		printf("%-8s %s (%lu failures)\n", variant->name, failures ? "FAIL" : "ok", failures);
+		if (failures)
+			failed = 1;
+	}
+	return failed;
 }
 
-static inline int pqueue_empty(struct p_queue_t *queue)
+void usage(void)
 {
-	return !queue->end;
+	fprintf(stderr, "usage: pqtest [-k <k>] [-s <sources>] [-r <rounds>] <graph>\n");
+	fprintf(stderr, "       pqtest -c [-r <rounds>]\n");
 }
 
-#define SIZE 10
-int main(void)
+int main(int argc, char **argv)
 {
-	srand(time(NULL) | getpid());
-
-	struct p_queue_t *queue = pqueue_alloc(SIZE);
-
-	/* Generate random values. */
-	uint32_t values[SIZE] = {0};
-	for (size_t i = 0; i < SIZE; i++)
-		values[i] = rand() % 100;
-
-	/* Generate, making sure the invariants are followed. */
-	for (size_t i = 0; i < SIZE; i++) {
-		pqueue_insert(queue, values, i);
-		/*
-		for (size_t j = 0; j < queue->end; j++)
-			printf("  add%lu  [%lu] -> %lu -> %lu\n", i, j, queue->vector[j], values[queue->vector[j]]);
-		*/
+	int opt, check_only = 0;
+	size_t sources = 64, rounds = 0;
+	uint16_t k = 8;
+
+	while ((opt = getopt(argc, argv, "ck:s:r:")) != -1) {
+		switch (opt) {
+		case 'c':
+			check_only = 1;
+			break;
+		case 'k':
+			k = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			sources = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+			return 1;
+		}
 	}
-	for (size_t i = 0; i < SIZE; i++) {
-		size_t val = pqueue_remove(queue, values);
-		/*
-		for (size_t j = 0; j < queue->end; j++)
-			printf("  rem%lu  [%lu] -> %lu -> %lu\n", i, j, queue->vector[j], values[queue->vector[j]]);
-		*/
-		printf("[%lu] %lu -> %lu\n", queue->end, val, values[val]);
+
+	if (check_only)
+		return check(rounds ? rounds : 20000);
+
+	if (argc - optind != 1 || !sources) {
+		usage();
+		return 1;
 	}
 
-	return 0;
+	size_t count = 0;
+	struct book_t *nodes = graph_open(argv[optind], &count);
+	if (!nodes)
+		return 1;
+
+	record(nodes, count, sources, k);
+	graph_unload(nodes, count);
+
+	printf("recorded %lu operations from %lu sources (k=%u)\n", g_trace.n_ops, sources, k);
+	int failed = bench(&g_trace, rounds ? rounds : 10);
+	free(g_trace.ops);
+	return failed;
 }
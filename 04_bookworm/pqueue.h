@@ -0,0 +1,535 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(PQUEUE_H)
+#define PQUEUE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bigalloc.h"
+
+/*
+ * MIN-Priority Queues keyed by book_idx, where the priority of each idx is
+ * stored by the caller in a shared uint32_t values[] array. All of the queues
+ * here have the same interface:
+ *
+ *   <name>_alloc(size)                  -- size is the size of the graph.
+ *   <name>_free(queue)
+ *   <name>_insert(queue, values, idx)
+ *   <name>_increase(queue, values, idx) -- values[idx] was *decreased*.
+ *   <name>_remove(queue, values)        -- pops an idx with the smallest value.
+ *   <name>_empty(queue)
+ *
+ * As with the original p_queue_t, the caller must only touch values[] entries
+ * which are not inside the queue (or which are being passed to _increase).
+ * The radix heap also requires the keys to be monotone (no value can be
+ * inserted which is smaller than the last value removed), which is always true
+ * for Djikstra-style searches.
+ *
+ * The variant used by worm.c is selected with PQ_VARIANT (see the bottom of
+ * this file), and pq_test/ has the benchmark used to pick the default.
+ */
+
+/*
+ * d-ary heap using array backing. DEFUN_DHEAP(name, arity) defines struct
+ * name_t and the name_* functions. It's stored as a flat array to make cache
+ * access easier on the CPU, and wider heaps trade more comparisons per level
+ * in _remove for a shallower tree (and fewer cache lines touched).
+ */
+#define DHEAP_PARENT(arity, idx) (((idx) - 1) / (arity))
+#define DHEAP_CHILD(arity, idx)  ((arity) * (idx) + 1)
+
+#define DEFUN_DHEAP(name, arity)						\
+	struct name##_t {							\
+		size_t *vector;							\
+		ssize_t *inverse;						\
+		size_t end;							\
+	};									\
+										\
+	static inline struct name##_t *name##_alloc(size_t size)		\
+	{									\
+		struct name##_t *queue = malloc(sizeof(*queue));		\
+		if (!queue)							\
+			return NULL;						\
+										\
+		/* ->inverse maps book_idx -> vector_idx, to avoid linear lookups. */ \
+		queue->vector = big_alloc(size * sizeof(*queue->vector));	\
+		queue->inverse = big_alloc(size * sizeof(*queue->inverse));	\
+		if (!queue->vector || !queue->inverse) {			\
+			big_free(queue->vector);				\
+			big_free(queue->inverse);				\
+			free(queue);						\
+			return NULL;						\
+		}								\
+										\
+		queue->end = 0;							\
+		for (size_t i = 0; i < size; i++)				\
+			queue->inverse[i] = -1;					\
+		return queue;							\
+	}									\
+										\
+	static inline void name##_free(struct name##_t *queue)			\
+	{									\
+		if (queue) {							\
+			big_free(queue->vector);				\
+			big_free(queue->inverse);				\
+		}								\
+		free(queue);							\
+	}									\
+										\
+	/* Propogate idx up the tree, starting from slot. */			\
+	static inline void name##_siftup(struct name##_t *queue, const uint32_t *values, size_t slot, size_t idx) \
+	{									\
+		while (slot) {							\
+			size_t parent = DHEAP_PARENT(arity, slot);		\
+										\
+			if (values[idx] >= values[queue->vector[parent]])	\
+				break;						\
+										\
+			queue->vector[slot] = queue->vector[parent];		\
+			queue->inverse[queue->vector[slot]] = slot;		\
+			slot = parent;						\
+		}								\
+										\
+		queue->vector[slot] = idx;					\
+		queue->inverse[idx] = slot;					\
+	}									\
+										\
+	static inline void name##_insert(struct name##_t *queue, const uint32_t *values, size_t idx) \
+	{									\
+		name##_siftup(queue, values, queue->end++, idx);		\
+	}									\
+										\
+	static inline void name##_increase(struct name##_t *queue, const uint32_t *values, size_t idx) \
+	{									\
+		ssize_t vecidx = queue->inverse[idx];				\
+		if (vecidx < 0)							\
+			return name##_insert(queue, values, idx);		\
+		name##_siftup(queue, values, vecidx, idx);			\
+	}									\
+										\
+	static inline size_t name##_remove(struct name##_t *queue, const uint32_t *values) \
+	{									\
+		size_t slot = 0;						\
+		size_t idx = queue->vector[slot];				\
+		queue->inverse[idx] = -1;					\
+										\
+		/* Move the end to the head and propogate it down. */		\
+		size_t tmp = queue->vector[--queue->end];			\
+		if (!queue->end)						\
+			return idx;						\
+										\
+		while (DHEAP_CHILD(arity, slot) < queue->end) {		\
+			size_t first = DHEAP_CHILD(arity, slot);		\
+			size_t last = first + (arity);				\
+			if (last > queue->end)					\
+				last = queue->end;				\
+										\
+			size_t child = first;					\
+			for (size_t i = first + 1; i < last; i++)		\
+				if (values[queue->vector[i]] < values[queue->vector[child]]) \
+					child = i;				\
+										\
+			if (values[tmp] <= values[queue->vector[child]])	\
+				break;						\
+										\
+			queue->vector[slot] = queue->vector[child];		\
+			queue->inverse[queue->vector[slot]] = slot;		\
+			slot = child;						\
+		}								\
+										\
+		queue->vector[slot] = tmp;					\
+		queue->inverse[tmp] = slot;					\
+		return idx;							\
+	}									\
+										\
+	static inline int name##_empty(struct name##_t *queue)			\
+	{									\
+		return !queue->end;						\
+	}
+
+DEFUN_DHEAP(dheap2, 2)
+DEFUN_DHEAP(dheap4, 4)
+
+/*
+ * Pairing heap. Each node is a book_idx, and the tree is threaded through
+ * ->child (leftmost child), ->sibling (next sibling to the right) and ->prev
+ * (the left sibling, or the parent for the leftmost child). This gives O(1)
+ * insert and decrease-key, with an amortised O(log n) remove.
+ */
+struct pheap_t {
+	ssize_t root;
+	ssize_t *child;
+	ssize_t *sibling;
+	ssize_t *prev;
+	/* Whether idx is currently in the heap. */
+	uint8_t *queued;
+	size_t size;
+};
+
+static inline struct pheap_t *pheap_alloc(size_t size)
+{
+	struct pheap_t *queue = malloc(sizeof(*queue));
+	if (!queue)
+		return NULL;
+
+	queue->child = big_alloc(size * sizeof(*queue->child));
+	queue->sibling = big_alloc(size * sizeof(*queue->sibling));
+	queue->prev = big_alloc(size * sizeof(*queue->prev));
+	queue->queued = big_calloc(size, sizeof(*queue->queued));
+	if (!queue->child || !queue->sibling || !queue->prev || !queue->queued) {
+		big_free(queue->child);
+		big_free(queue->sibling);
+		big_free(queue->prev);
+		big_free(queue->queued);
+		free(queue);
+		return NULL;
+	}
+
+	queue->root = -1;
+	queue->size = 0;
+	return queue;
+}
+
+static inline void pheap_free(struct pheap_t *queue)
+{
+	if (queue) {
+		big_free(queue->child);
+		big_free(queue->sibling);
+		big_free(queue->prev);
+		big_free(queue->queued);
+	}
+	free(queue);
+}
+
+/* Melds two (non-empty) root trees, returning the new root. */
+static inline size_t pheap_meld(struct pheap_t *queue, const uint32_t *values, size_t a, size_t b)
+{
+	if (values[b] < values[a]) {
+		size_t tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	/* b becomes the leftmost child of a. */
+	queue->sibling[b] = queue->child[a];
+	if (queue->child[a] >= 0)
+		queue->prev[queue->child[a]] = b;
+	queue->prev[b] = a;
+	queue->child[a] = b;
+	queue->sibling[a] = -1;
+	queue->prev[a] = -1;
+	return a;
+}
+
+static inline void pheap_insert(struct pheap_t *queue, const uint32_t *values, size_t idx)
+{
+	queue->child[idx] = queue->sibling[idx] = queue->prev[idx] = -1;
+	queue->queued[idx] = 1;
+	queue->size++;
+
+	if (queue->root < 0)
+		queue->root = idx;
+	else
+		queue->root = pheap_meld(queue, values, queue->root, idx);
+}
+
+static inline void pheap_increase(struct pheap_t *queue, const uint32_t *values, size_t idx)
+{
+	if (!queue->queued[idx])
+		return pheap_insert(queue, values, idx);
+	if ((size_t) queue->root == idx)
+		return;
+
+	/* Cut idx (and its subtree) out from its parent, and meld it with the root. */
+	ssize_t prev = queue->prev[idx];
+	if (queue->child[prev] == (ssize_t) idx)
+		queue->child[prev] = queue->sibling[idx];
+	else
+		queue->sibling[prev] = queue->sibling[idx];
+	if (queue->sibling[idx] >= 0)
+		queue->prev[queue->sibling[idx]] = prev;
+
+	queue->root = pheap_meld(queue, values, queue->root, idx);
+}
+
+static inline size_t pheap_remove(struct pheap_t *queue, const uint32_t *values)
+{
+	size_t idx = queue->root;
+	queue->queued[idx] = 0;
+	queue->size--;
+
+	/*
+	 * Standard two-pass pairing. The first pass melds the children in pairs
+	 * from left to right, and pushes each pair onto a stack (threaded through
+	 * ->sibling). The second pass melds the stack from right to left.
+	 */
+	ssize_t stack = -1;
+	ssize_t current = queue->child[idx];
+	while (current >= 0) {
+		ssize_t next = queue->sibling[current];
+		size_t pair = current;
+
+		if (next >= 0) {
+			ssize_t after = queue->sibling[next];
+			pair = pheap_meld(queue, values, current, next);
+			next = after;
+		}
+
+		queue->sibling[pair] = stack;
+		stack = pair;
+		current = next;
+	}
+
+	queue->root = -1;
+	while (stack >= 0) {
+		ssize_t next = queue->sibling[stack];
+		if (queue->root < 0) {
+			queue->root = stack;
+			queue->sibling[stack] = queue->prev[stack] = -1;
+		} else {
+			queue->root = pheap_meld(queue, values, queue->root, stack);
+		}
+		stack = next;
+	}
+
+	return idx;
+}
+
+static inline int pheap_empty(struct pheap_t *queue)
+{
+	return !queue->size;
+}
+
+/*
+ * Radix heap. Since keys are monotone, every key in the heap shares a prefix
+ * with the last removed key (->last), and bucket i holds the keys whose
+ * highest bit differing from ->last is bit (i - 1). Bucket 0 holds keys equal
+ * to ->last. Removing from an empty bucket 0 redistributes the smallest
+ * non-empty bucket, which only moves each key down. Buckets are intrusive
+ * doubly-linked lists, like b_queue_t in worm.c.
+ */
+#define RHEAP_BUCKETS 33
+
+struct rheap_t {
+	ssize_t buckets[RHEAP_BUCKETS];
+	ssize_t *next, *prev;
+	/* Maps book_idx -> bucket, or -1 if not queued. */
+	int8_t *inverse;
+	uint32_t last;
+	size_t size;
+};
+
+static inline struct rheap_t *rheap_alloc(size_t size)
+{
+	struct rheap_t *queue = malloc(sizeof(*queue));
+	if (!queue)
+		return NULL;
+
+	queue->next = big_alloc(size * sizeof(*queue->next));
+	queue->prev = big_alloc(size * sizeof(*queue->prev));
+	queue->inverse = big_alloc(size * sizeof(*queue->inverse));
+	if (!queue->next || !queue->prev || !queue->inverse) {
+		big_free(queue->next);
+		big_free(queue->prev);
+		big_free(queue->inverse);
+		free(queue);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < RHEAP_BUCKETS; i++)
+		queue->buckets[i] = -1;
+	memset(queue->inverse, -1, size * sizeof(*queue->inverse));
+	queue->last = 0;
+	queue->size = 0;
+	return queue;
+}
+
+static inline void rheap_free(struct rheap_t *queue)
+{
+	if (queue) {
+		big_free(queue->next);
+		big_free(queue->prev);
+		big_free(queue->inverse);
+	}
+	free(queue);
+}
+
+static inline int rheap_bucket(struct rheap_t *queue, uint32_t value)
+{
+	uint32_t diff = value ^ queue->last;
+	return diff ? 32 - __builtin_clz(diff) : 0;
+}
+
+static inline void rheap_link(struct rheap_t *queue, int bucket, size_t idx)
+{
+	queue->prev[idx] = -1;
+	queue->next[idx] = queue->buckets[bucket];
+	if (queue->next[idx] >= 0)
+		queue->prev[queue->next[idx]] = idx;
+	queue->buckets[bucket] = idx;
+	queue->inverse[idx] = bucket;
+}
+
+static inline void rheap_unlink(struct rheap_t *queue, size_t idx)
+{
+	if (queue->prev[idx] >= 0)
+		queue->next[queue->prev[idx]] = queue->next[idx];
+	else
+		queue->buckets[queue->inverse[idx]] = queue->next[idx];
+	if (queue->next[idx] >= 0)
+		queue->prev[queue->next[idx]] = queue->prev[idx];
+	queue->inverse[idx] = -1;
+}
+
+static inline void rheap_insert(struct rheap_t *queue, const uint32_t *values, size_t idx)
+{
+	rheap_link(queue, rheap_bucket(queue, values[idx]), idx);
+	queue->size++;
+}
+
+static inline void rheap_increase(struct rheap_t *queue, const uint32_t *values, size_t idx)
+{
+	if (queue->inverse[idx] < 0)
+		return rheap_insert(queue, values, idx);
+
+	int bucket = rheap_bucket(queue, values[idx]);
+	if (bucket != queue->inverse[idx]) {
+		rheap_unlink(queue, idx);
+		rheap_link(queue, bucket, idx);
+	}
+}
+
+static inline size_t rheap_remove(struct rheap_t *queue, const uint32_t *values)
+{
+	if (queue->buckets[0] < 0) {
+		int bucket = 1;
+		while (queue->buckets[bucket] < 0)
+			bucket++;
+
+		/* Find the new ->last, and redistribute the bucket with respect to it. */
+		ssize_t current = queue->buckets[bucket];
+		queue->last = values[current];
+		for (; current >= 0; current = queue->next[current])
+			if (values[current] < queue->last)
+				queue->last = values[current];
+
+		current = queue->buckets[bucket];
+		queue->buckets[bucket] = -1;
+		while (current >= 0) {
+			ssize_t next = queue->next[current];
+			rheap_link(queue, rheap_bucket(queue, values[current]), current);
+			current = next;
+		}
+	}
+
+	size_t idx = queue->buckets[0];
+	rheap_unlink(queue, idx);
+	queue->size--;
+	return idx;
+}
+
+static inline int rheap_empty(struct rheap_t *queue)
+{
+	return !queue->size;
+}
+
+/*
+ * The pqueue_* wrappers use the variant given by PQ_VARIANT (one of dheap2,
+ * dheap4, pheap or rheap), which is set by worm.c. They also allow every
+ * operation to be traced by defining PQ_TRACE and providing pqueue_trace(),
+ * which is how pq_test/ records real workloads.
+ */
+#if !defined(PQ_VARIANT)
+#	define PQ_VARIANT dheap2
+#endif
+
+#define __PQ_CONCAT(a, b) a ## b
+#define _PQ_CONCAT(a, b)  __PQ_CONCAT(a, b)
+#define PQ_TYPE           _PQ_CONCAT(PQ_VARIANT, _t)
+#define PQ_FN(fn)         _PQ_CONCAT(PQ_VARIANT, _ ## fn)
+
+enum {
+	PQ_OP_ALLOC,
+	PQ_OP_INSERT,
+	PQ_OP_INCREASE,
+	PQ_OP_REMOVE,
+	PQ_OP_FREE,
+};
+
+#if defined(PQ_TRACE)
+void pqueue_trace(int op, size_t idx, uint32_t value);
+#else
+#	define pqueue_trace(op, idx, value) do { } while (0)
+#endif
+
+static inline struct PQ_TYPE *pqueue_alloc(size_t size)
+{
+	pqueue_trace(PQ_OP_ALLOC, size, 0);
+	return PQ_FN(alloc)(size);
+}
+
+static inline void pqueue_free(struct PQ_TYPE *queue)
+{
+	pqueue_trace(PQ_OP_FREE, 0, 0);
+	PQ_FN(free)(queue);
+}
+
+static inline void pqueue_insert(struct PQ_TYPE *queue, const uint32_t *values, size_t idx)
+{
+	pqueue_trace(PQ_OP_INSERT, idx, values[idx]);
+	PQ_FN(insert)(queue, values, idx);
+}
+
+static inline void pqueue_increase(struct PQ_TYPE *queue, const uint32_t *values, size_t idx)
+{
+	pqueue_trace(PQ_OP_INCREASE, idx, values[idx]);
+	PQ_FN(increase)(queue, values, idx);
+}
+
+static inline size_t pqueue_remove(struct PQ_TYPE *queue, const uint32_t *values)
+{
+	size_t idx = PQ_FN(remove)(queue, values);
+	pqueue_trace(PQ_OP_REMOVE, idx, values[idx]);
+	return idx;
+}
+
+static inline int pqueue_empty(struct PQ_TYPE *queue)
+{
+	return PQ_FN(empty)(queue);
+}
+
+#endif
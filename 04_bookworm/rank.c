@@ -0,0 +1,510 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "worm.h"
+#include "graph.h"
+#include "bigalloc.h"
+#include "rank.h"
+
+/* State shared between the threads of a graph_rank. */
+struct rank_ctx_t {
+	struct book_t *nodes;
+	size_t count;
+	/* Number of books which haven't been deleted. */
+	size_t live;
+	double damping;
+
+	/* Reverse citations, in CSR form and in ascending order of citer. */
+	size_t *in_offsets;
+	size_t *in_edges;
+
+	/*
+	 * PageRank. ->contrib[i] is the score each citation of i passes on (its
+	 * score divided by its out-degree), double buffered since every node
+	 * computes its next contribution while others are still pulling the
+	 * current ones. ->base is the teleport plus the share of the dangling
+	 * (citation-less) books' scores that every book gets.
+	 */
+	double *scores, *next;
+	double *contrib[2];
+	int cur;
+	double base;
+
+	/* HITS, the raw scores are normalised once their norms are known. */
+	double *auth, *hub;
+	double *auth_raw, *hub_raw;
+	double auth_norm, hub_norm;
+};
+
+struct rank_arg_t {
+	struct rank_ctx_t *ctx;
+	size_t start;
+	size_t end;
+
+	/* Per-thread sums, reduced by the caller after every step. */
+	double dangling;
+	double residual;
+	double sum_sq;
+};
+
+void rank_params_default(struct rank_params_t *params)
+{
+	*params = (struct rank_params_t) {
+		.damping = RANK_DAMPING,
+		.tolerance = RANK_TOLERANCE,
+		.max_iterations = RANK_MAX_ITERATIONS,
+		.nthreads = g_nthreads,
+		.hits = false,
+	};
+}
+
+static inline bool rank_live(struct book_t *book)
+{
+	return book->id != BOOK_ID_NONE;
+}
+
+/* Builds the reverse citation CSR, so the steps can pull instead of push. */
+static int rank_build(struct rank_ctx_t *ctx)
+{
+	struct book_t *nodes = ctx->nodes;
+	size_t count = ctx->count;
+
+	ctx->in_offsets = big_calloc(count + 1, sizeof(*ctx->in_offsets));
+	if (!ctx->in_offsets)
+		return -1;
+
+	for (size_t i = 0; i < count; i++) {
+		if (rank_live(&nodes[i]))
+			ctx->live++;
+		for (size_t k = 0; k < nodes[i].n_citation_edges; k++)
+			ctx->in_offsets[nodes[i].b_citation_edges[k] + 1]++;
+	}
+	for (size_t i = 0; i < count; i++)
+		ctx->in_offsets[i + 1] += ctx->in_offsets[i];
+
+	size_t *fill = big_alloc(count * sizeof(*fill));
+	ctx->in_edges = big_alloc((ctx->in_offsets[count] ? ctx->in_offsets[count] : 1) * sizeof(*ctx->in_edges));
+	if (!fill || !ctx->in_edges) {
+		big_free(fill);
+		return -1;
+	}
+
+	memcpy(fill, ctx->in_offsets, count * sizeof(*fill));
+	for (size_t i = 0; i < count; i++)
+		for (size_t k = 0; k < nodes[i].n_citation_edges; k++)
+			ctx->in_edges[fill[nodes[i].b_citation_edges[k]]++] = i;
+
+	big_free(fill);
+	return 0;
+}
+
+/* Computes the initial contributions for the first PageRank step. */
+static void *pagerank_init(void *data)
+{
+	struct rank_arg_t *arg = data;
+	struct rank_ctx_t *ctx = arg->ctx;
+	double *contrib = ctx->contrib[ctx->cur];
+
+	arg->dangling = 0;
+	for (size_t i = arg->start; i < arg->end; i++) {
+		struct book_t *book = &ctx->nodes[i];
+
+		ctx->scores[i] = rank_live(book) ? 1.0 / ctx->live : 0;
+		contrib[i] = book->n_citation_edges ? ctx->scores[i] / book->n_citation_edges : 0;
+		if (!book->n_citation_edges)
+			arg->dangling += ctx->scores[i];
+	}
+	return NULL;
+}
+
+/* One PageRank iteration, which also computes the next contributions. */
+static void *pagerank_step(void *data)
+{
+	struct rank_arg_t *arg = data;
+	struct rank_ctx_t *ctx = arg->ctx;
+	double *contrib = ctx->contrib[ctx->cur];
+	double *contrib_next = ctx->contrib[!ctx->cur];
+
+	arg->dangling = 0;
+	arg->residual = 0;
+	for (size_t j = arg->start; j < arg->end; j++) {
+		struct book_t *book = &ctx->nodes[j];
+
+		if (!rank_live(book)) {
+			ctx->next[j] = contrib_next[j] = 0;
+			continue;
+		}
+
+		double sum = 0;
+		for (size_t k = ctx->in_offsets[j]; k < ctx->in_offsets[j + 1]; k++)
+			sum += contrib[ctx->in_edges[k]];
+
+		double score = ctx->base + ctx->damping * sum;
+		arg->residual += fabs(score - ctx->scores[j]);
+		ctx->next[j] = score;
+
+		if (book->n_citation_edges)
+			contrib_next[j] = score / book->n_citation_edges;
+		else {
+			contrib_next[j] = 0;
+			arg->dangling += score;
+		}
+	}
+	return NULL;
+}
+
+static double rank_reduce(struct rank_arg_t *args, size_t n, size_t offset)
+{
+	double sum = 0;
+	for (size_t i = 0; i < n; i++)
+		sum += *(double *) ((char *) &args[i] + offset);
+	return sum;
+}
+
+#define RANK_REDUCE(args, n, field) rank_reduce((args), (n), offsetof(struct rank_arg_t, field))
+
+static int graph_pagerank(struct rank_ctx_t *ctx, struct rank_arg_t *args, size_t nthreads,
+			  const struct rank_params_t *params, struct rank_t *rank)
+{
+	size_t count = ctx->count;
+
+	ctx->scores = big_alloc(count * sizeof(*ctx->scores));
+	ctx->next = big_alloc(count * sizeof(*ctx->next));
+	ctx->contrib[0] = big_alloc(count * sizeof(**ctx->contrib));
+	ctx->contrib[1] = big_alloc(count * sizeof(**ctx->contrib));
+	if (!ctx->scores || !ctx->next || !ctx->contrib[0] || !ctx->contrib[1])
+		goto out;
+
+	ctx->cur = 0;
+	run_parallel(args, sizeof(*args), nthreads, pagerank_init);
+	double dangling = RANK_REDUCE(args, nthreads, dangling);
+
+	double residual = INFINITY;
+	size_t iter = 0;
+	while (iter < params->max_iterations && residual >= params->tolerance) {
+		ctx->base = (1 - ctx->damping) / ctx->live + ctx->damping * dangling / ctx->live;
+		run_parallel(args, sizeof(*args), nthreads, pagerank_step);
+
+		dangling = RANK_REDUCE(args, nthreads, dangling);
+		residual = RANK_REDUCE(args, nthreads, residual);
+
+		double *tmp = ctx->scores;
+		ctx->scores = ctx->next;
+		ctx->next = tmp;
+		ctx->cur = !ctx->cur;
+		iter++;
+	}
+
+	rank->scores[RANK_PAGERANK] = ctx->scores;
+	rank->iterations[0] = iter;
+	rank->residual[0] = residual;
+	ctx->scores = NULL;
+
+out:
+	big_free(ctx->scores);
+	big_free(ctx->next);
+	big_free(ctx->contrib[0]);
+	big_free(ctx->contrib[1]);
+	return rank->scores[RANK_PAGERANK] ? 0 : -1;
+}
+
+static void *hits_init(void *data)
+{
+	struct rank_arg_t *arg = data;
+	struct rank_ctx_t *ctx = arg->ctx;
+
+	for (size_t i = arg->start; i < arg->end; i++) {
+		double score = rank_live(&ctx->nodes[i]) ? 1 / sqrt(ctx->live) : 0;
+		ctx->auth[i] = ctx->hub[i] = score;
+	}
+	return NULL;
+}
+
+/* A book's authority is the sum of the hub scores of the books citing it. */
+static void *hits_authority(void *data)
+{
+	struct rank_arg_t *arg = data;
+	struct rank_ctx_t *ctx = arg->ctx;
+
+	arg->sum_sq = 0;
+	for (size_t j = arg->start; j < arg->end; j++) {
+		double sum = 0;
+		for (size_t k = ctx->in_offsets[j]; k < ctx->in_offsets[j + 1]; k++)
+			sum += ctx->hub[ctx->in_edges[k]];
+		ctx->auth_raw[j] = sum;
+		arg->sum_sq += sum * sum;
+	}
+	return NULL;
+}
+
+/* A book's hub score is the sum of the authorities of the books it cites. */
+static void *hits_hub(void *data)
+{
+	struct rank_arg_t *arg = data;
+	struct rank_ctx_t *ctx = arg->ctx;
+
+	arg->sum_sq = 0;
+	for (size_t i = arg->start; i < arg->end; i++) {
+		struct book_t *book = &ctx->nodes[i];
+		double sum = 0;
+		for (size_t k = 0; k < book->n_citation_edges; k++)
+			sum += ctx->auth_raw[book->b_citation_edges[k]];
+		ctx->hub_raw[i] = sum;
+		arg->sum_sq += sum * sum;
+	}
+	return NULL;
+}
+
+static void *hits_normalise(void *data)
+{
+	struct rank_arg_t *arg = data;
+	struct rank_ctx_t *ctx = arg->ctx;
+
+	arg->residual = 0;
+	for (size_t i = arg->start; i < arg->end; i++) {
+		double auth = ctx->auth_norm ? ctx->auth_raw[i] / ctx->auth_norm : 0;
+		double hub = ctx->hub_norm ? ctx->hub_raw[i] / ctx->hub_norm : 0;
+
+		arg->residual += fabs(auth - ctx->auth[i]) + fabs(hub - ctx->hub[i]);
+		ctx->auth[i] = auth;
+		ctx->hub[i] = hub;
+	}
+	return NULL;
+}
+
+static int graph_hits(struct rank_ctx_t *ctx, struct rank_arg_t *args, size_t nthreads,
+		      const struct rank_params_t *params, struct rank_t *rank)
+{
+	size_t count = ctx->count;
+	int err = -1;
+
+	ctx->auth = big_alloc(count * sizeof(*ctx->auth));
+	ctx->hub = big_alloc(count * sizeof(*ctx->hub));
+	ctx->auth_raw = big_alloc(count * sizeof(*ctx->auth_raw));
+	ctx->hub_raw = big_alloc(count * sizeof(*ctx->hub_raw));
+	if (!ctx->auth || !ctx->hub || !ctx->auth_raw || !ctx->hub_raw)
+		goto out;
+
+	run_parallel(args, sizeof(*args), nthreads, hits_init);
+
+	double residual = INFINITY;
+	size_t iter = 0;
+	while (iter < params->max_iterations && residual >= params->tolerance) {
+		run_parallel(args, sizeof(*args), nthreads, hits_authority);
+		ctx->auth_norm = sqrt(RANK_REDUCE(args, nthreads, sum_sq));
+		run_parallel(args, sizeof(*args), nthreads, hits_hub);
+		ctx->hub_norm = sqrt(RANK_REDUCE(args, nthreads, sum_sq));
+		run_parallel(args, sizeof(*args), nthreads, hits_normalise);
+		residual = RANK_REDUCE(args, nthreads, residual);
+		iter++;
+	}
+
+	rank->scores[RANK_AUTHORITY] = ctx->auth;
+	rank->scores[RANK_HUB] = ctx->hub;
+	rank->iterations[1] = iter;
+	rank->residual[1] = residual;
+	ctx->auth = ctx->hub = NULL;
+	err = 0;
+
+out:
+	big_free(ctx->auth);
+	big_free(ctx->hub);
+	big_free(ctx->auth_raw);
+	big_free(ctx->hub_raw);
+	return err;
+}
+
+int graph_rank_update(struct rank_t *rank, struct book_t *nodes, size_t count, const struct rank_params_t *params)
+{
+	struct rank_ctx_t ctx = {
+		.nodes = nodes,
+		.count = count,
+		.damping = params->damping,
+	};
+	struct rank_arg_t *args = NULL;
+	size_t nthreads = params->nthreads ? params->nthreads : 1;
+	int err = -1;
+
+	bool pagerank = !rank->scores[RANK_PAGERANK];
+	bool hits = params->hits && !rank->scores[RANK_AUTHORITY];
+	if (!pagerank && !hits)
+		return 0;
+
+	if (rank_build(&ctx) < 0)
+		goto out;
+	/* There's nothing to score (and no 1/live to compute). */
+	if (!ctx.live) {
+		err = 0;
+		goto out;
+	}
+
+	args = calloc(nthreads, sizeof(*args));
+	if (!args)
+		goto out;
+	for (size_t i = 0; i < nthreads; i++) {
+		args[i].ctx = &ctx;
+		args[i].start = (i * count) / nthreads;
+		args[i].end = ((i + 1) * count) / nthreads;
+	}
+
+	if (pagerank && graph_pagerank(&ctx, args, nthreads, params, rank) < 0)
+		goto out;
+	if (hits && graph_hits(&ctx, args, nthreads, params, rank) < 0)
+		goto out;
+	err = 0;
+
+out:
+	free(args);
+	big_free(ctx.in_offsets);
+	big_free(ctx.in_edges);
+	return err;
+}
+
+struct rank_t *graph_rank(struct book_t *nodes, size_t count, const struct rank_params_t *params)
+{
+	struct rank_t *rank = calloc(1, sizeof(*rank));
+	if (!rank)
+		return NULL;
+	rank->count = count;
+
+	if (graph_rank_update(rank, nodes, count, params) < 0) {
+		graph_rank_free(rank);
+		return NULL;
+	}
+	return rank;
+}
+
+void graph_rank_free(struct rank_t *rank)
+{
+	if (!rank)
+		return;
+	for (int scoring = 0; scoring < NUM_RANKS; scoring++)
+		big_free(rank->scores[scoring]);
+	free(rank);
+}
+
+/* Whether @a should come before @b in the results. */
+static inline bool rank_before(const double *scores, size_t a, size_t b)
+{
+	return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+}
+
+/* Restores the heap below @i, where the root is the book that comes last. */
+static void rank_sift_down(const double *scores, size_t *heap, size_t n, size_t i)
+{
+	while (true) {
+		size_t last = i, l = 2*i + 1, r = 2*i + 2;
+
+		if (l < n && rank_before(scores, heap[last], heap[l]))
+			last = l;
+		if (r < n && rank_before(scores, heap[last], heap[r]))
+			last = r;
+		if (last == i)
+			return;
+
+		size_t tmp = heap[i];
+		heap[i] = heap[last];
+		heap[last] = tmp;
+		i = last;
+	}
+}
+
+/**
+ * find_top_influential - Finds the most influential books
+ * @nodes: node list from graph
+ * @count: size of node list
+ * @rank: scores computed by graph_rank for @nodes
+ * @scoring: which of the scores to use (RANK_*)
+ * @k: number of books to return
+ */
+struct result_t *find_top_influential(struct book_t *nodes, size_t count, const struct rank_t *rank, int scoring, size_t k)
+{
+	struct result_t *result = calloc(1, sizeof(*result));
+	if (!result)
+		return NULL;
+	if (scoring < 0 || scoring >= NUM_RANKS || !rank->scores[scoring] || !k)
+		return result;
+
+	const double *scores = rank->scores[scoring];
+	size_t *heap = malloc((k < count ? k : count) * sizeof(*heap));
+	size_t n = 0;
+	if (!heap && count)
+		goto err;
+
+	/* Keep the best k seen so far, with the worst of them at the root. */
+	for (size_t i = 0; i < count; i++) {
+		if (!rank_live(&nodes[i]))
+			continue;
+		if (n < k) {
+			size_t j = n++;
+			heap[j] = i;
+			while (j > 0 && rank_before(scores, heap[(j - 1) / 2], heap[j])) {
+				size_t tmp = heap[j];
+				heap[j] = heap[(j - 1) / 2];
+				heap[(j - 1) / 2] = tmp;
+				j = (j - 1) / 2;
+			}
+		} else if (rank_before(scores, i, heap[0])) {
+			heap[0] = i;
+			rank_sift_down(scores, heap, n, 0);
+		}
+	}
+
+	result->elements = malloc((n ? n : 1) * sizeof(*result->elements));
+	if (!result->elements)
+		goto err;
+
+	/* Popping the worst each time fills the result from the back. */
+	result->n_elements = n;
+	while (n > 0) {
+		result->elements[n - 1] = &nodes[heap[0]];
+		heap[0] = heap[--n];
+		rank_sift_down(scores, heap, n, 0);
+	}
+
+	free(heap);
+	return result;
+
+err:
+	free(heap);
+	free(result);
+	return NULL;
+}
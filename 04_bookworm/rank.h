@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(RANK_H)
+#define RANK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "worm.h"
+
+/*
+ * Influence scores over the citation graph. PageRank (and optionally HITS) is
+ * computed by pulling along the reverse citations, so every node's new score
+ * is written by exactly one thread and no atomics are needed. Iteration stops
+ * once the L1 change in the scores drops below the tolerance.
+ */
+#define RANK_DAMPING        0.85
+#define RANK_TOLERANCE      1e-9
+#define RANK_MAX_ITERATIONS 100
+
+/* Scorings, used to index rank_t. */
+enum {
+	RANK_PAGERANK,
+	RANK_AUTHORITY,
+	RANK_HUB,
+	NUM_RANKS,
+};
+
+struct rank_params_t {
+	double damping;
+	double tolerance;
+	size_t max_iterations;
+	size_t nthreads;
+	/* Whether to compute the HITS scores as well. */
+	bool hits;
+};
+
+struct rank_t {
+	size_t count;
+	/* Per node scores, NULL if that scoring wasn't computed. */
+	double *scores[NUM_RANKS];
+	/* Convergence of PageRank and HITS respectively. */
+	size_t iterations[2];
+	double residual[2];
+};
+
+void rank_params_default(struct rank_params_t *params);
+
+/*
+ * Scores the graph in @nodes. Deleted books get a score of 0. graph_rank_update
+ * only computes the scores that @rank doesn't have yet, and never touches the
+ * ones it does (so they can still be read while it runs).
+ */
+struct rank_t *graph_rank(struct book_t *nodes, size_t count, const struct rank_params_t *params);
+int graph_rank_update(struct rank_t *rank, struct book_t *nodes, size_t count, const struct rank_params_t *params);
+void graph_rank_free(struct rank_t *rank);
+
+/*
+ * Returns the @k books with the highest @scoring (RANK_*), highest first. Ties
+ * go to the book that comes first in @nodes.
+ */
+struct result_t *find_top_influential(struct book_t *nodes, size_t count, const struct rank_t *rank, int scoring, size_t k);
+
+#endif
@@ -0,0 +1,2536 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+/*
+ * Reference checks for the parts of worm that have a simpler (or older)
+ * equivalent. Every check runs both sides on randomly generated graphs and
+ * counts the places where they disagree. The graphs are written out in the
+ * text format and loaded with graph_load, since most of the interfaces take
+ * ownership of a loaded graph.
+ */
+
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "worm.h"
+#include "graph.h"
+#include "cache.h"
+#include "handle.h"
+#include "cursor.h"
+#include "index.h"
+#include "validate.h"
+#include "rank.h"
+#include "bitmap.h"
+
+/* Scratch files, which are all removed when we're done. */
+#define REF_MAX_FILES 32
+
+struct ref_t {
+	char dir[64];
+	char *files[REF_MAX_FILES];
+	size_t n_files;
+
+	/* Size of the generated graphs, and the seed for the first one. */
+	size_t n_books;
+	unsigned seed;
+};
+
+/* Returns the path of a new scratch file called @name. */
+static char *ref_path(struct ref_t *ref, const char *name)
+{
+	if (ref->n_files >= REF_MAX_FILES) {
+		fprintf(stderr, "reftest: too many scratch files\n");
+		exit(1);
+	}
+
+	char *path = malloc(strlen(ref->dir) + strlen(name) + 2);
+	if (!path) {
+		perror("reftest: malloc path");
+		exit(1);
+	}
+	sprintf(path, "%s/%s", ref->dir, name);
+	ref->files[ref->n_files++] = path;
+	return path;
+}
+
+/* Removes every scratch file (and anything worm left next to them). */
+static void ref_cleanup(struct ref_t *ref)
+{
+	for (size_t i = 0; i < ref->n_files; i++) {
+		char idx[strlen(ref->files[i]) + sizeof(GRAPH_INDEX_SUFFIX)];
+
+		sprintf(idx, "%s%s", ref->files[i], GRAPH_INDEX_SUFFIX);
+		unlink(idx);
+		unlink(ref->files[i]);
+		free(ref->files[i]);
+	}
+	ref->n_files = 0;
+	rmdir(ref->dir);
+}
+
+/* Writes @n space-separated edges as one line of the text format. */
+static void write_edges(FILE *f, size_t *edges, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		fprintf(f, "%s%lu", i ? " " : "", edges[i]);
+	fputc('\n', f);
+}
+
+/*
+ * Writes a random graph of @n books to @path. Author and publisher edges link
+ * every pair of books with the same author (or publisher), and about one book
+ * in eight is a reprint (the same id and author as an earlier book). The last
+ * 5% of the books are on their own, so there are components that can't reach
+ * each other. Citations are random, with the odd self loop and duplicate.
+ */
+static int graph_generate(const char *path, size_t n, unsigned seed)
+{
+	size_t n_authors = n / 6 + 1, n_publishers = n / 12 + 1;
+	size_t isolated = n / 20, connected = n - isolated;
+	int err = -1;
+
+	size_t *ids = malloc(n * sizeof(*ids));
+	size_t *authors = malloc(n * sizeof(*authors));
+	size_t *publishers = malloc(n * sizeof(*publishers));
+	size_t *edges = malloc((n + 8) * sizeof(*edges));
+	FILE *f = fopen(path, "w");
+	if (!ids || !authors || !publishers || !edges || !f)
+		goto out;
+
+	srand(seed);
+	for (size_t i = 0; i < n; i++) {
+		if (i >= connected) {
+			ids[i] = 1000 + 3 * i;
+			authors[i] = n_authors + i;
+			publishers[i] = n_publishers + i;
+		} else if (i && !(rand() % 8)) {
+			size_t j = rand() % i;
+			ids[i] = ids[j];
+			authors[i] = authors[j];
+			publishers[i] = rand() % n_publishers;
+		} else {
+			ids[i] = 1000 + 3 * i;
+			authors[i] = rand() % n_authors;
+			publishers[i] = rand() % n_publishers;
+		}
+	}
+
+	fprintf(f, "%lu\n", n);
+	for (size_t i = 0; i < n; i++) {
+		size_t n_edges;
+
+		fprintf(f, "%lu\n%lu\n%lu\n", ids[i], publishers[i], authors[i]);
+
+		n_edges = 0;
+		for (size_t j = 0; j < n; j++)
+			if (j != i && publishers[j] == publishers[i])
+				edges[n_edges++] = j;
+		write_edges(f, edges, n_edges);
+
+		n_edges = 0;
+		for (size_t j = 0; j < n; j++)
+			if (j != i && authors[j] == authors[i])
+				edges[n_edges++] = j;
+		write_edges(f, edges, n_edges);
+
+		n_edges = 0;
+		if (i < connected) {
+			size_t n_citations = rand() % 5;
+			for (size_t k = 0; k < n_citations; k++)
+				edges[n_edges++] = rand() % connected;
+			if (!(rand() % 50))
+				edges[n_edges++] = i;
+			if (n_edges && !(rand() % 50))
+				edges[n_edges] = edges[n_edges - 1], n_edges++;
+		}
+		write_edges(f, edges, n_edges);
+	}
+	err = 0;
+
+out:
+	if (f && fclose(f))
+		err = -1;
+	if (err < 0)
+		perror("reftest: write graph");
+	free(ids);
+	free(authors);
+	free(publishers);
+	free(edges);
+	return err;
+}
+
+/* Generates and loads a graph, exiting if that fails. */
+static struct book_t *ref_graph(struct ref_t *ref, const char *name, size_t n, unsigned seed, size_t *count)
+{
+	char *path = ref_path(ref, name);
+	if (graph_generate(path, n, seed) < 0)
+		exit(1);
+
+	struct book_t *nodes = graph_load(path, count);
+	if (!nodes)
+		exit(1);
+	return nodes;
+}
+
+/* Picks a book id for a query, which is occasionally one that doesn't exist. */
+static size_t random_id(struct book_t *nodes, size_t count)
+{
+	if (!(rand() % 20))
+		return 7;
+	return nodes[rand() % count].id;
+}
+
+static void result_free(struct result_t *result)
+{
+	if (result)
+		free(result->elements);
+	free(result);
+}
+
+/* Results are only equal if they have the same books in the same order. */
+static bool result_equal(struct result_t *a, struct result_t *b)
+{
+	if (!a || !b || a->n_elements != b->n_elements)
+		return false;
+	for (size_t i = 0; i < a->n_elements; i++)
+		if (a->elements[i] != b->elements[i])
+			return false;
+	return true;
+}
+
+/* Growable list of node indices, for the reference models. */
+struct vec_t {
+	size_t *v;
+	size_t n, cap;
+};
+
+static void vec_push(struct vec_t *vec, size_t val)
+{
+	if (vec->n >= vec->cap) {
+		vec->cap = vec->cap ? 2 * vec->cap : 8;
+		vec->v = realloc(vec->v, vec->cap * sizeof(*vec->v));
+		if (!vec->v) {
+			perror("reftest: realloc vec");
+			exit(1);
+		}
+	}
+	vec->v[vec->n++] = val;
+}
+
+static bool vec_contains(struct vec_t *vec, size_t val)
+{
+	for (size_t i = 0; i < vec->n; i++)
+		if (vec->v[i] == val)
+			return true;
+	return false;
+}
+
+/* Removes the first occurrence of @val, if there is one. */
+static void vec_remove(struct vec_t *vec, size_t val)
+{
+	for (size_t i = 0; i < vec->n; i++) {
+		if (vec->v[i] == val) {
+			memmove(vec->v + i, vec->v + i + 1, (vec->n - i - 1) * sizeof(*vec->v));
+			vec->n--;
+			return;
+		}
+	}
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a, y = *(const size_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* Compares two lists of indices as multisets, sorting both of them. */
+static bool same_multiset(size_t *a, size_t n_a, size_t *b, size_t n_b)
+{
+	if (n_a != n_b)
+		return false;
+	qsort(a, n_a, sizeof(*a), cmp_size);
+	qsort(b, n_b, sizeof(*b), cmp_size);
+	return !n_a || !memcmp(a, b, n_a * sizeof(*a));
+}
+
+/* A traversal query, as passed to the cached_find_* functions. */
+struct query_t {
+	int type;
+	size_t arg0, arg1;
+};
+
+/*
+ * Runs @rounds queries from @pool through @cache, and counts the results which
+ * differ from running the query directly.
+ */
+static size_t cache_compare(struct query_cache_t *cache, struct book_t *nodes, size_t count,
+			    struct query_t *pool, size_t n_pool, size_t rounds)
+{
+	size_t failures = 0;
+
+	for (size_t r = 0; r < rounds; r++) {
+		struct query_t *q = &pool[rand() % n_pool];
+		struct result_t *cached, *direct;
+
+		if (q->type == QUERY_K_DISTANCE) {
+			cached = cached_find_books_k_distance(cache, nodes, count, q->arg0, q->arg1);
+			direct = find_books_k_distance(nodes, count, q->arg0, q->arg1);
+		} else {
+			cached = cached_find_shortest_distance(cache, nodes, count, q->arg0, q->arg1);
+			direct = find_shortest_distance(nodes, count, q->arg0, q->arg1);
+		}
+		if (!result_equal(cached, direct))
+			failures++;
+		result_free(cached);
+		result_free(direct);
+	}
+	return failures;
+}
+
+/*
+ * Cached queries must give the same results as uncached ones, even once the
+ * cache is full, and must never give results from a different graph or an
+ * older version of a graph that was compacted in place.
+ */
+static size_t check_cache(struct ref_t *ref)
+{
+	struct query_t pool[32];
+	struct qcache_stats_t stats;
+	size_t count = 0, failures = 0;
+
+	struct book_t *nodes = ref_graph(ref, "cache.a", ref->n_books, ref->seed, &count);
+	for (size_t i = 0; i < 32; i++) {
+		pool[i].type = i % 2 ? QUERY_SHORTEST_DISTANCE : QUERY_K_DISTANCE;
+		pool[i].arg0 = random_id(nodes, count);
+		pool[i].arg1 = i % 2 ? random_id(nodes, count) : (size_t) rand() % 4 + 1;
+	}
+
+	/* Only room for a dozen or so results, so they evict each other. */
+	struct query_cache_t *small = qcache_alloc(1 << 10);
+	/* And room for all of them, so stale results would stick around. */
+	struct query_cache_t *cache = qcache_alloc(1 << 20);
+	if (!small || !cache) {
+		qcache_free(small);
+		qcache_free(cache);
+		graph_unload(nodes, count);
+		return 1;
+	}
+
+	failures += cache_compare(small, nodes, count, pool, 32, 400);
+	qcache_stats(small, &stats);
+	if (!stats.hits || !stats.evictions)
+		failures++;
+	qcache_free(small);
+
+	failures += cache_compare(cache, nodes, count, pool, 32, 400);
+	graph_unload(nodes, count);
+
+	/* The ids in the pool mostly exist in here too, with other answers. */
+	nodes = ref_graph(ref, "cache.b", ref->n_books / 2, ~ref->seed, &count);
+	failures += cache_compare(cache, nodes, count, pool, 32, 400);
+
+	struct graph_t *graph = graph_alloc(nodes, count);
+	if (!graph) {
+		graph_unload(nodes, count);
+		qcache_free(cache);
+		return failures + 1;
+	}
+	graph->cache = cache;
+
+	/*
+	 * Compaction keeps ->nodes and ->count, so only invalidation can save us.
+	 * Every k-distance source gets a new citation, and the middle of every
+	 * path found is removed, so all of the cached results go stale.
+	 */
+	for (size_t i = 0; i < 32; i++) {
+		ssize_t src = graph_lookup(graph, GROUP_BOOK, pool[i].arg0);
+		if (src < 0)
+			continue;
+		if (pool[i].type == QUERY_K_DISTANCE) {
+			graph_add_edge(graph, EDGE_CITATION, src, rand() % count);
+			continue;
+		}
+
+		struct result_t *path = find_shortest_distance(graph->nodes, count, pool[i].arg0, pool[i].arg1);
+		if (path->n_elements > 2)
+			graph_remove_book(graph, path->elements[path->n_elements / 2] - graph->nodes);
+		result_free(path);
+	}
+
+	struct book_t *before = graph->nodes;
+	if (graph_compact(graph) < 0 || graph->nodes != before)
+		failures++;
+	failures += cache_compare(cache, graph->nodes, graph->count, pool, 32, 400);
+	qcache_stats(cache, &stats);
+	if (!stats.invalidations)
+		failures++;
+
+	graph_free(graph);
+	qcache_free(cache);
+	return failures;
+}
+
+/*
+ * Reference model for the mutation API. Every change is applied straight
+ * away, one at a time, with the same rules as graph.h describes.
+ */
+struct model_book_t {
+	bool live;
+	size_t id, author_id, publisher_id;
+	struct vec_t edges[3];
+};
+
+struct model_t {
+	struct model_book_t *books;
+	size_t count;
+};
+
+static struct model_book_t *model_slot(struct model_t *model, size_t idx)
+{
+	if (idx >= model->count) {
+		model->books = realloc(model->books, (idx + 1) * sizeof(*model->books));
+		if (!model->books) {
+			perror("reftest: realloc model");
+			exit(1);
+		}
+		memset(model->books + model->count, 0, (idx + 1 - model->count) * sizeof(*model->books));
+		model->count = idx + 1;
+	}
+	return &model->books[idx];
+}
+
+static void model_edge(struct model_t *model, bool add, int type, size_t src, size_t dst)
+{
+	struct model_book_t *a = &model->books[src], *b = &model->books[dst];
+
+	if (!a->live || !b->live)
+		return;
+	if (type == EDGE_CITATION) {
+		if (add)
+			vec_push(&a->edges[type], dst);
+		else
+			vec_remove(&a->edges[type], dst);
+		return;
+	}
+
+	if (!add) {
+		vec_remove(&a->edges[type], dst);
+		vec_remove(&b->edges[type], src);
+	} else if (src != dst && !vec_contains(&a->edges[type], dst)) {
+		vec_push(&a->edges[type], dst);
+		vec_push(&b->edges[type], src);
+	}
+}
+
+static void model_insert(struct model_t *model, size_t idx, size_t id, size_t author_id, size_t publisher_id)
+{
+	struct model_book_t *book = model_slot(model, idx);
+	if (book->live)
+		return;
+
+	for (int type = 0; type < 3; type++)
+		book->edges[type].n = 0;
+	book->live = true;
+	book->id = id;
+	book->author_id = author_id;
+	book->publisher_id = publisher_id;
+
+	for (size_t i = 0; i < model->count; i++) {
+		struct model_book_t *other = &model->books[i];
+		if (i == idx || !other->live)
+			continue;
+		if (other->author_id == author_id)
+			model_edge(model, true, EDGE_AUTHOR, idx, i);
+		if (other->publisher_id == publisher_id)
+			model_edge(model, true, EDGE_PUBLISHER, idx, i);
+	}
+}
+
+static void model_remove(struct model_t *model, size_t idx)
+{
+	struct model_book_t *book = &model->books[idx];
+	if (!book->live)
+		return;
+
+	for (size_t i = 0; i < model->count; i++)
+		for (int type = 0; type < 3; type++)
+			while (vec_contains(&model->books[i].edges[type], idx))
+				vec_remove(&model->books[i].edges[type], idx);
+	for (int type = 0; type < 3; type++)
+		book->edges[type].n = 0;
+	book->live = false;
+}
+
+static void model_free(struct model_t *model)
+{
+	for (size_t i = 0; i < model->count; i++)
+		for (int type = 0; type < 3; type++)
+			free(model->books[i].edges[type].v);
+	free(model->books);
+}
+
+/* Picks a live book from the model. */
+static size_t model_random(struct model_t *model)
+{
+	while (true) {
+		size_t idx = rand() % model->count;
+		if (model->books[idx].live)
+			return idx;
+	}
+}
+
+static size_t *book_list(struct book_t *book, int type, size_t *n)
+{
+	switch (type) {
+	case EDGE_AUTHOR:
+		*n = book->n_author_edges;
+		return book->b_author_edges;
+	case EDGE_CITATION:
+		*n = book->n_citation_edges;
+		return book->b_citation_edges;
+	}
+	*n = book->n_publisher_edges;
+	return book->b_publisher_edges;
+}
+
+/* Counts the books (and id lookups) where @graph and @model disagree. */
+static size_t model_compare(struct model_t *model, struct graph_t *graph)
+{
+	size_t failures = 0, n = 0, *a = NULL, *b = NULL;
+
+	if (graph->count != model->count)
+		return 1;
+
+	struct vec_t *citers = calloc(model->count, sizeof(*citers));
+	if (!citers) {
+		perror("reftest: calloc citers");
+		exit(1);
+	}
+	for (size_t i = 0; i < model->count; i++)
+		for (size_t k = 0; k < model->books[i].edges[EDGE_CITATION].n; k++)
+			vec_push(&citers[model->books[i].edges[EDGE_CITATION].v[k]], i);
+
+	for (size_t i = 0; i < model->count; i++) {
+		struct model_book_t *m = &model->books[i];
+		struct book_t *book = &graph->nodes[i];
+
+		if ((book->id != BOOK_ID_NONE) != m->live) {
+			failures++;
+			continue;
+		}
+		if (!m->live)
+			continue;
+		if (book->id != m->id || book->author_id != m->author_id || book->publisher_id != m->publisher_id)
+			failures++;
+
+		for (int type = 0; type < 3; type++) {
+			size_t *edges = book_list(book, type, &n);
+
+			a = realloc(a, (n + 1) * sizeof(*a));
+			b = realloc(b, (m->edges[type].n + 1) * sizeof(*b));
+			memcpy(a, edges, n * sizeof(*a));
+			memcpy(b, m->edges[type].v, m->edges[type].n * sizeof(*b));
+			if (!same_multiset(a, n, b, m->edges[type].n))
+				failures++;
+		}
+
+		/* The reverse citations have to be kept up to date too. */
+		n = graph->cited_by[i].n_edges;
+		a = realloc(a, (n + 1) * sizeof(*a));
+		b = realloc(b, (citers[i].n + 1) * sizeof(*b));
+		memcpy(a, graph->cited_by[i].edges, n * sizeof(*a));
+		memcpy(b, citers[i].v, citers[i].n * sizeof(*b));
+		if (!same_multiset(a, n, b, citers[i].n))
+			failures++;
+
+		/* Lookups give a live book with the key, and nothing after this one. */
+		size_t keys[NUM_GROUPS] = { m->id, m->author_id, m->publisher_id };
+		for (int group = 0; group < NUM_GROUPS; group++) {
+			ssize_t found = graph_lookup(graph, group, keys[group]);
+			if (found < 0 || (size_t) found > i || graph->nodes[found].id == BOOK_ID_NONE)
+				failures++;
+		}
+	}
+
+	for (size_t i = 0; i < model->count; i++)
+		free(citers[i].v);
+	free(citers);
+	free(a);
+	free(b);
+	return failures;
+}
+
+/* Writes the live books of @model as a text graph, in slot order. */
+static int model_write(struct model_t *model, const char *path)
+{
+	size_t *map = malloc((model->count + 1) * sizeof(*map));
+	size_t *edges = malloc((model->count + 1) * sizeof(*edges));
+	FILE *f = fopen(path, "w");
+	size_t live = 0;
+	int err = -1;
+
+	if (!map || !edges || !f)
+		goto out;
+
+	for (size_t i = 0; i < model->count; i++)
+		if (model->books[i].live)
+			map[i] = live++;
+
+	fprintf(f, "%lu\n", live);
+	for (size_t i = 0; i < model->count; i++) {
+		struct model_book_t *m = &model->books[i];
+		int order[] = { EDGE_PUBLISHER, EDGE_AUTHOR, EDGE_CITATION };
+
+		if (!m->live)
+			continue;
+		fprintf(f, "%lu\n%lu\n%lu\n", m->id, m->publisher_id, m->author_id);
+		for (int k = 0; k < 3; k++) {
+			struct vec_t *vec = &m->edges[order[k]];
+			for (size_t j = 0; j < vec->n; j++)
+				edges[j] = map[vec->v[j]];
+			write_edges(f, edges, vec->n);
+		}
+	}
+	err = 0;
+
+out:
+	if (f && fclose(f))
+		err = -1;
+	free(map);
+	free(edges);
+	return err;
+}
+
+/* Returns the indices of the books in @result (through @map, if given). */
+static size_t *result_map(struct result_t *result, struct book_t *from, size_t *map, bool sorted)
+{
+	size_t *v = malloc((result->n_elements + 1) * sizeof(*v));
+	if (!v) {
+		perror("reftest: malloc map");
+		exit(1);
+	}
+	for (size_t i = 0; i < result->n_elements; i++)
+		v[i] = map ? map[result->elements[i] - from] : (size_t) (result->elements[i] - from);
+	if (sorted)
+		qsort(v, result->n_elements, sizeof(*v), cmp_size);
+	return v;
+}
+
+/* Runs the same queries on a compacted graph and on a rebuild of it. */
+static size_t rebuild_compare(struct graph_t *graph, struct book_t *nodes, size_t count, size_t rounds)
+{
+	size_t *map = malloc(graph->count * sizeof(*map));
+	size_t failures = 0, live = 0;
+
+	for (size_t i = 0; i < graph->count; i++)
+		map[i] = graph->nodes[i].id == BOOK_ID_NONE ? SIZE_MAX : live++;
+	if (live != count) {
+		free(map);
+		return 1;
+	}
+
+	for (size_t r = 0; r < rounds; r++) {
+		struct book_t *book = &nodes[rand() % count];
+		struct result_t *x[4], *y[4];
+
+		/* Graph order is slot order, so k-distance results match exactly. */
+		uint16_t k = rand() % 4;
+		x[0] = find_books_k_distance(graph->nodes, graph->count, book->id, k);
+		y[0] = find_books_k_distance(nodes, count, book->id, k);
+		x[1] = find_books_by_author(graph->nodes, graph->count, book->author_id);
+		y[1] = find_books_by_author(nodes, count, book->author_id);
+		x[2] = find_books_reprinted(graph->nodes, graph->count, book->publisher_id);
+		y[2] = find_books_reprinted(nodes, count, book->publisher_id);
+		size_t other = nodes[rand() % count].id;
+		x[3] = find_shortest_distance(graph->nodes, graph->count, book->id, other);
+		y[3] = find_shortest_distance(nodes, count, book->id, other);
+
+		for (int q = 0; q < 3; q++) {
+			size_t *a = result_map(x[q], graph->nodes, map, q > 0);
+			size_t *b = result_map(y[q], nodes, NULL, q > 0);
+			if (x[q]->n_elements != y[q]->n_elements ||
+			    memcmp(a, b, x[q]->n_elements * sizeof(*a)))
+				failures++;
+			free(a);
+			free(b);
+		}
+		/* Paths depend on the order of the edges, but not their length. */
+		if (x[3]->n_elements != y[3]->n_elements)
+			failures++;
+
+		for (int q = 0; q < 4; q++) {
+			result_free(x[q]);
+			result_free(y[q]);
+		}
+	}
+
+	free(map);
+	return failures;
+}
+
+/*
+ * Mutating a graph and compacting it must give the same graph as making the
+ * same changes one at a time and loading the result from scratch. Each round
+ * only inserts, removes or changes edges (between books that stay alive), so
+ * that the order compaction applies things in can't matter.
+ */
+static size_t check_mutate(struct ref_t *ref)
+{
+	struct model_t model = {0};
+	size_t count = 0, failures = 0, next_id = 1;
+
+	struct book_t *nodes = ref_graph(ref, "mutate", ref->n_books / 4, ref->seed, &count);
+	for (size_t i = 0; i < count; i++) {
+		struct book_t *book = &nodes[i];
+		struct model_book_t *m = model_slot(&model, i);
+
+		*m = (struct model_book_t) {
+			.live = true,
+			.id = book->id,
+			.author_id = book->author_id,
+			.publisher_id = book->publisher_id,
+		};
+		for (int type = 0; type < 3; type++) {
+			size_t n, *edges = book_list(book, type, &n);
+			for (size_t j = 0; j < n; j++)
+				vec_push(&m->edges[type], edges[j]);
+		}
+	}
+
+	struct graph_t *graph = graph_alloc(nodes, count);
+	if (!graph) {
+		graph_unload(nodes, count);
+		model_free(&model);
+		return 1;
+	}
+
+	for (size_t round = 0; round < 30; round++) {
+		size_t n_ops = rand() % 16 + 1;
+
+		for (size_t i = 0; i < n_ops; i++) {
+			switch (round % 3) {
+			case 0: {
+				/* New books, some of them reprints of old ones. */
+				struct model_book_t *like = &model.books[model_random(&model)];
+				size_t id = rand() % 4 ? next_id++ : like->id;
+				size_t author_id = rand() % 4 ? like->author_id : 1000000 + next_id++;
+				size_t publisher_id = rand() % 2 ? like->publisher_id : (size_t) rand() % 16;
+
+				ssize_t idx = graph_insert_book(graph, id, author_id, publisher_id);
+				if (idx < 0) {
+					failures++;
+					break;
+				}
+				model_insert(&model, idx, id, author_id, publisher_id);
+				break;
+			}
+			case 1: {
+				size_t idx = model_random(&model);
+				if (graph_remove_book(graph, idx) < 0)
+					failures++;
+				model_remove(&model, idx);
+				break;
+			}
+			case 2: {
+				int type = rand() % 3;
+				bool add = rand() % 3;
+				size_t src = model_random(&model), dst = model_random(&model);
+
+				/*
+				 * Removals mostly pick an edge that is actually there, and
+				 * some adds do too (which is a no-op unless it's a citation).
+				 */
+				struct vec_t *edges = &model.books[src].edges[type];
+				if (edges->n && rand() % 4 < (add ? 1 : 3))
+					dst = edges->v[rand() % edges->n];
+
+				if ((add ? graph_add_edge : graph_remove_edge)(graph, type, src, dst) < 0)
+					failures++;
+				model_edge(&model, add, type, src, dst);
+				break;
+			}
+			}
+		}
+
+		if (graph_compact(graph) < 0)
+			failures++;
+		failures += model_compare(&model, graph);
+	}
+
+	char *path = ref_path(ref, "mutate.rebuilt");
+	if (model_write(&model, path) < 0)
+		exit(1);
+	nodes = graph_load(path, &count);
+	if (!nodes)
+		exit(1);
+	failures += rebuild_compare(graph, nodes, count, 200);
+
+	graph_unload(nodes, count);
+	graph_free(graph);
+	model_free(&model);
+	return failures;
+}
+
+/* Hash of the ids in a graph, so readers can tell it hasn't been freed. */
+static uint64_t graph_sum(struct graph_t *graph)
+{
+	uint64_t sum = graph->count;
+	for (size_t i = 0; i < graph->count; i++)
+		sum = sum * 31 + graph->nodes[i].id;
+	return sum;
+}
+
+struct handle_arg_t {
+	struct graph_handle_t *handle;
+	uint64_t sum;
+	atomic_bool *stop;
+	size_t reads, failures;
+};
+
+static void *handle_reader(void *data)
+{
+	struct handle_arg_t *arg = data;
+	struct graph_reader_t reader;
+
+	if (graph_reader_register(arg->handle, &reader) < 0) {
+		arg->failures++;
+		return NULL;
+	}
+	while (!atomic_load(arg->stop)) {
+		struct graph_t *graph = graph_reader_enter(&reader);
+		if (!graph || graph_sum(graph) != arg->sum)
+			arg->failures++;
+		graph_reader_exit(&reader);
+		arg->reads++;
+	}
+	graph_reader_unregister(&reader);
+	return NULL;
+}
+
+/* Loads another copy of the graph at @path. */
+static struct graph_t *handle_graph(const char *path)
+{
+	size_t count = 0;
+	struct book_t *nodes = graph_load((char *) path, &count);
+	if (!nodes)
+		exit(1);
+
+	struct graph_t *graph = graph_alloc(nodes, count);
+	if (!graph)
+		exit(1);
+	return graph;
+}
+
+/*
+ * A snapshot must stay alive for as long as a reader that might have seen it
+ * is inside its critical section, and must be freed once none are. Readers
+ * check that the graph they get is intact while new copies are published as
+ * fast as we can load them.
+ */
+static size_t check_handle(struct ref_t *ref)
+{
+	struct graph_reader_t reader;
+	size_t failures = 0;
+
+	char *path = ref_path(ref, "handle");
+	if (graph_generate(path, ref->n_books, ref->seed) < 0)
+		exit(1);
+
+	struct graph_t *first = handle_graph(path);
+	uint64_t sum = graph_sum(first);
+	struct graph_handle_t *handle = graph_handle_alloc(first, NULL);
+	if (!handle || graph_reader_register(handle, &reader) < 0) {
+		graph_free(first);
+		return 1;
+	}
+
+	/* A reader still inside its critical section keeps the old graph alive. */
+	if (graph_reader_enter(&reader) != first)
+		failures++;
+	struct graph_t *second = handle_graph(path);
+	if (graph_handle_publish(handle, second) < 0)
+		failures++;
+	graph_handle_reclaim(handle);
+	if (!handle->retired || handle->retired->graph != first || graph_sum(first) != sum)
+		failures++;
+	graph_reader_exit(&reader);
+
+	graph_handle_reclaim(handle);
+	if (handle->retired)
+		failures++;
+	if (graph_reader_enter(&reader) != second)
+		failures++;
+	graph_reader_exit(&reader);
+	graph_reader_unregister(&reader);
+
+	/* The same again, with readers coming and going all the time. */
+	atomic_bool stop = false;
+	struct handle_arg_t args[4];
+	pthread_t threads[4];
+	for (size_t i = 0; i < 4; i++) {
+		args[i] = (struct handle_arg_t) {
+			.handle = handle,
+			.sum = sum,
+			.stop = &stop,
+		};
+		pthread_create(&threads[i], NULL, handle_reader, &args[i]);
+	}
+	for (size_t i = 0; i < 20; i++)
+		if (graph_handle_publish(handle, handle_graph(path)) < 0)
+			failures++;
+	atomic_store(&stop, true);
+	for (size_t i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+		failures += args[i].failures;
+	}
+
+	graph_handle_reclaim(handle);
+	if (handle->retired)
+		failures++;
+
+	/* Reloads publish the new graph, and failed ones leave the old one. */
+	if (graph_handle_reload(handle, path) < 0 || graph_handle_wait(handle) < 0)
+		failures++;
+	struct graph_t *current = atomic_load(&handle->current)->graph;
+	if (graph_sum(current) != sum)
+		failures++;
+	if (graph_handle_reload(handle, "/nonexistent") == 0 && graph_handle_wait(handle) >= 0)
+		failures++;
+	if (atomic_load(&handle->current)->graph != current)
+		failures++;
+
+	graph_handle_free(handle);
+	return failures;
+}
+
+/* Drains @cursor @chunk books at a time, into a result. Consumes @cursor. */
+static struct result_t *cursor_drain(struct result_cursor_t *cursor, size_t count, size_t chunk)
+{
+	struct result_t *result = calloc(1, sizeof(*result));
+	if (!result || !cursor)
+		goto err;
+
+	/* Every result can turn up more than once (REPRINTED). */
+	size_t cap = count + 1;
+	result->elements = malloc(cap * sizeof(*result->elements));
+	if (!result->elements)
+		goto err;
+
+	while (true) {
+		if (result->n_elements + chunk > cap) {
+			cap = 2 * (result->n_elements + chunk);
+			struct book_t **elements = realloc(result->elements, cap * sizeof(*elements));
+			if (!elements)
+				goto err;
+			result->elements = elements;
+		}
+
+		size_t n = cursor_next(cursor, result->elements + result->n_elements, chunk);
+		if (!n)
+			break;
+		result->n_elements += n;
+	}
+	cursor_free(cursor);
+	return result;
+
+err:
+	if (cursor)
+		cursor_free(cursor);
+	result_free(result);
+	return NULL;
+}
+
+/* Compares results as multisets of books. */
+static bool result_same_books(struct result_t *a, struct result_t *b, struct book_t *nodes)
+{
+	if (!a || !b)
+		return false;
+
+	size_t *x = result_map(a, nodes, NULL, true);
+	size_t *y = result_map(b, nodes, NULL, true);
+	bool same = a->n_elements == b->n_elements && !memcmp(x, y, a->n_elements * sizeof(*x));
+	free(x);
+	free(y);
+	return same;
+}
+
+/* Citation distance of every book from @src (SIZE_MAX if it can't be reached). */
+static size_t *citation_distances(struct book_t *nodes, size_t count, size_t src)
+{
+	size_t *dist = malloc(count * sizeof(*dist));
+	size_t *queue = malloc(count * sizeof(*queue));
+	size_t head = 0, tail = 0;
+
+	if (!dist || !queue) {
+		perror("reftest: malloc bfs");
+		exit(1);
+	}
+	for (size_t i = 0; i < count; i++)
+		dist[i] = SIZE_MAX;
+
+	dist[src] = 0;
+	queue[tail++] = src;
+	while (head < tail) {
+		struct book_t *book = &nodes[queue[head++]];
+		for (size_t i = 0; i < book->n_citation_edges; i++) {
+			size_t nxt = book->b_citation_edges[i];
+			if (dist[nxt] == SIZE_MAX) {
+				dist[nxt] = dist[book - nodes] + 1;
+				queue[tail++] = nxt;
+			}
+		}
+	}
+
+	free(queue);
+	return dist;
+}
+
+/*
+ * Cursors must find the same books as the find_* functions, however many
+ * books are taken at a time. K-distance cursors must return them nearest
+ * first, and reprint cursors in the same order as find_books_reprinted.
+ */
+static size_t check_cursor(struct ref_t *ref)
+{
+	size_t chunks[] = { 1, 7, 256 };
+	size_t count = 0, failures = 0;
+
+	struct book_t *nodes = ref_graph(ref, "cursor", ref->n_books, ref->seed, &count);
+
+	for (size_t r = 0; r < 300; r++) {
+		size_t id = random_id(nodes, count), chunk = chunks[r % 3];
+		uint16_t k = rand() % 6;
+
+		struct result_t *want = find_books_k_distance(nodes, count, id, k);
+		struct result_t *got = cursor_drain(cursor_books_k_distance(nodes, count, id, k), count, chunk);
+		if (!result_same_books(want, got, nodes))
+			failures++;
+
+		if (got && got->n_elements) {
+			size_t *dist = citation_distances(nodes, count, got->elements[0] - nodes);
+			for (size_t i = 1; i < got->n_elements; i++)
+				if (dist[got->elements[i] - nodes] < dist[got->elements[i - 1] - nodes])
+					failures++;
+			free(dist);
+		}
+		result_free(want);
+		result_free(got);
+
+		size_t publisher_id = rand() % 20 ? nodes[rand() % count].publisher_id : SIZE_MAX;
+		want = find_books_reprinted(nodes, count, publisher_id);
+		got = cursor_drain(cursor_books_reprinted(nodes, count, publisher_id), count, chunk);
+		if (!result_equal(want, got))
+			failures++;
+		result_free(want);
+		result_free(got);
+	}
+
+	/* Abandoning a cursor part of the way through must be fine too. */
+	for (size_t r = 0; r < 50; r++) {
+		struct book_t *chunk[8];
+		struct result_cursor_t *cursor = cursor_books_k_distance(nodes, count, random_id(nodes, count), 5);
+		if (!cursor) {
+			failures++;
+			continue;
+		}
+		cursor_next(cursor, chunk, 8);
+		cursor_free(cursor);
+	}
+
+	graph_unload(nodes, count);
+	return failures;
+}
+
+/* The first book with @id, which is the one the find_* functions use. */
+static ssize_t find_first(struct book_t *nodes, size_t count, size_t id)
+{
+	for (size_t i = 0; i < count; i++)
+		if (nodes[i].id == id)
+			return i;
+	return -1;
+}
+
+/* Cost of the cheapest followed edge from @a to @b (or UINT32_MAX). */
+static uint32_t edge_cost(struct book_t *a, struct book_t *b, struct book_t *nodes, const struct edge_weights_t *weights)
+{
+	uint8_t costs[] = { weights->author, weights->citation, weights->publisher };
+	uint32_t best = UINT32_MAX;
+
+	for (int type = 0; type < 3; type++) {
+		size_t n, *edges = book_list(a, type, &n);
+		if (!costs[type] || costs[type] >= best)
+			continue;
+		for (size_t i = 0; i < n; i++)
+			if (edges[i] == (size_t) (b - nodes))
+				best = costs[type];
+	}
+	return best;
+}
+
+/* Textbook Dijkstra, with a linear scan for the closest book. */
+static uint32_t dijkstra(struct book_t *nodes, size_t count, size_t src, size_t dst, const struct edge_weights_t *weights)
+{
+	uint32_t *dist = malloc(count * sizeof(*dist));
+	bool *done = calloc(count, sizeof(*done));
+	uint8_t costs[] = { weights->author, weights->citation, weights->publisher };
+
+	if (!dist || !done) {
+		perror("reftest: malloc dijkstra");
+		exit(1);
+	}
+	for (size_t i = 0; i < count; i++)
+		dist[i] = UINT32_MAX;
+	dist[src] = 0;
+
+	while (true) {
+		size_t best = SIZE_MAX;
+		for (size_t i = 0; i < count; i++)
+			if (!done[i] && dist[i] != UINT32_MAX && (best == SIZE_MAX || dist[i] < dist[best]))
+				best = i;
+		if (best == SIZE_MAX || best == dst)
+			break;
+		done[best] = true;
+
+		for (int type = 0; type < 3; type++) {
+			size_t n, *edges = book_list(&nodes[best], type, &n);
+			if (!costs[type])
+				continue;
+			for (size_t i = 0; i < n; i++)
+				if (dist[best] + costs[type] < dist[edges[i]])
+					dist[edges[i]] = dist[best] + costs[type];
+		}
+	}
+
+	uint32_t found = dist[dst];
+	free(dist);
+	free(done);
+	return found;
+}
+
+/*
+ * With unit weights the bucket queue must find paths as short as the BFS in
+ * find_shortest_distance. With any weights (where 0 means the edges aren't
+ * followed), it must find a real path from the first book to the second that
+ * costs as little as Dijkstra says it should.
+ */
+static size_t check_weighted(struct ref_t *ref)
+{
+	struct edge_weights_t unit = { 1, 1, 1 };
+	size_t count = 0, failures = 0;
+
+	struct book_t *nodes = ref_graph(ref, "weighted", ref->n_books / 2, ref->seed, &count);
+
+	for (size_t r = 0; r < 200; r++) {
+		size_t a = random_id(nodes, count), b = r % 10 ? random_id(nodes, count) : a;
+
+		struct result_t *bfs = find_shortest_distance(nodes, count, a, b);
+		struct result_t *dial = find_shortest_weighted(nodes, count, a, b, &unit);
+		if (bfs->n_elements != dial->n_elements)
+			failures++;
+		result_free(bfs);
+		result_free(dial);
+	}
+
+	for (size_t r = 0; r < 100; r++) {
+		struct edge_weights_t weights = {
+			.author = rand() % 5,
+			.citation = rand() % 5,
+			.publisher = rand() % 5,
+		};
+		size_t a = random_id(nodes, count), b = random_id(nodes, count);
+		ssize_t src = find_first(nodes, count, a), dst = find_first(nodes, count, b);
+
+		uint32_t want = UINT32_MAX;
+		if (src >= 0 && dst >= 0)
+			want = dijkstra(nodes, count, src, dst, &weights);
+
+		struct result_t *path = find_shortest_weighted(nodes, count, a, b, &weights);
+		if (want == UINT32_MAX) {
+			failures += path->n_elements != 0;
+			result_free(path);
+			continue;
+		}
+
+		uint32_t cost = 0;
+		if (!path->n_elements || path->elements[0] != &nodes[src] ||
+		    path->elements[path->n_elements - 1] != &nodes[dst]) {
+			failures++;
+			result_free(path);
+			continue;
+		}
+		for (size_t i = 1; i < path->n_elements && cost != UINT32_MAX; i++) {
+			uint32_t step = edge_cost(path->elements[i - 1], path->elements[i], nodes, &weights);
+			cost = step == UINT32_MAX ? step : cost + step;
+		}
+		if (cost != want)
+			failures++;
+		result_free(path);
+	}
+
+	graph_unload(nodes, count);
+	return failures;
+}
+
+/* Whether two graphs have the same books with the same edge lists, in order. */
+static bool graph_equal(struct book_t *a, size_t n_a, struct book_t *b, size_t n_b)
+{
+	if (n_a != n_b)
+		return false;
+	for (size_t i = 0; i < n_a; i++) {
+		if (a[i].id != b[i].id || a[i].author_id != b[i].author_id ||
+		    a[i].publisher_id != b[i].publisher_id)
+			return false;
+		for (int type = 0; type < 3; type++) {
+			size_t n, m, *x = book_list(&a[i], type, &n), *y = book_list(&b[i], type, &m);
+			if (n != m || (n && memcmp(x, y, n * sizeof(*x))))
+				return false;
+		}
+	}
+	return true;
+}
+
+/* Makes the same (random) changes to both graphs and compacts them. */
+static size_t shm_mutate(struct graph_t *a, struct graph_t *b)
+{
+	size_t failures = 0;
+
+	for (size_t i = 0; i < 64; i++) {
+		int type = rand() % 3;
+		bool add = rand() % 2;
+		size_t src = rand() % a->count, dst = rand() % a->count;
+
+		int ret_a = (add ? graph_add_edge : graph_remove_edge)(a, type, src, dst);
+		int ret_b = (add ? graph_add_edge : graph_remove_edge)(b, type, src, dst);
+		failures += ret_a < 0 || ret_b < 0;
+	}
+	size_t like = rand() % a->count;
+	if (graph_insert_book(a, 1234567, a->nodes[like].author_id, a->nodes[like].publisher_id) < 0 ||
+	    graph_insert_book(b, 1234567, b->nodes[like].author_id, b->nodes[like].publisher_id) < 0)
+		failures++;
+	if (graph_remove_book(a, like) < 0 || graph_remove_book(b, like) < 0)
+		failures++;
+
+	if (graph_compact(a) < 0 || graph_compact(b) < 0)
+		failures++;
+	return failures;
+}
+
+/*
+ * A published graph must attach (directly or through graph_open) as exactly
+ * the graph that was published. Mutating an attached graph must behave like
+ * mutating a private copy, without touching the segment other attachments
+ * see, and republishing must leave existing attachments on the old graph.
+ */
+static size_t check_shm(struct ref_t *ref)
+{
+	char name[64], shm_path[64 + sizeof(GRAPH_SHM_PREFIX)];
+	size_t count = 0, count_b = 0, n = 0, failures = 0;
+
+	snprintf(name, sizeof(name), "/reftest.%d", (int) getpid());
+	snprintf(shm_path, sizeof(shm_path), GRAPH_SHM_PREFIX "%s", name);
+
+	char *path = ref_path(ref, "shm");
+	if (graph_generate(path, ref->n_books / 2, ref->seed) < 0)
+		exit(1);
+	struct book_t *nodes = graph_load(path, &count);
+	if (!nodes || graph_shm_publish(name, nodes, count) < 0)
+		exit(1);
+
+	struct book_t *attached = graph_shm_attach(name, &n);
+	if (!attached || !graph_equal(attached, n, nodes, count))
+		failures++;
+
+	struct book_t *opened = graph_open(shm_path, &n);
+	if (!opened || !graph_equal(opened, n, nodes, count))
+		failures++;
+	if (opened)
+		graph_unload(opened, n);
+
+	/* Compaction must copy the edges out of the segment. */
+	struct book_t *shared = graph_shm_attach(name, &n);
+	struct book_t *private = graph_load(path, &count);
+	struct graph_t *a = shared ? graph_alloc(shared, n) : NULL;
+	struct graph_t *b = private ? graph_alloc(private, count) : NULL;
+	if (!a || !b)
+		exit(1);
+	for (size_t round = 0; round < 4; round++) {
+		failures += shm_mutate(a, b);
+		failures += !graph_equal(a->nodes, a->count, b->nodes, b->count);
+	}
+	graph_free(a);
+	graph_free(b);
+	if (attached && !graph_equal(attached, count, nodes, count))
+		failures++;
+
+	struct book_t *nodes_b = ref_graph(ref, "shm.b", ref->n_books / 2, ~ref->seed, &count_b);
+	if (graph_shm_publish(name, nodes_b, count_b) < 0)
+		exit(1);
+
+	struct book_t *republished = graph_shm_attach(name, &n);
+	if (!republished || !graph_equal(republished, n, nodes_b, count_b))
+		failures++;
+	if (republished)
+		graph_unload(republished, n);
+	if (attached && !graph_equal(attached, count, nodes, count))
+		failures++;
+
+	shm_unlink(name);
+	if (attached)
+		graph_unload(attached, count);
+	graph_unload(nodes_b, count_b);
+	graph_unload(nodes, count);
+	return failures;
+}
+
+/* Inode of the sidecar for @path, so we can tell whether it was rebuilt. */
+static ino_t index_inode(const char *path)
+{
+	char idx[strlen(path) + sizeof(GRAPH_INDEX_SUFFIX)];
+	struct stat st;
+
+	sprintf(idx, "%s%s", path, GRAPH_INDEX_SUFFIX);
+	if (stat(idx, &st) < 0)
+		return 0;
+	return st.st_ino;
+}
+
+/* Damages the sidecar for @path in one of a few ways graph_index_open must notice. */
+static void index_corrupt(const char *path, int how)
+{
+	char idx[strlen(path) + sizeof(GRAPH_INDEX_SUFFIX)];
+	struct stat st;
+
+	sprintf(idx, "%s%s", path, GRAPH_INDEX_SUFFIX);
+	int fd = open(idx, O_RDWR);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror("reftest: open index");
+		exit(1);
+	}
+
+	char junk[256];
+	memset(junk, 0xff, sizeof(junk));
+	switch (how) {
+	case 0:
+		/* Truncated. */
+		if (ftruncate(fd, st.st_size / 2) < 0)
+			goto err;
+		break;
+	case 1:
+		/* Bad magic. */
+		if (pwrite(fd, junk, 8, 0) != 8)
+			goto err;
+		break;
+	case 2:
+		/* Garbage at the end (the component labels). */
+		if (pwrite(fd, junk, sizeof(junk), st.st_size - sizeof(junk)) != sizeof(junk))
+			goto err;
+		break;
+	}
+	close(fd);
+	return;
+
+err:
+	perror("reftest: corrupt index");
+	exit(1);
+}
+
+/*
+ * Compares everything @index answers against the graph_t that built its own
+ * tables. Component labels only need to give the same partition as a plain
+ * union-find over every edge.
+ */
+static size_t index_compare(struct graph_index_t *index, struct graph_t *graph)
+{
+	struct book_t *nodes = graph->nodes;
+	size_t count = graph->count, failures = 0;
+
+	graph_read_lock(graph);
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		for (size_t i = 0; i < count; i++) {
+			size_t key = group == GROUP_BOOK ? nodes[i].id :
+				group == GROUP_AUTHOR ? nodes[i].author_id : nodes[i].publisher_id;
+			if (graph_index_lookup(index, group, key) != graph_lookup(graph, group, key))
+				failures++;
+		}
+		for (size_t i = 0; i < 64; i++) {
+			size_t key = i % 2 ? 7 : 1000000000 + (size_t) rand();
+			if (graph_index_lookup(index, group, key) != graph_lookup(graph, group, key))
+				failures++;
+		}
+	}
+
+	/* same_multiset sorts in place, and the sidecar is mapped read-only. */
+	for (size_t i = 0; i < count; i++) {
+		struct vec_t a = {0}, b = {0};
+		size_t n;
+		const size_t *cited = graph_index_cited_by(index, i, &n);
+
+		for (size_t j = 0; j < n; j++)
+			vec_push(&a, cited[j]);
+		for (size_t j = 0; j < graph->cited_by[i].n_edges; j++)
+			vec_push(&b, graph->cited_by[i].edges[j]);
+		if (!same_multiset(a.v, a.n, b.v, b.n))
+			failures++;
+		free(a.v);
+		free(b.v);
+	}
+	graph_read_unlock(graph);
+
+	size_t *parent = malloc(count * sizeof(*parent));
+	ssize_t *label_root = malloc(count * sizeof(*label_root));
+	if (!parent || !label_root) {
+		perror("reftest: malloc components");
+		exit(1);
+	}
+	for (size_t i = 0; i < count; i++) {
+		parent[i] = i;
+		label_root[i] = -1;
+	}
+	for (size_t i = 0; i < count; i++) {
+		for (int type = 0; type < 3; type++) {
+			size_t n, *edges = book_list(&nodes[i], type, &n);
+			for (size_t j = 0; j < n; j++) {
+				size_t a = i, b = edges[j];
+				while (parent[a] != a)
+					a = parent[a];
+				while (parent[b] != b)
+					b = parent[b];
+				parent[a > b ? a : b] = a > b ? b : a;
+			}
+		}
+	}
+
+	/* Every label must map to exactly one root, and every root to one label. */
+	ssize_t *root_label = malloc(count * sizeof(*root_label));
+	if (!root_label) {
+		perror("reftest: malloc components");
+		exit(1);
+	}
+	for (size_t i = 0; i < count; i++)
+		root_label[i] = -1;
+	for (size_t i = 0; i < count; i++) {
+		size_t root = i;
+		uint32_t label = graph_index_component(index, i);
+		while (parent[root] != root)
+			root = parent[root];
+		if (label >= count) {
+			failures++;
+			continue;
+		}
+		if (label_root[label] < 0)
+			label_root[label] = root;
+		if (root_label[root] < 0)
+			root_label[root] = label;
+		if ((size_t) label_root[label] != root || root_label[root] != label)
+			failures++;
+	}
+
+	free(parent);
+	free(label_root);
+	free(root_label);
+	return failures;
+}
+
+/* Opens the index for @path, and compares it against a graph_t built without one. */
+static size_t index_open_compare(const char *path, ino_t *inode)
+{
+	size_t count = 0, failures = 0;
+
+	struct book_t *nodes = graph_load((char *) path, &count);
+	struct graph_t *graph = nodes ? graph_alloc(nodes, count) : NULL;
+	if (!graph)
+		exit(1);
+
+	struct graph_index_t *index = graph_index_open((char *) path, graph->nodes, graph->count);
+	if (!index)
+		failures++;
+	else
+		failures += index_compare(index, graph);
+
+	*inode = index_inode(path);
+	graph_index_close(index);
+	graph_free(graph);
+	return failures;
+}
+
+/*
+ * The sidecar index must answer lookups, reverse citations and components the
+ * same way as the tables graph_alloc builds, whether it was just built, mapped
+ * from an earlier run, or rebuilt because the graph changed or the sidecar was
+ * damaged. Only the mapped reopen may reuse the sidecar.
+ */
+static size_t check_index(struct ref_t *ref)
+{
+	size_t failures = 0;
+	ino_t built, reopened, inode;
+
+	char *path = ref_path(ref, "index");
+	if (graph_generate(path, ref->n_books, ref->seed) < 0)
+		exit(1);
+
+	failures += index_open_compare(path, &built);
+	failures += index_open_compare(path, &reopened);
+	if (!built || built != reopened)
+		failures++;
+
+	if (graph_generate(path, ref->n_books, ~ref->seed) < 0)
+		exit(1);
+	failures += index_open_compare(path, &inode);
+	if (inode == reopened)
+		failures++;
+
+	for (int how = 0; how < 3; how++) {
+		ino_t before = inode;
+
+		index_corrupt(path, how);
+		failures += index_open_compare(path, &inode);
+		if (inode == before)
+			failures++;
+	}
+	return failures;
+}
+
+static size_t naive_bucket(size_t n)
+{
+	size_t b = 0;
+	while (n) {
+		b++;
+		n >>= 1;
+	}
+	return b;
+}
+
+static void naive_degree(struct report_degrees_t *degrees, size_t n)
+{
+	degrees->edges += n;
+	if (n < degrees->min)
+		degrees->min = n;
+	if (n > degrees->max)
+		degrees->max = n;
+	degrees->histogram[naive_bucket(n)]++;
+}
+
+/* Number of distinct ids among @ids (deleted books don't count). */
+static size_t naive_distinct(size_t *ids, size_t n)
+{
+	size_t distinct = 0;
+
+	qsort(ids, n, sizeof(*ids), cmp_size);
+	for (size_t i = 0; i < n; i++)
+		if (ids[i] != BOOK_ID_NONE && (!i || ids[i] != ids[i - 1]))
+			distinct++;
+	return distinct;
+}
+
+/*
+ * The obvious serial version of graph_validate: duplicates are found by
+ * comparing every pair of edges, symmetry by comparing each book's edges with
+ * the edges pointing back at it, and components with a plain union-find.
+ */
+static void naive_validate(struct book_t *nodes, size_t count, struct graph_report_t *report)
+{
+	struct vec_t *in[3] = {0};
+	bool *bad = calloc(count, sizeof(*bad));
+	size_t *cited = calloc(count, sizeof(*cited));
+	size_t *parent = malloc(count * sizeof(*parent));
+	size_t *sizes = calloc(count, sizeof(*sizes));
+	size_t *ids = malloc(count * sizeof(*ids));
+	for (int type = 0; type < 3; type++)
+		in[type] = calloc(count, sizeof(**in));
+	if (!bad || !cited || !parent || !sizes || !ids || !in[0] || !in[1] || !in[2]) {
+		perror("reftest: malloc naive_validate");
+		exit(1);
+	}
+
+	memset(report, 0, sizeof(*report));
+	report->count = count;
+	report->first_error = -1;
+	for (int type = 0; type < NUM_REPORT_EDGES; type++)
+		report->degrees[type].min = SIZE_MAX;
+	for (size_t i = 0; i < count; i++)
+		parent[i] = i;
+
+	for (size_t i = 0; i < count; i++) {
+		for (int type = 0; type < 3; type++) {
+			size_t n, *edges = book_list(&nodes[i], type, &n);
+
+			naive_degree(&report->degrees[type], n);
+			for (size_t k = 0; k < n; k++) {
+				size_t j = edges[k];
+
+				for (size_t l = 0; l < k; l++) {
+					if (edges[l] == j) {
+						report->duplicates[type]++;
+						bad[i] |= type != EDGE_CITATION;
+						break;
+					}
+				}
+				if (j >= count) {
+					report->out_of_bounds[type]++;
+					bad[i] = true;
+					continue;
+				}
+				if (j == i) {
+					report->self_loops[type]++;
+					bad[i] |= type != EDGE_CITATION;
+				}
+
+				size_t a = i, b = j;
+				while (parent[a] != a)
+					a = parent[a];
+				while (parent[b] != b)
+					b = parent[b];
+				parent[a > b ? a : b] = a > b ? b : a;
+
+				if (type == EDGE_CITATION) {
+					cited[j]++;
+					continue;
+				}
+				size_t key_i = type == EDGE_AUTHOR ? nodes[i].author_id : nodes[i].publisher_id;
+				size_t key_j = type == EDGE_AUTHOR ? nodes[j].author_id : nodes[j].publisher_id;
+				if (key_i != key_j) {
+					report->mismatched[type]++;
+					bad[i] = true;
+				}
+				vec_push(&in[type][j], i);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		for (int type = 0; type < 3; type++) {
+			struct vec_t out = {0};
+			size_t n, *edges = book_list(&nodes[i], type, &n);
+
+			if (type != EDGE_CITATION) {
+				for (size_t k = 0; k < n; k++)
+					if (edges[k] < count)
+						vec_push(&out, edges[k]);
+				if (!same_multiset(out.v, out.n, in[type][i].v, in[type][i].n)) {
+					report->asymmetric[type]++;
+					bad[i] = true;
+				}
+			}
+			free(out.v);
+			free(in[type][i].v);
+		}
+
+		naive_degree(&report->degrees[REPORT_CITED_BY], cited[i]);
+		if (bad[i] && report->first_error < 0)
+			report->first_error = i;
+	}
+
+	for (int type = 0; type < NUM_REPORT_EDGES; type++) {
+		report->errors += report->out_of_bounds[type] + report->mismatched[type] + report->asymmetric[type];
+		if (type != REPORT_CITATION)
+			report->errors += report->self_loops[type] + report->duplicates[type];
+	}
+
+	for (size_t i = 0; i < count; i++)
+		ids[i] = nodes[i].id;
+	report->book_ids = naive_distinct(ids, count);
+	for (size_t i = 0; i < count; i++)
+		ids[i] = nodes[i].author_id;
+	report->author_ids = naive_distinct(ids, count);
+	for (size_t i = 0; i < count; i++)
+		ids[i] = nodes[i].publisher_id;
+	report->publisher_ids = naive_distinct(ids, count);
+
+	for (size_t i = 0; i < count; i++) {
+		size_t root = i;
+		while (parent[root] != root)
+			root = parent[root];
+		sizes[root]++;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (!sizes[i])
+			continue;
+		report->n_components++;
+		if (sizes[i] > report->largest_component)
+			report->largest_component = sizes[i];
+		report->component_histogram[naive_bucket(sizes[i])]++;
+	}
+
+	for (int type = 0; type < 3; type++)
+		free(in[type]);
+	free(bad);
+	free(cited);
+	free(parent);
+	free(sizes);
+	free(ids);
+}
+
+/* Appends @val to an edge list of @book (which graph_unload will still free). */
+static void edge_append(struct book_t *book, int type, size_t val)
+{
+	size_t **edges = type == EDGE_AUTHOR ? &book->b_author_edges :
+		type == EDGE_CITATION ? &book->b_citation_edges : &book->b_publisher_edges;
+	size_t *n = type == EDGE_AUTHOR ? &book->n_author_edges :
+		type == EDGE_CITATION ? &book->n_citation_edges : &book->n_publisher_edges;
+
+	size_t *grown = realloc(*edges, (*n + 1) * sizeof(*grown));
+	if (!grown) {
+		perror("reftest: realloc edges");
+		exit(1);
+	}
+	grown[(*n)++] = val;
+	*edges = grown;
+}
+
+/* Breaks @nodes in one of the ways graph_validate is meant to notice. */
+static void validate_fault(struct book_t *nodes, size_t count)
+{
+	size_t i = rand() % count, other = rand() % count;
+	int type = rand() % 3;
+	size_t n, *edges = book_list(&nodes[i], type, &n);
+
+	switch (rand() % 8) {
+	case 0:
+		edge_append(&nodes[i], type, count + rand() % 4);
+		break;
+	case 1:
+		edge_append(&nodes[i], type, i);
+		break;
+	case 2:
+		edge_append(&nodes[i], type, n ? edges[rand() % n] : other);
+		break;
+	case 3:
+		/* A one-way edge, usually to a book with another author. */
+		if (n)
+			edges[rand() % n] = other;
+		else
+			edge_append(&nodes[i], type, other);
+		break;
+	case 4:
+		/* Drops an edge without dropping its mirror. */
+		if (type == EDGE_AUTHOR && nodes[i].n_author_edges)
+			nodes[i].n_author_edges--;
+		else if (type == EDGE_PUBLISHER && nodes[i].n_publisher_edges)
+			nodes[i].n_publisher_edges--;
+		else if (nodes[i].n_citation_edges)
+			nodes[i].n_citation_edges--;
+		break;
+	case 5:
+		if (type == EDGE_AUTHOR)
+			nodes[i].author_id = 5000000 + rand() % 4;
+		else
+			nodes[i].publisher_id = 5000000 + rand() % 4;
+		break;
+	case 6:
+		/* A deleted book, which still keeps its edges. */
+		nodes[i].id = nodes[i].author_id = nodes[i].publisher_id = BOOK_ID_NONE;
+		break;
+	case 7:
+		/* Joins an isolated book to the rest of the graph with just a citation. */
+		for (size_t k = 0; k < count; k++) {
+			struct book_t *book = &nodes[(i + k) % count];
+			if (!book->n_author_edges && !book->n_publisher_edges && !book->n_citation_edges) {
+				edge_append(book, EDGE_CITATION, other);
+				break;
+			}
+		}
+		break;
+	}
+}
+
+/* Compares graph_validate (with a few thread counts) against naive_validate. */
+static size_t validate_compare(struct book_t *nodes, size_t count)
+{
+	static const size_t threads[] = { 1, 3, 8 };
+	struct graph_report_t want, got;
+	size_t failures = 0;
+
+	naive_validate(nodes, count, &want);
+	for (size_t t = 0; t < sizeof(threads) / sizeof(*threads); t++) {
+		if (graph_validate(nodes, count, threads[t], &got) < 0 || memcmp(&want, &got, sizeof(want)))
+			failures++;
+	}
+	return failures;
+}
+
+/*
+ * graph_validate must produce exactly the report a naive serial validator
+ * does, for a clean graph and then as faults pile up in it.
+ */
+static size_t check_validate(struct ref_t *ref)
+{
+	size_t count = 0, failures = 0;
+
+	struct book_t *nodes = ref_graph(ref, "validate", ref->n_books, ref->seed, &count);
+	struct graph_report_t clean;
+	naive_validate(nodes, count, &clean);
+	if (clean.errors)
+		failures++;
+	failures += validate_compare(nodes, count);
+
+	for (size_t round = 0; round < 40; round++) {
+		validate_fault(nodes, count);
+		failures += validate_compare(nodes, count);
+	}
+
+	graph_unload(nodes, count);
+	return failures;
+}
+
+/*
+ * PageRank the obvious way: every book pushes its score along its citations,
+ * and the books that don't cite anything share theirs with everyone. Runs
+ * until the scores stop changing.
+ */
+static double *naive_pagerank(struct book_t *nodes, size_t count, double damping)
+{
+	double *scores = malloc(count * sizeof(*scores));
+	double *next = malloc(count * sizeof(*next));
+	size_t live = 0;
+	if (!scores || !next) {
+		perror("reftest: malloc pagerank");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		live += nodes[i].id != BOOK_ID_NONE;
+	for (size_t i = 0; i < count; i++)
+		scores[i] = nodes[i].id != BOOK_ID_NONE ? 1.0 / live : 0;
+
+	for (size_t iter = 0; iter < 10000; iter++) {
+		double dangling = 0, change = 0;
+
+		for (size_t i = 0; i < count; i++)
+			if (!nodes[i].n_citation_edges)
+				dangling += scores[i];
+		for (size_t i = 0; i < count; i++)
+			next[i] = (1 - damping) / live + damping * dangling / live;
+		for (size_t i = 0; i < count; i++)
+			for (size_t k = 0; k < nodes[i].n_citation_edges; k++)
+				next[nodes[i].b_citation_edges[k]] += damping * scores[i] / nodes[i].n_citation_edges;
+		for (size_t i = 0; i < count; i++) {
+			if (nodes[i].id == BOOK_ID_NONE)
+				next[i] = 0;
+			change += fabs(next[i] - scores[i]);
+		}
+
+		double *tmp = scores;
+		scores = next;
+		next = tmp;
+		if (change < 1e-15)
+			break;
+	}
+
+	free(next);
+	return scores;
+}
+
+/* HITS, for exactly @iterations rounds so it can be compared step for step. */
+static void naive_hits(struct book_t *nodes, size_t count, size_t iterations, double *auth, double *hub)
+{
+	double *auth_raw = malloc(count * sizeof(*auth_raw));
+	double *hub_raw = malloc(count * sizeof(*hub_raw));
+	size_t live = 0;
+	if (!auth_raw || !hub_raw) {
+		perror("reftest: malloc hits");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		live += nodes[i].id != BOOK_ID_NONE;
+	for (size_t i = 0; i < count; i++)
+		auth[i] = hub[i] = nodes[i].id != BOOK_ID_NONE ? 1 / sqrt(live) : 0;
+
+	for (size_t iter = 0; iter < iterations; iter++) {
+		double auth_norm = 0, hub_norm = 0;
+
+		memset(auth_raw, 0, count * sizeof(*auth_raw));
+		for (size_t i = 0; i < count; i++)
+			for (size_t k = 0; k < nodes[i].n_citation_edges; k++)
+				auth_raw[nodes[i].b_citation_edges[k]] += hub[i];
+		for (size_t i = 0; i < count; i++)
+			auth_norm += auth_raw[i] * auth_raw[i];
+
+		memset(hub_raw, 0, count * sizeof(*hub_raw));
+		for (size_t i = 0; i < count; i++)
+			for (size_t k = 0; k < nodes[i].n_citation_edges; k++)
+				hub_raw[i] += auth_raw[nodes[i].b_citation_edges[k]];
+		for (size_t i = 0; i < count; i++)
+			hub_norm += hub_raw[i] * hub_raw[i];
+
+		auth_norm = sqrt(auth_norm);
+		hub_norm = sqrt(hub_norm);
+		for (size_t i = 0; i < count; i++) {
+			auth[i] = auth_norm ? auth_raw[i] / auth_norm : 0;
+			hub[i] = hub_norm ? hub_raw[i] / hub_norm : 0;
+		}
+	}
+
+	free(auth_raw);
+	free(hub_raw);
+}
+
+static double scores_distance(const double *a, const double *b, size_t count)
+{
+	double distance = 0;
+	for (size_t i = 0; i < count; i++)
+		distance += fabs(a[i] - b[i]);
+	return distance;
+}
+
+struct scored_t {
+	double score;
+	size_t idx;
+};
+
+/* Best score first, and the lower index first on ties. */
+static int cmp_score(const void *a, const void *b)
+{
+	const struct scored_t *x = a, *y = b;
+
+	if (x->score != y->score)
+		return x->score > y->score ? -1 : 1;
+	return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+/* Compares find_top_influential against sorting every live book by score. */
+static size_t top_compare(struct book_t *nodes, size_t count, const struct rank_t *rank, int scoring)
+{
+	static const size_t ks[] = { 1, 2, 10, 100, SIZE_MAX };
+	struct scored_t *order = malloc(count * sizeof(*order));
+	size_t n = 0, failures = 0;
+	if (!order) {
+		perror("reftest: malloc order");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		if (nodes[i].id != BOOK_ID_NONE)
+			order[n++] = (struct scored_t) { rank->scores[scoring][i], i };
+	qsort(order, n, sizeof(*order), cmp_score);
+
+	for (size_t t = 0; t < sizeof(ks) / sizeof(*ks); t++) {
+		size_t k = ks[t] < n ? ks[t] : n;
+		struct result_t *top = find_top_influential(nodes, count, rank, scoring, ks[t]);
+
+		if (!top || top->n_elements != k) {
+			failures++;
+		} else {
+			for (size_t i = 0; i < k; i++)
+				if (top->elements[i] != &nodes[order[i].idx])
+					failures++;
+		}
+		result_free(top);
+	}
+
+	free(order);
+	return failures;
+}
+
+/*
+ * graph_rank must agree with a serial reference: PageRank once both have
+ * converged, HITS after the same number of rounds. find_top_influential must
+ * pick the same books as sorting all of them. A few books are deleted (but
+ * keep their edges), which must score 0 and never show up in the results.
+ */
+static size_t check_rank(struct ref_t *ref)
+{
+	static const size_t threads[] = { 1, 4 };
+	size_t count = 0, failures = 0;
+
+	struct book_t *nodes = ref_graph(ref, "rank", ref->n_books, ref->seed, &count);
+	for (size_t i = 0; i < count / 50; i++)
+		nodes[rand() % count].id = BOOK_ID_NONE;
+
+	double *pagerank = naive_pagerank(nodes, count, RANK_DAMPING);
+	double *auth = malloc(count * sizeof(*auth));
+	double *hub = malloc(count * sizeof(*hub));
+	if (!auth || !hub) {
+		perror("reftest: malloc hits");
+		exit(1);
+	}
+
+	for (size_t t = 0; t < sizeof(threads) / sizeof(*threads); t++) {
+		struct rank_params_t params;
+
+		rank_params_default(&params);
+		params.tolerance = 1e-12;
+		params.max_iterations = 1000;
+		params.nthreads = threads[t];
+		params.hits = true;
+
+		struct rank_t *rank = graph_rank(nodes, count, &params);
+		if (!rank || !rank->scores[RANK_PAGERANK] || !rank->scores[RANK_AUTHORITY]) {
+			failures++;
+			graph_rank_free(rank);
+			continue;
+		}
+
+		if (scores_distance(rank->scores[RANK_PAGERANK], pagerank, count) > 1e-7)
+			failures++;
+		naive_hits(nodes, count, rank->iterations[1], auth, hub);
+		if (scores_distance(rank->scores[RANK_AUTHORITY], auth, count) > 1e-7 ||
+		    scores_distance(rank->scores[RANK_HUB], hub, count) > 1e-7)
+			failures++;
+
+		for (int scoring = 0; scoring < NUM_RANKS; scoring++)
+			failures += top_compare(nodes, count, rank, scoring);
+		graph_rank_free(rank);
+	}
+
+	free(pagerank);
+	free(auth);
+	free(hub);
+	graph_unload(nodes, count);
+	return failures;
+}
+
+/* Whether @result is exactly the books in @set (of @n books), in ascending order. */
+static bool result_is_set(struct result_t *result, const bool *set, size_t n, struct book_t *nodes)
+{
+	size_t j = 0;
+
+	if (!result)
+		return false;
+	for (size_t i = 0; i < n; i++) {
+		if (!set[i])
+			continue;
+		if (j >= result->n_elements || result->elements[j] != &nodes[i])
+			return false;
+		j++;
+	}
+	return j == result->n_elements;
+}
+
+/* Compares everything @bitmap says about its members against @set. */
+static size_t bitmap_compare(const struct bitmap_t *bitmap, const bool *set, size_t n, struct book_t *nodes)
+{
+	size_t members = 0, failures = 0;
+
+	if (!bitmap)
+		return 1;
+	for (size_t i = 0; i < n; i++)
+		members += set[i];
+	if (bitmap_cardinality(bitmap) != members)
+		failures++;
+
+	/* Including a container's worth past the end, which must all be missing. */
+	for (size_t i = 0; i < n + 65536; i++)
+		if (bitmap_contains(bitmap, i) != (i < n && set[i]))
+			failures++;
+
+	struct result_t *result = bitmap_to_result(nodes, bitmap);
+	if (!result_is_set(result, set, n, nodes))
+		failures++;
+	result_free(result);
+	return failures;
+}
+
+/*
+ * Fills @set with a random mix of containers: empty, sparse, dense, full, and
+ * ones right around BITMAP_ARRAY_MAX (where containers change representation).
+ */
+static void bitmap_random_set(bool *set, size_t n)
+{
+	memset(set, 0, n * sizeof(*set));
+	for (size_t lo = 0; lo < n; lo += 65536) {
+		size_t hi = lo + 65536 < n ? lo + 65536 : n;
+
+		switch (rand() % 5) {
+		case 0:
+			break;
+		case 1:
+			for (size_t i = lo; i < hi; i++)
+				set[i] = !(rand() % 200);
+			break;
+		case 2: {
+			size_t want = BITMAP_ARRAY_MAX - 1 + rand() % 3, have = 0;
+			while (have < want && have < hi - lo) {
+				size_t i = lo + (size_t) rand() % (hi - lo);
+				have += !set[i];
+				set[i] = true;
+			}
+			break;
+		}
+		case 3:
+			for (size_t i = lo; i < hi; i++)
+				set[i] = rand() % 2;
+			break;
+		case 4:
+			for (size_t i = lo; i < hi; i++)
+				set[i] = true;
+			break;
+		}
+	}
+}
+
+/* Builds a bitmap of @set, adding the members in order or shuffled (with repeats). */
+static struct bitmap_t *bitmap_of_set(const bool *set, size_t n)
+{
+	struct bitmap_t *bitmap = bitmap_alloc();
+	struct vec_t members = {0};
+
+	for (size_t i = 0; i < n; i++)
+		if (set[i])
+			vec_push(&members, i);
+	if (members.n && rand() % 2) {
+		for (size_t i = members.n - 1; i > 0; i--) {
+			size_t j = rand() % (i + 1), tmp = members.v[i];
+			members.v[i] = members.v[j];
+			members.v[j] = tmp;
+		}
+		for (size_t i = 0; i < members.n / 8; i++)
+			vec_push(&members, members.v[rand() % members.n]);
+	}
+
+	for (size_t i = 0; bitmap && i < members.n; i++) {
+		if (bitmap_add(bitmap, members.v[i]) < 0) {
+			bitmap_free(bitmap);
+			bitmap = NULL;
+		}
+	}
+	free(members.v);
+	return bitmap;
+}
+
+/* Set algebra (and the result_t conversions) against arrays of bools. */
+static size_t bitmap_algebra(void)
+{
+	size_t n = 3 * 65536 + 1000, failures = 0;
+	struct book_t *nodes = calloc(n, sizeof(*nodes));
+	bool *a = malloc(n * sizeof(*a)), *b = malloc(n * sizeof(*b)), *want = malloc(n * sizeof(*want));
+	if (!nodes || !a || !b || !want) {
+		perror("reftest: malloc bitmaps");
+		exit(1);
+	}
+
+	for (size_t round = 0; round < 12; round++) {
+		bitmap_random_set(a, n);
+		if (round)
+			bitmap_random_set(b, n);
+		else
+			memset(b, 0, n * sizeof(*b));
+
+		struct bitmap_t *bm_a = bitmap_of_set(a, n), *bm_b = bitmap_of_set(b, n);
+		failures += bitmap_compare(bm_a, a, n, nodes);
+		failures += bitmap_compare(bm_b, b, n, nodes);
+		if (!bm_a || !bm_b) {
+			bitmap_free(bm_a);
+			bitmap_free(bm_b);
+			continue;
+		}
+
+		struct bitmap_t *got = bitmap_and(bm_a, bm_b);
+		for (size_t i = 0; i < n; i++)
+			want[i] = a[i] && b[i];
+		failures += bitmap_compare(got, want, n, nodes);
+		bitmap_free(got);
+
+		got = bitmap_or(bm_a, bm_b);
+		for (size_t i = 0; i < n; i++)
+			want[i] = a[i] || b[i];
+		failures += bitmap_compare(got, want, n, nodes);
+		bitmap_free(got);
+
+		got = bitmap_andnot(bm_a, bm_b);
+		for (size_t i = 0; i < n; i++)
+			want[i] = a[i] && !b[i];
+		failures += bitmap_compare(got, want, n, nodes);
+		bitmap_free(got);
+
+		got = bitmap_andnot(bm_b, bm_a);
+		for (size_t i = 0; i < n; i++)
+			want[i] = b[i] && !a[i];
+		failures += bitmap_compare(got, want, n, nodes);
+		bitmap_free(got);
+
+		got = bitmap_and(bm_a, bm_a);
+		failures += bitmap_compare(got, a, n, nodes);
+		bitmap_free(got);
+
+		/* bitmap_from_result doesn't care about order or repeats. */
+		struct result_t *result = bitmap_to_result(nodes, bm_a);
+		if (result && result->n_elements) {
+			size_t m = result->n_elements;
+			struct book_t **elements = realloc(result->elements, (m + m / 4) * sizeof(*elements));
+			if (!elements) {
+				perror("reftest: realloc elements");
+				exit(1);
+			}
+			for (size_t i = m - 1; i > 0; i--) {
+				size_t j = rand() % (i + 1);
+				struct book_t *tmp = elements[i];
+				elements[i] = elements[j];
+				elements[j] = tmp;
+			}
+			for (size_t i = 0; i < m / 4; i++)
+				elements[m + i] = elements[rand() % m];
+			result->elements = elements;
+			result->n_elements = m + m / 4;
+		}
+		got = bitmap_from_result(nodes, result);
+		failures += bitmap_compare(got, a, n, nodes);
+		bitmap_free(got);
+
+		bitmap_free(bm_a);
+		bitmap_free(bm_b);
+	}
+
+	free(nodes);
+	free(a);
+	free(b);
+	free(want);
+	return failures;
+}
+
+/* Marks the books in @result, which is freed. */
+static bool *result_set(struct result_t *result, struct book_t *nodes, size_t count)
+{
+	bool *set = calloc(count ? count : 1, sizeof(*set));
+	if (!set) {
+		perror("reftest: malloc set");
+		exit(1);
+	}
+	for (size_t i = 0; result && i < result->n_elements; i++)
+		set[result->elements[i] - nodes] = true;
+	result_free(result);
+	return set;
+}
+
+/*
+ * Bitmaps must hold exactly what they're given: the set algebra must match
+ * doing it a bool at a time (over several containers, and either side of the
+ * array/bitset cutover), the bitmap_books_* queries must match the find_*
+ * queries, and the composite queries must match intersecting those.
+ */
+static size_t check_bitmap(struct ref_t *ref)
+{
+	size_t count = 0, failures = bitmap_algebra();
+
+	struct book_t *nodes = ref_graph(ref, "bitmap", ref->n_books, ref->seed, &count);
+	for (size_t q = 0; q < 200; q++) {
+		size_t id = random_id(nodes, count);
+		uint16_t k = rand() % 4;
+		struct book_t *book = &nodes[rand() % count];
+
+		bool *kdist = result_set(find_books_k_distance(nodes, count, id, k), nodes, count);
+		struct bitmap_t *bm = bitmap_books_k_distance(nodes, count, id, k);
+		failures += bitmap_compare(bm, kdist, count, nodes);
+		bitmap_free(bm);
+
+		/* Mostly pick an author and publisher that the k-distance set has. */
+		struct vec_t near = {0};
+		for (size_t i = 0; i < count; i++)
+			if (kdist[i])
+				vec_push(&near, i);
+		if (near.n && rand() % 4)
+			book = &nodes[near.v[rand() % near.n]];
+		free(near.v);
+
+		bool *author = result_set(find_books_by_author(nodes, count, book->author_id), nodes, count);
+		bm = bitmap_books_by_author(nodes, count, book->author_id);
+		failures += bitmap_compare(bm, author, count, nodes);
+		bitmap_free(bm);
+
+		bool *reprinted = result_set(find_books_reprinted(nodes, count, book->publisher_id), nodes, count);
+		bm = bitmap_books_reprinted(nodes, count, book->publisher_id);
+		failures += bitmap_compare(bm, reprinted, count, nodes);
+		bitmap_free(bm);
+
+		for (size_t i = 0; i < count; i++) {
+			author[i] = author[i] && kdist[i];
+			reprinted[i] = reprinted[i] && kdist[i];
+		}
+		struct result_t *result = find_books_k_distance_by_author(nodes, count, id, k, book->author_id);
+		failures += !result_is_set(result, author, count, nodes);
+		result_free(result);
+		result = find_books_reprinted_within(nodes, count, id, k, book->publisher_id);
+		failures += !result_is_set(result, reprinted, count, nodes);
+		result_free(result);
+
+		free(kdist);
+		free(author);
+		free(reprinted);
+	}
+
+	graph_unload(nodes, count);
+	return failures;
+}
+
+/* Prints @result the way the server does (see server.h). Consumes @result. */
+static void print_result(struct result_t *result)
+{
+	printf("OK %lu", result->n_elements);
+	for (size_t i = 0; i < result->n_elements; i++)
+		printf(" %lu", result->elements[i]->id);
+	putchar('\n');
+	result_free(result);
+}
+
+/*
+ * Keeps the books of @result that are also in @set, in the order they are in
+ * @result. Consumes both.
+ */
+static struct result_t *result_filter(struct result_t *result, struct result_t *set)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < result->n_elements; i++)
+		for (size_t j = 0; j < set->n_elements; j++)
+			if (result->elements[i] == set->elements[j]) {
+				result->elements[n++] = result->elements[i];
+				break;
+			}
+	result->n_elements = n;
+	result_free(set);
+	return result;
+}
+
+/*
+ * Answers server requests from stdin with the plain find_* functions (and
+ * without any limits), so the server's responses can be checked against them.
+ */
+static int answer(struct book_t *nodes, size_t count)
+{
+	char *line = NULL;
+	size_t len = 0;
+
+	while (getline(&line, &len, stdin) >= 0) {
+		char *saveptr = NULL, *arg;
+		char *cmd = strtok_r(line, " \t\n", &saveptr);
+		size_t args[5] = {0};
+		int argc = 0;
+
+		while (argc < 5 && (arg = strtok_r(NULL, " \t\n", &saveptr)) != NULL)
+			args[argc++] = strtoul(arg, NULL, 10);
+
+		if (!cmd) {
+			printf("ERR Invalid Command\n");
+		} else if (!strcmp(cmd, "BOOK") && argc == 1) {
+			print_result(find_book(nodes, count, args[0]));
+		} else if (!strcmp(cmd, "AUTHOR") && argc == 1) {
+			print_result(find_books_by_author(nodes, count, args[0]));
+		} else if (!strcmp(cmd, "REPRINTED") && argc == 1) {
+			print_result(find_books_reprinted(nodes, count, args[0]));
+		} else if (!strcmp(cmd, "KDIST") && argc == 2) {
+			print_result(find_books_k_distance(nodes, count, args[0], args[1]));
+		} else if (!strcmp(cmd, "SHORTEST") && argc == 2) {
+			print_result(find_shortest_distance(nodes, count, args[0], args[1]));
+		} else if (!strcmp(cmd, "KDIST_AUTHOR") && argc == 3) {
+			print_result(result_filter(find_books_k_distance(nodes, count, args[0], args[1]),
+						   find_books_by_author(nodes, count, args[2])));
+		} else if (!strcmp(cmd, "KDIST_REPRINTED") && argc == 3) {
+			print_result(result_filter(find_books_k_distance(nodes, count, args[0], args[1]),
+						   find_books_reprinted(nodes, count, args[2])));
+		} else if (!strcmp(cmd, "WSHORTEST") && argc == 5) {
+			struct edge_weights_t weights = {
+				.author = args[2],
+				.citation = args[3],
+				.publisher = args[4],
+			};
+			print_result(find_shortest_weighted(nodes, count, args[0], args[1], &weights));
+		} else {
+			printf("ERR Invalid Command\n");
+		}
+	}
+
+	free(line);
+	return 0;
+}
+
+/* Prints @n random requests for the books in @nodes. */
+static void print_requests(struct book_t *nodes, size_t count, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		struct book_t *book = &nodes[rand() % count];
+		size_t other = random_id(nodes, count);
+
+		switch (rand() % 9) {
+		case 0:
+			printf("BOOK %lu\n", random_id(nodes, count));
+			break;
+		case 1:
+			printf("AUTHOR %lu\n", book->author_id);
+			break;
+		case 2:
+			printf("REPRINTED %lu\n", book->publisher_id);
+			break;
+		case 3:
+			printf("KDIST %lu %d\n", book->id, rand() % 6);
+			break;
+		case 4:
+			printf("SHORTEST %lu %lu\n", book->id, other);
+			break;
+		case 5:
+			printf("WSHORTEST %lu %lu %d %d %d\n", book->id, other, rand() % 4, rand() % 4, rand() % 4);
+			break;
+		case 6:
+			printf("KDIST_AUTHOR %lu %d %lu\n", book->id, rand() % 6, nodes[rand() % count].author_id);
+			break;
+		case 7:
+			printf("KDIST_REPRINTED %lu %d %lu\n", book->id, rand() % 6, nodes[rand() % count].publisher_id);
+			break;
+		case 8:
+			printf("NOPE %lu\n", book->id);
+			break;
+		}
+	}
+}
+
+struct check_t {
+	const char *name;
+	size_t (*fn)(struct ref_t *);
+};
+
+#define CHECK(name) { #name, check_##name }
+
+static struct check_t checks[] = {
+	CHECK(cache),
+	CHECK(mutate),
+	CHECK(handle),
+	CHECK(cursor),
+	CHECK(weighted),
+	CHECK(shm),
+	CHECK(index),
+	CHECK(validate),
+	CHECK(rank),
+	CHECK(bitmap),
+};
+
+#define NUM_CHECKS (sizeof(checks) / sizeof(*checks))
+
+static int check(struct ref_t *ref)
+{
+	int failed = 0;
+
+	for (size_t i = 0; i < NUM_CHECKS; i++) {
+		struct check_t *check = &checks[i];
+
+		/* Every check gets the same random numbers, however many run. */
+		srand(ref->seed + i);
+		size_t failures = check->fn(ref);
+
+		printf("%-10s %s (%lu failures)\n", check->name, failures ? "FAIL" : "ok", failures);
+		fflush(stdout);
+		if (failures)
+			failed = 1;
+	}
+	return failed;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "usage: reftest -c [-n <books>] [-s <seed>]\n");
+	fprintf(stderr, "       reftest -g <graph> [-n <books>] [-s <seed>]\n");
+	fprintf(stderr, "       reftest -q <graph> [-r <requests>] [-s <seed>]\n");
+	fprintf(stderr, "       reftest -a <graph>\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt, check_only = 0;
+	char *generate = NULL, *requests = NULL, *answers = NULL;
+	size_t n_requests = 2000;
+	struct ref_t ref = {
+		.n_books = 2000,
+		.seed = 2129,
+	};
+
+	while ((opt = getopt(argc, argv, "cg:q:a:n:r:s:")) != -1) {
+		switch (opt) {
+		case 'c':
+			check_only = 1;
+			break;
+		case 'g':
+			generate = optarg;
+			break;
+		case 'q':
+			requests = optarg;
+			break;
+		case 'a':
+			answers = optarg;
+			break;
+		case 'n':
+			ref.n_books = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			n_requests = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			ref.seed = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc != optind || ref.n_books < 20 || check_only + !!generate + !!requests + !!answers != 1) {
+		usage();
+		return 1;
+	}
+
+	/* Graphs and requests for the scripts next to us. */
+	if (generate)
+		return graph_generate(generate, ref.n_books, ref.seed) < 0;
+	if (requests || answers) {
+		size_t count = 0;
+		struct book_t *nodes = graph_load(requests ? requests : answers, &count);
+		if (!nodes || !count)
+			return 1;
+
+		srand(ref.seed);
+		if (requests)
+			print_requests(nodes, count, n_requests);
+		else
+			answer(nodes, count);
+		graph_unload(nodes, count);
+		return 0;
+	}
+
+	strcpy(ref.dir, "/tmp/reftest.XXXXXX");
+	if (!mkdtemp(ref.dir)) {
+		perror("reftest: mkdtemp");
+		return 1;
+	}
+
+	int failed = check(&ref);
+	ref_cleanup(&ref);
+	return failed;
+}
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# usage: server.sh
+#
+# Checks that the query server gives the same responses as running the
+# queries directly (see reftest -a), both from a pipe and through the bundled
+# client over a unix socket, with several workers answering out of order. By
+# default $WORM is the worm in the parent directory of server.sh.
+
+set -e
+
+self="$(readlink -f "$(dirname "$0")")"
+WORM="${WORM:-$self/../worm}"
+REFTEST="$self/reftest"
+
+tmpdir="$(mktemp --tmpdir -d "worm-server.XXXXXX")"
+trap 'kill $server 2>/dev/null; rm -rf "$tmpdir"' EXIT
+cd "$tmpdir"
+
+"$REFTEST" -g graph
+"$REFTEST" -q graph -r 5000 >requests
+"$REFTEST" -a graph <requests >want
+
+cat requests | "$WORM" -s - -j 4 graph >got.pipe
+cmp want got.pipe
+
+"$WORM" -s sock -j 4 graph &
+server=$!
+for i in $(seq 50); do [ -S sock ] && break; sleep 0.1; done
+"$WORM" -c sock <requests >got.socket
+cmp want got.socket
+
+# RELOAD can only load the same graph, or another file next to it.
+cp graph graph2
+printf 'RELOAD /etc/passwd\nRELOAD ../graph\nRELOAD .graph\nRELOAD graph2\n' |
+	"$WORM" -s - graph >got.reload
+printf 'ERR Permission denied\nERR Permission denied\nERR Permission denied\nOK 0\n' | cmp - got.reload
+
+echo "server     ok ($(wc -l <requests) requests)"
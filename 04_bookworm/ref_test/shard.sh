@@ -0,0 +1,73 @@
+#!/bin/sh
+# Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# usage: shard.sh
+#
+# Checks that a sharded graph, served by a worker per shard and queried
+# through the coordinator, gives the same KDIST responses as running the
+# queries directly (see reftest -a), for both partitioning methods. The
+# coordinator may find a different shortest path (reprints share ids), so
+# SHORTEST responses only have to agree on the length. By default $WORM is the
+# worm in the parent directory of shard.sh.
+
+set -e
+
+self="$(readlink -f "$(dirname "$0")")"
+WORM="${WORM:-$self/../worm}"
+REFTEST="$self/reftest"
+
+tmpdir="$(mktemp --tmpdir -d "worm-shard.XXXXXX")"
+trap 'kill $workers 2>/dev/null || true; rm -rf "$tmpdir"' EXIT
+cd "$tmpdir"
+
+# Only keeps the "OK <n>" of the responses to SHORTEST requests.
+lengths() {
+	paste requests "$1" | awk -F '\t' '{
+		split($1, req, " ")
+		if (req[1] == "SHORTEST") {
+			split($2, res, " ")
+			print res[1], res[2]
+		} else
+			print $2
+	}'
+}
+
+"$REFTEST" -g graph
+"$REFTEST" -q graph -r 5000 | grep -E '^(KDIST|SHORTEST) ' >requests
+"$REFTEST" -a graph <requests >want
+lengths want >want.lengths
+
+for method in cut publisher; do
+	rm -f shard.* sock*
+	"$WORM" -p 3 -M "$method" -o shard graph 2>partition.log
+
+	workers=
+	for n in 0 1 2; do
+		"$WORM" -W "sock$n" "shard.$n" &
+		workers="$workers $!"
+	done
+	for i in $(seq 50); do [ -S sock0 ] && [ -S sock1 ] && [ -S sock2 ] && break; sleep 0.1; done
+
+	"$WORM" -D sock0,sock1,sock2 <requests >"got.$method" 2>coordinator.log
+	kill $workers
+	wait $workers 2>/dev/null || true
+	workers=
+
+	lengths "got.$method" >"got.$method.lengths"
+	cmp want.lengths "got.$method.lengths"
+done
+
+echo "shard      ok ($(wc -l <requests) requests)"
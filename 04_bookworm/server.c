@@ -0,0 +1,971 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+/*
+ * Long-running query server. A single thread runs an epoll event loop which
+ * handles all of the client I/O and splits the input into requests. The
+ * requests are handed to a pool of worker threads, which run the queries
+ * against the current graph snapshot and hand the responses back to the event
+ * loop through an eventfd.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "worm.h"
+#include "cache.h"
+#include "graph.h"
+#include "handle.h"
+#include "cursor.h"
+#include "bigalloc.h"
+#include "bitmap.h"
+#include "server.h"
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE  4096
+
+struct client_t;
+
+/* job_t is a single request, and (once a worker is done with it) its response. */
+struct job_t {
+	struct client_t *client;
+	uint64_t seq;
+	char *line;
+	char *response;
+	size_t response_len;
+	struct job_t *next;
+};
+
+struct client_t {
+	int in_fd, out_fd;
+	/* Sockets are non-blocking, stdout is not. */
+	bool nonblock;
+
+	char *inbuf;
+	size_t in_len, in_cap;
+	char *outbuf;
+	size_t out_len, out_off, out_cap;
+
+	/* Requests are numbered so responses can be sent in order. */
+	uint64_t next_seq, send_seq;
+	/* Completed responses waiting for earlier ones, sorted by ->seq. */
+	struct job_t *ready;
+	size_t inflight;
+
+	/* Current epoll interest set. */
+	uint32_t events;
+
+	bool read_closed;
+	bool dead;
+
+	struct client_t *prev, *next;
+};
+
+struct server_t {
+	int epfd;
+	int listen_fd;
+	int event_fd;
+	int signal_fd;
+	const char *path;
+
+	/* The graph we were started with, which limits what RELOAD can load. */
+	const char *graph_path;
+
+	struct graph_handle_t *handle;
+	struct query_cache_t *cache;
+
+	pthread_t *workers;
+	size_t n_workers;
+
+	/* Protects the job queues and ->stopping. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct job_t *todo_head, *todo_tail;
+	struct job_t *done;
+	bool stopping;
+
+	struct client_t *clients;
+	bool stdio;
+};
+
+/* Sentinels used as the epoll data for the non-client file descriptors. */
+static char tag_listen, tag_event, tag_signal;
+
+static void job_free(struct job_t *job)
+{
+	if (job) {
+		free(job->line);
+		free(job->response);
+	}
+	free(job);
+}
+
+/* Formats the response for a query result. Consumes @result. */
+static void job_respond_result(struct job_t *job, struct result_t *result)
+{
+	FILE *out = open_memstream(&job->response, &job->response_len);
+	if (!out)
+		goto out;
+
+	if (!result) {
+		fprintf(out, "ERR Internal Error\n");
+	} else {
+		fprintf(out, "OK %lu", result->n_elements);
+		for (size_t i = 0; i < result->n_elements; i++)
+			fprintf(out, " %lu", result->elements[i]->id);
+		fputc('\n', out);
+	}
+	fclose(out);
+
+out:
+	if (result)
+		free(result->elements);
+	free(result);
+}
+
+/*
+ * Formats the response for the first @limit results of a cursor. Since the
+ * cursor only does as much work as it needs to, this is much cheaper than
+ * truncating a full result. Consumes @cursor.
+ */
+static void job_respond_cursor(struct job_t *job, struct result_cursor_t *cursor, size_t limit)
+{
+	struct book_t *chunk[SERVER_CURSOR_CHUNK];
+	size_t total = 0;
+	char *body = NULL;
+	size_t body_len = 0;
+
+	FILE *out = open_memstream(&job->response, &job->response_len);
+	if (!out || !cursor)
+		goto out;
+
+	/* We don't know the count until we're done, so it goes on the end. */
+	FILE *ids = open_memstream(&body, &body_len);
+	if (!ids)
+		goto out;
+
+	while (total < limit) {
+		size_t want = limit - total;
+		if (want > SERVER_CURSOR_CHUNK)
+			want = SERVER_CURSOR_CHUNK;
+
+		size_t n = cursor_next(cursor, chunk, want);
+		if (!n)
+			break;
+		for (size_t i = 0; i < n; i++)
+			fprintf(ids, " %lu", chunk[i]->id);
+		total += n;
+	}
+	if (fclose(ids) == 0 && body) {
+		fprintf(out, "OK %lu%s\n", total, body);
+		fclose(out);
+		free(body);
+		cursor_free(cursor);
+		return;
+	}
+
+out:
+	if (out) {
+		fprintf(out, "ERR Internal Error\n");
+		fclose(out);
+	}
+	free(body);
+	cursor_free(cursor);
+}
+
+static void job_respond(struct job_t *job, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void job_respond(struct job_t *job, const char *fmt, ...)
+{
+	va_list ap;
+
+	FILE *out = open_memstream(&job->response, &job->response_len);
+	if (!out)
+		return;
+
+	va_start(ap, fmt);
+	vfprintf(out, fmt, ap);
+	va_end(ap);
+	fclose(out);
+}
+
+/* Parses a single unsigned integer argument. */
+static int parse_arg(char *str, size_t *val)
+{
+	char *endptr;
+
+	if (!str)
+		return -1;
+	errno = 0;
+	*val = strtoul(str, &endptr, 10);
+	if (errno || endptr == str || *endptr)
+		return -1;
+	return 0;
+}
+
+/*
+ * Uses the component labels from the graph's index (if it has one) to skip
+ * searches that can't possibly find a path. Returns true if unsure.
+ */
+static bool job_reachable(struct graph_t *graph, size_t b1_id, size_t b2_id)
+{
+	ssize_t b1 = graph_lookup(graph, GROUP_BOOK, b1_id);
+	ssize_t b2 = graph_lookup(graph, GROUP_BOOK, b2_id);
+	if (b1 < 0 || b2 < 0)
+		return true;
+
+	ssize_t c1 = graph_component(graph, b1), c2 = graph_component(graph, b2);
+	return c1 < 0 || c2 < 0 || c1 == c2;
+}
+
+/* The scores are computed by whichever query needs them first. */
+static struct result_t *job_top_influential(struct graph_t *graph, int scoring, size_t k)
+{
+	const struct rank_t *rank = graph_rank_get(graph, scoring);
+	if (!rank)
+		return NULL;
+	return find_top_influential(graph->nodes, graph->count, rank, scoring, k);
+}
+
+/* Runs a single query, with the graph already pinned and read-locked. */
+static void job_query(struct server_t *server, struct job_t *job, struct graph_t *graph, char *cmd, char **args, int argc)
+{
+	size_t arg0 = 0, arg1 = 0, arg2 = 0, arg3 = 0, arg4 = 0;
+	struct result_t *result = NULL;
+
+	if (!graph) {
+		job_respond(job, "ERR No Graph Loaded\n");
+		return;
+	}
+
+	if (argc >= 1 && parse_arg(args[0], &arg0) < 0)
+		goto err_args;
+	if (argc >= 2 && parse_arg(args[1], &arg1) < 0)
+		goto err_args;
+	if (argc >= 3 && parse_arg(args[2], &arg2) < 0)
+		goto err_args;
+	if (argc >= 4 && parse_arg(args[3], &arg3) < 0)
+		goto err_args;
+	if (argc >= 5 && parse_arg(args[4], &arg4) < 0)
+		goto err_args;
+
+	/* Paginated queries, which are streamed from a cursor. */
+	if (!strcmp(cmd, "REPRINTED") && argc == 2) {
+		job_respond_cursor(job, cursor_books_reprinted(graph->nodes, graph->count, arg0), arg1);
+		return;
+	}
+	if (!strcmp(cmd, "KDIST") && argc == 3 && arg1 <= UINT16_MAX) {
+		job_respond_cursor(job, cursor_books_k_distance(graph->nodes, graph->count, arg0, arg1), arg2);
+		return;
+	}
+
+	if (!strcmp(cmd, "BOOK") && argc == 1)
+		result = find_book(graph->nodes, graph->count, arg0);
+	else if (!strcmp(cmd, "AUTHOR") && argc == 1)
+		result = find_books_by_author(graph->nodes, graph->count, arg0);
+	else if (!strcmp(cmd, "REPRINTED") && argc == 1)
+		result = find_books_reprinted(graph->nodes, graph->count, arg0);
+	else if (!strcmp(cmd, "KDIST") && argc == 2 && arg1 <= UINT16_MAX)
+		result = cached_find_books_k_distance(server->cache, graph->nodes, graph->count, arg0, arg1);
+	else if (!strcmp(cmd, "SHORTEST") && argc == 2 && !job_reachable(graph, arg0, arg1))
+		result = calloc(1, sizeof(*result));
+	else if (!strcmp(cmd, "SHORTEST") && argc == 2)
+		result = cached_find_shortest_distance(server->cache, graph->nodes, graph->count, arg0, arg1);
+	else if (!strcmp(cmd, "KDIST_AUTHOR") && argc == 3 && arg1 <= UINT16_MAX)
+		result = find_books_k_distance_by_author(graph->nodes, graph->count, arg0, arg1, arg2);
+	else if (!strcmp(cmd, "KDIST_REPRINTED") && argc == 3 && arg1 <= UINT16_MAX)
+		result = find_books_reprinted_within(graph->nodes, graph->count, arg0, arg1, arg2);
+	else if (!strcmp(cmd, "INFLUENTIAL") && argc == 1)
+		result = job_top_influential(graph, RANK_PAGERANK, arg0);
+	else if (!strcmp(cmd, "AUTHORITIES") && argc == 1)
+		result = job_top_influential(graph, RANK_AUTHORITY, arg0);
+	else if (!strcmp(cmd, "HUBS") && argc == 1)
+		result = job_top_influential(graph, RANK_HUB, arg0);
+	else if (!strcmp(cmd, "WSHORTEST") && argc == 5 && arg2 <= UINT8_MAX && arg3 <= UINT8_MAX && arg4 <= UINT8_MAX) {
+		struct edge_weights_t weights = {
+			.author = arg2,
+			.citation = arg3,
+			.publisher = arg4,
+		};
+		result = find_shortest_weighted(graph->nodes, graph->count, arg0, arg1, &weights);
+	} else
+		goto err_args;
+
+	job_respond_result(job, result);
+	return;
+
+err_args:
+	job_respond(job, "ERR Invalid Command\n");
+}
+
+/*
+ * Works out the file a RELOAD of @name should load. Clients can reload the
+ * graph we were started with, or a plain file name (not a hidden one, or "."
+ * and "..") in the same directory, so they can't make us open (and write an
+ * index next to) any file we can reach. Returns NULL and sets errno if @name
+ * isn't allowed.
+ */
+static char *server_reload_path(struct server_t *server, const char *name)
+{
+	const char *graph_path = server->graph_path;
+	bool shm = !strncmp(graph_path, GRAPH_SHM_PREFIX, strlen(GRAPH_SHM_PREFIX));
+
+	if (!strcmp(name, graph_path))
+		return strdup(name);
+	if (shm || strchr(name, '/') || name[0] == '.' ||
+	    !strncmp(name, GRAPH_SHM_PREFIX, strlen(GRAPH_SHM_PREFIX))) {
+		errno = EACCES;
+		return NULL;
+	}
+
+	const char *slash = strrchr(graph_path, '/');
+	int dir_len = slash ? slash - graph_path + 1 : 0;
+	char *path = malloc(dir_len + strlen(name) + 1);
+	if (path)
+		sprintf(path, "%.*s%s", dir_len, graph_path, name);
+	return path;
+}
+
+/* Parses and runs the request in @job, filling in the response. */
+static void job_run(struct server_t *server, struct graph_reader_t *reader, struct job_t *job)
+{
+	char *saveptr = NULL;
+	char *args[5] = {0};
+	int argc = 0;
+
+	char *cmd = strtok_r(job->line, " \t", &saveptr);
+	if (!cmd) {
+		job_respond(job, "ERR Invalid Command\n");
+		return;
+	}
+
+	char *arg;
+	while ((arg = strtok_r(NULL, " \t", &saveptr)) != NULL) {
+		if (argc >= (int) (sizeof(args) / sizeof(*args))) {
+			job_respond(job, "ERR Too Many Arguments\n");
+			return;
+		}
+		args[argc++] = arg;
+	}
+
+	/* Commands that don't need the graph. */
+	if (!strcmp(cmd, "STATS") && argc == 0) {
+		struct qcache_stats_t stats;
+		struct bigalloc_stats_t big;
+		qcache_stats(server->cache, &stats);
+		bigalloc_stats(&big);
+		job_respond(job, "OK hits=%lu misses=%lu insertions=%lu evictions=%lu invalidations=%lu "
+			    "hugetlb=%lu thp=%lu small=%lu fallbacks=%lu thp_resident=%lu\n",
+			    stats.hits, stats.misses, stats.insertions, stats.evictions, stats.invalidations,
+			    big.bytes[BIGALLOC_BACKING_HUGETLB], big.bytes[BIGALLOC_BACKING_THP],
+			    big.bytes[BIGALLOC_BACKING_MALLOC], big.fallbacks, big.thp_resident);
+		return;
+	}
+	if (!strcmp(cmd, "RELOAD") && argc == 1) {
+		char *path = server_reload_path(server, args[0]);
+		if (!path || graph_handle_reload(server->handle, path) < 0)
+			job_respond(job, "ERR %s\n", strerror(errno));
+		else
+			job_respond(job, "OK 0\n");
+		free(path);
+		return;
+	}
+
+	struct graph_t *graph = graph_reader_enter(reader);
+	if (graph)
+		graph_read_lock(graph);
+	job_query(server, job, graph, cmd, args, argc);
+	if (graph)
+		graph_read_unlock(graph);
+	graph_reader_exit(reader);
+}
+
+static void *server_worker(void *arg)
+{
+	struct server_t *server = arg;
+	struct graph_reader_t reader;
+
+	if (graph_reader_register(server->handle, &reader) < 0) {
+		perror("server_worker: register reader");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&server->lock);
+	while (true) {
+		while (!server->todo_head && !server->stopping)
+			pthread_cond_wait(&server->cond, &server->lock);
+		if (!server->todo_head)
+			break;
+
+		struct job_t *job = server->todo_head;
+		server->todo_head = job->next;
+		if (!server->todo_head)
+			server->todo_tail = NULL;
+		pthread_mutex_unlock(&server->lock);
+
+		job_run(server, &reader, job);
+		if (!job->response)
+			job_respond(job, "ERR Internal Error\n");
+
+		pthread_mutex_lock(&server->lock);
+		job->next = server->done;
+		server->done = job;
+		pthread_mutex_unlock(&server->lock);
+
+		/* Wake up the event loop. */
+		uint64_t one = 1;
+		if (write(server->event_fd, &one, sizeof(one)) < 0)
+			perror("server_worker: write eventfd");
+
+		pthread_mutex_lock(&server->lock);
+	}
+	pthread_mutex_unlock(&server->lock);
+
+	graph_reader_unregister(&reader);
+	return NULL;
+}
+
+static void server_submit(struct server_t *server, struct job_t *job)
+{
+	pthread_mutex_lock(&server->lock);
+	job->next = NULL;
+	if (server->todo_tail)
+		server->todo_tail->next = job;
+	else
+		server->todo_head = job;
+	server->todo_tail = job;
+	pthread_cond_signal(&server->cond);
+	pthread_mutex_unlock(&server->lock);
+}
+
+static int client_set_events(struct server_t *server, struct client_t *client, uint32_t events)
+{
+	if (client->events == events)
+		return 0;
+
+	struct epoll_event ev = {
+		.events = events,
+		.data.ptr = client,
+	};
+	int op = client->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (!events)
+		op = EPOLL_CTL_DEL;
+	if (epoll_ctl(server->epfd, op, client->in_fd, &ev) < 0)
+		return -1;
+
+	client->events = events;
+	return 0;
+}
+
+static struct client_t *client_alloc(struct server_t *server, int in_fd, int out_fd, bool nonblock)
+{
+	struct client_t *client = malloc(sizeof(*client));
+	if (!client)
+		return NULL;
+
+	*client = (struct client_t) {
+		.in_fd = in_fd,
+		.out_fd = out_fd,
+		.nonblock = nonblock,
+	};
+
+	if (client_set_events(server, client, EPOLLIN) < 0) {
+		free(client);
+		return NULL;
+	}
+
+	client->next = server->clients;
+	if (server->clients)
+		server->clients->prev = client;
+	server->clients = client;
+	return client;
+}
+
+/*
+ * Frees a client, unless there are still jobs in flight. In that case the
+ * client is freed once the last of them comes back.
+ */
+static void client_close(struct server_t *server, struct client_t *client)
+{
+	if (!client->dead) {
+		client_set_events(server, client, 0);
+		if (client->in_fd != client->out_fd && client->out_fd != STDOUT_FILENO)
+			close(client->out_fd);
+		if (client->in_fd != STDIN_FILENO)
+			close(client->in_fd);
+		client->dead = true;
+	}
+	if (client->inflight)
+		return;
+
+	if (client->prev)
+		client->prev->next = client->next;
+	else
+		server->clients = client->next;
+	if (client->next)
+		client->next->prev = client->prev;
+
+	while (client->ready) {
+		struct job_t *next = client->ready->next;
+		job_free(client->ready);
+		client->ready = next;
+	}
+	free(client->inbuf);
+	free(client->outbuf);
+	free(client);
+}
+
+/* Writes as much of ->outbuf as the client will take. */
+static int client_flush(struct client_t *client)
+{
+	while (client->out_off < client->out_len) {
+		ssize_t n = write(client->out_fd, client->outbuf + client->out_off, client->out_len - client->out_off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		client->out_off += n;
+	}
+
+	if (client->out_off == client->out_len)
+		client->out_off = client->out_len = 0;
+	return 0;
+}
+
+static bool client_blocked(struct client_t *client)
+{
+	return client->inflight >= SERVER_MAX_INFLIGHT ||
+	       client->out_len - client->out_off >= SERVER_MAX_OUTBUF;
+}
+
+/*
+ * Turns as many complete lines in ->inbuf into jobs as the back-pressure
+ * limits allow. If the client has hung up, a trailing partial line is
+ * treated as a complete one.
+ */
+static int client_parse(struct server_t *server, struct client_t *client)
+{
+	size_t start = 0;
+
+	while (start < client->in_len && !client_blocked(client)) {
+		char *line = client->inbuf + start;
+		char *nl = memchr(line, '\n', client->in_len - start);
+		size_t len = nl ? (size_t) (nl - line) : client->in_len - start;
+
+		if (!nl && !client->read_closed)
+			break;
+
+		/* Strip \r for the benefit of telnet-like clients. */
+		size_t copy = len;
+		if (copy && line[copy - 1] == '\r')
+			copy--;
+
+		struct job_t *job = malloc(sizeof(*job));
+		if (!job)
+			return -1;
+		*job = (struct job_t) {
+			.client = client,
+			.seq = client->next_seq++,
+			.line = strndup(line, copy),
+		};
+		if (!job->line) {
+			free(job);
+			return -1;
+		}
+
+		client->inflight++;
+		server_submit(server, job);
+		start += len + (nl ? 1 : 0);
+	}
+
+	memmove(client->inbuf, client->inbuf + start, client->in_len - start);
+	client->in_len -= start;
+	return 0;
+}
+
+/*
+ * Updates the epoll interest set to reflect the back-pressure state, and
+ * closes the client if it is completely done.
+ */
+static void client_update(struct server_t *server, struct client_t *client)
+{
+	if (client->dead)
+		return;
+
+	bool pending_out = client->out_off < client->out_len;
+	if (client->read_closed && !client->inflight && !pending_out && !client->in_len) {
+		client_close(server, client);
+		return;
+	}
+
+	uint32_t events = 0;
+	if (!client->read_closed && !client_blocked(client))
+		events |= EPOLLIN;
+	if (pending_out && client->nonblock && client->in_fd == client->out_fd)
+		events |= EPOLLOUT;
+	if (client_set_events(server, client, events) < 0)
+		client_close(server, client);
+}
+
+static void client_read(struct server_t *server, struct client_t *client)
+{
+	while (!client_blocked(client)) {
+		if (client->in_cap - client->in_len < SERVER_READ_SIZE) {
+			size_t cap = client->in_cap ? client->in_cap * 2 : SERVER_READ_SIZE * 2;
+			char *buf = realloc(client->inbuf, cap);
+			if (!buf)
+				goto err;
+			client->inbuf = buf;
+			client->in_cap = cap;
+		}
+
+		ssize_t n = read(client->in_fd, client->inbuf + client->in_len, client->in_cap - client->in_len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			goto err;
+		}
+		if (n == 0) {
+			client->read_closed = true;
+			break;
+		}
+		client->in_len += n;
+
+		if (client_parse(server, client) < 0)
+			goto err;
+
+		/* Blocking fds (stdin) only get one read per wakeup. */
+		if (!client->nonblock)
+			break;
+	}
+
+	if (client->read_closed && client_parse(server, client) < 0)
+		goto err;
+
+	client_update(server, client);
+	return;
+
+err:
+	client_close(server, client);
+}
+
+/* Queues a completed job's response, in request order. */
+static void client_deliver(struct server_t *server, struct job_t *job)
+{
+	struct client_t *client = job->client;
+	bool failed = false;
+
+	struct job_t **pp = &client->ready;
+	while (*pp && (*pp)->seq < job->seq)
+		pp = &(*pp)->next;
+	job->next = *pp;
+	*pp = job;
+
+	while (client->ready && client->ready->seq == client->send_seq) {
+		struct job_t *ready = client->ready;
+		client->ready = ready->next;
+
+		if (!client->dead && !failed) {
+			size_t need = client->out_len + ready->response_len;
+			if (need > client->out_cap) {
+				size_t cap = client->out_cap ? client->out_cap : SERVER_READ_SIZE;
+				while (cap < need)
+					cap *= 2;
+				char *buf = realloc(client->outbuf, cap);
+				if (buf) {
+					client->outbuf = buf;
+					client->out_cap = cap;
+				} else {
+					/* Closing here could free @client under us. */
+					failed = true;
+				}
+			}
+			if (!failed) {
+				memcpy(client->outbuf + client->out_len, ready->response, ready->response_len);
+				client->out_len += ready->response_len;
+			}
+		}
+
+		job_free(ready);
+		client->send_seq++;
+		client->inflight--;
+	}
+
+	if (client->dead || failed) {
+		client_close(server, client);
+		return;
+	}
+	if (client_flush(client) < 0) {
+		client_close(server, client);
+		return;
+	}
+
+	/* We might have room for more requests now. */
+	if (client_parse(server, client) < 0) {
+		client_close(server, client);
+		return;
+	}
+	client_update(server, client);
+}
+
+static void server_complete(struct server_t *server)
+{
+	uint64_t count;
+	if (read(server->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		perror("server_complete: read eventfd");
+
+	pthread_mutex_lock(&server->lock);
+	struct job_t *done = server->done;
+	server->done = NULL;
+	pthread_mutex_unlock(&server->lock);
+
+	while (done) {
+		struct job_t *next = done->next;
+		client_deliver(server, done);
+		done = next;
+	}
+}
+
+static void server_accept(struct server_t *server)
+{
+	while (true) {
+		int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("server_accept: accept");
+			return;
+		}
+		if (!client_alloc(server, fd, fd, true))
+			close(fd);
+	}
+}
+
+static int server_listen(struct server_t *server, const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "server_listen: socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server->listen_fd < 0)
+		goto err;
+
+	/* Clean up after a previous server that didn't exit cleanly. */
+	unlink(path);
+	if (bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		goto err;
+	if (listen(server->listen_fd, SOMAXCONN) < 0)
+		goto err;
+	server->path = path;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &tag_listen };
+	if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->listen_fd, &ev) < 0)
+		goto err;
+	return 0;
+
+err:
+	perror("server_listen");
+	return -1;
+}
+
+/* Stops the workers, and frees everything that is left over. */
+static void server_shutdown(struct server_t *server)
+{
+	pthread_mutex_lock(&server->lock);
+	server->stopping = true;
+	pthread_cond_broadcast(&server->cond);
+	pthread_mutex_unlock(&server->lock);
+
+	for (size_t i = 0; i < server->n_workers; i++)
+		pthread_join(server->workers[i], NULL);
+	free(server->workers);
+
+	/* Any responses left over are never going to be sent. */
+	server_complete(server);
+	while (server->clients) {
+		struct client_t *client = server->clients;
+		client->inflight = 0;
+		client_close(server, client);
+	}
+
+	if (server->listen_fd >= 0) {
+		close(server->listen_fd);
+		unlink(server->path);
+	}
+	close(server->signal_fd);
+	close(server->event_fd);
+	close(server->epfd);
+
+	pthread_cond_destroy(&server->cond);
+	pthread_mutex_destroy(&server->lock);
+	qcache_free(server->cache);
+}
+
+int server_run(struct graph_handle_t *handle, const char *graph_path, const char *path, size_t n_workers)
+{
+	int err = -1;
+	struct server_t server = {
+		.handle = handle,
+		.graph_path = graph_path,
+		.listen_fd = -1,
+		.stdio = !strcmp(path, "-"),
+	};
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_cond_init(&server.cond, NULL);
+
+	server.cache = qcache_alloc(SERVER_CACHE_BYTES);
+	handle->cache = server.cache;
+
+	server.epfd = epoll_create1(EPOLL_CLOEXEC);
+	server.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	/* Handle SIGINT and SIGTERM in the event loop. */
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	server.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	/* Clients going away shouldn't kill us. */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (server.epfd < 0 || server.event_fd < 0 || server.signal_fd < 0) {
+		perror("server_run: setup");
+		goto out;
+	}
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &tag_event };
+	if (epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.event_fd, &ev) < 0)
+		goto out;
+	ev.data.ptr = &tag_signal;
+	if (epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.signal_fd, &ev) < 0)
+		goto out;
+
+	if (server.stdio) {
+		if (!client_alloc(&server, STDIN_FILENO, STDOUT_FILENO, false)) {
+			perror("server_run: stdin must be a pipe or socket");
+			goto out;
+		}
+	} else if (server_listen(&server, path) < 0) {
+		goto out;
+	}
+
+	server.workers = malloc(n_workers * sizeof(*server.workers));
+	if (!server.workers)
+		goto out;
+	for (size_t i = 0; i < n_workers; i++) {
+		if (pthread_create(&server.workers[i], NULL, server_worker, &server))
+			break;
+		server.n_workers++;
+	}
+	if (!server.n_workers)
+		goto out;
+
+	bool running = true;
+	while (running) {
+		struct epoll_event events[SERVER_MAX_EVENTS];
+		int n = epoll_wait(server.epfd, events, SERVER_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("server_run: epoll_wait");
+			goto out;
+		}
+
+		for (int i = 0; i < n; i++) {
+			void *ptr = events[i].data.ptr;
+
+			if (ptr == &tag_listen) {
+				server_accept(&server);
+			} else if (ptr == &tag_event) {
+				server_complete(&server);
+			} else if (ptr == &tag_signal) {
+				running = false;
+			} else {
+				struct client_t *client = ptr;
+				if (client->dead)
+					continue;
+				if (events[i].events & EPOLLOUT) {
+					if (client_flush(client) < 0) {
+						client_close(&server, client);
+						continue;
+					}
+					if (client_parse(&server, client) < 0) {
+						client_close(&server, client);
+						continue;
+					}
+					client_update(&server, client);
+				}
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					client_read(&server, client);
+			}
+		}
+
+		/* In stdio mode we're done once the only client is. */
+		if (server.stdio && !server.clients)
+			running = false;
+	}
+	err = 0;
+
+out:
+	server_shutdown(&server);
+	handle->cache = NULL;
+	return err;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(SERVER_H)
+#define SERVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "worm.h"
+#include "handle.h"
+
+/*
+ * The server speaks a line-based protocol. Each request is a single line, and
+ * each request gets exactly one response line. Requests from a single client
+ * can be pipelined, and responses are always sent in the order the requests
+ * were made. The requests are:
+ *
+ *   BOOK <id>
+ *   AUTHOR <author_id>
+ *   REPRINTED <publisher_id> [<limit>]
+ *   KDIST <id> <k> [<limit>]
+ *   KDIST_AUTHOR <id> <k> <author_id>
+ *   KDIST_REPRINTED <id> <k> <publisher_id>
+ *   SHORTEST <id1> <id2>
+ *   WSHORTEST <id1> <id2> <author_weight> <citation_weight> <publisher_weight>
+ *   INFLUENTIAL <k>
+ *   AUTHORITIES <k>
+ *   HUBS <k>
+ *   STATS
+ *   RELOAD <file>
+ *
+ * Queries are answered with "OK <n> <id>..." where <id>... are the ids of the
+ * n books in the result, and errors are answered with "ERR <message>". If a
+ * <limit> is given, only the first <limit> results are computed (k-distance
+ * results are then returned nearest first). KDIST_AUTHOR and KDIST_REPRINTED
+ * intersect a k-distance query with AUTHOR and REPRINTED (see bitmap.h), and
+ * return the books in the order they appear in the graph. INFLUENTIAL,
+ * AUTHORITIES and HUBS return the <k> books with the highest PageRank, HITS
+ * authority and HITS hub scores over the citations (see rank.h). RELOAD loads
+ * a new graph in the background, and only accepts the file the server was
+ * started with or a plain file name in the same directory.
+ */
+
+/* Back-pressure limits, per client. */
+#define SERVER_MAX_INFLIGHT 64
+#define SERVER_MAX_OUTBUF   (1 << 20)
+
+/* How many results are pulled from a cursor at a time. */
+#define SERVER_CURSOR_CHUNK 256
+
+/* Default size of the result cache used by the server. */
+#define SERVER_CACHE_BYTES (64 << 20)
+
+/*
+ * Runs the server until it gets SIGINT or SIGTERM. If @path is "-" the server
+ * answers requests from stdin on stdout (and exits on EOF), otherwise it
+ * listens on the unix socket at @path. @graph_path is the file the graph in
+ * @handle was loaded from. Return value is < 0 if an error occurred.
+ */
+int server_run(struct graph_handle_t *handle, const char *graph_path,
+	       const char *path, size_t n_workers);
+
+/*
+ * Bundled client. Sends every line from stdin to the server listening at
+ * @path (without waiting for responses) and writes the responses to stdout.
+ */
+int client_run(const char *path);
+
+#endif
@@ -0,0 +1,886 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+/*
+ * Sharded query execution (see shard.h). The coordinator and the workers talk
+ * with messages made of a shard_msg_t header followed by ->n words (uint64_t),
+ * and every request gets exactly one reply (with the same ->type):
+ *
+ *   INFO   []                       -> [shard, n_shards, count]
+ *   LOOKUP [id]                     -> [lowest owned index with that id, or NONE]
+ *   BEGIN  [mode, target]           -> []
+ *   STEP   [expand, (node, parent, parent_owner)...]
+ *                                   -> [found, n_frontier, (owner, node, parent)...]
+ *   PARENT [node]                   -> [parent, parent_owner, id]
+ *   COLLECT []                      -> [(node, id)...]
+ *
+ * All nodes are global indices. BEGIN starts a new search, and each STEP is one
+ * round of it: the worker admits the books it was sent (those it hasn't seen
+ * yet join its frontier), reports whether the target has been reached, and (if
+ * asked to) expands its frontier. Edges within the shard are followed right
+ * away, and edges to ghosts are handed back to the coordinator (once per
+ * ghost and search) to be sent to their owner in the next round.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "worm.h"
+#include "graph.h"
+#include "bigalloc.h"
+#include "shard.h"
+
+/* How long the coordinator waits for workers that are still starting up. */
+#define SHARD_CONNECT_RETRIES 100
+#define SHARD_CONNECT_DELAY_MS 50
+
+/* Message types. */
+enum {
+	SHARD_MSG_INFO,
+	SHARD_MSG_LOOKUP,
+	SHARD_MSG_BEGIN,
+	SHARD_MSG_STEP,
+	SHARD_MSG_PARENT,
+	SHARD_MSG_COLLECT,
+};
+
+/* Search modes (for BEGIN). */
+enum {
+	/* SHORTEST: every edge type. */
+	SHARD_SEARCH_ALL,
+	/* KDIST: only citations. */
+	SHARD_SEARCH_CITATIONS,
+};
+
+struct shard_msg_t {
+	uint32_t type;
+	uint32_t status;
+	uint64_t n;
+};
+
+/* A growable list of message words. */
+struct shard_words_t {
+	uint64_t *v;
+	size_t n, cap;
+};
+
+static int words_reserve(struct shard_words_t *words, size_t n)
+{
+	if (words->n + n <= words->cap)
+		return 0;
+
+	size_t cap = words->cap ? words->cap : 64;
+	while (cap < words->n + n)
+		cap *= 2;
+
+	uint64_t *v = realloc(words->v, cap * sizeof(*v));
+	if (!v)
+		return -1;
+	words->v = v;
+	words->cap = cap;
+	return 0;
+}
+
+static int words_push(struct shard_words_t *words, uint64_t val)
+{
+	if (words_reserve(words, 1) < 0)
+		return -1;
+	words->v[words->n++] = val;
+	return 0;
+}
+
+static int io_full(int fd, void *buf, size_t len, bool writing)
+{
+	char *ptr = buf;
+
+	while (len) {
+		ssize_t n = writing ? write(fd, ptr, len) : read(fd, ptr, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		/* The other end went away. */
+		if (!n)
+			return -1;
+		ptr += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int msg_send(int fd, uint32_t type, uint32_t status, uint64_t *words, size_t n)
+{
+	struct shard_msg_t hdr = { .type = type, .status = status, .n = n };
+
+	if (io_full(fd, &hdr, sizeof(hdr), true) < 0)
+		return -1;
+	if (n && io_full(fd, words, n * sizeof(*words), true) < 0)
+		return -1;
+	return 0;
+}
+
+/* Receives a message, with the words ending up in @words. */
+static int msg_recv(int fd, struct shard_msg_t *hdr, struct shard_words_t *words)
+{
+	if (io_full(fd, hdr, sizeof(*hdr), false) < 0)
+		return -1;
+
+	words->n = 0;
+	if (words_reserve(words, hdr->n) < 0)
+		return -1;
+	if (hdr->n && io_full(fd, words->v, hdr->n * sizeof(*words->v), false) < 0)
+		return -1;
+	words->n = hdr->n;
+	return 0;
+}
+
+/* Per-search state of a worker. */
+struct shard_worker_t {
+	struct shard_t *shard;
+
+	int mode;
+	ssize_t target;
+	uint32_t epoch;
+
+	/* Indexed by local index. ->seen and ->ghost_seen hold epochs. */
+	uint32_t *seen;
+	uint64_t *parent;
+	uint32_t *parent_owner;
+	uint32_t *ghost_seen;
+
+	/* Local indices of the current and next frontier, and all visited books. */
+	struct shard_words_t frontier, next, visited;
+};
+
+static int worker_alloc(struct shard_worker_t *worker, struct shard_t *shard)
+{
+	memset(worker, 0, sizeof(*worker));
+	worker->shard = shard;
+	worker->target = -1;
+
+	size_t owned = shard->n_owned ? shard->n_owned : 1;
+	size_t ghosts = shard->n_ghosts ? shard->n_ghosts : 1;
+	worker->seen = big_calloc(owned, sizeof(*worker->seen));
+	worker->parent = big_alloc(owned * sizeof(*worker->parent));
+	worker->parent_owner = big_alloc(owned * sizeof(*worker->parent_owner));
+	worker->ghost_seen = big_calloc(ghosts, sizeof(*worker->ghost_seen));
+	if (!worker->seen || !worker->parent || !worker->parent_owner || !worker->ghost_seen)
+		return -1;
+	return 0;
+}
+
+static void worker_free(struct shard_worker_t *worker)
+{
+	big_free(worker->seen);
+	big_free(worker->parent);
+	big_free(worker->parent_owner);
+	big_free(worker->ghost_seen);
+	free(worker->frontier.v);
+	free(worker->next.v);
+	free(worker->visited.v);
+}
+
+static void worker_begin(struct shard_worker_t *worker, int mode, uint64_t target)
+{
+	struct shard_t *shard = worker->shard;
+
+	/* Epochs save us clearing ->seen for every search, until they wrap. */
+	if (!++worker->epoch) {
+		memset(worker->seen, 0, shard->n_owned * sizeof(*worker->seen));
+		memset(worker->ghost_seen, 0, shard->n_ghosts * sizeof(*worker->ghost_seen));
+		worker->epoch = 1;
+	}
+
+	worker->mode = mode;
+	worker->target = target == SHARD_NONE ? -1 : shard_local(shard, target);
+	worker->frontier.n = 0;
+	worker->next.n = 0;
+	worker->visited.n = 0;
+}
+
+/* Marks local book @idx as visited. Return value is 1 if it wasn't already. */
+static int worker_visit(struct shard_worker_t *worker, size_t idx, uint64_t parent, uint32_t parent_owner,
+			struct shard_words_t *list)
+{
+	if (worker->seen[idx] == worker->epoch)
+		return 0;
+
+	worker->seen[idx] = worker->epoch;
+	worker->parent[idx] = parent;
+	worker->parent_owner[idx] = parent_owner;
+	if (words_push(list, idx) < 0 || words_push(&worker->visited, idx) < 0)
+		return -1;
+	return 1;
+}
+
+static int worker_expand_edges(struct shard_worker_t *worker, size_t from, size_t *edges, size_t n,
+			       struct shard_words_t *reply)
+{
+	struct shard_t *shard = worker->shard;
+	uint64_t parent = shard->owned[from];
+
+	for (size_t i = 0; i < n; i++) {
+		size_t ref = edges[i];
+
+		if (!(ref & SHARD_REF_GHOST)) {
+			if (worker_visit(worker, ref, parent, shard->shard, &worker->next) < 0)
+				return -1;
+			continue;
+		}
+
+		ref &= ~SHARD_REF_GHOST;
+		if (worker->ghost_seen[ref] == worker->epoch)
+			continue;
+		worker->ghost_seen[ref] = worker->epoch;
+
+		if (words_reserve(reply, 3) < 0)
+			return -1;
+		reply->v[reply->n++] = shard->ghost_owner[ref];
+		reply->v[reply->n++] = shard->ghosts[ref];
+		reply->v[reply->n++] = parent;
+	}
+	return 0;
+}
+
+static int worker_step(struct shard_worker_t *worker, struct shard_words_t *req, struct shard_words_t *reply)
+{
+	struct shard_t *shard = worker->shard;
+
+	if (req->n < 1 || (req->n - 1) % 3)
+		return -1;
+	bool expand = req->v[0];
+
+	/* Admit the books sent to us into the frontier. */
+	for (size_t i = 1; i < req->n; i += 3) {
+		ssize_t idx = shard_local(shard, req->v[i]);
+		if (idx < 0)
+			return -1;
+		if (worker_visit(worker, idx, req->v[i + 1], req->v[i + 2], &worker->frontier) < 0)
+			return -1;
+	}
+
+	reply->n = 0;
+	if (words_push(reply, 0) < 0 || words_push(reply, 0) < 0)
+		return -1;
+
+	/* No point expanding any further if we've got there. */
+	if (worker->target >= 0 && worker->seen[worker->target] == worker->epoch) {
+		reply->v[0] = 1;
+		return 0;
+	}
+	if (!expand)
+		return 0;
+
+	worker->next.n = 0;
+	for (size_t i = 0; i < worker->frontier.n; i++) {
+		size_t idx = worker->frontier.v[i];
+		struct book_t *book = &shard->nodes[idx];
+
+		if (worker->mode == SHARD_SEARCH_ALL &&
+		    worker_expand_edges(worker, idx, book->b_author_edges, book->n_author_edges, reply) < 0)
+			return -1;
+		if (worker_expand_edges(worker, idx, book->b_citation_edges, book->n_citation_edges, reply) < 0)
+			return -1;
+		if (worker->mode == SHARD_SEARCH_ALL &&
+		    worker_expand_edges(worker, idx, book->b_publisher_edges, book->n_publisher_edges, reply) < 0)
+			return -1;
+	}
+
+	/* The books found locally are the next frontier. */
+	struct shard_words_t tmp = worker->frontier;
+	worker->frontier = worker->next;
+	worker->next = tmp;
+	reply->v[1] = worker->frontier.n;
+	return 0;
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* Handles a single request, filling in @reply. Return value is < 0 if it was invalid. */
+static int worker_handle(struct shard_worker_t *worker, struct shard_msg_t *hdr,
+			 struct shard_words_t *req, struct shard_words_t *reply)
+{
+	struct shard_t *shard = worker->shard;
+	ssize_t idx;
+
+	reply->n = 0;
+	switch (hdr->type) {
+	case SHARD_MSG_INFO:
+		if (words_push(reply, shard->shard) < 0 ||
+		    words_push(reply, shard->n_shards) < 0 ||
+		    words_push(reply, shard->count) < 0)
+			return -1;
+		return 0;
+
+	case SHARD_MSG_LOOKUP:
+		if (req->n != 1)
+			return -1;
+		idx = -1;
+		for (size_t i = 0; i < shard->n_owned; i++) {
+			if (shard->nodes[i].id == req->v[0]) {
+				idx = i;
+				break;
+			}
+		}
+		return words_push(reply, idx < 0 ? SHARD_NONE : shard->owned[idx]);
+
+	case SHARD_MSG_BEGIN:
+		if (req->n != 2 || req->v[0] > SHARD_SEARCH_CITATIONS)
+			return -1;
+		worker_begin(worker, req->v[0], req->v[1]);
+		return 0;
+
+	case SHARD_MSG_STEP:
+		return worker_step(worker, req, reply);
+
+	case SHARD_MSG_PARENT:
+		if (req->n != 1)
+			return -1;
+		idx = shard_local(shard, req->v[0]);
+		if (idx < 0 || worker->seen[idx] != worker->epoch)
+			return -1;
+		if (words_push(reply, worker->parent[idx]) < 0 ||
+		    words_push(reply, worker->parent_owner[idx]) < 0 ||
+		    words_push(reply, shard->nodes[idx].id) < 0)
+			return -1;
+		return 0;
+
+	case SHARD_MSG_COLLECT:
+		qsort(worker->visited.v, worker->visited.n, sizeof(*worker->visited.v), u64_cmp);
+		if (words_reserve(reply, 2 * worker->visited.n) < 0)
+			return -1;
+		for (size_t i = 0; i < worker->visited.n; i++) {
+			size_t idx = worker->visited.v[i];
+			reply->v[reply->n++] = shard->owned[idx];
+			reply->v[reply->n++] = shard->nodes[idx].id;
+		}
+		return 0;
+	}
+	return -1;
+}
+
+int shard_worker_run(struct shard_t *shard, const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct shard_worker_t worker;
+	struct shard_words_t req = {0}, reply = {0};
+	int listen_fd = -1;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "shard_worker_run: socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if (worker_alloc(&worker, shard) < 0)
+		goto err;
+
+	/* A coordinator going away shouldn't take us with it. */
+	signal(SIGPIPE, SIG_IGN);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+		goto err;
+
+	/* Clean up after a previous worker that didn't exit cleanly. */
+	unlink(path);
+	if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		goto err;
+	if (listen(listen_fd, SOMAXCONN) < 0)
+		goto err;
+
+	while (true) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			goto err;
+		}
+
+		struct shard_msg_t hdr;
+		while (!msg_recv(fd, &hdr, &req)) {
+			uint32_t status = worker_handle(&worker, &hdr, &req, &reply) < 0;
+			if (status)
+				reply.n = 0;
+			if (msg_send(fd, hdr.type, status, reply.v, reply.n) < 0)
+				break;
+		}
+		close(fd);
+	}
+
+err:
+	perror("shard_worker_run");
+	if (listen_fd >= 0)
+		close(listen_fd);
+	worker_free(&worker);
+	free(req.v);
+	free(reply.v);
+	return -1;
+}
+
+/* The coordinator's view of the workers. */
+struct shard_coordinator_t {
+	size_t n_shards;
+	int *fds;
+
+	/* Requests being built for (and replies from) each worker. */
+	struct shard_words_t *out, *in;
+	/* Size of each worker's frontier after the last round. */
+	uint64_t *frontier;
+
+	size_t queries, rounds, relayed;
+};
+
+/* Sends a request to worker @s and waits for the reply in ->in[s]. */
+static int coordinator_call(struct shard_coordinator_t *coord, size_t s, uint32_t type,
+			    uint64_t *words, size_t n)
+{
+	struct shard_msg_t hdr;
+
+	if (msg_send(coord->fds[s], type, 0, words, n) < 0)
+		return -1;
+	if (msg_recv(coord->fds[s], &hdr, &coord->in[s]) < 0)
+		return -1;
+	if (hdr.type != type || hdr.status)
+		return -1;
+	return 0;
+}
+
+/*
+ * Sends each worker's request in ->out, and then collects all of the replies
+ * in ->in, so that the workers all run at the same time.
+ */
+static int coordinator_broadcast(struct shard_coordinator_t *coord, uint32_t type, bool *active)
+{
+	for (size_t s = 0; s < coord->n_shards; s++)
+		if (active[s] && msg_send(coord->fds[s], type, 0, coord->out[s].v, coord->out[s].n) < 0)
+			return -1;
+
+	for (size_t s = 0; s < coord->n_shards; s++) {
+		struct shard_msg_t hdr;
+
+		if (!active[s])
+			continue;
+		if (msg_recv(coord->fds[s], &hdr, &coord->in[s]) < 0)
+			return -1;
+		if (hdr.type != type || hdr.status)
+			return -1;
+	}
+	return 0;
+}
+
+/* Finds the global index and owner of the book @id, as find_book would. */
+static int coordinator_lookup(struct shard_coordinator_t *coord, uint64_t id, uint64_t *idx, size_t *owner)
+{
+	bool active[coord->n_shards];
+
+	for (size_t s = 0; s < coord->n_shards; s++) {
+		active[s] = true;
+		coord->out[s].n = 0;
+		if (words_push(&coord->out[s], id) < 0)
+			return -1;
+	}
+	if (coordinator_broadcast(coord, SHARD_MSG_LOOKUP, active) < 0)
+		return -1;
+
+	*idx = SHARD_NONE;
+	for (size_t s = 0; s < coord->n_shards; s++) {
+		if (coord->in[s].n != 1)
+			return -1;
+		if (coord->in[s].v[0] < *idx) {
+			*idx = coord->in[s].v[0];
+			*owner = s;
+		}
+	}
+	return 0;
+}
+
+/* Starts a search from @source (owned by @owner) on every worker. */
+static int coordinator_begin(struct shard_coordinator_t *coord, int mode, uint64_t source, size_t owner,
+			     uint64_t target)
+{
+	bool active[coord->n_shards];
+
+	for (size_t s = 0; s < coord->n_shards; s++) {
+		active[s] = true;
+		coord->frontier[s] = 0;
+		coord->out[s].n = 0;
+		if (words_push(&coord->out[s], mode) < 0 || words_push(&coord->out[s], target) < 0)
+			return -1;
+	}
+	if (coordinator_broadcast(coord, SHARD_MSG_BEGIN, active) < 0)
+		return -1;
+
+	/* The source is the first book admitted, by the first round. */
+	for (size_t s = 0; s < coord->n_shards; s++) {
+		coord->out[s].n = 0;
+		if (words_push(&coord->out[s], 0) < 0)
+			return -1;
+	}
+	if (words_push(&coord->out[owner], source) < 0 ||
+	    words_push(&coord->out[owner], SHARD_NONE) < 0 ||
+	    words_push(&coord->out[owner], SHARD_NONE) < 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Runs a round of the search. Every worker with something to do admits the
+ * books routed to it in ->out and (if @expand) expands its frontier, and the
+ * books they hand back are routed into ->out for the next round. Return value
+ * is 1 if the target was found, 0 if the search can continue, and 2 if there
+ * is nothing left to search.
+ */
+static int coordinator_round(struct shard_coordinator_t *coord, bool expand)
+{
+	bool active[coord->n_shards];
+	bool any = false;
+
+	for (size_t s = 0; s < coord->n_shards; s++) {
+		active[s] = coord->out[s].n > 1 || coord->frontier[s];
+		any |= active[s];
+		coord->out[s].v[0] = expand;
+	}
+	if (!any)
+		return 2;
+
+	coord->rounds++;
+	if (coordinator_broadcast(coord, SHARD_MSG_STEP, active) < 0)
+		return -1;
+
+	for (size_t s = 0; s < coord->n_shards; s++)
+		if (active[s])
+			coord->out[s].n = 1;
+
+	int found = 0;
+	for (size_t s = 0; s < coord->n_shards; s++) {
+		struct shard_words_t *in = &coord->in[s];
+
+		if (!active[s])
+			continue;
+		if (in->n < 2 || (in->n - 2) % 3)
+			return -1;
+
+		found |= in->v[0] != 0;
+		coord->frontier[s] = in->v[1];
+		for (size_t i = 2; i < in->n; i += 3) {
+			uint64_t owner = in->v[i];
+			if (owner >= coord->n_shards)
+				return -1;
+			if (words_reserve(&coord->out[owner], 3) < 0)
+				return -1;
+			coord->out[owner].v[coord->out[owner].n++] = in->v[i + 1];
+			coord->out[owner].v[coord->out[owner].n++] = in->v[i + 2];
+			coord->out[owner].v[coord->out[owner].n++] = s;
+			coord->relayed++;
+		}
+	}
+	return found;
+}
+
+/* Answers SHORTEST, with the path from @b1_id to @b2_id (inclusive) in @path. */
+static int coordinator_shortest(struct shard_coordinator_t *coord, uint64_t b1_id, uint64_t b2_id,
+				struct shard_words_t *path)
+{
+	uint64_t b1, b2;
+	size_t b1_owner = 0, b2_owner = 0;
+
+	path->n = 0;
+	if (coordinator_lookup(coord, b1_id, &b1, &b1_owner) < 0)
+		return -1;
+	if (coordinator_lookup(coord, b2_id, &b2, &b2_owner) < 0)
+		return -1;
+	if (b1 == SHARD_NONE || b2 == SHARD_NONE)
+		return 0;
+
+	if (coordinator_begin(coord, SHARD_SEARCH_ALL, b1, b1_owner, b2) < 0)
+		return -1;
+
+	int ret;
+	while (!(ret = coordinator_round(coord, true)))
+		;
+	if (ret < 0)
+		return -1;
+	if (ret != 1)
+		return 0;
+
+	/* Walk the parents back to the source. */
+	uint64_t node = b2;
+	size_t owner = b2_owner;
+	while (node != SHARD_NONE) {
+		if (coordinator_call(coord, owner, SHARD_MSG_PARENT, &node, 1) < 0)
+			return -1;
+		struct shard_words_t *in = &coord->in[owner];
+		if (in->n != 3 || words_push(path, in->v[2]) < 0)
+			return -1;
+
+		node = in->v[0];
+		owner = in->v[1];
+		if (node != SHARD_NONE && owner >= coord->n_shards)
+			return -1;
+	}
+
+	for (size_t i = 0; i < path->n / 2; i++) {
+		uint64_t tmp = path->v[i];
+		path->v[i] = path->v[path->n - i - 1];
+		path->v[path->n - i - 1] = tmp;
+	}
+	return 0;
+}
+
+/* Answers KDIST, with the ids (in graph order) of the books found in @ids. */
+static int coordinator_k_distance(struct shard_coordinator_t *coord, uint64_t book_id, uint16_t k,
+				  struct shard_words_t *ids)
+{
+	uint64_t source;
+	size_t owner = 0;
+
+	ids->n = 0;
+	if (coordinator_lookup(coord, book_id, &source, &owner) < 0)
+		return -1;
+	if (source == SHARD_NONE)
+		return 0;
+
+	if (coordinator_begin(coord, SHARD_SEARCH_CITATIONS, source, owner, SHARD_NONE) < 0)
+		return -1;
+
+	/* Round r admits the books at distance r, the last one mustn't expand them. */
+	for (size_t r = 0; r <= k; r++) {
+		int ret = coordinator_round(coord, r < k);
+		if (ret < 0)
+			return -1;
+		if (ret == 2)
+			break;
+	}
+
+	bool active[coord->n_shards];
+	for (size_t s = 0; s < coord->n_shards; s++) {
+		active[s] = true;
+		coord->out[s].n = 0;
+	}
+	if (coordinator_broadcast(coord, SHARD_MSG_COLLECT, active) < 0)
+		return -1;
+
+	/* Each worker's books are sorted, so merge them into graph order. */
+	size_t pos[coord->n_shards];
+	memset(pos, 0, sizeof(pos));
+	while (true) {
+		ssize_t best = -1;
+		for (size_t s = 0; s < coord->n_shards; s++) {
+			if (pos[s] >= coord->in[s].n)
+				continue;
+			if (best < 0 || coord->in[s].v[pos[s]] < coord->in[best].v[pos[best]])
+				best = s;
+		}
+		if (best < 0)
+			break;
+
+		if (words_push(ids, coord->in[best].v[pos[best] + 1]) < 0)
+			return -1;
+		pos[best] += 2;
+	}
+	return 0;
+}
+
+static int coordinator_connect(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "shard_coordinator_run: socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	for (int i = 0; i < SHARD_CONNECT_RETRIES; i++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		if (!connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+			return fd;
+		close(fd);
+
+		/* The worker might still be loading its shard. */
+		struct timespec delay = { .tv_nsec = SHARD_CONNECT_DELAY_MS * 1000000L };
+		nanosleep(&delay, NULL);
+	}
+
+	perror("shard_coordinator_run: connect");
+	return -1;
+}
+
+/* Parses a single unsigned integer argument. */
+static int parse_arg(char *str, uint64_t *val)
+{
+	char *endptr;
+
+	if (!str)
+		return -1;
+	errno = 0;
+	*val = strtoul(str, &endptr, 10);
+	if (errno || endptr == str || *endptr)
+		return -1;
+	return 0;
+}
+
+/* Handles a single request line. Return value is < 0 if a worker failed. */
+static int coordinator_request(struct shard_coordinator_t *coord, char *line, struct shard_words_t *ids)
+{
+	char *saveptr = NULL;
+	char *cmd = strtok_r(line, " \t\n", &saveptr);
+	char *args[3] = {0};
+	int argc = 0;
+	uint64_t arg0, arg1;
+	int err;
+
+	char *arg;
+	while ((arg = strtok_r(NULL, " \t\n", &saveptr)) != NULL) {
+		if (argc >= (int) (sizeof(args) / sizeof(*args)))
+			goto err_args;
+		args[argc++] = arg;
+	}
+	if (!cmd || argc != 2 || parse_arg(args[0], &arg0) < 0 || parse_arg(args[1], &arg1) < 0)
+		goto err_args;
+
+	if (!strcmp(cmd, "SHORTEST"))
+		err = coordinator_shortest(coord, arg0, arg1, ids);
+	else if (!strcmp(cmd, "KDIST") && arg1 <= UINT16_MAX)
+		err = coordinator_k_distance(coord, arg0, arg1, ids);
+	else
+		goto err_args;
+
+	if (err < 0) {
+		printf("ERR Internal Error\n");
+		return -1;
+	}
+
+	coord->queries++;
+	printf("OK %lu", ids->n);
+	for (size_t i = 0; i < ids->n; i++)
+		printf(" %lu", ids->v[i]);
+	putchar('\n');
+	return 0;
+
+err_args:
+	printf("ERR Invalid Command\n");
+	return 0;
+}
+
+int shard_coordinator_run(char *paths)
+{
+	struct shard_coordinator_t coord = {0};
+	struct shard_words_t ids = {0};
+	char *line = NULL;
+	size_t len = 0;
+	int err = -1;
+
+	for (char *p = paths; *p; p++)
+		coord.n_shards += *p == ',';
+	coord.n_shards++;
+
+	coord.fds = malloc(coord.n_shards * sizeof(*coord.fds));
+	coord.out = calloc(coord.n_shards, sizeof(*coord.out));
+	coord.in = calloc(coord.n_shards, sizeof(*coord.in));
+	coord.frontier = calloc(coord.n_shards, sizeof(*coord.frontier));
+	if (!coord.fds || !coord.out || !coord.in || !coord.frontier)
+		goto out;
+	for (size_t s = 0; s < coord.n_shards; s++)
+		coord.fds[s] = -1;
+
+	char *saveptr = NULL;
+	uint64_t count = 0;
+	for (size_t s = 0; s < coord.n_shards; s++) {
+		char *path = strtok_r(s ? NULL : paths, ",", &saveptr);
+		if (!path)
+			goto out;
+
+		coord.fds[s] = coordinator_connect(path);
+		if (coord.fds[s] < 0)
+			goto out;
+
+		/* Make sure the workers were given to us in order, for the same graph. */
+		if (coordinator_call(&coord, s, SHARD_MSG_INFO, NULL, 0) < 0 || coord.in[s].n != 3)
+			goto out;
+		if (!s)
+			count = coord.in[s].v[2];
+		if (coord.in[s].v[0] != s || coord.in[s].v[1] != coord.n_shards || coord.in[s].v[2] != count) {
+			fprintf(stderr, "shard_coordinator_run: worker %s is not shard %lu of %lu\n",
+				path, s, coord.n_shards);
+			goto out;
+		}
+	}
+
+	while (getline(&line, &len, stdin) > 0) {
+		if (coordinator_request(&coord, line, &ids) < 0)
+			goto out;
+		fflush(stdout);
+	}
+	err = 0;
+
+	fprintf(stderr, "shard_coordinator_run: %lu queries, %lu rounds, %lu books relayed between shards\n",
+		coord.queries, coord.rounds, coord.relayed);
+
+out:
+	if (err < 0)
+		fprintf(stderr, "shard_coordinator_run: failed to talk to the workers\n");
+	for (size_t s = 0; coord.fds && s < coord.n_shards; s++) {
+		if (coord.fds[s] >= 0)
+			close(coord.fds[s]);
+		if (coord.out)
+			free(coord.out[s].v);
+		if (coord.in)
+			free(coord.in[s].v);
+	}
+	free(coord.fds);
+	free(coord.out);
+	free(coord.in);
+	free(coord.frontier);
+	free(ids.v);
+	free(line);
+	return err;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(SHARD_H)
+#define SHARD_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "worm.h"
+
+/*
+ * Sharded graphs, for graphs which don't fit on one host. shard_partition
+ * splits a graph into shard files ("<prefix>.<n>"), each of which holds the
+ * books that shard owns (with edges that are still indices into the whole
+ * graph) and a ghost table giving the owner of every book in another shard
+ * that those edges point to.
+ *
+ * Each shard is served by a worker process (shard_worker_run) listening on a
+ * unix socket, and a coordinator (shard_coordinator_run) answers queries by
+ * running a level-synchronous BFS across the workers. Every round, each
+ * worker expands its part of the frontier and hands back the edges which
+ * cross into other shards, and the coordinator routes those to their owners
+ * for the next round. Everything can run as local processes on one host.
+ */
+
+/* Partitioning methods. */
+enum {
+	/* Streaming edge-cut minimisation (linear deterministic greedy). */
+	SHARD_BY_CUT,
+	/* Every publisher's books in one shard, so publisher edges never cross. */
+	SHARD_BY_PUBLISHER,
+};
+
+/* Books in a shard may exceed an even split by this factor (SHARD_BY_CUT). */
+#define SHARD_SLACK 1.05
+
+/* Marks unvisited books, missing books and the like in the shard protocol. */
+#define SHARD_NONE UINT64_MAX
+
+/* Edge lists of a loaded shard hold these rather than global indices. */
+#define SHARD_REF_GHOST (1ULL << 63)
+
+/* A shard, as loaded by a worker. */
+struct shard_t {
+	uint32_t shard;
+	uint32_t n_shards;
+	/* Number of books in the whole graph. */
+	uint64_t count;
+
+	/*
+	 * Books owned by this shard. ->owned[i] is the global index of
+	 * ->nodes[i] (in ascending order), and the edge lists of ->nodes contain
+	 * local indices, or ghost indices with SHARD_REF_GHOST set.
+	 */
+	size_t n_owned;
+	uint64_t *owned;
+	struct book_t *nodes;
+
+	/* Ghost table, the global index (ascending) and owner of each ghost. */
+	size_t n_ghosts;
+	uint64_t *ghosts;
+	uint32_t *ghost_owner;
+};
+
+int shard_parse_method(const char *name);
+
+/*
+ * Partitions @nodes into @n_shards shard files named "<prefix>.<n>" with
+ * @method (SHARD_BY_*). Return value is < 0 if an error occurred.
+ */
+int shard_partition(struct book_t *nodes, size_t count, size_t n_shards, int method, const char *prefix);
+
+struct shard_t *shard_load(const char *filename);
+void shard_free(struct shard_t *shard);
+
+/* Looks up a global index in ->owned, returning the local index or -1. */
+ssize_t shard_local(struct shard_t *shard, uint64_t idx);
+
+/*
+ * Serves @shard on the unix socket at @path, one coordinator connection at a
+ * time, until killed. Return value is < 0 if the socket couldn't be set up.
+ */
+int shard_worker_run(struct shard_t *shard, const char *path);
+
+/*
+ * Connects to the workers listening on the comma-separated socket paths in
+ * @paths (which must be in shard order), and answers the SHORTEST and KDIST
+ * requests of the server protocol (see server.h) from stdin on stdout.
+ */
+int shard_coordinator_run(char *paths);
+
+#endif
@@ -0,0 +1,549 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "worm.h"
+#include "graph.h"
+#include "bigalloc.h"
+#include "validate.h"
+
+/* Marks an empty slot in an id_set_t. */
+#define ID_EMPTY UINT64_MAX
+
+/* Lock-free set of ids, only used to count the distinct ones. */
+struct id_set_t {
+	_Atomic uint64_t *slots;
+	size_t mask;
+};
+
+/* State shared between the threads of a graph_validate. */
+struct validate_t {
+	struct book_t *nodes;
+	size_t count;
+
+	/* Union-find forest for the components (see uf_union). */
+	_Atomic size_t *parent;
+	/* Size of each component, indexed by its root. */
+	_Atomic size_t *sizes;
+	/* Number of books citing each book. */
+	_Atomic size_t *cited_by;
+
+	/*
+	 * Symmetry checksums for author and publisher edges. Every edge i -> j
+	 * adds mix(j + 1) to sums[i] and subtracts mix(i + 1) from sums[j], so a
+	 * node's sum is zero iff its edges are mirrored (unless the hashes
+	 * collide). This avoids searching the edge list of j for every edge
+	 * i -> j. The + 1 is because mix(0) is 0, which would hide book 0.
+	 */
+	_Atomic uint64_t *sums[NUM_REPORT_EDGES];
+
+	struct id_set_t ids[NUM_GROUPS];
+};
+
+struct validate_arg_t {
+	struct validate_t *v;
+	size_t start;
+	size_t end;
+
+	/* Per-thread report, merged once all of the threads are done. */
+	struct graph_report_t report;
+
+	/* Scratch space for sorting unsorted edge lists. */
+	size_t *scratch;
+	size_t n_scratch;
+	int err;
+};
+
+static const char *report_names[NUM_REPORT_EDGES] = {
+	[REPORT_AUTHOR] = "author",
+	[REPORT_CITATION] = "citation",
+	[REPORT_PUBLISHER] = "publisher",
+	[REPORT_CITED_BY] = "cited_by",
+};
+
+static inline size_t report_bucket(size_t n)
+{
+	return n ? 64 - __builtin_clzl(n) : 0;
+}
+
+static void report_degree(struct report_degrees_t *degrees, size_t n)
+{
+	degrees->edges += n;
+	if (n < degrees->min)
+		degrees->min = n;
+	if (n > degrees->max)
+		degrees->max = n;
+	degrees->histogram[report_bucket(n)]++;
+}
+
+static void report_error(struct graph_report_t *report, size_t idx)
+{
+	if (report->first_error < 0 || (size_t) report->first_error > idx)
+		report->first_error = idx;
+}
+
+static inline size_t report_key(struct book_t *book, int type)
+{
+	return type == REPORT_AUTHOR ? book->author_id : book->publisher_id;
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a, y = *(const size_t *) b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Concurrent union-find. Roots are always linked under the smaller index, so
+ * parent[] only ever decreases and racing unions can't form a cycle. A failed
+ * link just means that someone else linked the root first, so we retry.
+ */
+static size_t uf_find(_Atomic size_t *parent, size_t x)
+{
+	while (true) {
+		size_t p = atomic_load_explicit(&parent[x], memory_order_relaxed);
+		if (p == x)
+			return x;
+
+		/* Path halving, which is fine to lose if it races. */
+		size_t gp = atomic_load_explicit(&parent[p], memory_order_relaxed);
+		if (gp != p)
+			atomic_compare_exchange_weak(&parent[x], &p, gp);
+		x = gp;
+	}
+}
+
+static void uf_union(_Atomic size_t *parent, size_t a, size_t b)
+{
+	while (true) {
+		a = uf_find(parent, a);
+		b = uf_find(parent, b);
+		if (a == b)
+			return;
+		if (a < b) {
+			size_t tmp = a;
+			a = b;
+			b = tmp;
+		}
+		size_t expected = a;
+		if (atomic_compare_exchange_strong(&parent[a], &expected, b))
+			return;
+	}
+}
+
+static bool id_set_add(struct id_set_t *set, uint64_t key)
+{
+	/* Deleted books have no id worth counting. */
+	if (key == ID_EMPTY)
+		return false;
+
+	size_t slot = graph_mix(key) & set->mask;
+	while (true) {
+		uint64_t cur = atomic_load_explicit(&set->slots[slot], memory_order_relaxed);
+		if (cur == ID_EMPTY) {
+			if (atomic_compare_exchange_strong(&set->slots[slot], &cur, key))
+				return true;
+			/* Someone else took the slot first, cur is now their key. */
+		}
+		if (cur == key)
+			return false;
+		slot = (slot + 1) & set->mask;
+	}
+}
+
+/* Checks one edge list of @idx, returning the number of errors found. */
+static size_t validate_edges(struct validate_arg_t *arg, size_t idx, int type, size_t *edges, size_t n)
+{
+	struct validate_t *v = arg->v;
+	struct graph_report_t *report = &arg->report;
+	struct book_t *nodes = v->nodes;
+	uint64_t sum = 0;
+	size_t errors = 0;
+	bool sorted = true;
+
+	report_degree(&report->degrees[type], n);
+	for (size_t k = 0; k < n; k++) {
+		size_t j = edges[k];
+
+		if (k && j <= edges[k - 1])
+			sorted = false;
+		if (j >= v->count) {
+			report->out_of_bounds[type]++;
+			errors++;
+			continue;
+		}
+		if (j == idx) {
+			report->self_loops[type]++;
+			errors += type != REPORT_CITATION;
+		}
+
+		uf_union(v->parent, idx, j);
+		if (type == REPORT_CITATION) {
+			atomic_fetch_add_explicit(&v->cited_by[j], 1, memory_order_relaxed);
+			continue;
+		}
+
+		if (report_key(&nodes[idx], type) != report_key(&nodes[j], type)) {
+			report->mismatched[type]++;
+			errors++;
+		}
+		sum += graph_mix(j + 1);
+		atomic_fetch_sub_explicit(&v->sums[type][j], graph_mix(idx + 1), memory_order_relaxed);
+	}
+	if (v->sums[type])
+		atomic_fetch_add_explicit(&v->sums[type][idx], sum, memory_order_relaxed);
+
+	/* Strictly ascending lists can't have duplicates, otherwise sort a copy. */
+	if (sorted)
+		return errors;
+	if (n > arg->n_scratch) {
+		size_t *scratch = realloc(arg->scratch, n * sizeof(*scratch));
+		if (!scratch) {
+			arg->err = -1;
+			return errors;
+		}
+		arg->scratch = scratch;
+		arg->n_scratch = n;
+	}
+	memcpy(arg->scratch, edges, n * sizeof(*edges));
+	qsort(arg->scratch, n, sizeof(*arg->scratch), cmp_size);
+	for (size_t k = 1; k < n; k++) {
+		if (arg->scratch[k] == arg->scratch[k - 1]) {
+			report->duplicates[type]++;
+			errors += type != REPORT_CITATION;
+		}
+	}
+	return errors;
+}
+
+static void *validate_init(void *data)
+{
+	struct validate_arg_t *arg = data;
+	struct validate_t *v = arg->v;
+
+	for (size_t i = arg->start; i < arg->end; i++)
+		atomic_init(&v->parent[i], i);
+
+	/* The id sets are split between the threads the same way as the nodes. */
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		struct id_set_t *set = &v->ids[group];
+		size_t n_slots = set->mask + 1;
+		size_t start = arg->start * (n_slots / v->count);
+		size_t end = arg->end == v->count ? n_slots : arg->end * (n_slots / v->count);
+
+		for (size_t slot = start; slot < end; slot++)
+			atomic_init(&set->slots[slot], ID_EMPTY);
+	}
+	return NULL;
+}
+
+static void *validate_scan(void *data)
+{
+	struct validate_arg_t *arg = data;
+	struct validate_t *v = arg->v;
+	struct graph_report_t *report = &arg->report;
+
+	for (size_t i = arg->start; i < arg->end; i++) {
+		struct book_t *book = &v->nodes[i];
+		size_t errors = 0;
+
+		errors += validate_edges(arg, i, REPORT_AUTHOR, book->b_author_edges, book->n_author_edges);
+		errors += validate_edges(arg, i, REPORT_CITATION, book->b_citation_edges, book->n_citation_edges);
+		errors += validate_edges(arg, i, REPORT_PUBLISHER, book->b_publisher_edges, book->n_publisher_edges);
+		if (errors)
+			report_error(report, i);
+
+		report->book_ids += id_set_add(&v->ids[GROUP_BOOK], book->id);
+		report->author_ids += id_set_add(&v->ids[GROUP_AUTHOR], book->author_id);
+		report->publisher_ids += id_set_add(&v->ids[GROUP_PUBLISHER], book->publisher_id);
+	}
+	return NULL;
+}
+
+/* Must run after validate_scan, which finishes all of the atomic updates. */
+static void *validate_finish(void *data)
+{
+	struct validate_arg_t *arg = data;
+	struct validate_t *v = arg->v;
+	struct graph_report_t *report = &arg->report;
+
+	for (size_t i = arg->start; i < arg->end; i++) {
+		for (int type = 0; type < NUM_REPORT_EDGES; type++) {
+			if (!v->sums[type] || !atomic_load_explicit(&v->sums[type][i], memory_order_relaxed))
+				continue;
+			report->asymmetric[type]++;
+			report_error(report, i);
+		}
+
+		report_degree(&report->degrees[REPORT_CITED_BY], atomic_load_explicit(&v->cited_by[i], memory_order_relaxed));
+		atomic_fetch_add_explicit(&v->sizes[uf_find(v->parent, i)], 1, memory_order_relaxed);
+	}
+	return NULL;
+}
+
+/* Must run after validate_finish, which counts the size of every component. */
+static void *validate_components(void *data)
+{
+	struct validate_arg_t *arg = data;
+	struct validate_t *v = arg->v;
+	struct graph_report_t *report = &arg->report;
+
+	for (size_t i = arg->start; i < arg->end; i++) {
+		if (atomic_load_explicit(&v->parent[i], memory_order_relaxed) != i)
+			continue;
+
+		size_t size = atomic_load_explicit(&v->sizes[i], memory_order_relaxed);
+		report->n_components++;
+		if (size > report->largest_component)
+			report->largest_component = size;
+		report->component_histogram[report_bucket(size)]++;
+	}
+	return NULL;
+}
+
+static void report_init(struct graph_report_t *report)
+{
+	memset(report, 0, sizeof(*report));
+	report->first_error = -1;
+	for (int type = 0; type < NUM_REPORT_EDGES; type++)
+		report->degrees[type].min = SIZE_MAX;
+}
+
+static void report_merge(struct graph_report_t *dst, struct graph_report_t *src)
+{
+	for (int type = 0; type < NUM_REPORT_EDGES; type++) {
+		struct report_degrees_t *d = &dst->degrees[type], *s = &src->degrees[type];
+
+		dst->out_of_bounds[type] += src->out_of_bounds[type];
+		dst->self_loops[type] += src->self_loops[type];
+		dst->duplicates[type] += src->duplicates[type];
+		dst->mismatched[type] += src->mismatched[type];
+		dst->asymmetric[type] += src->asymmetric[type];
+
+		d->edges += s->edges;
+		if (s->min < d->min)
+			d->min = s->min;
+		if (s->max > d->max)
+			d->max = s->max;
+		for (size_t b = 0; b < REPORT_BUCKETS; b++)
+			d->histogram[b] += s->histogram[b];
+	}
+
+	if (src->first_error >= 0)
+		report_error(dst, src->first_error);
+
+	dst->book_ids += src->book_ids;
+	dst->author_ids += src->author_ids;
+	dst->publisher_ids += src->publisher_ids;
+
+	dst->n_components += src->n_components;
+	if (src->largest_component > dst->largest_component)
+		dst->largest_component = src->largest_component;
+	for (size_t b = 0; b < REPORT_BUCKETS; b++)
+		dst->component_histogram[b] += src->component_histogram[b];
+}
+
+int graph_validate(struct book_t *nodes, size_t count, size_t nthreads, struct graph_report_t *report)
+{
+	struct validate_t v = {
+		.nodes = nodes,
+		.count = count,
+	};
+	struct validate_arg_t *args = NULL;
+	int err = -1;
+
+	report_init(report);
+	report->count = count;
+	if (!count)
+		goto out_empty;
+	if (!nthreads)
+		nthreads = 1;
+
+	v.parent = big_alloc(count * sizeof(*v.parent));
+	v.sizes = big_calloc(count, sizeof(*v.sizes));
+	v.cited_by = big_calloc(count, sizeof(*v.cited_by));
+	v.sums[REPORT_AUTHOR] = big_calloc(count, sizeof(**v.sums));
+	v.sums[REPORT_PUBLISHER] = big_calloc(count, sizeof(**v.sums));
+	if (!v.parent || !v.sizes || !v.cited_by || !v.sums[REPORT_AUTHOR] || !v.sums[REPORT_PUBLISHER])
+		goto out;
+
+	/* Keep the id sets at most half full. */
+	for (int group = 0; group < NUM_GROUPS; group++) {
+		size_t n_slots = 64;
+		while (n_slots < 2 * count)
+			n_slots *= 2;
+		v.ids[group].mask = n_slots - 1;
+		v.ids[group].slots = big_alloc(n_slots * sizeof(*v.ids[group].slots));
+		if (!v.ids[group].slots)
+			goto out;
+	}
+
+	args = calloc(nthreads, sizeof(*args));
+	if (!args)
+		goto out;
+	for (size_t i = 0; i < nthreads; i++) {
+		args[i].v = &v;
+		args[i].start = (i * count) / nthreads;
+		args[i].end = ((i + 1) * count) / nthreads;
+		report_init(&args[i].report);
+	}
+
+	run_parallel(args, sizeof(*args), nthreads, validate_init);
+	run_parallel(args, sizeof(*args), nthreads, validate_scan);
+	run_parallel(args, sizeof(*args), nthreads, validate_finish);
+	run_parallel(args, sizeof(*args), nthreads, validate_components);
+
+	err = 0;
+	for (size_t i = 0; i < nthreads; i++) {
+		if (args[i].err < 0)
+			err = -1;
+		report_merge(report, &args[i].report);
+	}
+	if (err < 0)
+		goto out;
+
+out_empty:
+	for (int type = 0; type < NUM_REPORT_EDGES; type++) {
+		report->errors += report->out_of_bounds[type] + report->mismatched[type] +
+				  report->asymmetric[type];
+		if (type != REPORT_CITATION)
+			report->errors += report->self_loops[type] + report->duplicates[type];
+		if (report->degrees[type].min == SIZE_MAX)
+			report->degrees[type].min = 0;
+	}
+	err = 0;
+
+out:
+	if (args)
+		for (size_t i = 0; i < nthreads; i++)
+			free(args[i].scratch);
+	free(args);
+	for (int group = 0; group < NUM_GROUPS; group++)
+		big_free(v.ids[group].slots);
+	big_free(v.sums[REPORT_AUTHOR]);
+	big_free(v.sums[REPORT_PUBLISHER]);
+	big_free(v.cited_by);
+	big_free(v.sizes);
+	big_free(v.parent);
+	return err;
+}
+
+/* Writes a histogram as a JSON array, without the trailing empty buckets. */
+static void json_histogram(FILE *f, size_t *histogram)
+{
+	size_t n = REPORT_BUCKETS;
+	while (n > 0 && !histogram[n - 1])
+		n--;
+
+	fprintf(f, "[");
+	for (size_t b = 0; b < n; b++)
+		fprintf(f, "%s%lu", b ? ", " : "", histogram[b]);
+	fprintf(f, "]");
+}
+
+/*
+ * Writes the per-type error counts. Reverse citations aren't checked, and
+ * citations are left out unless @citations is set (see graph_report_t).
+ */
+static void json_errors(FILE *f, const char *name, size_t *counts, bool citations)
+{
+	const char *sep = "";
+
+	fprintf(f, ",\n\t\t\"%s\": {", name);
+	for (int type = 0; type < REPORT_CITED_BY; type++) {
+		if (type == REPORT_CITATION && !citations)
+			continue;
+		fprintf(f, "%s\"%s\": %lu", sep, report_names[type], counts[type]);
+		sep = ", ";
+	}
+	fprintf(f, "}");
+}
+
+void graph_report_json(FILE *f, struct graph_report_t *report)
+{
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"books\": %lu,\n", report->count);
+	fprintf(f, "\t\"valid\": %s,\n", report->errors ? "false" : "true");
+
+	fprintf(f, "\t\"errors\": {\n");
+	fprintf(f, "\t\t\"total\": %lu,\n", report->errors);
+	if (report->first_error < 0)
+		fprintf(f, "\t\t\"first\": null");
+	else
+		fprintf(f, "\t\t\"first\": %ld", report->first_error);
+	json_errors(f, "out_of_bounds", report->out_of_bounds, true);
+	json_errors(f, "self_loops", report->self_loops, false);
+	json_errors(f, "duplicates", report->duplicates, false);
+	json_errors(f, "mismatched", report->mismatched, true);
+	json_errors(f, "asymmetric", report->asymmetric, true);
+	fprintf(f, "\n\t},\n");
+
+	fprintf(f, "\t\"citations\": {\n");
+	fprintf(f, "\t\t\"self\": %lu,\n", report->self_loops[REPORT_CITATION]);
+	fprintf(f, "\t\t\"duplicates\": %lu\n", report->duplicates[REPORT_CITATION]);
+	fprintf(f, "\t},\n");
+
+	fprintf(f, "\t\"ids\": {\n");
+	fprintf(f, "\t\t\"books\": %lu,\n", report->book_ids);
+	fprintf(f, "\t\t\"authors\": %lu,\n", report->author_ids);
+	fprintf(f, "\t\t\"publishers\": %lu,\n", report->publisher_ids);
+	fprintf(f, "\t\t\"reprints\": %lu\n", report->count - report->book_ids);
+	fprintf(f, "\t},\n");
+
+	fprintf(f, "\t\"degrees\": {\n");
+	for (int type = 0; type < NUM_REPORT_EDGES; type++) {
+		struct report_degrees_t *d = &report->degrees[type];
+
+		fprintf(f, "\t\t\"%s\": {\"edges\": %lu, \"min\": %lu, \"max\": %lu, \"mean\": %.3f, \"histogram\": ",
+			report_names[type], d->edges, d->min, d->max,
+			report->count ? (double) d->edges / report->count : 0.0);
+		json_histogram(f, d->histogram);
+		fprintf(f, "}%s\n", type < NUM_REPORT_EDGES - 1 ? "," : "");
+	}
+	fprintf(f, "\t},\n");
+
+	fprintf(f, "\t\"components\": {\n");
+	fprintf(f, "\t\t\"count\": %lu,\n", report->n_components);
+	fprintf(f, "\t\t\"largest\": %lu,\n", report->largest_component);
+	fprintf(f, "\t\t\"histogram\": ");
+	json_histogram(f, report->component_histogram);
+	fprintf(f, "\n\t}\n");
+	fprintf(f, "}\n");
+}
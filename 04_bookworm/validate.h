@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2017 Aleksa Sarai <cyphar@cyphar.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * == WARNING ==
+ *
+ * I've been informed that some current COMP2129 students have been
+ * plagiarising the code from this project, and removing the copyright
+ * statement to try to hide their plagiarism.
+ *
+ * These attempts have obviously failed, since you're reading this warning.
+ *
+ * Aside from being against the University's policies on academic honesty
+ * (which can lead to you being severely penalised), it's also outright
+ * copyright infringement since the GPL mandates that a full copy of the
+ * license and copyright information be included in copies of the work. Not to
+ * mention that it's also completely unethical.
+ */
+
+#if !defined(VALIDATE_H)
+#define VALIDATE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "worm.h"
+
+/*
+ * Validation and statistics for a loaded graph. graph_load (and the binary
+ * loader) trust the edge lists they're given, so a bad index only shows up
+ * when a search wanders off the end of the node array. graph_validate checks
+ * every edge list in parallel, and collects the statistics we use to tune the
+ * searches while it's at it.
+ */
+
+/* Edge types in a report. REPORT_CITED_BY (reverse citations) only has degrees. */
+enum {
+	REPORT_AUTHOR,
+	REPORT_CITATION,
+	REPORT_PUBLISHER,
+	REPORT_CITED_BY,
+	NUM_REPORT_EDGES,
+};
+
+/* Histograms are log2 buckets: 0 holds zeroes, bucket k holds [2^(k-1), 2^k). */
+#define REPORT_BUCKETS 65
+
+struct report_degrees_t {
+	size_t edges;
+	size_t min;
+	size_t max;
+	size_t histogram[REPORT_BUCKETS];
+};
+
+struct graph_report_t {
+	size_t count;
+
+	/*
+	 * Errors, per edge type. Edges which are out of bounds aren't checked any
+	 * further. Author and publisher edges must be symmetric and must link
+	 * books with the same author (or publisher), ->asymmetric and
+	 * ->mismatched count the nodes and edges which aren't. Citations are a
+	 * multiset (graph_add_edge will happily add the same citation twice, or a
+	 * book citing itself), so their self loops and duplicates are counted but
+	 * aren't errors.
+	 */
+	size_t out_of_bounds[NUM_REPORT_EDGES];
+	size_t self_loops[NUM_REPORT_EDGES];
+	size_t duplicates[NUM_REPORT_EDGES];
+	size_t mismatched[NUM_REPORT_EDGES];
+	size_t asymmetric[NUM_REPORT_EDGES];
+
+	/*
+	 * Total of the above (except for citation self loops and duplicates), and
+	 * the lowest node index with an error (or -1).
+	 */
+	size_t errors;
+	ssize_t first_error;
+
+	/* Number of distinct book, author and publisher ids. */
+	size_t book_ids;
+	size_t author_ids;
+	size_t publisher_ids;
+
+	struct report_degrees_t degrees[NUM_REPORT_EDGES];
+
+	/* Weakly connected components, over all edge types. */
+	size_t n_components;
+	size_t largest_component;
+	size_t component_histogram[REPORT_BUCKETS];
+};
+
+/*
+ * Fills @report for the graph in @nodes using @nthreads threads. Returns -1 if
+ * the report couldn't be produced (not if the graph has errors, which callers
+ * need to check ->errors for).
+ */
+int graph_validate(struct book_t *nodes, size_t count, size_t nthreads, struct graph_report_t *report);
+
+/* Writes @report to @f as a JSON object. */
+void graph_report_json(FILE *f, struct graph_report_t *report);
+
+#endif
@@ -35,11 +35,33 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "worm.h"
+#include "bigalloc.h"
+
+/*
+ * Priority queue used by find_books_k_distance (see pqueue.h). The radix heap
+ * was the fastest on traces from pq_test/, but it can be overridden with
+ * -DPQ_VARIANT=... when building.
+ */
+#if !defined(PQ_VARIANT)
+#	define PQ_VARIANT rheap
+#endif
+#include "pqueue.h"
 
 size_t g_nthreads = 3;
+size_t g_prefetch_distance = 8;
+
+/*
+ * Software prefetching for the search loops. Graphs much larger than the
+ * cache turn every access to per-node state (seen[], best_k[]) and every
+ * adjacency list into a cache miss, so we issue the loads a few iterations
+ * before we need them.
+ */
+#define prefetch_read(addr)  __builtin_prefetch((addr), 0, 3)
+#define prefetch_write(addr) __builtin_prefetch((addr), 1, 3)
 
 /* Used for debugging a given struct book_t. */
 #if defined(DEBUG)
@@ -154,6 +176,28 @@ struct book_t *search_parallel(struct book_t *nodes, size_t count, int type, siz
 	return &nodes[idx];
 }
 
+void run_parallel(void *args, size_t size, size_t n, void *(*fn)(void *))
+{
+	pthread_t *threads = malloc(n * sizeof(*threads));
+	bool *started = calloc(n, sizeof(*started));
+
+	/* If we can't get a thread, that element is just done on this one. */
+	for (size_t i = 0; i < n; i++) {
+		void *arg = (char *) args + i * size;
+
+		if (threads && started && !pthread_create(&threads[i], NULL, fn, arg))
+			started[i] = true;
+		else
+			fn(arg);
+	}
+	for (size_t i = 0; i < n; i++)
+		if (started && started[i])
+			pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(started);
+}
+
 /* Linear searches are sometimes more efficient due to thread overhead. */
 struct book_t *search_linear(struct book_t *nodes, size_t count, int type, size_t val)
 {
@@ -291,181 +335,6 @@ struct result_t *find_books_reprinted(struct book_t *nodes, size_t count,
 	return result;
 }
 
-/* MIN-Priority Queue using array backing. */
-struct p_queue_t {
-	size_t *vector;
-	ssize_t *inverse;
-	size_t end;
-};
-
-static struct p_queue_t *pqueue_alloc(size_t size)
-{
-	struct p_queue_t *queue = malloc(sizeof(*queue));
-	if (!queue)
-		goto err;
-
-	/* ->vector stores the actual queue. */
-	queue->vector = malloc(size * sizeof(*queue->vector));
-	if (!queue->vector)
-		goto err_vec;
-
-	/*
-	 * ->inverse stores a mapping from book_idx -> vector_idx. This is done to
-	 *  avoid linear lookups in pqueue_increase. Since the size of ->vector is
-	 *  always the same as the size of the graph (this is guaranteed by the
-	 *  caller) this is perfectly safe.
-	 */
-	queue->inverse = malloc(size * sizeof(*queue->vector));
-	if (!queue->inverse)
-		goto err_inv;
-
-	queue->end = 0;
-	memset(queue->vector, 0, size * sizeof(*queue->vector));
-	for (size_t i = 0; i < size; i++)
-		queue->inverse[i] = -1;
-	return queue;
-
-err_inv:
-	free(queue->vector);
-err_vec:
-	free(queue);
-err:
-	return NULL;
-}
-
-static void pqueue_free(struct p_queue_t *queue)
-{
-	if (queue) {
-		free(queue->vector);
-		free(queue->inverse);
-	}
-	free(queue);
-}
-
-/*
- * Macros for indexing within the array. It's a binary heap, but stored as a
- * flat array to make cache access easier on the CPU.
- */
-#define PQ_ROOT        0
-#define PQ_OFFSET      1
-#define PQ_LEFT(idx)   ((2*((idx) + PQ_OFFSET)) - PQ_OFFSET)
-#define PQ_RIGHT(idx)  ((2*((idx) + PQ_OFFSET) + 1) - PQ_OFFSET)
-#define PQ_PARENT(idx) ((((idx) + PQ_OFFSET) / 2) - PQ_OFFSET)
-
-/*
- * Insert the the given index (with the corresponding value in @values) into
- * the priority queue.
- */
-static inline void pqueue_insert(struct p_queue_t *queue, const uint32_t *values, size_t idx)
-{
-	/*
-	 * We make a lot of assumptions to allow us to store the raw idx as well as
-	 * not doing any extra allocations. In particular, we assume the caller
-	 * isn't messing with us and won't change values that are owned by us. This
-	 * isn't Rust so you can't express that restriction in code without locks.
-	 */
-
-	/* Insert at the end. */
-	size_t slot = queue->end++;
-
-	/* Propogate up the tree. */
-	while (slot) {
-		size_t parent = PQ_PARENT(slot);
-
-		if (values[idx] > values[queue->vector[parent]])
-			break;
-
-		queue->vector[slot] = queue->vector[parent];
-		queue->inverse[queue->vector[slot]] = slot;
-		slot = parent;
-	}
-
-	queue->vector[slot] = idx;
-	queue->inverse[idx] = slot;
-}
-
-/*
- * Increases the priority (decreases the value) of the given idx in the
- * priority queue. Note that the *only* value owned by queue that is allowed to
- * be changed by the caller is value[idx] -- and the value *must* have been
- * *decreased*.
- */
-static void pqueue_increase(struct p_queue_t *queue, const uint32_t *values, size_t idx)
-{
-	/*
-	 * Get the inverse vector and fall-back to a normal insert if the element
-	 * is not present in the pqueue.
-	 */
-	ssize_t vecidx = queue->inverse[idx];
-	if (vecidx < 0)
-		return pqueue_insert(queue, values, idx);
-
-	/*
-	 * Bubble *up*. We know the direction because the caller told us they
-	 * decreased the value.
-	 */
-	size_t slot = vecidx;
-	while (slot) {
-		size_t parent = PQ_PARENT(slot);
-
-		if (values[idx] > values[queue->vector[parent]])
-			break;
-
-		queue->vector[slot] = queue->vector[parent];
-		queue->inverse[queue->vector[slot]] = slot;
-		slot = parent;
-	}
-
-	queue->vector[slot] = idx;
-	queue->inverse[idx] = slot;
-}
-
-/*
- * Pop the highest value off the priority queue and reorder the queue as
- * necessary usign the provided values vector.
- */
-static inline size_t pqueue_remove(struct p_queue_t *queue, const uint32_t *values)
-{
-	/* Get our return value first. */
-	size_t slot = PQ_ROOT;
-	size_t idx = queue->vector[slot];
-
-	/* Deregister inverse. */
-	queue->inverse[idx] = -1;
-
-	/* We need to swap the end with the head. */
-	queue->vector[slot] = queue->vector[--queue->end];
-	size_t tmp = queue->vector[slot];
-
-	/* Propogate the newest head down if necessary. */
-	while (PQ_LEFT(slot) <= queue->end) {
-		size_t left = PQ_LEFT(slot);
-		size_t right = PQ_RIGHT(slot);
-
-		size_t child = left;
-		if (right < queue->end) {
-			if (values[queue->vector[right]] < values[queue->vector[left]])
-				child = right;
-		}
-
-		if (values[tmp] <= values[queue->vector[child]])
-			break;
-
-		queue->vector[slot] = queue->vector[child];
-		queue->inverse[queue->vector[slot]] = slot;
-		slot = child;
-	}
-
-	queue->vector[slot] = tmp;
-	queue->inverse[tmp] = slot;
-	return idx;
-}
-
-static inline int pqueue_empty(struct p_queue_t *queue)
-{
-	return !queue->end;
-}
-
 /**
  * find_books_k_distance - Finds books k distance away
  * @nodes: node list from graph
@@ -498,15 +367,16 @@ struct result_t *find_books_k_distance(struct book_t *nodes, size_t count,
 	 * The "best_k" list. This is all we care about, and is used for values in
 	 * the @remaining queue. Note that because part of the priority queue's
 	 * data is shared with us in this array, we must only modify entries that
-	 * won't cause the p_queue_t to become corrupted.
+	 * won't cause the queue to become corrupted.
 	 */
-	uint32_t *best_k = malloc(count * sizeof(*best_k));
+	size_t ahead = g_prefetch_distance;
+	uint32_t *best_k = big_alloc(count * sizeof(*best_k));
 	for (size_t i = 0; i < count; i++)
 		best_k[i] = UINT32_MAX;
 	best_k[idx] = 0;
 
 	/* Create stack for our search. We really don't care about the order of iteration. */
-	struct p_queue_t *remaining = pqueue_alloc(count);
+	struct PQ_TYPE *remaining = pqueue_alloc(count);
 	pqueue_insert(remaining, best_k, idx);
 
 	while (!pqueue_empty(remaining)) {
@@ -530,6 +400,9 @@ struct result_t *find_books_k_distance(struct book_t *nodes, size_t count,
 			size_t nxt = book->b_citation_edges[i];
 			uint32_t tentative = best_k[idx] + 1;
 
+			if (ahead && i + ahead < book->n_citation_edges)
+				prefetch_write(&best_k[book->b_citation_edges[i + ahead]]);
+
 			if (tentative < best_k[nxt]) {
 				best_k[nxt] = tentative;
 				pqueue_increase(remaining, best_k, nxt);
@@ -542,7 +415,7 @@ struct result_t *find_books_k_distance(struct book_t *nodes, size_t count,
 		if (best_k[i] <= k)
 			result->elements[result->n_elements++] = &nodes[i];
 
-	free(best_k);
+	big_free(best_k);
 	pqueue_free(remaining);
 	return result;
 }
@@ -560,7 +433,7 @@ static struct queue_t *queue_alloc(size_t size)
 		return NULL;
 
 	queue->size = size;
-	queue->vector = malloc(queue->size * sizeof(*queue->vector));
+	queue->vector = big_alloc(queue->size * sizeof(*queue->vector));
 	if (!queue->vector) {
 		free(queue);
 		return NULL;
@@ -573,7 +446,7 @@ static struct queue_t *queue_alloc(size_t size)
 static void queue_free(struct queue_t *queue)
 {
 	if (queue->vector)
-		free(queue->vector);
+		big_free(queue->vector);
 	free(queue);
 }
 
@@ -592,6 +465,43 @@ static inline int queue_empty(struct queue_t *queue)
 	return queue->head == queue->tail;
 }
 
+/* Returns the value @ahead places from the head (0 is the next dequeue), or -1. */
+static inline ssize_t queue_peek(struct queue_t *queue, size_t ahead)
+{
+	if (queue->head + ahead >= queue->tail)
+		return -1;
+	return queue->vector[(queue->head + ahead) % queue->size];
+}
+
+/* Prefetches the seen[] state of the edge @ahead places after @i. */
+static inline void prefetch_edge(uint8_t *seen, size_t *edges, size_t n_edges, size_t i, size_t ahead)
+{
+	if (ahead && i + ahead < n_edges)
+		prefetch_write(&seen[edges[i + ahead]]);
+}
+
+/*
+ * Prefetches the frontier: the book @ahead places into the queue, and the
+ * adjacency lists of the next book (whose struct should already be cached by
+ * the previous iterations).
+ */
+static inline void prefetch_frontier(struct book_t *nodes, struct queue_t *queue, size_t ahead)
+{
+	if (!ahead)
+		return;
+
+	ssize_t far = queue_peek(queue, ahead - 1);
+	if (far >= 0)
+		prefetch_read(&nodes[far]);
+
+	ssize_t next = queue_peek(queue, 0);
+	if (next >= 0) {
+		prefetch_read(nodes[next].b_author_edges);
+		prefetch_read(nodes[next].b_citation_edges);
+		prefetch_read(nodes[next].b_publisher_edges);
+	}
+}
+
 
 /**
  * find_shortest_distance - Finds the shortest path between two books
@@ -609,6 +519,7 @@ struct result_t *find_shortest_distance(struct book_t *nodes, size_t count, size
 	uint8_t *seen;
 	struct queue_t *queue;
 	ssize_t *previous;
+	size_t ahead = g_prefetch_distance;
 
 	struct result_t *result = malloc(sizeof(*result));
 	memset(result, 0, sizeof(*result));
@@ -630,10 +541,9 @@ struct result_t *find_shortest_distance(struct book_t *nodes, size_t count, size
 	b2_idx = b2 - nodes;
 
 	/* Set of nodes seen. We use char because it's guaranteed to be only one byte. */
-	seen = malloc(count * sizeof(*seen));
-	memset(seen, 0, count * sizeof(*seen));
+	seen = big_calloc(count, sizeof(*seen));
 	/* Vector of previous nodes, used to build the final path. */
-	previous = malloc(count * sizeof(*previous));
+	previous = big_alloc(count * sizeof(*previous));
 	for (size_t i = 0; i < count; i++)
 		previous[i] = -1;
 	/* Queue used for BFS, storing the indices. */
@@ -646,9 +556,12 @@ struct result_t *find_shortest_distance(struct book_t *nodes, size_t count, size
 		current = queue_dequeue(queue);
 		if (current == b2_idx)
 			break;
+		prefetch_frontier(nodes, queue, ahead);
 		for (size_t i = 0; i < nodes[current].n_author_edges; i++) {
 			size_t idx = nodes[current].b_author_edges[i];
 
+			prefetch_edge(seen, nodes[current].b_author_edges, nodes[current].n_author_edges, i, ahead);
+
 			if (seen[idx])
 				continue;
 
@@ -659,6 +572,7 @@ struct result_t *find_shortest_distance(struct book_t *nodes, size_t count, size
 		for (size_t i = 0; i < nodes[current].n_citation_edges; i++) {
 			size_t idx = nodes[current].b_citation_edges[i];
 
+			prefetch_edge(seen, nodes[current].b_citation_edges, nodes[current].n_citation_edges, i, ahead);
 			if (seen[idx])
 				continue;
 
@@ -669,6 +583,7 @@ struct result_t *find_shortest_distance(struct book_t *nodes, size_t count, size
 		for (size_t i = 0; i < nodes[current].n_publisher_edges; i++) {
 			size_t idx = nodes[current].b_publisher_edges[i];
 
+			prefetch_edge(seen, nodes[current].b_publisher_edges, nodes[current].n_publisher_edges, i, ahead);
 			if (seen[idx])
 				continue;
 
@@ -700,12 +615,220 @@ struct result_t *find_shortest_distance(struct book_t *nodes, size_t count, size
 	}
 
 out:
-	free(seen);
-	free(previous);
+	big_free(seen);
+	big_free(previous);
 	queue_free(queue);
 	return result;
 }
 
+/*
+ * MIN-Priority Queue for small integer keys (Dial's algorithm). Since the
+ * tentative distances in the queue never span more than the largest edge
+ * weight, we only need (max_weight + 1) buckets used as a circular array, and
+ * insert, decrease-key and remove are all O(1) (amortised for remove).
+ *
+ * Each bucket is an intrusive doubly-linked list threaded through ->next and
+ * ->prev, and ->inverse maps book_idx -> bucket (just like the heaps in
+ * pqueue.h) so that decrease-key can unlink a node without searching for it.
+ */
+struct b_queue_t {
+	ssize_t *buckets;
+	size_t n_buckets;
+	ssize_t *next, *prev;
+	ssize_t *inverse;
+	size_t size;
+	/* Index of the bucket containing the current minimum value. */
+	size_t current;
+};
+
+static struct b_queue_t *bqueue_alloc(size_t size, size_t max_weight)
+{
+	struct b_queue_t *queue = malloc(sizeof(*queue));
+	if (!queue)
+		goto err;
+	memset(queue, 0, sizeof(*queue));
+
+	queue->n_buckets = max_weight + 1;
+	queue->buckets = malloc(queue->n_buckets * sizeof(*queue->buckets));
+	queue->next = big_calloc(size, sizeof(*queue->next));
+	queue->prev = big_calloc(size, sizeof(*queue->prev));
+	queue->inverse = big_alloc(size * sizeof(*queue->inverse));
+	if (!queue->buckets || !queue->next || !queue->prev || !queue->inverse)
+		goto err_free;
+
+	for (size_t i = 0; i < queue->n_buckets; i++)
+		queue->buckets[i] = -1;
+	for (size_t i = 0; i < size; i++)
+		queue->inverse[i] = -1;
+	return queue;
+
+err_free:
+	free(queue->buckets);
+	big_free(queue->next);
+	big_free(queue->prev);
+	big_free(queue->inverse);
+	free(queue);
+err:
+	return NULL;
+}
+
+static void bqueue_free(struct b_queue_t *queue)
+{
+	if (queue) {
+		free(queue->buckets);
+		big_free(queue->next);
+		big_free(queue->prev);
+		big_free(queue->inverse);
+	}
+	free(queue);
+}
+
+static inline void bqueue_unlink(struct b_queue_t *queue, size_t idx)
+{
+	ssize_t bucket = queue->inverse[idx];
+
+	if (queue->prev[idx] >= 0)
+		queue->next[queue->prev[idx]] = queue->next[idx];
+	else
+		queue->buckets[bucket] = queue->next[idx];
+	if (queue->next[idx] >= 0)
+		queue->prev[queue->next[idx]] = queue->prev[idx];
+
+	queue->inverse[idx] = -1;
+	queue->size--;
+}
+
+/*
+ * Inserts the given index (with the corresponding value in @values) into the
+ * queue, or moves it to its new bucket if it's already in the queue. As with
+ * pqueue_increase, the value *must* only ever decrease, and must not be
+ * smaller than the last value removed.
+ */
+static inline void bqueue_increase(struct b_queue_t *queue, const uint32_t *values, size_t idx)
+{
+	if (queue->inverse[idx] >= 0)
+		bqueue_unlink(queue, idx);
+
+	size_t bucket = values[idx] % queue->n_buckets;
+	queue->prev[idx] = -1;
+	queue->next[idx] = queue->buckets[bucket];
+	if (queue->next[idx] >= 0)
+		queue->prev[queue->next[idx]] = idx;
+	queue->buckets[bucket] = idx;
+	queue->inverse[idx] = bucket;
+	queue->size++;
+}
+
+/* Pop an index with the smallest value off the queue. */
+static inline size_t bqueue_remove(struct b_queue_t *queue)
+{
+	/* The caller must check bqueue_empty, otherwise this will never end. */
+	while (queue->buckets[queue->current] < 0)
+		queue->current = (queue->current + 1) % queue->n_buckets;
+
+	size_t idx = queue->buckets[queue->current];
+	bqueue_unlink(queue, idx);
+	return idx;
+}
+
+static inline int bqueue_empty(struct b_queue_t *queue)
+{
+	return !queue->size;
+}
+
+/**
+ * find_shortest_weighted - Finds the cheapest path between two books
+ * @nodes: node list from graph
+ * @count: size of node list
+ * @b1_id: start book
+ * @b2_id: end book
+ * @weights: cost of following each type of edge
+ *
+ * This is Dijkstra's algorithm using a bucket queue, which beats the binary
+ * heap since the edge weights are small integers. The result is the path from
+ * b1 to b2 (inclusive), or empty if there is no such path.
+ */
+struct result_t *find_shortest_weighted(struct book_t *nodes, size_t count, size_t b1_id,
+					size_t b2_id, const struct edge_weights_t *weights)
+{
+	struct result_t *result = malloc(sizeof(*result));
+	memset(result, 0, sizeof(*result));
+
+	struct book_t *b1 = do_search(nodes, count, SEARCH_BOOK, b1_id);
+	struct book_t *b2 = do_search(nodes, count, SEARCH_BOOK, b2_id);
+	if (!b1 || !b2)
+		return result;
+	size_t b1_idx = b1 - nodes, b2_idx = b2 - nodes;
+
+	uint8_t max_weight = weights->author;
+	if (weights->citation > max_weight)
+		max_weight = weights->citation;
+	if (weights->publisher > max_weight)
+		max_weight = weights->publisher;
+
+	/* Same rules as best_k in find_books_k_distance. */
+	uint32_t *dist = big_alloc(count * sizeof(*dist));
+	ssize_t *previous = big_alloc(count * sizeof(*previous));
+	struct b_queue_t *queue = bqueue_alloc(count, max_weight);
+	if (!dist || !previous || !queue)
+		goto out;
+
+	for (size_t i = 0; i < count; i++) {
+		dist[i] = UINT32_MAX;
+		previous[i] = -1;
+	}
+	dist[b1_idx] = 0;
+	bqueue_increase(queue, dist, b1_idx);
+
+	while (!bqueue_empty(queue)) {
+		size_t current = bqueue_remove(queue);
+		if (current == b2_idx)
+			break;
+
+		struct book_t *book = &nodes[current];
+		size_t *lists[] = { book->b_author_edges, book->b_citation_edges, book->b_publisher_edges };
+		size_t lengths[] = { book->n_author_edges, book->n_citation_edges, book->n_publisher_edges };
+		uint8_t costs[] = { weights->author, weights->citation, weights->publisher };
+
+		for (size_t type = 0; type < 3; type++) {
+			if (!costs[type])
+				continue;
+
+			for (size_t i = 0; i < lengths[type]; i++) {
+				size_t nxt = lists[type][i];
+				uint32_t tentative = dist[current] + costs[type];
+
+				if (tentative < dist[nxt]) {
+					dist[nxt] = tentative;
+					previous[nxt] = current;
+					bqueue_increase(queue, dist, nxt);
+				}
+			}
+		}
+	}
+
+	/* Path not found, bail with empty results. */
+	if (dist[b2_idx] == UINT32_MAX)
+		goto out;
+
+	/* Count the path length first, so we only have to allocate once. */
+	size_t length = 1;
+	for (ssize_t current = b2_idx; (size_t) current != b1_idx; current = previous[current])
+		length++;
+
+	result->elements = malloc(length * sizeof(*result->elements));
+	result->n_elements = length;
+	ssize_t current = b2_idx;
+	for (size_t i = length; i-- > 0; current = previous[current])
+		result->elements[i] = &nodes[current];
+
+out:
+	big_free(dist);
+	big_free(previous);
+	bqueue_free(queue);
+	return result;
+}
+
 /* Needed to get the tests to run. */
 struct result_t *find_shortest_edge_type(struct book_t *nodes, size_t count, size_t a1_id, size_t a2_id)
 {
@@ -55,10 +55,27 @@ struct result_t {
 	size_t n_elements;
 };
 
+/*
+ * Per-edge-type weights for find_shortest_weighted. A weight of 0 means that
+ * edges of that type are not followed at all.
+ */
+struct edge_weights_t {
+	uint8_t author;
+	uint8_t citation;
+	uint8_t publisher;
+};
+
 /* typedefs are evil. */
 typedef struct book_t book_t;
 typedef struct result_t result_t;
 
+/* Number of threads used by the parallel parts of the implementation. */
+extern size_t g_nthreads;
+
+/* How far ahead the search loops prefetch (in edges or frontier nodes), 0 disables it. */
+extern size_t g_prefetch_distance;
+#define PREFETCH_MAX_DISTANCE 1024
+
 /* All of the interfaces required for the assignment. */
 struct result_t *find_book(struct book_t *nodes, size_t count, size_t book_id);
 struct result_t *find_books_by_author(struct book_t *nodes, size_t count, size_t author_id);
@@ -66,5 +83,14 @@ struct result_t *find_books_reprinted(struct book_t *nodes, size_t count, size_t
 struct result_t *find_books_k_distance(struct book_t *nodes, size_t count, size_t book_id, uint16_t k);
 struct result_t *find_shortest_distance(struct book_t *nodes, size_t count, size_t b1_id, size_t b2_id);
 
+/*
+ * Runs @fn on each of the @n elements (of @size bytes) of @args, each in its
+ * own thread, and waits for all of them to finish.
+ */
+void run_parallel(void *args, size_t size, size_t n, void *(*fn)(void *));
+
+/* Extensions. */
+struct result_t *find_shortest_weighted(struct book_t *nodes, size_t count, size_t b1_id, size_t b2_id, const struct edge_weights_t *weights);
+
 #endif
 